@@ -113,12 +113,38 @@ AC_DEFUN([CCI_SETUP_CTP],[
                        [[#include <valgrind/memcheck.h>]])
     fi
 
+    # Binary trace rings (see include/cci_trace.h)
+    AC_ARG_ENABLE([trace],
+        [AC_HELP_STRING([--enable-trace],
+                        [Build the per-thread binary trace rings (default: disabled)])])
+    AS_IF([test "$enable_trace" = "yes"],
+          [AC_MSG_NOTICE([activating binary trace rings])
+           cci_trace_enabled=1],
+          [cci_trace_enabled=0])
+    AC_DEFINE_UNQUOTED([CCI_TRACE_ENABLED], [$cci_trace_enabled],
+                       [Whether the binary trace rings are built])
+    AM_CONDITIONAL([CCI_BUILD_TRACE], [test "$cci_trace_enabled" = "1"])
+
+    # debug() output to stderr, compiled out for release builds
+    AC_ARG_ENABLE([debug-output],
+        [AC_HELP_STRING([--disable-debug-output],
+                        [Compile out the debug() stderr messages (default: enabled)])])
+    AS_IF([test "$enable_debug_output" = "no"],
+          [AC_MSG_NOTICE([compiling out debug output])
+           cci_debug_output=0],
+          [cci_debug_output=1])
+    AC_DEFINE_UNQUOTED([CCI_DEBUG], [$cci_debug_output],
+                       [Whether debug() messages are compiled in])
+
     AC_CHECK_HEADERS([ifaddrs.h], [
 	AC_CHECK_FUNCS([getifaddrs])
     ])
     AC_CHECK_HEADERS([sys/epoll.h], [
     AC_CHECK_FUNCS([epoll_create])
     ])
+    AC_CHECK_FUNCS([recvmmsg sendmmsg])
+    AC_CHECK_HEADERS([linux/filter.h])
+    AC_CHECK_HEADERS([linux/errqueue.h])
     AC_CHECK_DECLS([ethtool_cmd_speed],,,[[#include <linux/ethtool.h>]])
 
     #
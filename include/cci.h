@@ -72,6 +72,28 @@ BEGIN_C_DECLS
  */
 #define CCI_ABI_VERSION 2
 
+/*!
+  Flags for cci_init().
+
+  \ingroup env
+ */
+typedef enum cci_init_flags {
+	/*! Cache RMA registrations on every endpoint.
+
+	   cci_rma_deregister() then keeps the registration, and a later
+	   cci_rma_register() of the same start address, with a length and
+	   access flags that the cached one covers, returns the cached
+	   handle. Unused registrations are released least recently used
+	   first, or when the endpoint is destroyed. Devices can also enable
+	   the cache with the "reg_cache = <entries>" config key.
+
+	   Only use the cache if registered buffers stay mapped until the
+	   endpoint is destroyed; a transport that pins memory would keep
+	   using the old pages of a freed and reallocated buffer.
+	 */
+	CCI_INIT_FLAG_REG_CACHE = (1 << 0)
+} cci_init_flags_t;
+
 /*!
   This is the first CCI function that must called; no other CCI
   functions can be invoked before this function returns successfully.
@@ -80,7 +102,7 @@ BEGIN_C_DECLS
    application requires (one of the CCI_ABI_* values).
 
    \param[in] flags: A constant describing behaviors that this application
-   requires.  Currently, 0 is the only valid value.
+   requires: 0 or a bitwise OR of cci_init_flags_t values.
 
    \param[out] caps: Capabilities of the underlying library:
    * THREAD_SAFETY
@@ -472,7 +494,27 @@ CCI_DECLSPEC int cci_get_devices(cci_device_t * const ** devices);
  */
 typedef enum cci_endpoint_flags {
 	/*! For future expansion */
-	bogus_must_have_something_here
+	bogus_must_have_something_here,
+
+	/*! The application never calls cci_get_event() or cci_get_events()
+	   on this endpoint from more than one thread at a time. Transports
+	   with a lock-free completion queue then skip the lock that
+	   serializes concurrent pollers. */
+	CCI_EP_FLAG_SINGLE_CONSUMER = (1 << 0),
+
+	/*! Also open a companion shared memory (sm) endpoint and use it
+	   for peers on the same host. The endpoint URI then names both,
+	   and cci_connect() picks sm when the server runs on this host,
+	   falling back to the network otherwise. Events for both paths
+	   are returned by cci_get_event() on this endpoint, and RMA
+	   handles registered on it work over either path. Connections
+	   that use sm report the companion endpoint in
+	   connection->endpoint.
+
+	   Ignored on sm devices, when no sm device is up, when the
+	   caller asks for an OS handle, or when the network transport's
+	   RMA handles cannot be combined with sm's. */
+	CCI_EP_FLAG_HYBRID = (1 << 1)
 } cci_endpoint_flags_t;
 
 /*! Endpoint.
@@ -1280,6 +1322,36 @@ CCI_DECLSPEC int cci_arm_os_handle(cci_endpoint_t * endpoint, int flags);
 CCI_DECLSPEC int cci_get_event(cci_endpoint_t * endpoint,
 			       cci_event_t ** event);
 
+/*!
+  Get up to max available CCI events.
+
+  This function behaves like cci_get_event() but may return several
+  events at once, amortizing the cost of progressing the endpoint and
+  locking its event queue across the whole batch. Like
+  cci_get_event(), it never blocks.
+
+  Each returned event borrows its buffer and must be returned later via
+  cci_return_event() (or cci_return_events()).
+
+  \param[in]  endpoint  Endpoint to poll for new events.
+  \param[out] events    Array of at least max event pointers.
+  \param[in]  max       Maximum number of events to retrieve.
+  \param[out] count     Number of events stored in events.
+
+  \return CCI_SUCCESS   At least one event was retrieved.
+  \return CCI_EAGAIN    No event is available.
+  \return CCI_ENOBUFS	No event is available and there are no available
+                        receive buffers. The application must return events
+			before any more messages can be received.
+  \return CCI_EINVAL    Events or count is NULL or max is 0.
+  \return Each transport may have additional error codes.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_get_events(cci_endpoint_t * endpoint,
+				cci_event_t ** events, uint32_t max,
+				uint32_t * count);
+
 /*!
   This function returns the buffer associated with an event that was
   previously obtained via cci_get_event().  The data buffer associated
@@ -1306,6 +1378,132 @@ CCI_DECLSPEC int cci_get_event(cci_endpoint_t * endpoint,
 */
 CCI_DECLSPEC int cci_return_event(cci_event_t * event);
 
+/*!
+  Return several events previously obtained via cci_get_event() or
+  cci_get_events().
+
+  This is equivalent to calling cci_return_event() on each event, but
+  lets the transport recycle the associated buffers in one critical
+  section per endpoint. Events may come from different endpoints; NULL
+  entries are ignored.
+
+  \param[in] events	    Array of events to return.
+  \param[in] count	    Number of events in the array.
+
+  \return CCI_SUCCESS  All events were returned to CCI.
+  \return CCI_EINVAL   Events is NULL and count is non-zero.
+  \return Otherwise the first error returned by a transport. The
+                       remaining events are still returned.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_return_events(cci_event_t ** events, uint32_t count);
+
+/*!
+  A set of endpoints that one thread can block on.
+
+  \ingroup events
+*/
+typedef struct cci_pollset cci_pollset_t;
+
+/*!
+  Create an empty pollset.
+
+  A pollset lets one thread sleep until any of several endpoints has
+  events, without requesting an OS handle for each of them. The
+  endpoints wake the waiter at most once between two calls to
+  cci_pollset_wait(), however many events arrive in the meantime.
+
+  \param[out] pollset   New pollset.
+
+  \return CCI_SUCCESS   The pollset is ready for cci_pollset_add().
+  \return CCI_EINVAL    Pollset is NULL.
+  \return CCI_ENOMEM    Unable to allocate memory.
+  \return CCI_ERR_NOT_IMPLEMENTED This platform has no epoll.
+  \return Errno values if the kernel objects could not be created.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_pollset_create(cci_pollset_t ** pollset);
+
+/*!
+  Destroy a pollset. Endpoints still in it are removed first.
+
+  \param[in] pollset    Pollset to destroy.
+
+  \return CCI_SUCCESS   The pollset is gone.
+  \return CCI_EINVAL    Pollset is NULL.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_pollset_destroy(cci_pollset_t * pollset);
+
+/*!
+  Add an endpoint to a pollset.
+
+  An endpoint can be in one pollset at a time. It leaves its pollset
+  when it is destroyed.
+
+  \param[in] pollset    Pollset to add to.
+  \param[in] endpoint   Endpoint to watch.
+
+  \return CCI_SUCCESS   The endpoint is in the pollset.
+  \return CCI_EINVAL    Pollset or endpoint is NULL.
+  \return CCI_EBUSY     The endpoint is already in a pollset.
+  \return CCI_ENOMEM    Unable to allocate memory.
+  \return CCI_ERR_NOT_IMPLEMENTED The endpoint's transport (or one of
+                        its rails) cannot wake a pollset.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_pollset_add(cci_pollset_t * pollset,
+				 cci_endpoint_t * endpoint);
+
+/*!
+  Remove an endpoint from a pollset.
+
+  \param[in] pollset    Pollset to remove from.
+  \param[in] endpoint   Endpoint to stop watching.
+
+  \return CCI_SUCCESS   The endpoint left the pollset.
+  \return CCI_EINVAL    Pollset or endpoint is NULL, or the endpoint
+                        is not in this pollset.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_pollset_remove(cci_pollset_t * pollset,
+				    cci_endpoint_t * endpoint);
+
+/*!
+  Wait until one or more endpoints in the pollset have events.
+
+  Returns the endpoints that woke the waiter; the application then
+  drains each one with cci_get_event() or cci_get_events() until it
+  returns CCI_EAGAIN. Endpoints that still hold events when the next
+  wait starts are returned again right away, so stopping early loses
+  nothing.
+
+  Only one thread may wait on a pollset at a time.
+
+  \param[in]  pollset   Pollset to wait on.
+  \param[out] endpoints Array of at least max endpoint pointers.
+  \param[in]  max       Maximum number of endpoints to return.
+  \param[out] count     Number of endpoints stored in endpoints.
+  \param[in]  timeout   Milliseconds to wait, 0 to only check, or -1
+                        to wait forever.
+
+  \return CCI_SUCCESS   At least one endpoint was returned.
+  \return CCI_EAGAIN    Timeout is 0 and no endpoint has events.
+  \return CCI_ETIMEDOUT No endpoint had events before the timeout.
+  \return CCI_EINVAL    Pollset, endpoints or count is NULL or max is 0.
+  \return Errno values if epoll_wait() fails.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_pollset_wait(cci_pollset_t * pollset,
+				  cci_endpoint_t ** endpoints, uint32_t max,
+				  uint32_t * count, int timeout);
+
 /*====================================================================*/
 /*                                                                    */
 /*                 ENDPOINTS / CONNECTIONS OPTIONS                    */
@@ -1432,7 +1630,26 @@ typedef enum cci_opt_name {
 
 	   The parameter must point to a uint32_t.
 	 */
-	CCI_OPT_CONN_KEEPALIVE_TIMEOUT
+	CCI_OPT_CONN_KEEPALIVE_TIMEOUT,
+
+	/*! Performance counters for the endpoint, summed over all of its
+	   connections (including closed ones).
+
+	   cci_get_opt() only.
+
+	   The parameter must point to a cci_stats_t whose version field is
+	   set to CCI_STATS_VERSION.
+	 */
+	CCI_OPT_ENDPT_STATS,
+
+	/*! Performance counters for a single connection.
+
+	   cci_get_opt() only.
+
+	   The parameter must point to a cci_stats_t whose version field is
+	   set to CCI_STATS_VERSION.
+	 */
+	CCI_OPT_CONN_STATS
 } cci_opt_name_t;
 
 typedef struct cci_alignment {
@@ -1444,6 +1661,45 @@ typedef struct cci_alignment {
 	uint32_t rma_read_length;	/*!< READ length */
 } cci_alignment_t;
 
+/*! Version of cci_stats_t described by this header. New fields are
+    only ever appended and come with a new version. */
+#define CCI_STATS_VERSION	(2)
+
+/*!
+  Counters returned by CCI_OPT_ENDPT_STATS and CCI_OPT_CONN_STATS.
+
+  The caller sets version to CCI_STATS_VERSION; CCI fills in the fields
+  that exist in that version. Counters that do not apply to a transport
+  are left at 0. The counters are maintained without extra
+  synchronization, so a value read while traffic is flowing may be
+  slightly stale.
+
+  \ingroup opts
+*/
+typedef struct cci_stats {
+	uint32_t version;	/*!< In: CCI_STATS_VERSION */
+	uint32_t pad;
+
+	/* Cumulative counters */
+	uint64_t msgs_sent;	/*!< MSGs put on the wire */
+	uint64_t bytes_sent;	/*!< MSG payload bytes put on the wire */
+	uint64_t msgs_recv;	/*!< MSGs delivered to the application */
+	uint64_t bytes_recv;	/*!< MSG payload bytes delivered */
+	uint64_t resends;	/*!< Retransmitted messages */
+	uint64_t rnr;		/*!< Receiver-not-ready NACKs received */
+	uint64_t no_bufs;	/*!< Sends that failed for lack of buffers */
+	uint64_t partial_sends;	/*!< Socket writes that did not complete */
+	uint64_t ring_full;	/*!< Send attempts that found the peer's ring full */
+
+	/* Current state, sampled by cci_get_opt() */
+	uint32_t queued;	/*!< Sends waiting to go on the wire */
+	uint32_t pending;	/*!< Sends on the wire waiting for an ack */
+	uint32_t seq;		/*!< Last sequence number sent (CONN only) */
+	uint32_t acked;		/*!< Last sequence number acked (CONN only) */
+	uint32_t cwnd;		/*!< Congestion window (CONN only) */
+	uint32_t rtt;		/*!< Smoothed RTT in usecs (CONN only, version 2) */
+} cci_stats_t;
+
 typedef const void cci_opt_handle_t;
 
 /*!
@@ -1484,6 +1740,7 @@ CCI_DECLSPEC int cci_set_opt(cci_opt_handle_t * handle,
 
   \return CCI_SUCCESS   Value successfully retrieved.
   \return CCI_EINVAL    Handle or val is NULL.
+  \return CCI_EINVAL    Unknown cci_stats_t version.
   \return CCI_ERR_NOT_IMPLEMENTED   Not supported by this transport.
   \return Each transport may have additional error codes.
 
@@ -1615,6 +1872,61 @@ CCI_DECLSPEC int cci_sendv(cci_connection_t * connection,
 			   const struct iovec *data, uint32_t iovcnt,
 			   const void *context, int flags);
 
+/*!
+  Descriptor for one message of a cci_send_batch() call.
+
+  The first five fields have the same meaning as the parameters of
+  cci_send(). The status field is set by cci_send_batch().
+
+  \ingroup communications
+*/
+typedef struct cci_send_desc {
+	/*! Connection (destination/reliability/ordering). */
+	cci_connection_t *connection;
+
+	/*! Pointer to local segment. */
+	const void *msg_ptr;
+
+	/*! Length of local segment (limited to max send size). */
+	uint32_t msg_len;
+
+	/*! Cookie to identify the completion through a Send event. */
+	const void *context;
+
+	/*! Optional flags (see cci_send()). */
+	int flags;
+
+	/*! Output: CCI_SUCCESS if the message was queued, else the error
+	   cci_send() would have returned for it. */
+	int status;
+} cci_send_desc_t;
+
+/*!
+  Send a batch of short messages.
+
+  This is equivalent to calling cci_send() on each descriptor in
+  order, but lets the transport queue the whole batch at once and
+  notify its progress engine (or the peer) only once. The messages may
+  target different connections, even on different endpoints; messages
+  on the same connection are sent in array order.
+
+  Each message is accepted or rejected individually, and its outcome
+  is stored in its descriptor's status. For example, when the
+  transport runs out of send buffers part way through the batch, the
+  leading messages are queued and the rest fail with CCI_ENOBUFS.
+  Completions are reported exactly as for cci_send().
+
+  \param[in,out] descs	Array of message descriptors.
+  \param[in] count	Number of descriptors.
+
+  \return CCI_SUCCESS   All messages have been queued to send.
+  \return CCI_EINVAL    Descs is NULL and count is non-zero.
+  \return Otherwise the status of the first rejected message.
+
+  \ingroup communications
+ */
+CCI_DECLSPEC int cci_send_batch(cci_send_desc_t * descs, uint32_t count);
+
 /* RMA Area operations */
 
 /*!
@@ -1642,6 +1954,10 @@ typedef const struct cci_rma_handle {
 
   It is allowable to have overlapping registrations.
 
+  With the registration cache (CCI_INIT_FLAG_REG_CACHE), the same handle
+  may be returned for several registrations; each must still be passed
+  to cci_rma_deregister().
+
   \param[in]  endpoint      Local endpoint to use for RMA.
   \param[in]  start         Pointer to local memory.
   \param[in]  length        Length of local memory.
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Lock-free completion queue for endpoint event delivery.
+ *
+ * This is an intrusive multi-producer/single-consumer queue (D. Vyukov).
+ * A producer swaps its node into the tail and then links the previous
+ * tail to it, so producers never wait on each other or on the consumer.
+ * The consumer pops from the head and only touches the tail when the
+ * queue runs empty.
+ *
+ * If several threads may poll the same queue, initialize it with
+ * mc = 1. Consumers then serialize on a lock that producers never take.
+ *
+ * A producer that has swapped the tail but not yet linked its node makes
+ * the node invisible for a moment; pop returns NULL and the consumer
+ * simply tries again later.
+ */
+
+#ifndef CCI_EVTQ_H
+#define CCI_EVTQ_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "opa_primitives.h"
+
+#define CCI_EVTQ_CACHE_LINE	(64)
+
+typedef struct cci__evtq_node {
+	OPA_ptr_t next;
+} cci__evtq_node_t;
+
+typedef struct cci__evtq {
+	/*! Last node pushed, producers only */
+	OPA_ptr_t tail;
+	char pad0[CCI_EVTQ_CACHE_LINE - sizeof(OPA_ptr_t)];
+
+	/*! Next node to pop, consumer only */
+	cci__evtq_node_t *head;
+
+	/*! Placeholder that keeps the list non-empty */
+	cci__evtq_node_t stub;
+
+	/*! Serialize consumers? */
+	int mc;
+
+	/*! Consumer lock, only used if mc */
+	pthread_mutex_t lock;
+} cci__evtq_t;
+
+static inline void cci__evtq_init(cci__evtq_t * q, int mc)
+{
+	OPA_store_ptr(&q->stub.next, NULL);
+	OPA_store_ptr(&q->tail, &q->stub);
+	q->head = &q->stub;
+	q->mc = mc;
+	pthread_mutex_init(&q->lock, NULL);
+}
+
+static inline void cci__evtq_destroy(cci__evtq_t * q)
+{
+	pthread_mutex_destroy(&q->lock);
+}
+
+/* Push a chain of nodes already linked first -> ... -> last. */
+static inline void
+cci__evtq_push_chain(cci__evtq_t * q, cci__evtq_node_t * first,
+		     cci__evtq_node_t * last)
+{
+	cci__evtq_node_t *prev = NULL;
+
+	OPA_store_ptr(&last->next, NULL);
+	OPA_write_barrier();
+	prev = OPA_swap_ptr(&q->tail, last);
+	OPA_store_release_ptr(&prev->next, first);
+}
+
+static inline void cci__evtq_push(cci__evtq_t * q, cci__evtq_node_t * node)
+{
+	cci__evtq_push_chain(q, node, node);
+}
+
+static inline cci__evtq_node_t *cci__evtq_pop_sc(cci__evtq_t * q)
+{
+	cci__evtq_node_t *head = q->head;
+	cci__evtq_node_t *next = OPA_load_acquire_ptr(&head->next);
+
+	if (head == &q->stub) {
+		if (!next)
+			return NULL;
+		q->head = head = next;
+		next = OPA_load_acquire_ptr(&head->next);
+	}
+
+	if (next) {
+		q->head = next;
+		return head;
+	}
+
+	/* head is the last node, or a producer is still linking behind it */
+	if (OPA_load_acquire_ptr(&q->tail) != head)
+		return NULL;
+
+	cci__evtq_push(q, &q->stub);
+
+	next = OPA_load_acquire_ptr(&head->next);
+	if (next) {
+		q->head = next;
+		return head;
+	}
+	return NULL;
+}
+
+static inline cci__evtq_node_t *cci__evtq_pop(cci__evtq_t * q)
+{
+	cci__evtq_node_t *node = NULL;
+
+	if (!q->mc)
+		return cci__evtq_pop_sc(q);
+
+	pthread_mutex_lock(&q->lock);
+	node = cci__evtq_pop_sc(q);
+	pthread_mutex_unlock(&q->lock);
+
+	return node;
+}
+
+/* Only a hint while producers are running */
+static inline int cci__evtq_empty(cci__evtq_t * q)
+{
+	return OPA_load_acquire_ptr(&q->tail) == &q->stub;
+}
+
+#endif /* CCI_EVTQ_H */
@@ -20,6 +20,7 @@
 #include <stddef.h>
 #include <unistd.h>
 #include "bsd/queue.h"
+#include "cci_evtq.h"
 #include "plugins/ctp/ctp.h"
 
 BEGIN_C_DECLS
@@ -73,6 +74,33 @@ BEGIN_C_DECLS
 /* export for transports as needed */
 void cci__init_dev(cci__dev_t *dev);
 
+/*! Cumulative counters behind CCI_OPT_ENDPT_STATS and CCI_OPT_CONN_STATS */
+typedef struct cci__stats {
+	uint64_t msgs_sent;
+	uint64_t bytes_sent;
+	uint64_t msgs_recv;
+	uint64_t bytes_recv;
+	uint64_t resends;
+	uint64_t rnr;
+	uint64_t no_bufs;
+	uint64_t partial_sends;
+	uint64_t ring_full;
+} cci__stats_t;
+
+/* Bump a counter on the connection (if any) and on its endpoint. Several
+   progress threads may count on the same endpoint, so the adds are atomic,
+   but relaxed: the counters order nothing else. */
+#define CCI_STAT_ADD(ep,conn,field,n)                                   \
+  do {                                                                  \
+        __atomic_fetch_add(&(ep)->stats.field, (n), __ATOMIC_RELAXED);  \
+        if (conn)                                                       \
+            __atomic_fetch_add(&(conn)->stats.field, (n),               \
+                               __ATOMIC_RELAXED);                       \
+  } while (0)
+
+/* Read a counter that other threads may be bumping */
+#define CCI_STAT_READ(s,field) __atomic_load_n(&(s)->field, __ATOMIC_RELAXED)
+
 /*! CCI private endpoint */
 typedef struct cci__ep {
 	/*! Pointer to the plugin structure */
@@ -99,6 +127,10 @@ typedef struct cci__ep {
 	/*! Events ready for process */
 	 TAILQ_HEAD(s_evts, cci__evt) evts;
 
+	/*! Lock-free completion queue (sm, sock and tcp use this instead
+	    of evts, see cci__queue_evt()) */
+	cci__evtq_t evtq;
+
 	/*! Lock to protect evts */
 	pthread_mutex_t lock;
 
@@ -118,6 +150,27 @@ typedef struct cci__ep {
 	    listening address that client's can pass to cci_connect().
 	    The application should never need to parse this URI. */
 	char *uri;
+
+	/*! Counters for CCI_OPT_ENDPT_STATS */
+	cci__stats_t stats;
+
+	/*! Companion sm endpoint (CCI_EP_FLAG_HYBRID) */
+	struct cci__ep *sm_ep;
+
+	/*! If this is a companion, the network endpoint that owns it */
+	struct cci__ep *net_ep;
+
+	/*! URI naming both endpoints, for CCI_OPT_ENDPT_URI */
+	char *hybrid_uri;
+
+	/*! Which endpoint a hybrid get_event polls first */
+	uint32_t hybrid_turn;
+
+	/*! Wakeup of the pollset this endpoint (or its owner) is in */
+	struct cci__pollwake *poll;
+
+	/*! RMA registration cache, NULL if disabled */
+	struct cci__rcache *rcache;
 } cci__ep_t;
 
 /*! CCI private connection */
@@ -137,6 +190,9 @@ typedef struct cci__conn {
 	/*! Keepalive timeout in microseconds */
 	uint32_t keepalive_timeout;
 
+	/*! Counters for CCI_OPT_CONN_STATS */
+	cci__stats_t stats;
+
 	/*! Pointer to device specific struct */
 	void *priv;
 } cci__conn_t;
@@ -161,6 +217,9 @@ typedef struct cci__evt {
 	/*! Entry to hang on ep->evts */
 	TAILQ_ENTRY(cci__evt) entry;
 
+	/*! Link in ep->evtq */
+	cci__evtq_node_t qnode;
+
 	/*! Pointer to device specific struct */
 	void *priv;
 } cci__evt_t;
@@ -212,6 +271,67 @@ extern cci__globals_t *globals;
  *    example 2 */
 #define container_of(p,stype,field) ((stype *)(((uint8_t *)(p)) - offsetof(stype, field)))
 
+/*! Pollset wakeup, see pollset.c */
+typedef struct cci__pollwake {
+	/*! Set while the waiter may sleep, cleared by the first wakeup */
+	OPA_int_t armed;
+
+	/*! Write end of the member's wake pipe */
+	int fd;
+} cci__pollwake_t;
+
+/* Wake the pollset waiter. Only the first call after the waiter armed
+   the member writes, so a burst of events costs one write(). */
+static inline void cci__pollset_wake(cci__pollwake_t * poll)
+{
+	char one = 1;
+	ssize_t rc = 0;
+
+	if (OPA_load_int(&poll->armed) && OPA_cas_int(&poll->armed, 1, 0) == 1)
+		rc = write(poll->fd, &one, sizeof(one));
+	(void) rc;
+}
+
+/* Have the pollset also wait on fd for ep, e.g. a FIFO that peers
+   write to. The transport keeps ownership of fd. */
+int cci__pollset_watch(cci__ep_t * ep, int fd);
+
+/* Deliver a completion. Lock-free, callable from any thread. */
+static inline void cci__queue_evt(cci__ep_t * ep, cci__evt_t * evt)
+{
+	cci__pollwake_t *poll = ep->poll;
+
+	cci__evtq_push(&ep->evtq, &evt->qnode);
+	if (poll)
+		cci__pollset_wake(poll);
+}
+
+/* Deliver a TAILQ of completions (linked through entry) with a single
+   tail swap. The TAILQ must not be used afterwards. */
+#define cci__queue_evt_list(ep, list)                                   \
+  do {                                                                  \
+        cci__evt_t *_e = TAILQ_FIRST(list), *_n = NULL;                 \
+        cci__pollwake_t *_p = (ep)->poll;                               \
+        if (_e) {                                                       \
+            cci__evtq_node_t *_first = &_e->qnode;                      \
+            while ((_n = TAILQ_NEXT(_e, entry))) {                      \
+                OPA_store_ptr(&_e->qnode.next, &_n->qnode);             \
+                _e = _n;                                                \
+            }                                                           \
+            cci__evtq_push_chain(&(ep)->evtq, _first, &_e->qnode);      \
+            if (_p)                                                     \
+                cci__pollset_wake(_p);                                  \
+        }                                                               \
+  } while (0)
+
+/* Take the oldest completion, or NULL if none is visible yet */
+static inline cci__evt_t *cci__dequeue_evt(cci__ep_t * ep)
+{
+	cci__evtq_node_t *node = cci__evtq_pop(&ep->evtq);
+
+	return node ? container_of(node, cci__evt_t, qnode) : NULL;
+}
+
 extern int cci__debug;
 
 /*
@@ -231,7 +351,9 @@ extern int cci__debug;
 #define CCI_DB_ALL    (~0)	/* print everything */
 #define CCI_DB_DFLT   (CCI_DB_ERR|CCI_DB_WARN)
 
+#ifndef CCI_DEBUG
 #define CCI_DEBUG     1		/* Turn on for developing */
+#endif
 
 #if CCI_DEBUG
 #define debug(lvl,fmt,...)                           \
@@ -241,7 +363,14 @@ extern int cci__debug;
                   getpid(), __VA_ARGS__);            \
   } while (0)
 #else /* ! CCI_DEBUG */
-#define debug(lvl,fmt,...) do { } while (0)
+/* never printed, but the arguments are still type-checked and used */
+#define debug(lvl,fmt,...)                           \
+  do {                                               \
+      (void)(lvl);                                   \
+      if (0)                                         \
+          fprintf(stderr, "cci:%d:" fmt "\n",        \
+                  getpid(), __VA_ARGS__);            \
+  } while (0)
 #endif /* CCI_DEBUG */
 
 #if CCI_DEBUG
@@ -252,7 +381,13 @@ extern int cci__debug;
                   getpid(), (void*)ep, __VA_ARGS__); \
   } while (0)
 #else /* ! CCI_DEBUG */
-#define debug_ep(ep,lvl,fmt,...) do { } while (0)
+#define debug_ep(ep,lvl,fmt,...)                     \
+  do {                                               \
+      (void)(lvl);                                   \
+      if (0)                                         \
+          fprintf(stderr, "cci:%d:ep %p:" fmt "\n",  \
+                  getpid(), (void*)ep, __VA_ARGS__); \
+  } while (0)
 #endif /* CCI_DEBUG */
 
 #define CCI_ENTER                                                               \
@@ -265,6 +400,8 @@ extern int cci__debug;
         debug(CCI_DB_FUNC, "exiting  %s", __func__);                            \
   } while (0);
 
+#include "cci_trace.h"
+
 #if (defined HAVE_DECL_VALGRIND_MAKE_MEM_NOACCESS) && HAVE_DECL_VALGRIND_MAKE_MEM_NOACCESS
 #include <valgrind/memcheck.h>
 #define CCI_VALGRIND_MEMORY_MAKE_NOACCESS(p, s) VALGRIND_MAKE_MEM_NOACCESS(p, s)
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Binary trace ring for the Common Communications Interface (CCI).
+ *
+ * When configured with --enable-trace, each thread that calls
+ * CCI_TRACE() gets its own ring of fixed-size records (timestamp,
+ * event id, three integer arguments). Recording is lock-free and does
+ * not format anything, so it can stay on in latency-sensitive runs.
+ *
+ * Recording is armed at cci_init() when the CCI_TRACE environment
+ * variable names an output file. The rings are written to that file
+ * (with ".<pid>" appended) on SIGUSR2 and at cci_finalize(). Use
+ * cci_trace_decode to print the file.
+ *
+ * Without --enable-trace, CCI_TRACE() compiles to nothing.
+ */
+
+#ifndef CCI_TRACE_H
+#define CCI_TRACE_H
+
+#include <stdint.h>
+
+#define CCI_TRACE_MAGIC		"CCITRACE"
+#define CCI_TRACE_VERSION	(1)
+#define CCI_TRACE_RING_SHIFT	(13)	/* 8K records per thread */
+#define CCI_TRACE_RING_SIZE	(1 << CCI_TRACE_RING_SHIFT)
+#define CCI_TRACE_RING_MASK	(CCI_TRACE_RING_SIZE - 1)
+
+/* Event ids. Append only, the decoder relies on the values. */
+typedef enum cci_trace_id {
+	CCI_TRACE_NONE = 0,
+	CCI_TRACE_SEND,		/* conn, seq or id, len */
+	CCI_TRACE_RECV,		/* conn, seq or id, len */
+	CCI_TRACE_ACK_TX,	/* conn, first seq, last seq */
+	CCI_TRACE_ACK_RX,	/* conn, first seq, last seq */
+	CCI_TRACE_RESEND,	/* conn, seq, send count */
+	CCI_TRACE_RMA,		/* conn, fragment offset, len */
+	CCI_TRACE_ID_MAX
+} cci_trace_id_t;
+
+/* File layout: header, then for each ring a ring header followed by
+ * count records, oldest first. All fields are in host byte order. */
+typedef struct cci_trace_file_hdr {
+	char magic[8];		/* CCI_TRACE_MAGIC */
+	uint32_t version;	/* CCI_TRACE_VERSION */
+	uint32_t num_rings;
+	uint64_t pid;
+} cci_trace_file_hdr_t;
+
+typedef struct cci_trace_ring_hdr {
+	uint64_t thread;	/* ring index, in creation order */
+	uint64_t count;		/* records that follow */
+	uint64_t dropped;	/* records overwritten before the dump */
+} cci_trace_ring_hdr_t;
+
+typedef struct cci_trace_rec {
+	uint64_t ts;		/* CLOCK_MONOTONIC in ns */
+	uint32_t id;		/* cci_trace_id_t */
+	uint32_t transport;	/* CCI_TRACE_TP_* */
+	uint64_t arg[3];
+} cci_trace_rec_t;
+
+#define CCI_TRACE_TP_NONE	(0)
+#define CCI_TRACE_TP_SOCK	(1)
+#define CCI_TRACE_TP_TCP	(2)
+#define CCI_TRACE_TP_SM		(3)
+
+static inline const char *
+cci_trace_id_str(uint32_t id)
+{
+	switch (id) {
+	case CCI_TRACE_SEND:
+		return "send";
+	case CCI_TRACE_RECV:
+		return "recv";
+	case CCI_TRACE_ACK_TX:
+		return "ack_tx";
+	case CCI_TRACE_ACK_RX:
+		return "ack_rx";
+	case CCI_TRACE_RESEND:
+		return "resend";
+	case CCI_TRACE_RMA:
+		return "rma";
+	}
+	return "unknown";
+}
+
+static inline const char *
+cci_trace_tp_str(uint32_t tp)
+{
+	switch (tp) {
+	case CCI_TRACE_TP_SOCK:
+		return "sock";
+	case CCI_TRACE_TP_TCP:
+		return "tcp";
+	case CCI_TRACE_TP_SM:
+		return "sm";
+	}
+	return "-";
+}
+
+#if defined(CCI_TRACE_ENABLED) && CCI_TRACE_ENABLED
+
+extern volatile int cci__trace_on;
+
+void cci__trace_record(uint32_t id, uint32_t transport,
+		       uint64_t a0, uint64_t a1, uint64_t a2);
+void cci__trace_init(void);
+void cci__trace_finalize(void);
+
+#define CCI_TRACE(id,tp,a0,a1,a2)                                       \
+  do {                                                                  \
+        if (cci__trace_on)                                              \
+            cci__trace_record((id), (tp), (uint64_t)(uintptr_t)(a0),    \
+                              (uint64_t)(a1), (uint64_t)(a2));          \
+  } while (0)
+
+#else /* !CCI_TRACE_ENABLED */
+
+#define CCI_TRACE(id,tp,a0,a1,a2) do { } while (0)
+#define cci__trace_init() do { } while (0)
+#define cci__trace_finalize() do { } while (0)
+
+#endif /* CCI_TRACE_ENABLED */
+
+#endif /* CCI_TRACE_H */
@@ -12,6 +12,49 @@ void cci__init_dev(cci__dev_t *dev);
 
 int cci__parse_config(const char *path);
 
+int cci__hybrid_open(cci__ep_t * ep, int flags);
+
+void cci__hybrid_close(cci__ep_t * ep);
+
+int cci__hybrid_is_uri(const char *uri);
+
+int cci__hybrid_connect(cci__ep_t * ep, const char *server_uri,
+			const void *data_ptr, uint32_t data_len,
+			cci_conn_attribute_t attribute,
+			const void *context, int flags,
+			const struct timeval *timeout);
+
+int cci__hybrid_get_event(cci__ep_t * ep, cci_event_t ** event);
+
+int cci__hybrid_get_events(cci__ep_t * ep, cci_event_t ** events,
+			   uint32_t max, uint32_t * count);
+
+int cci__hybrid_rma_register(cci__ep_t * ep, void *start, uint64_t length,
+			     int flags, cci_rma_handle_t ** rma_handle);
+
+int cci__hybrid_rma_deregister(cci__ep_t * ep, cci_rma_handle_t * rma_handle);
+
+cci_rma_handle_t *cci__hybrid_local_handle(cci__ep_t * ep,
+					   cci_rma_handle_t * local_handle);
+
+extern cci_plugin_ctp_t cci__mrail_plugin;
+
+void cci__pollset_leave(cci__ep_t * ep);
+
+int cci__rma_register(cci__ep_t * ep, void *start, uint64_t length,
+		      int flags, cci_rma_handle_t ** rma_handle);
+
+int cci__rma_deregister(cci__ep_t * ep, cci_rma_handle_t * rma_handle);
+
+void cci__rcache_open(cci__ep_t * ep);
+
+void cci__rcache_close(cci__ep_t * ep);
+
+int cci__rcache_register(cci__ep_t * ep, void *start, uint64_t length,
+			 int flags, cci_rma_handle_t ** rma_handle);
+
+int cci__rcache_deregister(cci__ep_t * ep, cci_rma_handle_t * rma_handle);
+
 #ifdef HAVE_GETIFADDRS
 #ifdef HAVE_IFADDRS_H
 #include <ifaddrs.h>
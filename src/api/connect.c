@@ -16,6 +16,7 @@
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
+#include "cci-api.h"
 
 int cci_connect(cci_endpoint_t * endpoint, const char *server_uri,
 		const void *data_ptr, uint32_t data_len,
@@ -27,6 +28,11 @@ int cci_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	if (data_len > CCI_CONN_REQ_LEN)
 		return CCI_EINVAL;
 
+	/* a hybrid endpoint's URI also names its sm companion */
+	if (cci__hybrid_is_uri(server_uri))
+		return cci__hybrid_connect(ep, server_uri, data_ptr, data_len,
+					   attribute, context, flags, timeout);
+
 	/* NOTE the transport does all of the connection management
 	 * It allocates whatever it needs in addition to the cci__conn_t
 	 */
@@ -18,6 +18,7 @@
 #include "cci.h"
 #include "cci_lib_types.h"
 #include "plugins/ctp/ctp.h"
+#include "cci-api.h"
 
 int cci_create_endpoint(cci_device_t * device,
 			int flags,
@@ -62,6 +63,7 @@ int cci_create_endpoint(cci_device_t * device,
 	}
 
 	TAILQ_INIT(&ep->evts);
+	cci__evtq_init(&ep->evtq, !(flags & CCI_EP_FLAG_SINGLE_CONSUMER));
 	pthread_mutex_init(&ep->lock, NULL);
 	ep->dev = dev;
 	ep->endpoint.device = &dev->device;
@@ -76,9 +78,21 @@ int cci_create_endpoint(cci_device_t * device,
 		/* TODO check dev's state */
 		TAILQ_INSERT_TAIL(&dev->eps, ep, entry);
 		pthread_mutex_unlock(&dev->lock);
+
+		/* the companion cannot share the OS handle */
+		if (flags & CCI_EP_FLAG_HYBRID) {
+			if (fd)
+				debug(CCI_DB_EP, "%s: OS handle requested, "
+					"not a hybrid endpoint", __func__);
+			else
+				cci__hybrid_open(ep, flags);
+		}
+
+		cci__rcache_open(ep);
 	} else {
 		pthread_mutex_unlock(&globals->lock);
 		pthread_mutex_destroy(&ep->lock);
+		cci__evtq_destroy(&ep->evtq);
 		free(ep);
 	}
 
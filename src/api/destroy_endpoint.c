@@ -16,6 +16,7 @@
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
+#include "cci-api.h"
 
 int cci_destroy_endpoint(cci_endpoint_t * endpoint)
 {
@@ -29,6 +30,10 @@ int cci_destroy_endpoint(cci_endpoint_t * endpoint)
 	ep = container_of(endpoint, cci__ep_t, endpoint);
 	dev = ep->dev;
 
+	cci__pollset_leave(ep);
+	cci__rcache_close(ep);
+	cci__hybrid_close(ep);
+
 	pthread_mutex_lock(&dev->lock);
 	ep->closing = 1;
 	TAILQ_REMOVE(&dev->eps, ep, entry);
@@ -39,6 +44,7 @@ int cci_destroy_endpoint(cci_endpoint_t * endpoint)
 	 */
 	ret = ep->plugin->destroy_endpoint(endpoint);
 
+	cci__evtq_destroy(&ep->evtq);
 	free(ep);
 
 	return ret;
@@ -59,6 +59,8 @@ int cci_finalize(void)
 		pthread_mutex_unlock(&dev->lock);
 	}
 
+	cci__mrail_plugin.finalize(&cci__mrail_plugin);
+
 	/* let the transport clean up the private device */
 	for (i = 0;
 	     cci_all_plugins[i].plugin != NULL;
@@ -85,6 +87,8 @@ int cci_finalize(void)
 	cci_plugins_ctp_close();
 	cci_plugins_finalize();
 
+	cci__trace_finalize();
+
 out:
 	pthread_mutex_unlock(&init_lock);
 	return ret;
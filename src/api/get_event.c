@@ -16,9 +16,14 @@
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
+#include "cci-api.h"
 
 int cci_get_event(cci_endpoint_t * endpoint, cci_event_t ** event)
 {
 	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	if (ep->sm_ep)
+		return cci__hybrid_get_event(ep, event);
+
 	return ep->plugin->get_event(endpoint, event);
 }
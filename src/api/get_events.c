@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2010 Cisco Systems, Inc.  All rights reserved.
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ * Copyright © 2012 inria.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+#include "cci-api.h"
+
+int cci_get_events(cci_endpoint_t * endpoint, cci_event_t ** events,
+		   uint32_t max, uint32_t * count)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t i = 0;
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	if (!events || !count || !max)
+		return CCI_EINVAL;
+
+	if (ep->sm_ep)
+		return cci__hybrid_get_events(ep, events, max, count);
+
+	if (ep->plugin->get_events)
+		return ep->plugin->get_events(endpoint, events, max, count);
+
+	/* generic fallback for transports without a native version */
+	for (i = 0; i < max; i++) {
+		ret = ep->plugin->get_event(endpoint, &events[i]);
+		if (ret != CCI_SUCCESS)
+			break;
+	}
+
+	*count = i;
+
+	/* report the first error only if nothing was retrieved */
+	if (i)
+		ret = CCI_SUCCESS;
+
+	return ret;
+}
@@ -12,12 +12,26 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "cci/private_config.h"
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
 
+/* Bytes of cci_stats_t that exist in a given version, 0 if unknown */
+static size_t cci__stats_size(uint32_t version)
+{
+	switch (version) {
+	case 1:
+		return offsetof(cci_stats_t, rtt);
+	case 2:
+		return sizeof(cci_stats_t);
+	default:
+		return 0;
+	}
+}
+
 int cci_get_opt(cci_opt_handle_t * handle,
 		cci_opt_name_t name, void *val)
 {
@@ -39,11 +53,13 @@ int cci_get_opt(cci_opt_handle_t * handle,
 	case CCI_OPT_ENDPT_KEEPALIVE_TIMEOUT:
 	case CCI_OPT_ENDPT_URI:
 	case CCI_OPT_ENDPT_RMA_ALIGN:
+	case CCI_OPT_ENDPT_STATS:
 		ep = container_of(handle, cci__ep_t, endpoint);
 		plugin = ep->plugin;
 		break;
 	case CCI_OPT_CONN_SEND_TIMEOUT:
 	case CCI_OPT_CONN_KEEPALIVE_TIMEOUT:
+	case CCI_OPT_CONN_STATS:
 		conn =
 		    container_of(handle, cci__conn_t, connection);
 		plugin = conn->plugin;
@@ -78,7 +94,8 @@ int cci_get_opt(cci_opt_handle_t * handle,
 	case CCI_OPT_ENDPT_URI:
 		{
 			char **urip = val;
-			char *uri = strdup(ep->uri);
+			char *uri = strdup(ep->hybrid_uri ?
+					   ep->hybrid_uri : ep->uri);
 			if (!uri)
 				return CCI_ENOMEM;
 
@@ -98,6 +115,49 @@ int cci_get_opt(cci_opt_handle_t * handle,
 			*timeout = conn->tx_timeout;
 			break;
 		}
+	case CCI_OPT_ENDPT_STATS:
+	case CCI_OPT_CONN_STATS:
+		{
+			cci_stats_t *stats = val;
+			cci__stats_t *s = ep ? &ep->stats : &conn->stats;
+			size_t len = cci__stats_size(stats->version);
+
+			if (!len) {
+				ret = CCI_EINVAL;
+				break;
+			}
+
+			/* the cumulative counters are generic, the transport
+			   fills in the current queue state; never touch bytes
+			   past the caller's version of the struct */
+			memset(&stats->pad, 0, len - offsetof(cci_stats_t, pad));
+			stats->msgs_sent = CCI_STAT_READ(s, msgs_sent);
+			stats->bytes_sent = CCI_STAT_READ(s, bytes_sent);
+			stats->msgs_recv = CCI_STAT_READ(s, msgs_recv);
+			stats->bytes_recv = CCI_STAT_READ(s, bytes_recv);
+			stats->resends = CCI_STAT_READ(s, resends);
+			stats->rnr = CCI_STAT_READ(s, rnr);
+			stats->no_bufs = CCI_STAT_READ(s, no_bufs);
+			stats->partial_sends = CCI_STAT_READ(s, partial_sends);
+			stats->ring_full = CCI_STAT_READ(s, ring_full);
+
+			/* a hybrid endpoint also counts its sm traffic */
+			if (ep && ep->sm_ep) {
+				s = &ep->sm_ep->stats;
+				stats->msgs_sent += CCI_STAT_READ(s, msgs_sent);
+				stats->bytes_sent += CCI_STAT_READ(s, bytes_sent);
+				stats->msgs_recv += CCI_STAT_READ(s, msgs_recv);
+				stats->bytes_recv += CCI_STAT_READ(s, bytes_recv);
+				stats->resends += CCI_STAT_READ(s, resends);
+				stats->rnr += CCI_STAT_READ(s, rnr);
+				stats->no_bufs += CCI_STAT_READ(s, no_bufs);
+				stats->partial_sends += CCI_STAT_READ(s, partial_sends);
+				stats->ring_full += CCI_STAT_READ(s, ring_full);
+			}
+
+			ret = plugin->get_opt(handle, name, val);
+			break;
+		}
 	default:
 		ret = plugin->get_opt(handle, name, val);
 	}
@@ -0,0 +1,359 @@
+/*
+ * Copyright © 2013 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Hybrid endpoints (CCI_EP_FLAG_HYBRID).
+ *
+ * A hybrid endpoint is a network endpoint with a companion sm endpoint.
+ * Its URI is "<network uri>;host=<hostname>;sm=<sm uri>". A client on
+ * the same host connects through the companion, anyone else uses the
+ * network URI. The companion's connections and events belong to the sm
+ * transport, so only connect, event polling and RMA handles need help
+ * from the core.
+ *
+ * RMA handles registered on a hybrid endpoint are registered with both
+ * transports. The handle the application sees keeps the network
+ * transport's word in stuff[0] and sm's start, length and pid in
+ * stuff[1..3], so a peer can use it over either path. That is why the
+ * network transport must leave stuff[1..3] unused and sm must have a
+ * single-copy path (CMA or XPMEM); sm's copy-through-the-ring fallback
+ * needs its own stuff[0].
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "plugins/ctp/ctp.h"
+#include "cci-api.h"
+
+#define HYBRID_HOST	";host="
+#define HYBRID_SM	";sm="
+
+typedef struct cci__hybrid_rma {
+	/*! What the application sees and sends to peers */
+	struct cci_rma_handle handle;
+
+	/*! Owning (network) endpoint */
+	cci__ep_t *ep;
+
+	/*! Handles from each transport */
+	cci_rma_handle_t *net;
+	cci_rma_handle_t *sm;
+} cci__hybrid_rma_t;
+
+/* Can this network endpoint's RMA handles share a handle with sm? */
+static int hybrid_rma_compatible(cci__ep_t * ep)
+{
+#if HAVE_CMA_H || HAVE_XPMEM_H
+	static char probe;
+	cci_rma_handle_t *h = NULL;
+	int ret = 0;
+
+	if (ep->plugin->rma_register(&ep->endpoint, &probe, sizeof(probe),
+				     CCI_FLAG_READ, &h))
+		return 0;
+
+	ret = !h->stuff[1] && !h->stuff[2] && !h->stuff[3];
+	ep->plugin->rma_deregister(&ep->endpoint, h);
+
+	return ret;
+#else
+	(void) ep;
+	return 0;
+#endif
+}
+
+int cci__hybrid_open(cci__ep_t * ep, int flags)
+{
+	int ret = CCI_SUCCESS;
+	cci__dev_t *dev = NULL;
+	cci_device_t *sm_device = NULL;
+	cci_endpoint_t *endpoint = NULL;
+	cci__ep_t *sep = NULL;
+	char hname[MAXHOSTNAMELEN + 1];
+	size_t len = 0;
+
+	if (!strcmp(ep->dev->device.transport, "sm"))
+		return CCI_SUCCESS;
+
+	pthread_mutex_lock(&globals->lock);
+	TAILQ_FOREACH(dev, &globals->devs, entry) {
+		if (dev->device.up && !strcmp(dev->device.transport, "sm")) {
+			sm_device = &dev->device;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&globals->lock);
+
+	if (!sm_device) {
+		debug(CCI_DB_EP, "%s: no sm device, not a hybrid endpoint",
+			__func__);
+		return CCI_SUCCESS;
+	}
+
+	if (!hybrid_rma_compatible(ep)) {
+		debug(CCI_DB_EP, "%s: %s RMA handles cannot be shared with sm, "
+			"not a hybrid endpoint", __func__,
+			ep->dev->device.transport);
+		return CCI_SUCCESS;
+	}
+
+	memset(hname, 0, sizeof(hname));
+	if (gethostname(hname, sizeof(hname) - 1))
+		return CCI_ERROR;
+
+	ret = cci_create_endpoint(sm_device, flags & ~CCI_EP_FLAG_HYBRID,
+				  &endpoint, NULL);
+	if (ret) {
+		debug(CCI_DB_EP, "%s: unable to open the sm endpoint (%s)",
+			__func__, cci_strerror(NULL, ret));
+		return ret;
+	}
+	sep = container_of(endpoint, cci__ep_t, endpoint);
+
+	len = strlen(ep->uri) + strlen(HYBRID_HOST) + strlen(hname) +
+		strlen(HYBRID_SM) + strlen(sep->uri) + 1;
+	ep->hybrid_uri = calloc(1, len);
+	if (!ep->hybrid_uri) {
+		cci_destroy_endpoint(endpoint);
+		return CCI_ENOMEM;
+	}
+	snprintf(ep->hybrid_uri, len, "%s" HYBRID_HOST "%s" HYBRID_SM "%s",
+		 ep->uri, hname, sep->uri);
+
+	sep->net_ep = ep;
+	ep->sm_ep = sep;
+
+	debug(CCI_DB_EP, "%s: %s", __func__, ep->hybrid_uri);
+
+	return CCI_SUCCESS;
+}
+
+void cci__hybrid_close(cci__ep_t * ep)
+{
+	if (ep->net_ep) {
+		/* companion going away first, e.g. in cci_finalize() */
+		ep->net_ep->sm_ep = NULL;
+		ep->net_ep = NULL;
+	}
+
+	if (ep->sm_ep) {
+		cci__ep_t *sep = ep->sm_ep;
+
+		ep->sm_ep = NULL;
+		sep->net_ep = NULL;
+		cci_destroy_endpoint(&sep->endpoint);
+	}
+
+	free(ep->hybrid_uri);
+	ep->hybrid_uri = NULL;
+}
+
+int cci__hybrid_is_uri(const char *uri)
+{
+	return strstr(uri, HYBRID_SM) != NULL;
+}
+
+int cci__hybrid_connect(cci__ep_t * ep, const char *server_uri,
+			const void *data_ptr, uint32_t data_len,
+			cci_conn_attribute_t attribute,
+			const void *context, int flags,
+			const struct timeval *timeout)
+{
+	int ret = CCI_SUCCESS;
+	char *uri = NULL, *host = NULL, *sm_uri = NULL, *p = NULL;
+	char hname[MAXHOSTNAMELEN + 1];
+
+	uri = strdup(server_uri);
+	if (!uri)
+		return CCI_ENOMEM;
+
+	/* sm= is last since the sm URI is a path */
+	sm_uri = strstr(uri, HYBRID_SM);
+	*sm_uri = '\0';
+	sm_uri += strlen(HYBRID_SM);
+
+	host = strstr(uri, HYBRID_HOST);
+	if (host) {
+		*host = '\0';
+		host += strlen(HYBRID_HOST);
+	}
+
+	/* uri is now the network URI alone */
+	p = strchr(uri, ';');
+	if (p)
+		*p = '\0';
+
+	if (ep->net_ep)
+		ep = ep->net_ep;
+
+	memset(hname, 0, sizeof(hname));
+	if (ep->sm_ep && host && !gethostname(hname, sizeof(hname) - 1) &&
+	    !strcmp(host, hname)) {
+		cci__ep_t *sep = ep->sm_ep;
+
+		ret = sep->plugin->connect(&sep->endpoint, sm_uri, data_ptr,
+					   data_len, attribute, context, flags,
+					   timeout);
+		if (ret == CCI_SUCCESS)
+			goto out;
+
+		debug(CCI_DB_CONN, "%s: sm connect to %s failed (%s), "
+			"using %s", __func__, sm_uri,
+			cci_strerror(&sep->endpoint, ret), uri);
+	}
+
+	ret = ep->plugin->connect(&ep->endpoint, uri, data_ptr, data_len,
+				  attribute, context, flags, timeout);
+
+    out:
+	free(uri);
+	return ret;
+}
+
+int cci__hybrid_get_event(cci__ep_t * ep, cci_event_t ** event)
+{
+	int ret = CCI_SUCCESS, ret2 = CCI_SUCCESS;
+	cci__ep_t *first = ep, *second = ep->sm_ep;
+
+	/* take turns so that neither path starves the other */
+	if (ep->hybrid_turn++ & 1) {
+		first = second;
+		second = ep;
+	}
+
+	ret = first->plugin->get_event(&first->endpoint, event);
+	if (ret == CCI_SUCCESS)
+		return ret;
+
+	ret2 = second->plugin->get_event(&second->endpoint, event);
+	if (ret2 == CCI_SUCCESS)
+		return ret2;
+
+	/* ENOBUFS from either side matters more than EAGAIN */
+	return ret == CCI_EAGAIN ? ret2 : ret;
+}
+
+static int hybrid_poll(cci__ep_t * ep, cci_event_t ** events,
+		       uint32_t max, uint32_t * count)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t i = 0;
+
+	if (ep->plugin->get_events)
+		return ep->plugin->get_events(&ep->endpoint, events, max, count);
+
+	for (i = 0; i < max; i++) {
+		ret = ep->plugin->get_event(&ep->endpoint, &events[i]);
+		if (ret != CCI_SUCCESS)
+			break;
+	}
+	*count = i;
+
+	return i ? CCI_SUCCESS : ret;
+}
+
+int cci__hybrid_get_events(cci__ep_t * ep, cci_event_t ** events,
+			   uint32_t max, uint32_t * count)
+{
+	int ret = CCI_SUCCESS, ret2 = CCI_SUCCESS;
+	uint32_t cnt = 0, cnt2 = 0;
+	cci__ep_t *first = ep, *second = ep->sm_ep;
+
+	if (ep->hybrid_turn++ & 1) {
+		first = second;
+		second = ep;
+	}
+
+	ret = hybrid_poll(first, events, max, &cnt);
+	if (ret != CCI_SUCCESS)
+		cnt = 0;
+
+	if (cnt < max) {
+		ret2 = hybrid_poll(second, &events[cnt], max - cnt, &cnt2);
+		if (ret2 != CCI_SUCCESS)
+			cnt2 = 0;
+	}
+
+	*count = cnt + cnt2;
+	if (*count)
+		return CCI_SUCCESS;
+
+	return ret == CCI_EAGAIN ? ret2 : ret;
+}
+
+int cci__hybrid_rma_register(cci__ep_t * ep, void *start, uint64_t length,
+			     int flags, cci_rma_handle_t ** rma_handle)
+{
+	int ret = CCI_SUCCESS;
+	cci__ep_t *sep = ep->sm_ep;
+	cci__hybrid_rma_t *h = NULL;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return CCI_ENOMEM;
+	h->ep = ep;
+
+	ret = ep->plugin->rma_register(&ep->endpoint, start, length, flags,
+				       &h->net);
+	if (ret)
+		goto out;
+
+	ret = sep->plugin->rma_register(&sep->endpoint, start, length, flags,
+					&h->sm);
+	if (ret) {
+		ep->plugin->rma_deregister(&ep->endpoint, h->net);
+		goto out;
+	}
+
+	h->handle.stuff[0] = h->net->stuff[0];
+	h->handle.stuff[1] = h->sm->stuff[1];
+	h->handle.stuff[2] = h->sm->stuff[2];
+	h->handle.stuff[3] = h->sm->stuff[3];
+
+	*rma_handle = &h->handle;
+
+    out:
+	if (ret)
+		free(h);
+	return ret;
+}
+
+int cci__hybrid_rma_deregister(cci__ep_t * ep, cci_rma_handle_t * rma_handle)
+{
+	int ret = CCI_SUCCESS, rc = CCI_SUCCESS;
+	cci__hybrid_rma_t *h = container_of(rma_handle, cci__hybrid_rma_t,
+					    handle);
+
+	if (h->ep != ep)
+		return CCI_EINVAL;
+
+	ret = ep->plugin->rma_deregister(&ep->endpoint, h->net);
+	if (ep->sm_ep)
+		rc = ep->sm_ep->plugin->rma_deregister(&ep->sm_ep->endpoint,
+						       h->sm);
+	free(h);
+
+	return ret ? ret : rc;
+}
+
+cci_rma_handle_t *cci__hybrid_local_handle(cci__ep_t * ep,
+					   cci_rma_handle_t * local_handle)
+{
+	cci__hybrid_rma_t *h = container_of(local_handle, cci__hybrid_rma_t,
+					    handle);
+
+	/* ep is the endpoint of the connection */
+	return ep->net_ep ? h->sm : h->net;
+}
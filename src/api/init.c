@@ -584,6 +584,8 @@ int cci_init(uint32_t abi_ver, uint32_t flags, uint32_t * caps)
 			goto out;
 		}
 
+		cci__trace_init();
+
 		globals->flags = flags;
 		TAILQ_INIT(&globals->devs);
 		globals->configfile = 0;
@@ -638,6 +640,9 @@ int cci_init(uint32_t abi_ver, uint32_t flags, uint32_t * caps)
 			goto out_with_config_file;
 		}
 
+		/* bundle the claimed devices into multi-rail devices */
+		cci__mrail_plugin.init(&cci__mrail_plugin, abi_ver, flags, caps);
+
 		/* drop devices that weren't claimed by any transport,
 		 * they didn't move from configfile_devs to devs */
 		cci__free_configfile_devs("not claimed by any transport");
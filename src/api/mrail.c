@@ -0,0 +1,1780 @@
+/*
+ * Copyright © 2013 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Multi-rail devices.
+ *
+ * A config file section with transport=mrail bundles devices that a
+ * transport already claimed:
+ *
+ *	[mr0]
+ *	transport = mrail
+ *	rail = eth0		# one line per rail, in order, up to 4
+ *	rail = eth1
+ *	stripe_min = 65536	# optional, smallest RMA worth striping
+ *
+ * The core acts as the transport for these devices. An endpoint opens
+ * one endpoint per rail and its URI lists theirs. A connection connects
+ * rail 0 (the primary) first, with the application's payload, and then
+ * the other rails. Messages on RU and UU connections are spread over
+ * the rails; RO connections keep to the primary to preserve ordering.
+ * RMAs of at least stripe_min bytes are cut into page-aligned chunks,
+ * one per rail, and complete once every chunk has. A completion message
+ * goes out on the primary after the last chunk.
+ *
+ * An RMA handle carries rail i's stuff[0] in stuff[i], so rails whose
+ * transport needs more than one word of handle cannot be bundled.
+ * CCI_FLAG_FENCE orders RMAs on each rail, not across rails.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "plugins/ctp/ctp.h"
+#include "cci-api.h"
+
+#define MRAIL_MAX_RAILS		(4)	/* words in struct cci_rma_handle */
+#define MRAIL_FRAGS		(1024)	/* RMA chunks in flight per endpoint */
+#define MRAIL_STRIPE_MIN	(64 * 1024)
+#define MRAIL_CHUNK_ALIGN	(4096)
+#define MRAIL_MAGIC		(0x6d726c31)	/* "mrl1" */
+#define MRAIL_URI_PREFIX	"mrail://"
+#define MRAIL_URI_SEP		'|'
+
+typedef struct mrail_dev {
+	/*! Bundled devices, rail 0 is the primary */
+	int nrails;
+	cci__dev_t *rails[MRAIL_MAX_RAILS];
+
+	/*! Smallest RMA that is striped */
+	uint64_t stripe_min;
+} mrail_dev_t;
+
+/* Prepended to each rail's connect payload */
+typedef struct mrail_hdr {
+	uint32_t magic;
+	uint8_t rail;		/* rail index, the same on both sides */
+	uint8_t primary;	/* carries the application's payload */
+	uint8_t nrails;		/* rails the client will try */
+	uint8_t pad;
+	uint64_t token;		/* ties the rails to one connection */
+} mrail_hdr_t;
+
+typedef enum mrail_conn_state {
+	MRAIL_CONN_ACTIVE,	/* client, primary connecting */
+	MRAIL_CONN_PASSIVE,	/* server, waiting for cci_accept() */
+	MRAIL_CONN_ACCEPTING,	/* server, primary accepting */
+	MRAIL_CONN_READY,
+	MRAIL_CONN_CLOSED	/* the application is done with it */
+} mrail_conn_state_t;
+
+typedef struct mrail_conn {
+	/*! What the application sees, conn.priv points back here */
+	cci__conn_t conn;
+
+	mrail_conn_state_t state;
+	uint64_t token;
+
+	/*! Rails agreed with the peer and their connections */
+	int nrails;
+	cci_connection_t *rails[MRAIL_MAX_RAILS];
+
+	/*! Client, the peer's rail URIs until we connect them */
+	char *uris[MRAIL_MAX_RAILS];
+
+	/*! Rail connects/accepts and RMAs not completed yet. We free the
+	    connection once it is closed and this drops to 0. */
+	int inflight;
+
+	/*! Round-robin for messages */
+	uint32_t next;
+
+	TAILQ_ENTRY(mrail_conn) entry;
+} mrail_conn_t;
+
+typedef enum mrail_evt_kind {
+	MRAIL_EVT_WRAP,		/* a rail event, seen through the bundle */
+	MRAIL_EVT_OP		/* completion of a striped RMA */
+} mrail_evt_kind_t;
+
+typedef struct mrail_evt {
+	cci__evt_t evt;
+	mrail_evt_kind_t kind;
+
+	/*! WRAP, the rail event we return along with this one */
+	cci__evt_t *rail_evt;
+
+	/*! CONNECT_REQUEST, the connection being set up */
+	mrail_conn_t *mconn;
+
+	TAILQ_ENTRY(mrail_evt) entry;
+} mrail_evt_t;
+
+struct mrail_frag;
+
+typedef struct mrail_op {
+	/*! The application's completion */
+	mrail_evt_t wevt;
+
+	mrail_conn_t *mconn;
+	int flags;
+	int status;
+
+	/*! Chunks on the wire */
+	int pending;
+
+	/*! Completion message, sent once all chunks are done */
+	void *msg;
+	uint32_t msg_len;
+	struct mrail_frag *msg_frag;
+} mrail_op_t;
+
+/* Context of an internal send or RMA chunk. These come from one array
+   per endpoint so that we can tell them from application contexts. */
+typedef struct mrail_frag {
+	mrail_op_t *op;
+
+	/*! The peer's handle as this rail sees it, rails keep the pointer */
+	struct cci_rma_handle remote;
+
+	TAILQ_ENTRY(mrail_frag) entry;
+} mrail_frag_t;
+
+typedef struct mrail_rma {
+	/*! What the application sees and sends to peers */
+	struct cci_rma_handle handle;
+
+	cci__ep_t *ep;
+	cci_rma_handle_t *rails[MRAIL_MAX_RAILS];
+} mrail_rma_t;
+
+typedef struct mrail_ep {
+	int nrails;
+	cci__ep_t *rails[MRAIL_MAX_RAILS];
+	uint64_t stripe_min;
+
+	/*! Rail that get_event polls first */
+	uint32_t turn;
+
+	/*! All connections, for token lookup and cleanup */
+	TAILQ_HEAD(m_conns, mrail_conn) conns;
+
+	/*! Completions found outside of get_event */
+	TAILQ_HEAD(m_ready, mrail_evt) ready;
+
+	TAILQ_HEAD(m_idle_evts, mrail_evt) idle_evts;
+
+	mrail_frag_t *frags;
+	TAILQ_HEAD(m_idle_frags, mrail_frag) idle_frags;
+} mrail_ep_t;
+
+static int mrail_destroy_endpoint(cci_endpoint_t * endpoint);
+
+/******* helpers *******/
+
+static int mrail_is_frag(mrail_ep_t * mep, const void *ctx)
+{
+	return (uintptr_t) ctx >= (uintptr_t) mep->frags &&
+		(uintptr_t) ctx < (uintptr_t) (mep->frags + MRAIL_FRAGS);
+}
+
+static cci__conn_t *mrail_rail_conn(cci_connection_t * rc)
+{
+	return container_of(rc, cci__conn_t, connection);
+}
+
+static int mrail_same_transport(cci__ep_t * rail, const char *uri)
+{
+	const char *transport = rail->dev->device.transport;
+	size_t len = strlen(transport);
+
+	return !strncmp(uri, transport, len) && uri[len] == ':';
+}
+
+static uint64_t mrail_token(mrail_conn_t * mconn)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((uint64_t) getpid() << 40) ^
+		((uint64_t) tv.tv_sec << 20) ^ (uint64_t) tv.tv_usec ^
+		((uint64_t) (uintptr_t) mconn << 8);
+}
+
+/* Return a rail event to its transport */
+static void mrail_put_rail_evt(cci__evt_t * revt)
+{
+	revt->ep->plugin->return_event(&revt->event);
+}
+
+static void mrail_disconnect_rail(cci_connection_t * rc)
+{
+	if (rc)
+		mrail_rail_conn(rc)->plugin->disconnect(rc);
+}
+
+/* Free the connection if nobody needs it anymore. Hold ep->lock. */
+static void mrail_conn_put(mrail_ep_t * mep, mrail_conn_t * mconn)
+{
+	int i;
+
+	if (mconn->state != MRAIL_CONN_CLOSED || mconn->inflight)
+		return;
+
+	TAILQ_REMOVE(&mep->conns, mconn, entry);
+	for (i = 0; i < MRAIL_MAX_RAILS; i++)
+		free(mconn->uris[i]);
+	free(mconn);
+}
+
+static mrail_conn_t *mrail_conn_alloc(cci__ep_t * ep,
+				      cci_conn_attribute_t attribute,
+				      const void *context)
+{
+	mrail_conn_t *mconn = calloc(1, sizeof(*mconn));
+
+	if (!mconn)
+		return NULL;
+
+	mconn->conn.plugin = ep->plugin;
+	mconn->conn.connection.endpoint = &ep->endpoint;
+	mconn->conn.connection.attribute = attribute;
+	mconn->conn.connection.context = (void *)context;
+	mconn->conn.connection.max_send_size = ep->dev->device.max_send_size;
+	mconn->conn.priv = mconn;
+
+	return mconn;
+}
+
+/* Wrap a rail event for the application */
+static mrail_evt_t *mrail_wrap(cci__ep_t * ep, cci__evt_t * revt)
+{
+	mrail_ep_t *mep = ep->priv;
+	mrail_evt_t *w = NULL;
+
+	pthread_mutex_lock(&ep->lock);
+	w = TAILQ_FIRST(&mep->idle_evts);
+	if (w)
+		TAILQ_REMOVE(&mep->idle_evts, w, entry);
+	pthread_mutex_unlock(&ep->lock);
+
+	if (!w) {
+		w = calloc(1, sizeof(*w));
+		if (!w)
+			return NULL;
+	}
+
+	w->kind = MRAIL_EVT_WRAP;
+	w->rail_evt = revt;
+	w->mconn = NULL;
+	w->evt.event = revt->event;
+	w->evt.ep = ep;
+	w->evt.conn = NULL;
+
+	return w;
+}
+
+static void mrail_unwrap(cci__ep_t * ep, mrail_evt_t * w)
+{
+	mrail_ep_t *mep = ep->priv;
+
+	pthread_mutex_lock(&ep->lock);
+	TAILQ_INSERT_HEAD(&mep->idle_evts, w, entry);
+	pthread_mutex_unlock(&ep->lock);
+}
+
+static void mrail_op_free(mrail_op_t * op)
+{
+	free(op->msg);
+	free(op);
+}
+
+/******* device setup *******/
+
+static int mrail_init(cci_plugin_ctp_t * plugin,
+		      uint32_t abi_ver, uint32_t flags, uint32_t * caps)
+{
+	cci__dev_t *dev = NULL, *ndev = NULL;
+
+	(void) abi_ver;
+	(void) flags;
+	(void) caps;
+
+	/* called by cci_init() with globals->lock held, once the
+	 * transports have claimed their devices */
+	TAILQ_FOREACH_SAFE(dev, &globals->configfile_devs, entry, ndev) {
+		const char * const *arg;
+		struct cci_device *device = &dev->device;
+		mrail_dev_t *mdev = NULL;
+		char *info = NULL;
+		size_t len = 0;
+		int i;
+
+		if (strcmp("mrail", device->transport))
+			continue;
+
+		mdev = calloc(1, sizeof(*mdev));
+		if (!mdev)
+			return CCI_ENOMEM;
+		mdev->stripe_min = MRAIL_STRIPE_MIN;
+
+		for (arg = device->conf_argv; *arg != NULL; arg++) {
+			if (0 == strncmp("rail=", *arg, 5)) {
+				const char *name = *arg + 5;
+				cci__dev_t *rdev = NULL, *d = NULL;
+
+				if (mdev->nrails == MRAIL_MAX_RAILS) {
+					debug(CCI_DB_WARN, "%s: device [%s] has "
+					      "more than %d rails, ignoring %s",
+					      __func__, device->name,
+					      MRAIL_MAX_RAILS, name);
+					continue;
+				}
+				TAILQ_FOREACH(d, &globals->devs, entry) {
+					if (!strcmp(d->device.name, name) &&
+					    strcmp(d->device.transport, "mrail")) {
+						rdev = d;
+						break;
+					}
+				}
+				if (!rdev) {
+					debug(CCI_DB_WARN, "%s: device [%s] rail "
+					      "%s is not a ready device",
+					      __func__, device->name, name);
+					continue;
+				}
+				mdev->rails[mdev->nrails++] = rdev;
+				len += strlen(name) + 1;
+			} else if (0 == strncmp("stripe_min=", *arg, 11)) {
+				mdev->stripe_min = strtoull(*arg + 11, NULL, 0);
+			}
+		}
+
+		if (!mdev->nrails) {
+			/* left on configfile_devs, cci_init() drops it */
+			debug(CCI_DB_WARN, "%s: device [%s] has no rails",
+			      __func__, device->name);
+			free(mdev);
+			continue;
+		}
+
+		info = calloc(1, len + 1);
+		if (!info) {
+			free(mdev);
+			return CCI_ENOMEM;
+		}
+
+		device->up = 1;
+		device->max_send_size = (uint32_t) -1;
+		device->rate = 0;
+		for (i = 0; i < mdev->nrails; i++) {
+			cci__dev_t *rdev = mdev->rails[i];
+			struct cci_device *rd = &rdev->device;
+
+			if (i)
+				strcat(info, ",");
+			strcat(info, rd->name);
+
+			device->up &= rd->up;
+			if (rd->max_send_size < device->max_send_size)
+				device->max_send_size = rd->max_send_size;
+			device->rate += rd->rate;
+
+			/* the strictest requirement of any rail */
+			if (rdev->align.rma_write_local_addr > dev->align.rma_write_local_addr)
+				dev->align.rma_write_local_addr = rdev->align.rma_write_local_addr;
+			if (rdev->align.rma_write_remote_addr > dev->align.rma_write_remote_addr)
+				dev->align.rma_write_remote_addr = rdev->align.rma_write_remote_addr;
+			if (rdev->align.rma_write_length > dev->align.rma_write_length)
+				dev->align.rma_write_length = rdev->align.rma_write_length;
+			if (rdev->align.rma_read_local_addr > dev->align.rma_read_local_addr)
+				dev->align.rma_read_local_addr = rdev->align.rma_read_local_addr;
+			if (rdev->align.rma_read_remote_addr > dev->align.rma_read_remote_addr)
+				dev->align.rma_read_remote_addr = rdev->align.rma_read_remote_addr;
+			if (rdev->align.rma_read_length > dev->align.rma_read_length)
+				dev->align.rma_read_length = rdev->align.rma_read_length;
+		}
+		device->info = info;
+
+		dev->plugin = plugin;
+		if (dev->priority == -1)
+			dev->priority = plugin->base.priority;
+		dev->priv = mdev;
+
+		debug(CCI_DB_INFO, "%s: device [%s] bundles %s", __func__,
+		      device->name, info);
+
+		TAILQ_REMOVE(&globals->configfile_devs, dev, entry);
+		cci__add_dev(dev);
+	}
+
+	return CCI_SUCCESS;
+}
+
+static int mrail_finalize(cci_plugin_ctp_t * plugin)
+{
+	cci__dev_t *dev = NULL;
+
+	/* called by cci_finalize() with globals->lock held */
+	TAILQ_FOREACH(dev, &globals->devs, entry) {
+		if (dev->plugin == plugin) {
+			free(dev->priv);
+			dev->priv = NULL;
+		}
+	}
+
+	return CCI_SUCCESS;
+}
+
+static const char *mrail_strerror(cci_endpoint_t * endpoint,
+				  enum cci_status status)
+{
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	mrail_ep_t *mep = ep->priv;
+	cci__ep_t *rail = mep->rails[0];
+
+	return rail->plugin->strerror(&rail->endpoint, status);
+}
+
+/******* endpoints *******/
+
+/* Open a rail's endpoint like cci_create_endpoint() would, but keep it
+ * private: it is not on its device's list and only we poll it. */
+static int mrail_open_rail(cci__dev_t * dev, int flags, cci__ep_t ** railp)
+{
+	int ret;
+	cci__ep_t *ep = NULL;
+	cci_endpoint_t *endpoint = NULL;
+
+	ep = calloc(1, sizeof(*ep));
+	if (!ep)
+		return CCI_ENOMEM;
+
+	TAILQ_INIT(&ep->evts);
+	cci__evtq_init(&ep->evtq, !(flags & CCI_EP_FLAG_SINGLE_CONSUMER));
+	pthread_mutex_init(&ep->lock, NULL);
+	ep->dev = dev;
+	ep->endpoint.device = &dev->device;
+	ep->plugin = dev->plugin;
+	endpoint = &ep->endpoint;
+
+	ret = dev->plugin->create_endpoint(&dev->device, flags, &endpoint, NULL);
+	if (ret) {
+		pthread_mutex_destroy(&ep->lock);
+		cci__evtq_destroy(&ep->evtq);
+		free(ep);
+		return ret;
+	}
+
+	*railp = ep;
+	return CCI_SUCCESS;
+}
+
+static void mrail_close_rail(cci__ep_t * ep)
+{
+	ep->closing = 1;
+	ep->plugin->destroy_endpoint(&ep->endpoint);
+	pthread_mutex_destroy(&ep->lock);
+	cci__evtq_destroy(&ep->evtq);
+	free(ep);
+}
+
+static int mrail_create_endpoint(cci_device_t * device,
+				 int flags,
+				 cci_endpoint_t ** endpointp,
+				 cci_os_handle_t * fd)
+{
+	int ret = CCI_SUCCESS, i;
+	cci__dev_t *dev = container_of(device, cci__dev_t, device);
+	mrail_dev_t *mdev = dev->priv;
+	cci__ep_t *ep = container_of(*endpointp, cci__ep_t, endpoint);
+	mrail_ep_t *mep = NULL;
+	size_t len = strlen(MRAIL_URI_PREFIX) + 1;
+
+	if (fd) {
+		/* there is one OS handle per rail */
+		debug(CCI_DB_EP, "%s: multi-rail endpoints have no OS handle",
+		      __func__);
+		return CCI_ERR_NOT_IMPLEMENTED;
+	}
+
+	mep = calloc(1, sizeof(*mep));
+	if (!mep)
+		return CCI_ENOMEM;
+	ep->priv = mep;
+
+	TAILQ_INIT(&mep->conns);
+	TAILQ_INIT(&mep->ready);
+	TAILQ_INIT(&mep->idle_evts);
+	TAILQ_INIT(&mep->idle_frags);
+	mep->stripe_min = mdev->stripe_min;
+
+	mep->frags = calloc(MRAIL_FRAGS, sizeof(*mep->frags));
+	if (!mep->frags) {
+		ret = CCI_ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MRAIL_FRAGS; i++)
+		TAILQ_INSERT_TAIL(&mep->idle_frags, &mep->frags[i], entry);
+
+	for (i = 0; i < mdev->nrails; i++) {
+		ret = mrail_open_rail(mdev->rails[i],
+				      flags & ~CCI_EP_FLAG_HYBRID,
+				      &mep->rails[i]);
+		if (ret) {
+			debug(CCI_DB_EP, "%s: unable to open rail %s (%s)",
+			      __func__, mdev->rails[i]->device.name,
+			      cci_strerror(NULL, ret));
+			goto out;
+		}
+		mep->nrails++;
+		len += strlen(mep->rails[i]->uri) + 1;
+	}
+
+	ep->uri = calloc(1, len);
+	if (!ep->uri) {
+		ret = CCI_ENOMEM;
+		goto out;
+	}
+	strcpy(ep->uri, MRAIL_URI_PREFIX);
+	for (i = 0; i < mep->nrails; i++) {
+		if (i)
+			ep->uri[strlen(ep->uri)] = MRAIL_URI_SEP;
+		strcat(ep->uri, mep->rails[i]->uri);
+	}
+
+	/* the core reports these from the endpoint */
+	ep->rx_buf_cnt = mep->rails[0]->rx_buf_cnt;
+	ep->tx_buf_cnt = mep->rails[0]->tx_buf_cnt;
+	ep->buffer_len = mep->rails[0]->buffer_len;
+	ep->tx_timeout = mep->rails[0]->tx_timeout;
+	ep->keepalive_timeout = mep->rails[0]->keepalive_timeout;
+
+	debug(CCI_DB_EP, "%s: %s", __func__, ep->uri);
+
+	return CCI_SUCCESS;
+
+    out:
+	mrail_destroy_endpoint(&ep->endpoint);
+	return ret;
+}
+
+static int mrail_create_endpoint_at(cci_device_t * device,
+				    const char *service,
+				    int flags,
+				    cci_endpoint_t ** endpointp,
+				    cci_os_handle_t * fd)
+{
+	/* one service cannot name several rails */
+	debug(CCI_DB_EP, "%s: ignoring service %s", __func__, service);
+	return mrail_create_endpoint(device, flags, endpointp, fd);
+}
+
+static int mrail_destroy_endpoint(cci_endpoint_t * endpoint)
+{
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	mrail_ep_t *mep = ep->priv;
+	int i;
+
+	if (!mep)
+		return CCI_SUCCESS;
+
+	/* the rails clean up their own connections and events */
+	for (i = 0; i < mep->nrails; i++)
+		mrail_close_rail(mep->rails[i]);
+
+	while (!TAILQ_EMPTY(&mep->conns)) {
+		mrail_conn_t *mconn = TAILQ_FIRST(&mep->conns);
+
+		mconn->state = MRAIL_CONN_CLOSED;
+		mconn->inflight = 0;
+		mrail_conn_put(mep, mconn);
+	}
+	while (!TAILQ_EMPTY(&mep->ready)) {
+		mrail_evt_t *w = TAILQ_FIRST(&mep->ready);
+
+		TAILQ_REMOVE(&mep->ready, w, entry);
+		mrail_op_free(container_of(w, mrail_op_t, wevt));
+	}
+	while (!TAILQ_EMPTY(&mep->idle_evts)) {
+		mrail_evt_t *w = TAILQ_FIRST(&mep->idle_evts);
+
+		TAILQ_REMOVE(&mep->idle_evts, w, entry);
+		free(w);
+	}
+
+	free(mep->frags);
+	free(mep);
+	ep->priv = NULL;
+
+	free(ep->uri);
+	ep->uri = NULL;
+
+	return CCI_SUCCESS;
+}
+
+/******* connections *******/
+
+/* "mrail://uri0|uri1|..." into its rail URIs */
+static int mrail_parse_uri(const char *server_uri, char **uris, int *count)
+{
+	const char *p = server_uri + strlen(MRAIL_URI_PREFIX);
+	int n = 0;
+
+	if (strncmp(server_uri, MRAIL_URI_PREFIX, strlen(MRAIL_URI_PREFIX)))
+		return CCI_EINVAL;
+
+	while (*p && n < MRAIL_MAX_RAILS) {
+		const char *sep = strchr(p, MRAIL_URI_SEP);
+		size_t len = sep ? (size_t) (sep - p) : strlen(p);
+
+		uris[n] = calloc(1, len + 1);
+		if (!uris[n]) {
+			while (n--)
+				free(uris[n]);
+			return CCI_ENOMEM;
+		}
+		memcpy(uris[n], p, len);
+		n++;
+		p += len;
+		if (*p)
+			p++;
+	}
+
+	if (!n)
+		return CCI_EINVAL;
+
+	*count = n;
+	return CCI_SUCCESS;
+}
+
+static int mrail_connect(cci_endpoint_t * endpoint, const char *server_uri,
+			 const void *data_ptr, uint32_t data_len,
+			 cci_conn_attribute_t attribute,
+			 const void *context, int flags,
+			 const struct timeval *timeout)
+{
+	int ret = CCI_SUCCESS, i, n = 0;
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	mrail_ep_t *mep = ep->priv;
+	cci__ep_t *rail = mep->rails[0];
+	mrail_conn_t *mconn = NULL;
+	char *uris[MRAIL_MAX_RAILS] = { NULL };
+	char buf[CCI_CONN_REQ_LEN];
+	mrail_hdr_t *hdr = (mrail_hdr_t *) buf;
+
+	if (data_len + sizeof(*hdr) > CCI_CONN_REQ_LEN)
+		return CCI_EINVAL;
+
+	ret = mrail_parse_uri(server_uri, uris, &n);
+	if (ret)
+		return ret;
+
+	if (!mrail_same_transport(rail, uris[0])) {
+		debug(CCI_DB_CONN, "%s: %s cannot reach %s", __func__,
+		      rail->dev->device.transport, uris[0]);
+		ret = CCI_EINVAL;
+		goto out;
+	}
+
+	mconn = mrail_conn_alloc(ep, attribute, context);
+	if (!mconn) {
+		ret = CCI_ENOMEM;
+		goto out;
+	}
+	mconn->state = MRAIL_CONN_ACTIVE;
+	mconn->token = mrail_token(mconn);
+	mconn->nrails = n < mep->nrails ? n : mep->nrails;
+
+	/* keep the secondaries for when the primary is up */
+	for (i = 1; i < mconn->nrails; i++) {
+		if (mrail_same_transport(mep->rails[i], uris[i])) {
+			mconn->uris[i] = uris[i];
+			uris[i] = NULL;
+		}
+	}
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = MRAIL_MAGIC;
+	hdr->rail = 0;
+	hdr->primary = 1;
+	hdr->nrails = mconn->nrails;
+	hdr->token = mconn->token;
+	if (data_len)
+		memcpy(hdr + 1, data_ptr, data_len);
+
+	pthread_mutex_lock(&ep->lock);
+	TAILQ_INSERT_TAIL(&mep->conns, mconn, entry);
+	mconn->inflight = 1;
+	pthread_mutex_unlock(&ep->lock);
+
+	ret = rail->plugin->connect(&rail->endpoint, uris[0], buf,
+				    sizeof(*hdr) + data_len, attribute, mconn,
+				    flags, timeout);
+	if (ret) {
+		pthread_mutex_lock(&ep->lock);
+		mconn->state = MRAIL_CONN_CLOSED;
+		mconn->inflight = 0;
+		mrail_conn_put(mep, mconn);
+		pthread_mutex_unlock(&ep->lock);
+	}
+
+    out:
+	for (i = 0; i < n; i++)
+		free(uris[i]);
+	return ret;
+}
+
+/* The primary is up, bring up the other rails */
+static void mrail_connect_secondaries(cci__ep_t * ep, mrail_conn_t * mconn)
+{
+	mrail_ep_t *mep = ep->priv;
+	int i;
+
+	for (i = 1; i < mconn->nrails; i++) {
+		cci__ep_t *rail = mep->rails[i];
+		mrail_hdr_t hdr;
+		char *uri = NULL;
+		int ret;
+
+		pthread_mutex_lock(&ep->lock);
+		uri = mconn->uris[i];
+		mconn->uris[i] = NULL;
+		if (uri)
+			mconn->inflight++;
+		pthread_mutex_unlock(&ep->lock);
+
+		if (!uri)
+			continue;
+
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic = MRAIL_MAGIC;
+		hdr.rail = i;
+		hdr.primary = 0;
+		hdr.nrails = mconn->nrails;
+		hdr.token = mconn->token;
+
+		ret = rail->plugin->connect(&rail->endpoint, uri, &hdr,
+					    sizeof(hdr),
+					    mconn->conn.connection.attribute,
+					    mconn, 0, NULL);
+		free(uri);
+		if (ret) {
+			debug(CCI_DB_CONN, "%s: rail %d connect failed (%s)",
+			      __func__, i, cci_strerror(&rail->endpoint, ret));
+			pthread_mutex_lock(&ep->lock);
+			mconn->inflight--;
+			mrail_conn_put(mep, mconn);
+			pthread_mutex_unlock(&ep->lock);
+		}
+	}
+}
+
+static int mrail_accept(cci_event_t * event, const void *context)
+{
+	int ret;
+	mrail_evt_t *w = container_of(event, mrail_evt_t, evt.event);
+	cci__ep_t *ep = w->evt.ep;
+	mrail_conn_t *mconn = w->mconn;
+	cci__evt_t *revt = w->rail_evt;
+
+	if (w->kind != MRAIL_EVT_WRAP || !mconn)
+		return CCI_EINVAL;
+
+	pthread_mutex_lock(&ep->lock);
+	if (mconn->state != MRAIL_CONN_PASSIVE) {
+		pthread_mutex_unlock(&ep->lock);
+		return CCI_EINVAL;
+	}
+	mconn->state = MRAIL_CONN_ACCEPTING;
+	mconn->conn.connection.context = (void *)context;
+	mconn->inflight++;
+	pthread_mutex_unlock(&ep->lock);
+
+	ret = revt->ep->plugin->accept(&revt->event, mconn);
+	if (ret) {
+		pthread_mutex_lock(&ep->lock);
+		mconn->state = MRAIL_CONN_PASSIVE;
+		mconn->inflight--;
+		pthread_mutex_unlock(&ep->lock);
+	}
+
+	return ret;
+}
+
+static int mrail_reject(cci_event_t * event)
+{
+	int ret;
+	mrail_evt_t *w = container_of(event, mrail_evt_t, evt.event);
+	cci__ep_t *ep = w->evt.ep;
+	mrail_conn_t *mconn = w->mconn;
+	cci__evt_t *revt = w->rail_evt;
+
+	if (w->kind != MRAIL_EVT_WRAP || !mconn)
+		return CCI_EINVAL;
+
+	pthread_mutex_lock(&ep->lock);
+	if (mconn->state != MRAIL_CONN_PASSIVE) {
+		pthread_mutex_unlock(&ep->lock);
+		return CCI_EINVAL;
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	ret = revt->ep->plugin->reject(&revt->event);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&ep->lock);
+	mconn->state = MRAIL_CONN_CLOSED;
+	mrail_conn_put(ep->priv, mconn);
+	pthread_mutex_unlock(&ep->lock);
+	w->mconn = NULL;
+
+	return CCI_SUCCESS;
+}
+
+static int mrail_disconnect(cci_connection_t * connection)
+{
+	cci__conn_t *conn = container_of(connection, cci__conn_t, connection);
+	mrail_conn_t *mconn = conn->priv;
+	cci__ep_t *ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	cci_connection_t *rails[MRAIL_MAX_RAILS];
+	int i;
+
+	pthread_mutex_lock(&ep->lock);
+	if (mconn->state == MRAIL_CONN_CLOSED) {
+		pthread_mutex_unlock(&ep->lock);
+		return CCI_EINVAL;
+	}
+	mconn->state = MRAIL_CONN_CLOSED;
+	memcpy(rails, mconn->rails, sizeof(rails));
+	memset(mconn->rails, 0, sizeof(mconn->rails));
+	mrail_conn_put(ep->priv, mconn);
+	pthread_mutex_unlock(&ep->lock);
+
+	for (i = 0; i < MRAIL_MAX_RAILS; i++)
+		mrail_disconnect_rail(rails[i]);
+
+	return CCI_SUCCESS;
+}
+
+/******* options *******/
+
+static int mrail_set_opt(cci_opt_handle_t * handle,
+			 cci_opt_name_t name, const void *val)
+{
+	int ret = CCI_SUCCESS, rc, i;
+
+	switch (name) {
+	case CCI_OPT_ENDPT_SEND_TIMEOUT:
+	case CCI_OPT_ENDPT_RECV_BUF_COUNT:
+	case CCI_OPT_ENDPT_SEND_BUF_COUNT:
+	case CCI_OPT_ENDPT_KEEPALIVE_TIMEOUT:
+	{
+		cci__ep_t *ep = container_of(handle, cci__ep_t, endpoint);
+		mrail_ep_t *mep = ep->priv;
+
+		for (i = 0; i < mep->nrails; i++) {
+			cci__ep_t *rail = mep->rails[i];
+
+			rc = rail->plugin->set_opt(&rail->endpoint, name, val);
+			if (rc && !ret)
+				ret = rc;
+		}
+		ep->rx_buf_cnt = mep->rails[0]->rx_buf_cnt;
+		ep->tx_buf_cnt = mep->rails[0]->tx_buf_cnt;
+		ep->tx_timeout = mep->rails[0]->tx_timeout;
+		ep->keepalive_timeout = mep->rails[0]->keepalive_timeout;
+		break;
+	}
+	case CCI_OPT_CONN_SEND_TIMEOUT:
+	case CCI_OPT_CONN_KEEPALIVE_TIMEOUT:
+	{
+		cci__conn_t *conn = container_of(handle, cci__conn_t, connection);
+		mrail_conn_t *mconn = conn->priv;
+
+		for (i = 0; i < mconn->nrails; i++) {
+			cci_connection_t *rc_conn = mconn->rails[i];
+
+			if (!rc_conn)
+				continue;
+			rc = mrail_rail_conn(rc_conn)->plugin->set_opt(rc_conn,
+								       name, val);
+			if (rc && !ret)
+				ret = rc;
+		}
+		if (!ret && name == CCI_OPT_CONN_SEND_TIMEOUT)
+			conn->tx_timeout = *((uint32_t *) val);
+		else if (!ret)
+			conn->keepalive_timeout = *((uint32_t *) val);
+		break;
+	}
+	default:
+		debug(CCI_DB_INFO, "%s: unknown option %u", __func__, name);
+		ret = CCI_EINVAL;
+	}
+
+	return ret;
+}
+
+static void mrail_stats_add(cci_stats_t * sum, const cci_stats_t * s)
+{
+	sum->msgs_sent += s->msgs_sent;
+	sum->bytes_sent += s->bytes_sent;
+	sum->msgs_recv += s->msgs_recv;
+	sum->bytes_recv += s->bytes_recv;
+	sum->resends += s->resends;
+	sum->rnr += s->rnr;
+	sum->no_bufs += s->no_bufs;
+	sum->partial_sends += s->partial_sends;
+	sum->ring_full += s->ring_full;
+	sum->queued += s->queued;
+	sum->pending += s->pending;
+}
+
+static int mrail_get_opt(cci_opt_handle_t * handle,
+			 cci_opt_name_t name, void *val)
+{
+	int ret = CCI_SUCCESS, i;
+
+	switch (name) {
+	case CCI_OPT_ENDPT_STATS:
+	{
+		cci__ep_t *ep = container_of(handle, cci__ep_t, endpoint);
+		mrail_ep_t *mep = ep->priv;
+		cci_stats_t *stats = val;
+
+		for (i = 0; i < mep->nrails; i++) {
+			cci_stats_t s;
+
+			memset(&s, 0, sizeof(s));
+			s.version = stats->version;
+			if (!cci_get_opt(&mep->rails[i]->endpoint, name, &s))
+				mrail_stats_add(stats, &s);
+		}
+		break;
+	}
+	case CCI_OPT_CONN_STATS:
+	{
+		cci__conn_t *conn = container_of(handle, cci__conn_t, connection);
+		mrail_conn_t *mconn = conn->priv;
+		cci_stats_t *stats = val;
+
+		for (i = 0; i < mconn->nrails; i++) {
+			cci_stats_t s;
+
+			if (!mconn->rails[i])
+				continue;
+			memset(&s, 0, sizeof(s));
+			s.version = stats->version;
+			if (cci_get_opt(mconn->rails[i], name, &s))
+				continue;
+			mrail_stats_add(stats, &s);
+			if (i == 0) {
+				/* sequence state only makes sense per rail */
+				stats->seq = s.seq;
+				stats->acked = s.acked;
+				stats->cwnd = s.cwnd;
+				if (stats->version >= 2)
+					stats->rtt = s.rtt;
+			}
+		}
+		break;
+	}
+	case CCI_OPT_CONN_KEEPALIVE_TIMEOUT:
+	{
+		cci__conn_t *conn = container_of(handle, cci__conn_t, connection);
+		mrail_conn_t *mconn = conn->priv;
+
+		if (!mconn->rails[0])
+			return CCI_ERR_DISCONNECTED;
+		ret = mrail_rail_conn(mconn->rails[0])->plugin->get_opt(mconn->rails[0],
+									name, val);
+		break;
+	}
+	default:
+		debug(CCI_DB_INFO, "%s: unknown option %u", __func__, name);
+		ret = CCI_EINVAL;
+	}
+
+	return ret;
+}
+
+static int mrail_arm_os_handle(cci_endpoint_t * endpoint, int flags)
+{
+	(void) endpoint;
+	(void) flags;
+
+	return CCI_ERR_NOT_IMPLEMENTED;
+}
+
+/* The rails share our pollset member. Any of them without pollset
+ * support fails the arm, which makes cci_pollset_add() reject us. */
+static int mrail_pollset_arm(cci_endpoint_t * endpoint)
+{
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	mrail_ep_t *mep = ep->priv;
+	int i, ret = CCI_SUCCESS, pending = !TAILQ_EMPTY(&mep->ready);
+
+	for (i = 0; i < mep->nrails; i++) {
+		cci__ep_t *rail = mep->rails[i];
+		int rc = CCI_ERR_NOT_IMPLEMENTED;
+
+		rail->poll = ep->poll;
+		if (rail->plugin->pollset_arm)
+			rc = rail->plugin->pollset_arm(&rail->endpoint);
+		if (rc && !ret)
+			ret = rc;
+		if (!cci__evtq_empty(&rail->evtq))
+			pending = 1;
+	}
+
+	if (ep->poll && pending)
+		cci__pollset_wake(ep->poll);
+
+	return ret;
+}
+
+/******* events *******/
+
+static mrail_evt_t *mrail_op_done(cci__ep_t * ep, mrail_op_t * op,
+				  int msg_done);
+
+/* An internal send or RMA chunk completed */
+static mrail_evt_t *mrail_frag_done(cci__ep_t * ep, mrail_frag_t * frag,
+				    int status)
+{
+	mrail_ep_t *mep = ep->priv;
+	mrail_op_t *op = frag->op;
+	int done = 0, msg_done = (frag == op->msg_frag);
+
+	pthread_mutex_lock(&ep->lock);
+	if (status != CCI_SUCCESS && op->status == CCI_SUCCESS)
+		op->status = status;
+	if (msg_done) {
+		done = 1;
+	} else {
+		TAILQ_INSERT_HEAD(&mep->idle_frags, frag, entry);
+		done = (--op->pending == 0);
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	return done ? mrail_op_done(ep, op, msg_done) : NULL;
+}
+
+/* All chunks are done. Send the completion message, if any, else
+ * complete the RMA for the application. */
+static mrail_evt_t *mrail_op_done(cci__ep_t * ep, mrail_op_t * op,
+				  int msg_done)
+{
+	mrail_ep_t *mep = ep->priv;
+	mrail_conn_t *mconn = op->mconn;
+
+	if (op->msg_frag && !msg_done && op->status == CCI_SUCCESS) {
+		cci_connection_t *rc = mconn->rails[0];
+		int ret = CCI_ERR_DISCONNECTED;
+
+		/* the data is in place, the message may go */
+		if (rc)
+			ret = mrail_rail_conn(rc)->plugin->send(rc, op->msg,
+								op->msg_len,
+								op->msg_frag, 0);
+		if (ret == CCI_SUCCESS)
+			return NULL;
+		op->status = ret;
+	}
+
+	pthread_mutex_lock(&ep->lock);
+	if (op->msg_frag) {
+		TAILQ_INSERT_HEAD(&mep->idle_frags, op->msg_frag, entry);
+		op->msg_frag = NULL;
+	}
+	mconn->inflight--;
+	mrail_conn_put(mep, mconn);
+	pthread_mutex_unlock(&ep->lock);
+	op->mconn = NULL;
+
+	if (op->flags & CCI_FLAG_SILENT) {
+		mrail_op_free(op);
+		return NULL;
+	}
+
+	op->wevt.evt.event.send.status = op->status;
+	return &op->wevt;
+}
+
+static mrail_evt_t *mrail_handle_connect(cci__ep_t * ep, int rail,
+					 cci__evt_t * revt)
+{
+	mrail_ep_t *mep = ep->priv;
+	mrail_conn_t *mconn = revt->event.connect.context;
+	cci_connection_t *rc = revt->event.connect.connection;
+	int status = revt->event.connect.status;
+	mrail_evt_t *w = NULL;
+
+	if (rail != 0) {
+		cci_connection_t *stale = NULL;
+
+		pthread_mutex_lock(&ep->lock);
+		mconn->inflight--;
+		if (status == CCI_SUCCESS) {
+			if (mconn->state == MRAIL_CONN_READY)
+				mconn->rails[rail] = rc;
+			else
+				stale = rc;
+		}
+		mrail_conn_put(mep, mconn);
+		pthread_mutex_unlock(&ep->lock);
+
+		debug(CCI_DB_CONN, "%s: rail %d %s", __func__, rail,
+		      cci_strerror(&ep->endpoint, status));
+
+		mrail_disconnect_rail(stale);
+		mrail_put_rail_evt(revt);
+		return NULL;
+	}
+
+	w = mrail_wrap(ep, revt);
+	if (!w) {
+		/* we cannot tell the application, give up on it */
+		mrail_disconnect_rail(status == CCI_SUCCESS ? rc : NULL);
+		status = CCI_ENOMEM;
+	}
+
+	pthread_mutex_lock(&ep->lock);
+	mconn->inflight--;
+	if (status == CCI_SUCCESS) {
+		mconn->rails[0] = rc;
+		mconn->conn.connection.max_send_size = rc->max_send_size;
+		mconn->state = MRAIL_CONN_READY;
+	} else {
+		mconn->state = MRAIL_CONN_CLOSED;
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	if (w) {
+		w->evt.event.connect.context = mconn->conn.connection.context;
+		if (status == CCI_SUCCESS) {
+			w->evt.event.connect.connection = &mconn->conn.connection;
+			w->evt.conn = &mconn->conn;
+		} else {
+			w->evt.event.connect.connection = NULL;
+		}
+	}
+
+	if (status == CCI_SUCCESS) {
+		mrail_connect_secondaries(ep, mconn);
+	} else {
+		pthread_mutex_lock(&ep->lock);
+		mrail_conn_put(mep, mconn);
+		pthread_mutex_unlock(&ep->lock);
+	}
+
+	if (!w)
+		mrail_put_rail_evt(revt);
+	return w;
+}
+
+static mrail_evt_t *mrail_handle_request(cci__ep_t * ep, int rail,
+					 cci__evt_t * revt)
+{
+	mrail_ep_t *mep = ep->priv;
+	const mrail_hdr_t *hdr = revt->event.request.data_ptr;
+	mrail_conn_t *mconn = NULL;
+	mrail_evt_t *w = NULL;
+	int ret;
+
+	if (revt->event.request.data_len < sizeof(*hdr) ||
+	    hdr->magic != MRAIL_MAGIC || hdr->rail != rail) {
+		debug(CCI_DB_CONN, "%s: rail %d, not a multi-rail peer",
+		      __func__, rail);
+		goto reject;
+	}
+
+	if (!hdr->primary) {
+		/* the client only connects these once we accepted */
+		pthread_mutex_lock(&ep->lock);
+		TAILQ_FOREACH(mconn, &mep->conns, entry) {
+			if (mconn->token == hdr->token &&
+			    (mconn->state == MRAIL_CONN_ACCEPTING ||
+			     mconn->state == MRAIL_CONN_READY) &&
+			    rail < mconn->nrails && !mconn->rails[rail])
+				break;
+		}
+		if (mconn)
+			mconn->inflight++;
+		pthread_mutex_unlock(&ep->lock);
+
+		if (!mconn)
+			goto reject;
+
+		ret = revt->ep->plugin->accept(&revt->event, mconn);
+		if (ret) {
+			pthread_mutex_lock(&ep->lock);
+			mconn->inflight--;
+			mrail_conn_put(mep, mconn);
+			pthread_mutex_unlock(&ep->lock);
+		}
+		mrail_put_rail_evt(revt);
+		return NULL;
+	}
+
+	mconn = mrail_conn_alloc(ep, revt->event.request.attribute, NULL);
+	if (!mconn)
+		goto reject;
+	w = mrail_wrap(ep, revt);
+	if (!w) {
+		free(mconn);
+		goto reject;
+	}
+
+	mconn->state = MRAIL_CONN_PASSIVE;
+	mconn->token = hdr->token;
+	mconn->nrails = hdr->nrails < mep->nrails ? hdr->nrails : mep->nrails;
+
+	pthread_mutex_lock(&ep->lock);
+	TAILQ_INSERT_TAIL(&mep->conns, mconn, entry);
+	pthread_mutex_unlock(&ep->lock);
+
+	w->mconn = mconn;
+	w->evt.event.request.data_ptr = hdr + 1;
+	w->evt.event.request.data_len -= sizeof(*hdr);
+
+	return w;
+
+    reject:
+	revt->ep->plugin->reject(&revt->event);
+	mrail_put_rail_evt(revt);
+	return NULL;
+}
+
+static mrail_evt_t *mrail_handle_accept(cci__ep_t * ep, int rail,
+					cci__evt_t * revt)
+{
+	mrail_ep_t *mep = ep->priv;
+	mrail_conn_t *mconn = revt->event.accept.context;
+	cci_connection_t *rc = revt->event.accept.connection;
+	cci_connection_t *stale[MRAIL_MAX_RAILS] = { NULL };
+	int status = revt->event.accept.status;
+	mrail_evt_t *w = NULL;
+	int i;
+
+	if (rail != 0) {
+		pthread_mutex_lock(&ep->lock);
+		mconn->inflight--;
+		if (status == CCI_SUCCESS) {
+			if (mconn->state == MRAIL_CONN_ACCEPTING ||
+			    mconn->state == MRAIL_CONN_READY)
+				mconn->rails[rail] = rc;
+			else
+				stale[0] = rc;
+		}
+		mrail_conn_put(mep, mconn);
+		pthread_mutex_unlock(&ep->lock);
+
+		mrail_disconnect_rail(stale[0]);
+		mrail_put_rail_evt(revt);
+		return NULL;
+	}
+
+	w = mrail_wrap(ep, revt);
+	if (!w) {
+		stale[0] = status == CCI_SUCCESS ? rc : NULL;
+		status = CCI_ENOMEM;
+	}
+
+	pthread_mutex_lock(&ep->lock);
+	mconn->inflight--;
+	if (status == CCI_SUCCESS) {
+		mconn->rails[0] = rc;
+		mconn->conn.connection.max_send_size = rc->max_send_size;
+		mconn->state = MRAIL_CONN_READY;
+	} else {
+		/* drop any secondary that beat us here */
+		for (i = 1; i < MRAIL_MAX_RAILS; i++) {
+			stale[i] = mconn->rails[i];
+			mconn->rails[i] = NULL;
+		}
+		mconn->state = MRAIL_CONN_CLOSED;
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	if (w) {
+		w->evt.event.accept.context = mconn->conn.connection.context;
+		if (status == CCI_SUCCESS) {
+			w->evt.event.accept.connection = &mconn->conn.connection;
+			w->evt.conn = &mconn->conn;
+		} else {
+			w->evt.event.accept.connection = NULL;
+		}
+	}
+
+	if (status != CCI_SUCCESS) {
+		pthread_mutex_lock(&ep->lock);
+		mrail_conn_put(mep, mconn);
+		pthread_mutex_unlock(&ep->lock);
+		for (i = 0; i < MRAIL_MAX_RAILS; i++)
+			mrail_disconnect_rail(stale[i]);
+	}
+
+	if (!w)
+		mrail_put_rail_evt(revt);
+	return w;
+}
+
+/* Turn a rail event into one for the application, or consume it */
+static mrail_evt_t *mrail_handle_event(cci__ep_t * ep, int rail,
+				       cci__evt_t * revt)
+{
+	mrail_ep_t *mep = ep->priv;
+	mrail_conn_t *mconn = NULL;
+	mrail_evt_t *w = NULL;
+
+	switch (revt->event.type) {
+	case CCI_EVENT_SEND:
+		if (mrail_is_frag(mep, revt->event.send.context)) {
+			mrail_frag_t *frag = revt->event.send.context;
+			int status = revt->event.send.status;
+
+			mrail_put_rail_evt(revt);
+			return mrail_frag_done(ep, frag, status);
+		}
+		mconn = revt->event.send.connection->context;
+		w = mrail_wrap(ep, revt);
+		if (w)
+			w->evt.event.send.connection = &mconn->conn.connection;
+		break;
+	case CCI_EVENT_RECV:
+		mconn = revt->event.recv.connection->context;
+		w = mrail_wrap(ep, revt);
+		if (w)
+			w->evt.event.recv.connection = &mconn->conn.connection;
+		break;
+	case CCI_EVENT_CONNECT:
+		return mrail_handle_connect(ep, rail, revt);
+	case CCI_EVENT_CONNECT_REQUEST:
+		return mrail_handle_request(ep, rail, revt);
+	case CCI_EVENT_ACCEPT:
+		return mrail_handle_accept(ep, rail, revt);
+	case CCI_EVENT_KEEPALIVE_TIMEDOUT:
+		mconn = revt->event.keepalive.connection->context;
+		w = mrail_wrap(ep, revt);
+		if (w)
+			w->evt.event.keepalive.connection = &mconn->conn.connection;
+		break;
+	case CCI_EVENT_ENDPOINT_DEVICE_FAILED:
+		w = mrail_wrap(ep, revt);
+		if (w)
+			w->evt.event.dev_failed.endpoint = &ep->endpoint;
+		break;
+	default:
+		w = mrail_wrap(ep, revt);
+		break;
+	}
+
+	if (!w) {
+		debug(CCI_DB_WARN, "%s: dropping %s event on rail %d, no memory",
+		      __func__, cci_event_type_str(revt->event.type), rail);
+		mrail_put_rail_evt(revt);
+		return NULL;
+	}
+
+	if (mconn)
+		w->evt.conn = &mconn->conn;
+	return w;
+}
+
+static int mrail_get_event(cci_endpoint_t * endpoint,
+			   cci_event_t ** const event)
+{
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	mrail_ep_t *mep = ep->priv;
+	mrail_evt_t *w = NULL;
+	int ret = CCI_EAGAIN, idle = 0;
+
+	if (!TAILQ_EMPTY(&mep->ready)) {
+		pthread_mutex_lock(&ep->lock);
+		w = TAILQ_FIRST(&mep->ready);
+		if (w)
+			TAILQ_REMOVE(&mep->ready, w, entry);
+		pthread_mutex_unlock(&ep->lock);
+		if (w) {
+			*event = &w->evt.event;
+			return CCI_SUCCESS;
+		}
+	}
+
+	/* poll the rails in turn until all of them are idle */
+	while (idle < mep->nrails) {
+		int i = mep->turn++ % mep->nrails;
+		cci__ep_t *rail = mep->rails[i];
+		cci_event_t *e = NULL;
+		int rc;
+
+		rc = rail->plugin->get_event(&rail->endpoint, &e);
+		if (rc != CCI_SUCCESS) {
+			/* ENOBUFS matters more than EAGAIN */
+			if (rc != CCI_EAGAIN)
+				ret = rc;
+			idle++;
+			continue;
+		}
+		idle = 0;
+
+		w = mrail_handle_event(ep, i, container_of(e, cci__evt_t, event));
+		if (w) {
+			*event = &w->evt.event;
+			return CCI_SUCCESS;
+		}
+	}
+
+	return ret;
+}
+
+static int mrail_return_event(cci_event_t * event)
+{
+	int ret;
+	mrail_evt_t *w = container_of(event, mrail_evt_t, evt.event);
+	cci__ep_t *ep = w->evt.ep;
+	cci__evt_t *revt = w->rail_evt;
+
+	if (w->kind == MRAIL_EVT_OP) {
+		mrail_op_free(container_of(w, mrail_op_t, wevt));
+		return CCI_SUCCESS;
+	}
+
+	ret = revt->ep->plugin->return_event(&revt->event);
+	mrail_unwrap(ep, w);
+
+	return ret;
+}
+
+/******* messages *******/
+
+/* RO keeps to the primary, the others take turns among the rails that
+ * can carry the message */
+static cci_connection_t *mrail_pick(mrail_conn_t * mconn, uint32_t len)
+{
+	cci_connection_t *rc = mconn->rails[0];
+	int i;
+
+	if (mconn->conn.connection.attribute == CCI_CONN_ATTR_RO ||
+	    mconn->nrails < 2)
+		return rc;
+
+	for (i = 0; i < mconn->nrails; i++) {
+		cci_connection_t *c = mconn->rails[mconn->next++ % mconn->nrails];
+
+		if (c && len <= c->max_send_size)
+			return c;
+	}
+	return rc;
+}
+
+static int mrail_send(cci_connection_t * connection,
+		      const void *msg_ptr, uint32_t msg_len,
+		      const void *context, int flags)
+{
+	cci__conn_t *conn = container_of(connection, cci__conn_t, connection);
+	cci_connection_t *rc = mrail_pick(conn->priv, msg_len);
+
+	if (!rc)
+		return CCI_ERR_DISCONNECTED;
+
+	return mrail_rail_conn(rc)->plugin->send(rc, msg_ptr, msg_len,
+						 context, flags);
+}
+
+static int mrail_sendv(cci_connection_t * connection,
+		       const struct iovec *data, uint32_t iovcnt,
+		       const void *context, int flags)
+{
+	cci__conn_t *conn = container_of(connection, cci__conn_t, connection);
+	cci_connection_t *rc = NULL;
+	uint32_t i, len = 0;
+
+	for (i = 0; i < iovcnt; i++)
+		len += data[i].iov_len;
+
+	rc = mrail_pick(conn->priv, len);
+	if (!rc)
+		return CCI_ERR_DISCONNECTED;
+
+	return mrail_rail_conn(rc)->plugin->sendv(rc, data, iovcnt,
+						  context, flags);
+}
+
+/******* RMA *******/
+
+static int mrail_rma_deregister(cci_endpoint_t * endpoint,
+				cci_rma_handle_t * rma_handle)
+{
+	int ret = CCI_SUCCESS, rc, i;
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	mrail_ep_t *mep = ep->priv;
+	mrail_rma_t *h = container_of(rma_handle, mrail_rma_t, handle);
+
+	if (h->ep != ep)
+		return CCI_EINVAL;
+
+	for (i = 0; i < mep->nrails; i++) {
+		cci__ep_t *rail = mep->rails[i];
+
+		if (!h->rails[i])
+			continue;
+		rc = rail->plugin->rma_deregister(&rail->endpoint, h->rails[i]);
+		if (rc && !ret)
+			ret = rc;
+	}
+	free(h);
+
+	return ret;
+}
+
+static int mrail_rma_register(cci_endpoint_t * endpoint,
+			      void *start, uint64_t length,
+			      int flags, cci_rma_handle_t ** rma_handle)
+{
+	int ret = CCI_SUCCESS, i;
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	mrail_ep_t *mep = ep->priv;
+	mrail_rma_t *h = NULL;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return CCI_ENOMEM;
+	h->ep = ep;
+
+	for (i = 0; i < mep->nrails; i++) {
+		cci__ep_t *rail = mep->rails[i];
+		cci_rma_handle_t *rh = NULL;
+
+		ret = rail->plugin->rma_register(&rail->endpoint, start, length,
+						 flags, &h->rails[i]);
+		if (ret)
+			break;
+
+		rh = h->rails[i];
+		if (rh->stuff[1] || rh->stuff[2] || rh->stuff[3]) {
+			debug(CCI_DB_WARN, "%s: %s RMA handles do not fit "
+			      "in one word", __func__,
+			      rail->dev->device.transport);
+			ret = CCI_ERR_NOT_IMPLEMENTED;
+			break;
+		}
+		h->handle.stuff[i] = rh->stuff[0];
+	}
+
+	if (ret) {
+		mrail_rma_deregister(endpoint, &h->handle);
+		return ret;
+	}
+
+	*rma_handle = &h->handle;
+	return CCI_SUCCESS;
+}
+
+static int mrail_rma(cci_connection_t * connection,
+		     const void *msg_ptr, uint32_t msg_len,
+		     cci_rma_handle_t * local_handle, uint64_t local_offset,
+		     cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		     uint64_t data_len, const void *context, int flags)
+{
+	int ret = CCI_SUCCESS, i, k, n = 0, nfrags;
+	cci__conn_t *conn = container_of(connection, cci__conn_t, connection);
+	mrail_conn_t *mconn = conn->priv;
+	cci__ep_t *ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	mrail_ep_t *mep = ep->priv;
+	mrail_rma_t *lh = container_of(local_handle, mrail_rma_t, handle);
+	int rails[MRAIL_MAX_RAILS];
+	mrail_frag_t *frags[MRAIL_MAX_RAILS + 1];
+	mrail_op_t *op = NULL;
+	uint64_t chunk = data_len, off = 0;
+
+	if (lh->ep != ep)
+		return CCI_EINVAL;
+
+	if (!mconn->rails[0])
+		return CCI_ERR_DISCONNECTED;
+
+	if (flags & CCI_FLAG_BLOCKING) {
+		/* the primary alone, the rail is done with the handle
+		 * when it returns */
+		cci_connection_t *rc = mconn->rails[0];
+		struct cci_rma_handle remote;
+
+		memset(&remote, 0, sizeof(remote));
+		remote.stuff[0] = remote_handle->stuff[0];
+		return mrail_rail_conn(rc)->plugin->rma(rc, msg_ptr, msg_len,
+							lh->rails[0], local_offset,
+							&remote, remote_offset,
+							data_len, context, flags);
+	}
+
+	rails[n++] = 0;
+	if (data_len >= mep->stripe_min) {
+		for (i = 1; i < mconn->nrails; i++)
+			if (mconn->rails[i])
+				rails[n++] = i;
+	}
+	if (n > 1) {
+		chunk = (data_len + n - 1) / n;
+		chunk = (chunk + MRAIL_CHUNK_ALIGN - 1) &
+			~((uint64_t) MRAIL_CHUNK_ALIGN - 1);
+		n = (data_len + chunk - 1) / chunk;
+	}
+	nfrags = n + (msg_len ? 1 : 0);
+
+	op = calloc(1, sizeof(*op));
+	if (!op)
+		return CCI_ENOMEM;
+	if (msg_len) {
+		op->msg = malloc(msg_len);
+		if (!op->msg) {
+			free(op);
+			return CCI_ENOMEM;
+		}
+		memcpy(op->msg, msg_ptr, msg_len);
+		op->msg_len = msg_len;
+	}
+	op->mconn = mconn;
+	op->flags = flags;
+	op->wevt.kind = MRAIL_EVT_OP;
+	op->wevt.evt.ep = ep;
+	op->wevt.evt.conn = conn;
+	op->wevt.evt.event.send.type = CCI_EVENT_SEND;
+	op->wevt.evt.event.send.status = CCI_SUCCESS;
+	op->wevt.evt.event.send.connection = connection;
+	op->wevt.evt.event.send.context = (void *)context;
+
+	pthread_mutex_lock(&ep->lock);
+	for (k = 0; k < nfrags; k++) {
+		frags[k] = TAILQ_FIRST(&mep->idle_frags);
+		if (!frags[k])
+			break;
+		TAILQ_REMOVE(&mep->idle_frags, frags[k], entry);
+		frags[k]->op = op;
+	}
+	if (k < nfrags) {
+		while (k--)
+			TAILQ_INSERT_HEAD(&mep->idle_frags, frags[k], entry);
+		pthread_mutex_unlock(&ep->lock);
+		mrail_op_free(op);
+		return CCI_ENOBUFS;
+	}
+	op->pending = n;
+	if (msg_len)
+		op->msg_frag = frags[n];
+	mconn->inflight++;
+	pthread_mutex_unlock(&ep->lock);
+
+	for (k = 0; k < n; k++) {
+		cci_connection_t *rc = mconn->rails[rails[k]];
+		uint64_t len = data_len - off < chunk ? data_len - off : chunk;
+
+		i = rails[k];
+		memset(&frags[k]->remote, 0, sizeof(frags[k]->remote));
+		frags[k]->remote.stuff[0] = remote_handle->stuff[i];
+
+		ret = mrail_rail_conn(rc)->plugin->rma(rc, NULL, 0,
+						       lh->rails[i],
+						       local_offset + off,
+						       &frags[k]->remote,
+						       remote_offset + off,
+						       len, frags[k],
+						       flags & ~CCI_FLAG_SILENT);
+		if (ret)
+			break;
+		off += len;
+	}
+
+	if (k < n) {
+		mrail_evt_t *w = NULL;
+		int done;
+
+		debug(CCI_DB_MSG, "%s: rail %d refused chunk %d of %d (%s)",
+		      __func__, rails[k], k, n, cci_strerror(&ep->endpoint, ret));
+
+		pthread_mutex_lock(&ep->lock);
+		for (i = k; i < n; i++)
+			TAILQ_INSERT_HEAD(&mep->idle_frags, frags[i], entry);
+		if (k == 0) {
+			/* nothing went out, fail the call */
+			if (op->msg_frag)
+				TAILQ_INSERT_HEAD(&mep->idle_frags,
+						  op->msg_frag, entry);
+			mconn->inflight--;
+			pthread_mutex_unlock(&ep->lock);
+			mrail_op_free(op);
+			return ret;
+		}
+		op->status = ret;
+		op->pending -= n - k;
+		done = (op->pending == 0);
+		pthread_mutex_unlock(&ep->lock);
+
+		/* the chunks that did go out may all be done already */
+		if (done)
+			w = mrail_op_done(ep, op, 0);
+		if (w) {
+			pthread_mutex_lock(&ep->lock);
+			TAILQ_INSERT_TAIL(&mep->ready, w, entry);
+			pthread_mutex_unlock(&ep->lock);
+		}
+	}
+
+	return CCI_SUCCESS;
+}
+
+cci_plugin_ctp_t cci__mrail_plugin = {
+	{
+	/* Logistics */
+	CCI_ABI_VERSION,
+	CCI_CTP_API_VERSION,
+	"mrail",
+	CCI_MAJOR_VERSION, CCI_MINOR_VERSION, CCI_RELEASE_VERSION,
+	50,
+
+	/* Bootstrap function pointers, the core is never unloaded */
+	NULL,
+	NULL,
+	},
+
+	/* API function pointers */
+	mrail_init,
+	mrail_finalize,
+	mrail_strerror,
+	mrail_create_endpoint,
+	mrail_create_endpoint_at,
+	mrail_destroy_endpoint,
+	mrail_accept,
+	mrail_reject,
+	mrail_connect,
+	mrail_disconnect,
+	mrail_set_opt,
+	mrail_get_opt,
+	mrail_arm_os_handle,
+	mrail_get_event,
+	mrail_return_event,
+	mrail_send,
+	mrail_sendv,
+	mrail_rma_register,
+	mrail_rma_deregister,
+	mrail_rma,
+	NULL,			/* get_events, the API loops on get_event */
+	NULL,			/* return_events */
+	NULL,			/* send_batch, the API loops on send */
+	mrail_pollset_arm
+};
@@ -0,0 +1,565 @@
+/*
+ * Copyright © 2013 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Pollsets (cci_pollset_*).
+ *
+ * Each member endpoint gets a nonblocking wake pipe registered with the
+ * pollset's epoll fd. Before sleeping, the waiter arms every member;
+ * cci__queue_evt() then writes the pipe for the first event only, so a
+ * burst of completions costs one write() and one epoll wakeup.
+ *
+ * Only transports that deliver every event through cci__queue_evt()
+ * can be members, they provide the ctp pollset_arm() hook. Those whose
+ * data arrives without a local thread (sm) learn from it that the
+ * waiter is about to sleep. They may add their own fds with
+ * cci__pollset_watch(), which the pollset drains like the wake pipe.
+ * Companion (hybrid) and rail (mrail) endpoints share their owner's
+ * member through ep->poll.
+ *
+ * Removed members and watched fds are kept until the pollset is
+ * destroyed so that a racing producer or a wait already in epoll_wait()
+ * never touches freed memory.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "plugins/ctp/ctp.h"
+#include "cci-api.h"
+
+#define POLLSET_EVENTS	(64)
+
+typedef struct cci__pollsrc cci__pollsrc_t;
+typedef struct cci__pollmbr cci__pollmbr_t;
+
+struct cci__pollsrc {
+	/*! Member to report */
+	cci__pollmbr_t *m;
+
+	/*! Endpoint that called cci__pollset_watch(), NULL for the wake pipe */
+	cci__ep_t *ep;
+
+	/*! Readable when m has something to report */
+	int fd;
+
+	/*! Registered with epoll? */
+	int active;
+
+	TAILQ_ENTRY(cci__pollsrc) entry;
+};
+
+struct cci__pollmbr {
+	/*! What producers see through ep->poll */
+	cci__pollwake_t wake;
+
+	/*! Owning pollset */
+	cci_pollset_t *ps;
+
+	/*! Wake pipe, fd[1] is wake.fd */
+	int fd[2];
+
+	/*! Member endpoint, NULL once removed */
+	cci__ep_t *ep;
+
+	/*! Last wait that returned this member */
+	uint32_t gen;
+
+	/*! Fds to drain, the wake pipe first */
+	TAILQ_HEAD(s_srcs, cci__pollsrc) srcs;
+
+	TAILQ_ENTRY(cci__pollmbr) entry;
+};
+
+struct cci_pollset {
+	int epfd;
+
+	/*! Protects everything below */
+	pthread_mutex_t lock;
+
+	/*! Number of waits so far */
+	uint32_t gen;
+
+	TAILQ_HEAD(s_mbrs, cci__pollmbr) members;
+
+	/*! Removed members, reused by cci_pollset_add() */
+	struct s_mbrs idle;
+
+	/*! Watched fds of endpoints that left */
+	struct s_srcs dead;
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+
+static cci__pollmbr_t *pollset_member(cci__ep_t * ep)
+{
+	cci__pollwake_t *poll = ep->poll;
+
+	return poll ? container_of(poll, cci__pollmbr_t, wake) : NULL;
+}
+
+static int pollset_ctl_add(cci_pollset_t * ps, cci__pollsrc_t * src)
+{
+	int ret = 0;
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = src;
+
+	ret = epoll_ctl(ps->epfd, EPOLL_CTL_ADD, src->fd, &ev);
+	if (ret) {
+		ret = errno;
+		debug(CCI_DB_WARN, "%s: epoll_ctl(ADD %d) failed with %s",
+			__func__, src->fd, strerror(ret));
+		return ret;
+	}
+	src->active = 1;
+
+	return CCI_SUCCESS;
+}
+
+static int pollset_add_src(cci__pollmbr_t * m, cci__ep_t * ep, int fd)
+{
+	int ret = CCI_SUCCESS;
+	cci__pollsrc_t *src = NULL;
+
+	src = calloc(1, sizeof(*src));
+	if (!src)
+		return CCI_ENOMEM;
+	src->m = m;
+	src->ep = ep;
+	src->fd = fd;
+
+	ret = pollset_ctl_add(m->ps, src);
+	if (ret) {
+		free(src);
+		return ret;
+	}
+	TAILQ_INSERT_TAIL(&m->srcs, src, entry);
+
+	return CCI_SUCCESS;
+}
+
+/* Stop watching the fds that ep added. With ep == NULL, all of them. */
+static void pollset_forget(cci__pollmbr_t * m, cci__ep_t * ep)
+{
+	cci_pollset_t *ps = m->ps;
+	cci__pollsrc_t *src = TAILQ_FIRST(&m->srcs), *next = NULL;
+
+	for (; src; src = next) {
+		next = TAILQ_NEXT(src, entry);
+
+		if (!src->ep || (ep && src->ep != ep))
+			continue;
+
+		epoll_ctl(ps->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+		src->active = 0;
+		TAILQ_REMOVE(&m->srcs, src, entry);
+		TAILQ_INSERT_TAIL(&ps->dead, src, entry);
+	}
+}
+
+static void pollset_drain(int fd)
+{
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0) ;
+}
+
+/* Let the transports prepare for sleep, then report what is queued */
+static void pollset_arm(cci__pollmbr_t * m)
+{
+	cci__ep_t *ep = m->ep;
+
+	OPA_store_int(&m->wake.armed, 1);
+	OPA_read_write_barrier();
+
+	ep->plugin->pollset_arm(&ep->endpoint);
+	if (ep->sm_ep)
+		ep->sm_ep->plugin->pollset_arm(&ep->sm_ep->endpoint);
+
+	if (!cci__evtq_empty(&ep->evtq) ||
+	    (ep->sm_ep && !cci__evtq_empty(&ep->sm_ep->evtq)))
+		cci__pollset_wake(&m->wake);
+}
+
+/* Called with ps->lock held */
+static void pollset_leave(cci_pollset_t * ps, cci__pollmbr_t * m)
+{
+	cci__ep_t *ep = m->ep;
+	cci__pollsrc_t *pipe_src = TAILQ_FIRST(&m->srcs);
+
+	pollset_forget(m, NULL);
+	epoll_ctl(ps->epfd, EPOLL_CTL_DEL, pipe_src->fd, NULL);
+	pipe_src->active = 0;
+
+	/* arming with ep->poll NULL lets the transports drop their state,
+	   e.g. mrail's rails pointing at m */
+	ep->poll = NULL;
+	ep->plugin->pollset_arm(&ep->endpoint);
+	if (ep->sm_ep) {
+		ep->sm_ep->poll = NULL;
+		ep->sm_ep->plugin->pollset_arm(&ep->sm_ep->endpoint);
+	}
+
+	m->ep = NULL;
+	TAILQ_REMOVE(&ps->members, m, entry);
+	TAILQ_INSERT_TAIL(&ps->idle, m, entry);
+}
+
+static void pollset_free_member(cci__pollmbr_t * m)
+{
+	cci__pollsrc_t *src = NULL;
+
+	while ((src = TAILQ_FIRST(&m->srcs))) {
+		TAILQ_REMOVE(&m->srcs, src, entry);
+		free(src);
+	}
+	close(m->fd[0]);
+	close(m->fd[1]);
+	free(m);
+}
+
+static cci__pollmbr_t *pollset_new_member(cci_pollset_t * ps, int *ret)
+{
+	int i = 0;
+	cci__pollmbr_t *m = NULL;
+
+	m = calloc(1, sizeof(*m));
+	if (!m) {
+		*ret = CCI_ENOMEM;
+		return NULL;
+	}
+	m->ps = ps;
+	TAILQ_INIT(&m->srcs);
+
+	if (pipe(m->fd)) {
+		*ret = errno;
+		free(m);
+		return NULL;
+	}
+	for (i = 0; i < 2; i++) {
+		int flags = fcntl(m->fd[i], F_GETFL, 0);
+
+		if (flags == -1 ||
+		    fcntl(m->fd[i], F_SETFL, flags | O_NONBLOCK) == -1) {
+			*ret = errno;
+			goto out;
+		}
+	}
+	m->wake.fd = m->fd[1];
+
+	*ret = pollset_add_src(m, NULL, m->fd[0]);
+
+    out:
+	if (*ret) {
+		pollset_free_member(m);
+		m = NULL;
+	}
+	return m;
+}
+
+int cci_pollset_create(cci_pollset_t ** pollset)
+{
+	cci_pollset_t *ps = NULL;
+
+	if (!pollset)
+		return CCI_EINVAL;
+
+	ps = calloc(1, sizeof(*ps));
+	if (!ps)
+		return CCI_ENOMEM;
+
+	ps->epfd = epoll_create(POLLSET_EVENTS);
+	if (ps->epfd == -1) {
+		int ret = errno;
+
+		free(ps);
+		return ret;
+	}
+
+	pthread_mutex_init(&ps->lock, NULL);
+	TAILQ_INIT(&ps->members);
+	TAILQ_INIT(&ps->idle);
+	TAILQ_INIT(&ps->dead);
+
+	*pollset = ps;
+
+	return CCI_SUCCESS;
+}
+
+int cci_pollset_destroy(cci_pollset_t * pollset)
+{
+	cci_pollset_t *ps = pollset;
+	cci__pollmbr_t *m = NULL;
+	cci__pollsrc_t *src = NULL;
+
+	if (!ps)
+		return CCI_EINVAL;
+
+	pthread_mutex_lock(&ps->lock);
+	while ((m = TAILQ_FIRST(&ps->members)))
+		pollset_leave(ps, m);
+	pthread_mutex_unlock(&ps->lock);
+
+	while ((m = TAILQ_FIRST(&ps->idle))) {
+		TAILQ_REMOVE(&ps->idle, m, entry);
+		pollset_free_member(m);
+	}
+	while ((src = TAILQ_FIRST(&ps->dead))) {
+		TAILQ_REMOVE(&ps->dead, src, entry);
+		free(src);
+	}
+
+	close(ps->epfd);
+	pthread_mutex_destroy(&ps->lock);
+	free(ps);
+
+	return CCI_SUCCESS;
+}
+
+int cci_pollset_add(cci_pollset_t * pollset, cci_endpoint_t * endpoint)
+{
+	int ret = CCI_SUCCESS;
+	cci_pollset_t *ps = pollset;
+	cci__ep_t *ep = NULL;
+	cci__pollmbr_t *m = NULL;
+
+	if (!ps || !endpoint)
+		return CCI_EINVAL;
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	/* events queued elsewhere would never wake the pollset */
+	if (!ep->plugin->pollset_arm ||
+	    (ep->sm_ep && !ep->sm_ep->plugin->pollset_arm))
+		return CCI_ERR_NOT_IMPLEMENTED;
+
+	pthread_mutex_lock(&ps->lock);
+	if (ep->poll) {
+		ret = CCI_EBUSY;
+		goto out;
+	}
+
+	m = TAILQ_FIRST(&ps->idle);
+	if (m) {
+		ret = pollset_ctl_add(ps, TAILQ_FIRST(&m->srcs));
+		if (ret)
+			goto out;
+		TAILQ_REMOVE(&ps->idle, m, entry);
+		pollset_drain(m->fd[0]);
+	} else {
+		m = pollset_new_member(ps, &ret);
+		if (!m)
+			goto out;
+	}
+
+	m->ep = ep;
+	m->gen = ps->gen;
+	OPA_store_int(&m->wake.armed, 0);
+	TAILQ_INSERT_TAIL(&ps->members, m, entry);
+
+	ep->poll = &m->wake;
+	if (ep->sm_ep)
+		ep->sm_ep->poll = &m->wake;
+
+	/* e.g. an mrail endpoint with a rail that cannot be a member */
+	ret = ep->plugin->pollset_arm(&ep->endpoint);
+	if (!ret && ep->sm_ep)
+		ret = ep->sm_ep->plugin->pollset_arm(&ep->sm_ep->endpoint);
+	if (ret) {
+		pollset_leave(ps, m);
+		goto out;
+	}
+
+	debug(CCI_DB_EP, "%s: added %s", __func__,
+	      ep->uri ? ep->uri : ep->dev->device.name);
+
+    out:
+	pthread_mutex_unlock(&ps->lock);
+	return ret;
+}
+
+int cci_pollset_remove(cci_pollset_t * pollset, cci_endpoint_t * endpoint)
+{
+	int ret = CCI_SUCCESS;
+	cci_pollset_t *ps = pollset;
+	cci__ep_t *ep = NULL;
+	cci__pollmbr_t *m = NULL;
+
+	if (!ps || !endpoint)
+		return CCI_EINVAL;
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	pthread_mutex_lock(&ps->lock);
+	m = pollset_member(ep);
+	if (!m || m->ps != ps || m->ep != ep)
+		ret = CCI_EINVAL;
+	else
+		pollset_leave(ps, m);
+	pthread_mutex_unlock(&ps->lock);
+
+	return ret;
+}
+
+int cci_pollset_wait(cci_pollset_t * pollset, cci_endpoint_t ** endpoints,
+		     uint32_t max, uint32_t * count, int timeout)
+{
+	int i = 0, nev = 0;
+	uint32_t n = 0, gen = 0;
+	cci_pollset_t *ps = pollset;
+	cci__pollmbr_t *m = NULL;
+	struct epoll_event evs[POLLSET_EVENTS];
+
+	if (!ps || !endpoints || !count || !max)
+		return CCI_EINVAL;
+
+    again:
+	pthread_mutex_lock(&ps->lock);
+	TAILQ_FOREACH(m, &ps->members, entry)
+		pollset_arm(m);
+	pthread_mutex_unlock(&ps->lock);
+
+	nev = epoll_wait(ps->epfd, evs, POLLSET_EVENTS, timeout);
+	if (nev == -1) {
+		if (errno != EINTR)
+			return errno;
+		nev = 0;
+	}
+
+	pthread_mutex_lock(&ps->lock);
+	gen = ++ps->gen;
+	for (i = 0; i < nev; i++) {
+		cci__pollsrc_t *src = evs[i].data.ptr;
+
+		/* left while we slept, its fd may be closed by now */
+		if (!src->active)
+			continue;
+
+		pollset_drain(src->fd);
+
+		m = src->m;
+		if (!m->ep || m->gen == gen || n == max)
+			continue;
+		m->gen = gen;
+		endpoints[n++] = &m->ep->endpoint;
+	}
+	pthread_mutex_unlock(&ps->lock);
+
+	/* woken only by endpoints that left */
+	if (!n && nev && timeout < 0)
+		goto again;
+
+	*count = n;
+	if (n)
+		return CCI_SUCCESS;
+
+	return timeout ? CCI_ETIMEDOUT : CCI_EAGAIN;
+}
+
+int cci__pollset_watch(cci__ep_t * ep, int fd)
+{
+	cci__pollmbr_t *m = pollset_member(ep);
+
+	if (!m)
+		return CCI_EINVAL;
+
+	/* only called from pollset_arm() while the pollset is locked */
+	return pollset_add_src(m, ep, fd);
+}
+
+void cci__pollset_leave(cci__ep_t * ep)
+{
+	cci__pollmbr_t *m = pollset_member(ep);
+	cci_pollset_t *ps = NULL;
+
+	if (!m)
+		return;
+	ps = m->ps;
+
+	pthread_mutex_lock(&ps->lock);
+	if (m->ep == ep) {
+		pollset_leave(ps, m);
+	} else {
+		/* a companion or rail going away before its owner */
+		pollset_forget(m, ep);
+		ep->poll = NULL;
+	}
+	pthread_mutex_unlock(&ps->lock);
+}
+
+#else /* ! HAVE_SYS_EPOLL_H */
+
+int cci_pollset_create(cci_pollset_t ** pollset)
+{
+	(void) pollset;
+
+	return CCI_ERR_NOT_IMPLEMENTED;
+}
+
+int cci_pollset_destroy(cci_pollset_t * pollset)
+{
+	(void) pollset;
+
+	return CCI_EINVAL;
+}
+
+int cci_pollset_add(cci_pollset_t * pollset, cci_endpoint_t * endpoint)
+{
+	(void) pollset;
+	(void) endpoint;
+
+	return CCI_EINVAL;
+}
+
+int cci_pollset_remove(cci_pollset_t * pollset, cci_endpoint_t * endpoint)
+{
+	(void) pollset;
+	(void) endpoint;
+
+	return CCI_EINVAL;
+}
+
+int cci_pollset_wait(cci_pollset_t * pollset, cci_endpoint_t ** endpoints,
+		     uint32_t max, uint32_t * count, int timeout)
+{
+	(void) pollset;
+	(void) endpoints;
+	(void) max;
+	(void) count;
+	(void) timeout;
+
+	return CCI_EINVAL;
+}
+
+int cci__pollset_watch(cci__ep_t * ep, int fd)
+{
+	(void) ep;
+	(void) fd;
+
+	return CCI_ERR_NOT_IMPLEMENTED;
+}
+
+void cci__pollset_leave(cci__ep_t * ep)
+{
+	(void) ep;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
@@ -0,0 +1,504 @@
+/*
+ * Copyright © 2013 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * RMA registration cache (CCI_INIT_FLAG_REG_CACHE, reg_cache=).
+ *
+ * Registrations live in a per-endpoint interval tree (an AVL tree
+ * ordered by start and augmented with the largest end in each
+ * subtree) and are reference counted. A registration that is no longer
+ * used goes on an LRU list and stays registered until the cache is
+ * over its size or the endpoint is destroyed.
+ *
+ * Offsets in cci_rma() are relative to the start of the registration,
+ * so only a cached registration with the same start can satisfy a
+ * request: it hits if it contains the requested range and has at least
+ * the requested access flags. A new registration that contains unused
+ * ones from the same start replaces them.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "plugins/ctp/ctp.h"
+#include "cci-api.h"
+
+#define RCACHE_DEFAULT	(1024)	/* entries with CCI_INIT_FLAG_REG_CACHE */
+#define RCACHE_BUCKETS	(256)	/* handle hash */
+#define RCACHE_HASH(h)	((((uintptr_t)(h)) >> 4) & (RCACHE_BUCKETS - 1))
+
+#define RCACHE_FLAGS	(CCI_FLAG_READ | CCI_FLAG_WRITE)
+
+typedef struct cci__rcache_entry {
+	/*! Registered range [start, end) */
+	uintptr_t start;
+	uintptr_t end;
+
+	/*! Largest end in this subtree */
+	uintptr_t max_end;
+
+	int height;
+	struct cci__rcache_entry *left;
+	struct cci__rcache_entry *right;
+
+	/*! CCI_FLAG_READ/WRITE it was registered with */
+	int flags;
+
+	/*! Registrations not yet deregistered by the application */
+	uint32_t refcnt;
+
+	/*! Transport handle */
+	cci_rma_handle_t *handle;
+
+	/*! Next entry in the handle's hash bucket */
+	struct cci__rcache_entry *hnext;
+
+	/*! On the LRU list (refcnt == 0) or an eviction list */
+	TAILQ_ENTRY(cci__rcache_entry) entry;
+} cci__rcache_entry_t;
+
+TAILQ_HEAD(cci__rcache_list, cci__rcache_entry);
+
+typedef struct cci__rcache {
+	pthread_mutex_t lock;
+
+	cci__rcache_entry_t *root;
+
+	/*! Entries in the tree, and how many to keep */
+	uint32_t count;
+	uint32_t max;
+
+	/*! Unused entries, least recently used first */
+	struct cci__rcache_list lru;
+
+	cci__rcache_entry_t *hash[RCACHE_BUCKETS];
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} cci__rcache_t;
+
+/******* interval tree *******/
+
+static int rcache_cmp(const cci__rcache_entry_t * a,
+		      const cci__rcache_entry_t * b)
+{
+	if (a->start != b->start)
+		return a->start < b->start ? -1 : 1;
+	if (a->end != b->end)
+		return a->end < b->end ? -1 : 1;
+	if (a != b)
+		return (uintptr_t) a < (uintptr_t) b ? -1 : 1;
+	return 0;
+}
+
+static int rcache_height(const cci__rcache_entry_t * e)
+{
+	return e ? e->height : 0;
+}
+
+static uintptr_t rcache_max_end(const cci__rcache_entry_t * e)
+{
+	return e ? e->max_end : 0;
+}
+
+static void rcache_update(cci__rcache_entry_t * e)
+{
+	int hl = rcache_height(e->left), hr = rcache_height(e->right);
+	uintptr_t ml = rcache_max_end(e->left), mr = rcache_max_end(e->right);
+
+	e->height = 1 + (hl > hr ? hl : hr);
+	e->max_end = e->end;
+	if (ml > e->max_end)
+		e->max_end = ml;
+	if (mr > e->max_end)
+		e->max_end = mr;
+}
+
+static cci__rcache_entry_t *rcache_rotate_right(cci__rcache_entry_t * y)
+{
+	cci__rcache_entry_t *x = y->left;
+
+	y->left = x->right;
+	x->right = y;
+	rcache_update(y);
+	rcache_update(x);
+
+	return x;
+}
+
+static cci__rcache_entry_t *rcache_rotate_left(cci__rcache_entry_t * x)
+{
+	cci__rcache_entry_t *y = x->right;
+
+	x->right = y->left;
+	y->left = x;
+	rcache_update(x);
+	rcache_update(y);
+
+	return y;
+}
+
+static cci__rcache_entry_t *rcache_balance(cci__rcache_entry_t * n)
+{
+	int bal = 0;
+
+	rcache_update(n);
+	bal = rcache_height(n->left) - rcache_height(n->right);
+
+	if (bal > 1) {
+		if (rcache_height(n->left->left) < rcache_height(n->left->right))
+			n->left = rcache_rotate_left(n->left);
+		return rcache_rotate_right(n);
+	}
+	if (bal < -1) {
+		if (rcache_height(n->right->right) < rcache_height(n->right->left))
+			n->right = rcache_rotate_right(n->right);
+		return rcache_rotate_left(n);
+	}
+
+	return n;
+}
+
+static cci__rcache_entry_t *rcache_insert(cci__rcache_entry_t * n,
+					  cci__rcache_entry_t * e)
+{
+	if (!n) {
+		e->left = e->right = NULL;
+		rcache_update(e);
+		return e;
+	}
+
+	if (rcache_cmp(e, n) < 0)
+		n->left = rcache_insert(n->left, e);
+	else
+		n->right = rcache_insert(n->right, e);
+
+	return rcache_balance(n);
+}
+
+static cci__rcache_entry_t *rcache_remove_min(cci__rcache_entry_t * n,
+					      cci__rcache_entry_t ** min)
+{
+	if (!n->left) {
+		*min = n;
+		return n->right;
+	}
+	n->left = rcache_remove_min(n->left, min);
+
+	return rcache_balance(n);
+}
+
+static cci__rcache_entry_t *rcache_remove(cci__rcache_entry_t * n,
+					  cci__rcache_entry_t * e)
+{
+	int c = 0;
+
+	if (!n)
+		return NULL;
+
+	c = rcache_cmp(e, n);
+	if (c < 0) {
+		n->left = rcache_remove(n->left, e);
+	} else if (c > 0) {
+		n->right = rcache_remove(n->right, e);
+	} else {
+		cci__rcache_entry_t *l = n->left, *r = n->right, *m = NULL;
+
+		if (!r)
+			return l;
+		r = rcache_remove_min(r, &m);
+		m->left = l;
+		m->right = r;
+		n = m;
+	}
+
+	return rcache_balance(n);
+}
+
+/* Call fn on every entry that overlaps [start, end) */
+static void rcache_overlap(cci__rcache_entry_t * n, uintptr_t start,
+			   uintptr_t end,
+			   void (*fn) (cci__rcache_entry_t *, void *), void *arg)
+{
+	while (n && n->max_end > start) {
+		rcache_overlap(n->left, start, end, fn, arg);
+
+		if (n->start >= end)
+			return;
+		if (n->end > start)
+			fn(n, arg);
+
+		n = n->right;
+	}
+}
+
+/******* cache *******/
+
+typedef struct rcache_query {
+	uintptr_t start;
+	uintptr_t end;
+	int flags;
+	cci__rcache_entry_t *hit;
+	struct cci__rcache_list *victims;
+	cci__rcache_t *rc;
+} rcache_query_t;
+
+static void rcache_find_fn(cci__rcache_entry_t * e, void *arg)
+{
+	rcache_query_t *q = arg;
+
+	if (e->start == q->start && e->end >= q->end &&
+	    (e->flags & q->flags) == q->flags &&
+	    (!q->hit || e->end < q->hit->end))
+		q->hit = e;
+}
+
+/* Unused entries that the new registration makes redundant */
+static void rcache_shadow_fn(cci__rcache_entry_t * e, void *arg)
+{
+	rcache_query_t *q = arg;
+
+	if (!e->refcnt && e->start == q->start && e->end <= q->end &&
+	    (e->flags & q->flags) == e->flags) {
+		TAILQ_REMOVE(&q->rc->lru, e, entry);
+		TAILQ_INSERT_TAIL(q->victims, e, entry);
+	}
+}
+
+static void rcache_hash_del(cci__rcache_t * rc, cci__rcache_entry_t * e)
+{
+	cci__rcache_entry_t **p = &rc->hash[RCACHE_HASH(e->handle)];
+
+	while (*p != e)
+		p = &(*p)->hnext;
+	*p = e->hnext;
+}
+
+static cci__rcache_entry_t *rcache_hash_find(cci__rcache_t * rc,
+					     cci_rma_handle_t * handle)
+{
+	cci__rcache_entry_t *e = rc->hash[RCACHE_HASH(handle)];
+
+	while (e && e->handle != handle)
+		e = e->hnext;
+
+	return e;
+}
+
+/* Take e out of the cache; the caller deregisters it */
+static void rcache_unlink(cci__rcache_t * rc, cci__rcache_entry_t * e)
+{
+	rc->root = rcache_remove(rc->root, e);
+	rcache_hash_del(rc, e);
+	rc->count--;
+	rc->evictions++;
+}
+
+/* Move unused entries to victims until the cache fits, or all of them */
+static void rcache_trim(cci__rcache_t * rc, struct cci__rcache_list *victims,
+			int all)
+{
+	cci__rcache_entry_t *e = NULL;
+
+	while ((all || rc->count > rc->max) &&
+	       (e = TAILQ_FIRST(&rc->lru))) {
+		TAILQ_REMOVE(&rc->lru, e, entry);
+		rcache_unlink(rc, e);
+		TAILQ_INSERT_TAIL(victims, e, entry);
+	}
+}
+
+static void rcache_release(cci__ep_t * ep, struct cci__rcache_list *victims)
+{
+	cci__rcache_entry_t *e = NULL;
+
+	while ((e = TAILQ_FIRST(victims))) {
+		TAILQ_REMOVE(victims, e, entry);
+		cci__rma_deregister(ep, e->handle);
+		free(e);
+	}
+}
+
+/* Caching is an optimization, so failing to set it up is not an error */
+void cci__rcache_open(cci__ep_t * ep)
+{
+	uint32_t max = 0;
+	cci__rcache_t *rc = NULL;
+	const char * const *arg = NULL;
+
+	if (globals->flags & CCI_INIT_FLAG_REG_CACHE)
+		max = RCACHE_DEFAULT;
+
+	for (arg = ep->dev->device.conf_argv; arg && *arg; arg++) {
+		if (0 == strncasecmp("reg_cache=", *arg, 10))
+			max = strtoul(*arg + 10, NULL, 0);
+	}
+
+	if (!max)
+		return;
+
+	rc = calloc(1, sizeof(*rc));
+	if (!rc) {
+		debug(CCI_DB_WARN, "%s: no memory for the registration cache",
+		      __func__);
+		return;
+	}
+
+	pthread_mutex_init(&rc->lock, NULL);
+	TAILQ_INIT(&rc->lru);
+	rc->max = max;
+	ep->rcache = rc;
+
+	debug(CCI_DB_EP, "%s: caching up to %u registrations", __func__, max);
+}
+
+void cci__rcache_close(cci__ep_t * ep)
+{
+	cci__rcache_t *rc = ep->rcache;
+	cci__rcache_entry_t *e = NULL;
+	struct cci__rcache_list victims;
+	uint32_t i = 0;
+
+	if (!rc)
+		return;
+	ep->rcache = NULL;
+
+	debug(CCI_DB_EP, "%s: %" PRIu64 " hits, %" PRIu64 " misses, %"
+	      PRIu64 " evictions", __func__, rc->hits, rc->misses,
+	      rc->evictions);
+
+	/* registrations the application did not release go too */
+	TAILQ_INIT(&victims);
+	for (i = 0; i < RCACHE_BUCKETS; i++) {
+		while ((e = rc->hash[i])) {
+			rc->hash[i] = e->hnext;
+			TAILQ_INSERT_TAIL(&victims, e, entry);
+		}
+	}
+	rcache_release(ep, &victims);
+
+	pthread_mutex_destroy(&rc->lock);
+	free(rc);
+}
+
+int cci__rcache_register(cci__ep_t * ep, void *start, uint64_t length,
+			 int flags, cci_rma_handle_t ** rma_handle)
+{
+	int ret = CCI_SUCCESS;
+	cci__rcache_t *rc = ep->rcache;
+	cci__rcache_entry_t *e = NULL, *old = NULL;
+	struct cci__rcache_list victims;
+	rcache_query_t q;
+
+	memset(&q, 0, sizeof(q));
+	q.start = (uintptr_t) start;
+	q.end = q.start + length;
+	q.flags = flags & RCACHE_FLAGS;
+	q.victims = &victims;
+	q.rc = rc;
+	TAILQ_INIT(&victims);
+
+	pthread_mutex_lock(&rc->lock);
+	rcache_overlap(rc->root, q.start, q.end, rcache_find_fn, &q);
+	e = q.hit;
+	if (e) {
+		if (!e->refcnt++)
+			TAILQ_REMOVE(&rc->lru, e, entry);
+		rc->hits++;
+		*rma_handle = e->handle;
+		pthread_mutex_unlock(&rc->lock);
+		return CCI_SUCCESS;
+	}
+	rc->misses++;
+	pthread_mutex_unlock(&rc->lock);
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return CCI_ENOMEM;
+	e->start = q.start;
+	e->end = q.end;
+	e->flags = q.flags;
+	e->refcnt = 1;
+
+	/* registrations are not free, so register outside the lock */
+	ret = cci__rma_register(ep, start, length, flags, &e->handle);
+	if (ret) {
+		/* the transport may be out of resources that we hold */
+		pthread_mutex_lock(&rc->lock);
+		rcache_trim(rc, &victims, 1);
+		pthread_mutex_unlock(&rc->lock);
+
+		if (TAILQ_EMPTY(&victims)) {
+			free(e);
+			return ret;
+		}
+		rcache_release(ep, &victims);
+
+		ret = cci__rma_register(ep, start, length, flags, &e->handle);
+		if (ret) {
+			free(e);
+			return ret;
+		}
+	}
+
+	pthread_mutex_lock(&rc->lock);
+	rcache_overlap(rc->root, q.start, q.end, rcache_shadow_fn, &q);
+	TAILQ_FOREACH(old, &victims, entry)
+		rcache_unlink(rc, old);
+
+	rc->root = rcache_insert(rc->root, e);
+	e->hnext = rc->hash[RCACHE_HASH(e->handle)];
+	rc->hash[RCACHE_HASH(e->handle)] = e;
+	rc->count++;
+
+	rcache_trim(rc, &victims, 0);
+	pthread_mutex_unlock(&rc->lock);
+
+	rcache_release(ep, &victims);
+
+	*rma_handle = e->handle;
+
+	return CCI_SUCCESS;
+}
+
+int cci__rcache_deregister(cci__ep_t * ep, cci_rma_handle_t * rma_handle)
+{
+	int ret = CCI_SUCCESS;
+	cci__rcache_t *rc = ep->rcache;
+	cci__rcache_entry_t *e = NULL;
+	struct cci__rcache_list victims;
+
+	TAILQ_INIT(&victims);
+
+	pthread_mutex_lock(&rc->lock);
+	e = rcache_hash_find(rc, rma_handle);
+	if (!e) {
+		pthread_mutex_unlock(&rc->lock);
+		/* not ours, e.g. registered before the cache existed */
+		return cci__rma_deregister(ep, rma_handle);
+	}
+
+	if (!e->refcnt) {
+		ret = CCI_EINVAL;
+	} else if (!--e->refcnt) {
+		TAILQ_INSERT_TAIL(&rc->lru, e, entry);
+		rcache_trim(rc, &victims, 0);
+	}
+	pthread_mutex_unlock(&rc->lock);
+
+	rcache_release(ep, &victims);
+
+	return ret;
+}
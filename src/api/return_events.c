@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2010 Cisco Systems, Inc.  All rights reserved.
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ * Copyright © 2012 inria.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_return_events(cci_event_t ** events, uint32_t count)
+{
+	int ret = CCI_SUCCESS, rc = 0;
+	uint32_t i = 0, j = 0;
+
+	if (!events && count)
+		return CCI_EINVAL;
+
+	while (i < count) {
+		cci__evt_t *ev = NULL;
+		cci__ep_t *ep = NULL;
+
+		if (!events[i]) {
+			i++;
+			continue;
+		}
+
+		ev = container_of(events[i], cci__evt_t, event);
+		ep = ev->ep;
+
+		/* find the run of events from the same endpoint */
+		for (j = i + 1; j < count && events[j]; j++) {
+			cci__evt_t *e = container_of(events[j], cci__evt_t, event);
+			if (e->ep != ep)
+				break;
+		}
+
+		if (ep->plugin->return_events) {
+			rc = ep->plugin->return_events(&events[i], j - i);
+			if (rc && !ret)
+				ret = rc;
+		} else {
+			for (; i < j; i++) {
+				rc = ep->plugin->return_event(events[i]);
+				if (rc && !ret)
+					ret = rc;
+			}
+		}
+		i = j;
+	}
+
+	return ret;
+}
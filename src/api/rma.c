@@ -16,6 +16,7 @@
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
+#include "cci-api.h"
 
 int cci_rma(cci_connection_t * connection,
 	    const void *header_ptr, uint32_t header_len,
@@ -24,6 +25,7 @@ int cci_rma(cci_connection_t * connection,
 	    uint64_t data_len, const void *context, int flags)
 {
 	cci__conn_t *conn = NULL;
+	cci__ep_t *ep = NULL;
 
 	if (NULL == local_handle || NULL == remote_handle) {
 		debug(CCI_DB_INFO, "%s: %s handle is NULL\n",
@@ -60,6 +62,11 @@ int cci_rma(cci_connection_t * connection,
 		return CCI_EINVAL;
 	}
 
+	/* hybrid handles carry one handle per transport */
+	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	if (ep->sm_ep || ep->net_ep)
+		local_handle = cci__hybrid_local_handle(ep, local_handle);
+
 	return conn->plugin->rma(connection, header_ptr, header_len,
 				 local_handle, local_offset,
 				 remote_handle, remote_offset,
@@ -14,9 +14,24 @@
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
+#include "cci-api.h"
+
+int cci__rma_deregister(cci__ep_t * ep, cci_rma_handle_t * rma_handle)
+{
+	if (ep->net_ep)
+		ep = ep->net_ep;
+	if (ep->sm_ep)
+		return cci__hybrid_rma_deregister(ep, rma_handle);
+
+	return ep->plugin->rma_deregister(&ep->endpoint, rma_handle);
+}
 
 int cci_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t * rma_handle)
 {
 	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
-	return ep->plugin->rma_deregister(endpoint, rma_handle);
+
+	if (ep->rcache)
+		return cci__rcache_deregister(ep, rma_handle);
+
+	return cci__rma_deregister(ep, rma_handle);
 }
@@ -16,6 +16,21 @@
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
+#include "cci-api.h"
+
+int cci__rma_register(cci__ep_t * ep, void *start, uint64_t length,
+		      int flags, cci_rma_handle_t ** rma_handle)
+{
+	/* register through the network endpoint that owns a companion */
+	if (ep->net_ep)
+		ep = ep->net_ep;
+	if (ep->sm_ep)
+		return cci__hybrid_rma_register(ep, start, length, flags,
+						rma_handle);
+
+	return ep->plugin->rma_register(&ep->endpoint, start, length, flags,
+					rma_handle);
+}
 
 int cci_rma_register(cci_endpoint_t * endpoint,
 		     void *start, uint64_t length,
@@ -28,6 +43,9 @@ int cci_rma_register(cci_endpoint_t * endpoint,
 		return CCI_EINVAL;
 	}
 
-	return ep->plugin->rma_register(endpoint, start, length, flags,
-					rma_handle);
+	if (ep->rcache)
+		return cci__rcache_register(ep, start, length, flags,
+					    rma_handle);
+
+	return cci__rma_register(ep, start, length, flags, rma_handle);
 }
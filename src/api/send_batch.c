@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2010 Cisco Systems, Inc.  All rights reserved.
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ * Copyright © 2012 inria.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_send_batch(cci_send_desc_t * descs, uint32_t count)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t i = 0, j = 0;
+
+	if (!descs && count)
+		return CCI_EINVAL;
+
+	while (i < count) {
+		cci_endpoint_t *endpoint = NULL;
+		cci__conn_t *conn = NULL;
+
+		if (NULL == descs[i].connection) {
+			descs[i].status = CCI_EINVAL;
+			i++;
+			continue;
+		}
+
+		conn = container_of(descs[i].connection, cci__conn_t, connection);
+		endpoint = descs[i].connection->endpoint;
+
+		/* find the run of descriptors on the same endpoint */
+		for (j = i + 1; j < count; j++) {
+			if (!descs[j].connection ||
+				descs[j].connection->endpoint != endpoint)
+				break;
+		}
+
+		if (conn->plugin->send_batch) {
+			conn->plugin->send_batch(&descs[i], j - i);
+		} else {
+			for (; i < j; i++) {
+				descs[i].status = conn->plugin->send(descs[i].connection,
+							descs[i].msg_ptr, descs[i].msg_len,
+							descs[i].context, descs[i].flags);
+			}
+		}
+		i = j;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (descs[i].status != CCI_SUCCESS) {
+			ret = descs[i].status;
+			break;
+		}
+	}
+
+	return ret;
+}
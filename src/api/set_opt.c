@@ -35,13 +35,15 @@ int cci_set_opt(cci_opt_handle_t * handle,
 	case CCI_OPT_ENDPT_SEND_BUF_COUNT:
 	case CCI_OPT_ENDPT_KEEPALIVE_TIMEOUT:
 	case CCI_OPT_ENDPT_URI:
-	case CCI_OPT_ENDPT_RMA_ALIGN: {
+	case CCI_OPT_ENDPT_RMA_ALIGN:
+	case CCI_OPT_ENDPT_STATS: {
 		cci__ep_t *ep = container_of(handle, cci__ep_t, endpoint);
 		plugin = ep->plugin;
 		break;
 	}
 	case CCI_OPT_CONN_SEND_TIMEOUT:
-	case CCI_OPT_CONN_KEEPALIVE_TIMEOUT: {
+	case CCI_OPT_CONN_KEEPALIVE_TIMEOUT:
+	case CCI_OPT_CONN_STATS: {
 		cci__conn_t *conn = container_of(handle, cci__conn_t, connection);
 		plugin = conn->plugin;
 		break;
@@ -50,6 +52,16 @@ int cci_set_opt(cci_opt_handle_t * handle,
 
 	ret = plugin->set_opt(handle, name, val);
 
+	/* keep a hybrid endpoint's companion in step, best effort */
+	if (!ret && (name == CCI_OPT_ENDPT_SEND_TIMEOUT ||
+		     name == CCI_OPT_ENDPT_KEEPALIVE_TIMEOUT)) {
+		cci__ep_t *ep = container_of(handle, cci__ep_t, endpoint);
+
+		if (ep->sm_ep)
+			ep->sm_ep->plugin->set_opt(&ep->sm_ep->endpoint,
+						   name, val);
+	}
+
 	CCI_EXIT;
 
 	return ret;
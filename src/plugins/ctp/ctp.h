@@ -82,6 +82,13 @@ typedef int (*cci_rma_fn_t) (cci_connection_t * connection,
 			     cci_rma_handle_t * local_handle, uint64_t local_offset,
 			     cci_rma_handle_t * remote_handle, uint64_t remote_offset,
 			     uint64_t data_len, const void *context, int flags);
+typedef int (*cci_get_events_fn_t) (cci_endpoint_t * endpoint,
+				    cci_event_t ** const events,
+				    uint32_t max, uint32_t * count);
+typedef int (*cci_return_events_fn_t) (cci_event_t ** const events,
+				       uint32_t count);
+typedef int (*cci_send_batch_fn_t) (cci_send_desc_t * descs, uint32_t count);
+typedef int (*cci_pollset_arm_fn_t) (cci_endpoint_t * endpoint);
 
 /* Plugin struct */
 
@@ -109,6 +116,19 @@ typedef struct cci_plugin_ctp {
 	cci_rma_register_fn_t rma_register;
 	cci_rma_deregister_fn_t rma_deregister;
 	cci_rma_fn_t rma;
+
+	/* Optional batched entry points. When NULL, the CCI API
+	 * falls back to looping over the single-event functions. */
+	cci_get_events_fn_t get_events;
+	cci_return_events_fn_t return_events;
+	cci_send_batch_fn_t send_batch;
+
+	/* Optional pollset support, for transports that deliver every
+	 * event through cci__queue_evt(), which wakes the pollset. When
+	 * NULL, cci_pollset_add() rejects the endpoint. Called before each
+	 * wait (ep->poll set) and once after the endpoint leaves (ep->poll
+	 * NULL). */
+	cci_pollset_arm_fn_t pollset_arm;
 } cci_plugin_ctp_t;
 
 /* Global variable containing all plugins handles,
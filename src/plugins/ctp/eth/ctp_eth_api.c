@@ -119,7 +119,11 @@ cci_plugin_ctp_t cci_ctp_eth_plugin = {
 	ctp_eth_sendv,
 	ctp_eth_rma_register,
 	ctp_eth_rma_deregister,
-	ctp_eth_rma
+	ctp_eth_rma,
+	NULL,			/* get_events, the API loops on get_event */
+	NULL,			/* return_events */
+	NULL,			/* send_batch, the API loops on send */
+	NULL			/* pollset_arm, no pollset support */
 };
 
 static int eth__get_device_info(cci__dev_t * _dev, struct ifaddrs *addr)
@@ -142,7 +142,11 @@ cci_plugin_ctp_t cci_ctp_gni_plugin = {
 	ctp_gni_sendv,
 	ctp_gni_rma_register,
 	ctp_gni_rma_deregister,
-	ctp_gni_rma
+	ctp_gni_rma,
+	NULL,			/* get_events, the API loops on get_event */
+	NULL,			/* return_events */
+	NULL,			/* send_batch, the API loops on send */
+	NULL			/* pollset_arm, no pollset support */
 };
 
 static uint64_t gni_device_rate(void)
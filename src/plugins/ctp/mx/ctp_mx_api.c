@@ -112,7 +112,11 @@ cci_plugin_ctp_t cci_ctp_mx_plugin = {
 	mx_sendv,
 	mx_rma_register,
 	mx_rma_deregister,
-	mx_rma
+	mx_rma,
+	NULL,			/* get_events, the API loops on get_event */
+	NULL,			/* return_events */
+	NULL,			/* send_batch, the API loops on send */
+	NULL			/* pollset_arm, no pollset support */
 };
 
 static int mx_init(cci_plugin_ctp_t *plugin, uint32_t abi_ver, uint32_t flags, uint32_t * caps)
@@ -213,7 +213,11 @@ cci_plugin_ctp_t cci_ctp_portals_plugin = {
 	ctp_portals_sendv,
 	ctp_portals_rma_register,
 	ctp_portals_rma_deregister,
-	ctp_portals_rma
+	ctp_portals_rma,
+	NULL,			/* get_events, the API loops on get_event */
+	NULL,			/* return_events */
+	NULL,			/* send_batch, the API loops on send */
+	NULL			/* pollset_arm, no pollset support */
 };
 
 static int ctp_portals_init(cci_plugin_ctp_t *plugin, uint32_t abi_ver, uint32_t flags, uint32_t * caps)
@@ -320,6 +320,8 @@ struct sm_ep {
 	uint32_t		id;		/* Endpoint ID */
 
 	cci_os_handle_t		fifo;		/* FIFO fd for receiving headers */
+	cci_os_handle_t		wake;		/* FIFO fd for pollset wakeups */
+	void			*wake_poll;	/* Pollset wake was added to */
 
 	void			*conns;		/* Tree of conns sorted by IDs */
 	pthread_rwlock_t	conns_lock;	/* Lock for conns tree */
@@ -377,7 +379,8 @@ typedef struct sm_conn_params {
 
 struct sm_conn_buffer {
 	OPA_ptr_t		avail;		/* Bitmask for available cache lines */
-	char			pad[SM_LINE - sizeof(uint64_t)];
+	OPA_int_t		wake;		/* Reader sleeps, write its wake FIFO */
+	char			pad[SM_LINE - sizeof(uint64_t) - sizeof(OPA_int_t)];
 	char			buf[SM_LINE * 64]; /* Cache lines */
 	ring_t			ring;		/* For headers */
 };
@@ -394,6 +397,7 @@ struct sm_conn {
 	cci__conn_t		*conn;		/* Owning conn */
 	sm_conn_state_t		state;		/* SM_CONN_* */
 	cci_os_handle_t		fifo;		/* for sending keepalives and wakeups */
+	cci_os_handle_t		wake;		/* peer's pollset wake FIFO */
 
 	int			id;		/* ID we assigned to peer */
 	int			peer_id;	/* ID peer assigned to us */
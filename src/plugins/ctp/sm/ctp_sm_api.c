@@ -58,6 +58,12 @@ static int ctp_sm_arm_os_handle(cci_endpoint_t * endpoint, int flags);
 static int ctp_sm_get_event(cci_endpoint_t * endpoint,
 			      cci_event_t ** event);
 static int ctp_sm_return_event(cci_event_t * event);
+static int ctp_sm_get_events(cci_endpoint_t * endpoint,
+			      cci_event_t ** events, uint32_t max,
+			      uint32_t * count);
+static int ctp_sm_return_events(cci_event_t ** events, uint32_t count);
+static int ctp_sm_send_batch(cci_send_desc_t * descs, uint32_t count);
+static int ctp_sm_pollset_arm(cci_endpoint_t * endpoint);
 static int ctp_sm_send(cci_connection_t * connection,
 			 const void *msg_ptr, uint32_t msg_len,
 			 const void *context, int flags);
@@ -121,7 +127,11 @@ cci_plugin_ctp_t cci_ctp_sm_plugin = {
 	ctp_sm_sendv,
 	ctp_sm_rma_register,
 	ctp_sm_rma_deregister,
-	ctp_sm_rma
+	ctp_sm_rma,
+	ctp_sm_get_events,
+	ctp_sm_return_events,
+	ctp_sm_send_batch,
+	ctp_sm_pollset_arm
 };
 
 static int
@@ -1048,9 +1058,11 @@ static int ctp_sm_destroy_endpoint(cci_endpoint_t * endpoint)
 
 		free(sep->conn_ids);
 
-		/* Close FIFO */
+		/* Close FIFOs */
 		if (sep->fifo)
 			close(sep->fifo);
+		if (sep->wake)
+			close(sep->wake);
 
 		if (path)
 			slash = strrchr(path, '/');
@@ -1305,10 +1317,8 @@ static int ctp_sm_accept(cci_event_t *event, const void *context)
 
 	sconn->state = SM_CONN_READY;
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
+	cci__queue_evt(ep, evt);
 	sm_ep_notify(ep);
-	pthread_mutex_unlock(&ep->lock);
 
     out:
 	if (ret) {
@@ -1340,6 +1350,8 @@ sm_free_conn(cci__conn_t *conn)
 
 		if (sconn->fifo != 0)
 			close(sconn->fifo);
+		if (sconn->wake != 0)
+			close(sconn->wake);
 
 		if (sconn->mmap)
 			munmap(sconn->mmap, len);
@@ -1751,6 +1763,40 @@ sm_create_conn(cci__ep_t *ep, const char *uri, cci__conn_t **connp)
 static inline int
 sm_write(cci__ep_t *ep, cci__conn_t *conn);
 
+/* The peer is blocked in a pollset, see ctp_sm_pollset_arm() */
+static void
+sm_wake_peer(sm_conn_t *sconn)
+{
+	int ret = 0;
+	char one = 1;
+
+	if (!sconn->wake) {
+		char name[MAXPATHLEN], *ptr = NULL;
+
+		memset(name, 0, sizeof(name));
+		snprintf(name, sizeof(name), "%s", sconn->name);
+		ptr = strstr(name, "/sock");
+		if (!ptr)
+			return;
+		snprintf(ptr, sizeof(name) - (ptr - name), "/wake");
+
+		ret = open(name, O_WRONLY|O_NONBLOCK);
+		if (ret == -1) {
+			debug(CCI_DB_CONN, "%s: unable to open %s", __func__,
+				name);
+			return;
+		}
+		sconn->wake = ret;
+	}
+
+	ret = write(sconn->wake, &one, sizeof(one));
+	if (ret != sizeof(one))
+		debug(CCI_DB_MSG, "%s: write(%s) failed with %s", __func__,
+			sconn->name, strerror(errno));
+
+	return;
+}
+
 static inline void
 sm_conn_notify(cci__ep_t *ep, cci__conn_t *conn)
 {
@@ -1759,6 +1805,14 @@ sm_conn_notify(cci__ep_t *ep, cci__conn_t *conn)
 	if (sconn->fifo)
 		sm_write(ep, conn);
 
+	if (sconn->tx) {
+		/* pairs with the barrier in ctp_sm_pollset_arm() */
+		OPA_read_write_barrier();
+		if (OPA_load_int(&sconn->tx->wake) &&
+		    OPA_cas_int(&sconn->tx->wake, 1, 0) == 1)
+			sm_wake_peer(sconn);
+	}
+
 	return;
 }
 
@@ -1903,12 +1957,84 @@ static int ctp_sm_set_opt(cci_opt_handle_t * handle,
 static int ctp_sm_get_opt(cci_opt_handle_t * handle,
 			    cci_opt_name_t name, void *val)
 {
+	int ret = CCI_ERR_NOT_IMPLEMENTED;
+
 	CCI_ENTER;
 
 	debug(CCI_DB_INFO, "%s", "In sm_get_opt\n");
 
+	switch (name) {
+	case CCI_OPT_ENDPT_STATS:
+		/* sends go straight into the peer's ring, nothing is queued */
+		ret = CCI_SUCCESS;
+		break;
+	case CCI_OPT_CONN_STATS:
+	{
+		cci_stats_t *stats = val;
+		cci__conn_t *conn = container_of(handle, cci__conn_t, connection);
+		sm_conn_t *sconn = conn->priv;
+		ring_t *ring = &sconn->tx->ring;
+		uint32_t head = OPA_load_int(&ring->head) & ~1;
+		uint32_t tail = OPA_load_int(&ring->tail) & ~1;
+
+		/* headers the peer has not consumed yet */
+		stats->queued = (head - tail) / 2;
+		ret = CCI_SUCCESS;
+		break;
+	}
+	default:
+		break;
+	}
+
 	CCI_EXIT;
-	return CCI_ERR_NOT_IMPLEMENTED;
+	return ret;
+}
+
+static int
+sm_progress_ep(cci__ep_t *ep);
+
+static void
+sm_arm_conn_tree(const void *nodep, const VISIT which, const int depth)
+{
+	sm_conn_t *sconn = NULL;
+
+	if (which != preorder && which != leaf)
+		return;
+
+	sconn = *(sm_conn_t**)nodep;
+	if (sconn->rx)
+		OPA_store_int(&sconn->rx->wake, 1);
+
+	return;
+}
+
+static int
+sm_open_wake(cci__ep_t *ep)
+{
+	int ret = 0;
+	sm_ep_t *sep = ep->priv;
+	char name[MAXPATHLEN];
+
+	memset(name, 0, sizeof(name));
+	snprintf(name, sizeof(name), "%s/wake", ep->uri + strlen("sm://"));
+
+	unlink(name);
+	ret = mkfifo(name, 0622);
+	if (ret) {
+		debug(CCI_DB_WARN, "%s: mkfifo(%s) failed with %s", __func__,
+				name, strerror(errno));
+		return CCI_ERROR;
+	}
+
+	ret = open(name, O_RDWR|O_NONBLOCK);
+	if (ret == -1) {
+		debug(CCI_DB_WARN, "%s: open(%s) failed with %s", __func__,
+				name, strerror(errno));
+		return CCI_ERROR;
+	}
+	sep->wake = ret;
+
+	return CCI_SUCCESS;
 }
 
 static int ctp_sm_arm_os_handle(cci_endpoint_t * endpoint, int flags)
@@ -1921,6 +2047,50 @@ static int ctp_sm_arm_os_handle(cci_endpoint_t * endpoint, int flags)
 	return CCI_ERR_NOT_IMPLEMENTED;
 }
 
+/* Peers write our wake FIFO once after we flag their send buffers,
+ * instead of once per message. */
+static int ctp_sm_pollset_arm(cci_endpoint_t * endpoint)
+{
+	int ret = 0;
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	sm_ep_t *sep = ep->priv;
+
+	CCI_ENTER;
+
+	if (!ep->poll) {
+		sep->wake_poll = NULL;
+		goto out;
+	}
+
+	if (!sep->wake) {
+		ret = sm_open_wake(ep);
+		if (ret)
+			goto out;
+	}
+
+	if (sep->wake_poll != ep->poll) {
+		ret = cci__pollset_watch(ep, sep->wake);
+		if (ret)
+			goto out;
+		sep->wake_poll = ep->poll;
+	}
+
+	pthread_rwlock_rdlock(&sep->conns_lock);
+	if (sep->conns)
+		twalk(sep->conns, sm_arm_conn_tree);
+	pthread_rwlock_unlock(&sep->conns_lock);
+
+	/* pairs with the barrier in sm_conn_notify() */
+	OPA_read_write_barrier();
+
+	/* headers written before the peers saw the flags */
+	sm_progress_ep(ep);
+
+    out:
+	CCI_EXIT;
+	return ret;
+}
+
 static int
 sm_handle_connect(cci__ep_t *ep, const char *path, void *buffer, int len)
 {
@@ -1977,10 +2147,8 @@ sm_handle_connect(cci__ep_t *ep, const char *path, void *buffer, int len)
 	sconn->segid = hdr->connect.segid;
 #endif
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, rx, entry);
+	cci__queue_evt(ep, rx);
 	sm_ep_notify(ep);
-	pthread_mutex_unlock(&ep->lock);
 
     out:
 	if (ret) {
@@ -2097,10 +2265,8 @@ sm_handle_connect_reply(cci__ep_t *ep, void *buffer)
 		sm_free_conn(conn);
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
+	cci__queue_evt(ep, evt);
 	sm_ep_notify(ep);
-	pthread_mutex_unlock(&ep->lock);
 
 	hdr->ack.type = SM_CMSG_CONN_ACK;
 	hdr->ack.pad = 0;
@@ -2242,12 +2408,14 @@ sm_handle_send(cci__ep_t *ep, cci__conn_t *conn, sm_hdr_t *hdr)
 	/* evt->event.recv.connection = &conn->connection; */
 	evt->priv = (void*)((uintptr_t) hdr->send.offset);
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__queue_evt(ep, evt);
 
 	debug(CCI_DB_MSG, "%s: received SEND from %s (offset %u) len %u",
 		__func__, conn->uri, hdr->send.offset, hdr->send.len);
+	CCI_TRACE(CCI_TRACE_RECV, CCI_TRACE_TP_SM, conn, hdr->send.offset,
+		hdr->send.len);
+	CCI_STAT_ADD(ep, conn, msgs_recv, 1);
+	CCI_STAT_ADD(ep, conn, bytes_recv, hdr->send.len);
 
 	CCI_EXIT;
 	return ret;
@@ -2332,10 +2500,8 @@ sm_complete_rma(cci__ep_t *ep, sm_rma_t *rma)
 
 	if (!(rma->flags & CCI_FLAG_SILENT)) {
 		debug(CCI_DB_MSG, "%s: queuing rma %p", __func__, (void*)rma);
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_TAIL(&ep->evts, &rma->evt, entry);
+		cci__queue_evt(ep, &rma->evt);
 		sm_ep_notify(ep);
-		pthread_mutex_unlock(&ep->lock);
 	} else {
 		debug(CCI_DB_MSG, "%s: freeing rma %p", __func__, (void*)rma);
 		free(rma);
@@ -2360,6 +2526,9 @@ sm_handle_rma_ack(cci__ep_t *ep, cci__conn_t *conn, sm_hdr_t *hdr)
 	sm_rma_handle_t *h = (void*) ((uintptr_t)rma_hdr->local_handle);
 	sm_rma_t *rma = (void*)((uintptr_t)rma_hdr->rma);
 
+	CCI_TRACE(CCI_TRACE_ACK_RX, CCI_TRACE_TP_SM, conn,
+		hdr->rma_ack.offset, hdr->rma_ack.status);
+
 	rma->pending--;
 	rma->completed++;
 
@@ -2473,16 +2642,15 @@ sm_get_tx(sm_conn_t *sconn)
 	return tx;
 }
 
+/* Return one or more txs to the connection with a single CAS */
 static void
-sm_put_tx(cci__evt_t *tx)
+sm_put_tx_bits(sm_conn_t *sconn, uint64_t bits)
 {
-	int idx = (int)SM_TX(tx->priv);
 	uint64_t avail = 0, new = 0;
-	sm_conn_t *sconn = tx->conn->priv;
 
     again:
 	avail = (uintptr_t) OPA_load_ptr(&sconn->txs_avail);
-	new = (1ULL << idx) | avail;
+	new = bits | avail;
 	if (OPA_cas_ptr(&sconn->txs_avail, (void*)avail, (void*)new) != (void*)avail) {
 		goto again;
 	}
@@ -2490,6 +2658,16 @@ sm_put_tx(cci__evt_t *tx)
 	return;
 }
 
+static void
+sm_put_tx(cci__evt_t *tx)
+{
+	int idx = (int)SM_TX(tx->priv);
+
+	sm_put_tx_bits(tx->conn->priv, 1ULL << idx);
+
+	return;
+}
+
 static void
 sm_read_fifo(cci__ep_t *ep, const char *func)
 {
@@ -2519,13 +2697,11 @@ static int ctp_sm_get_event(cci_endpoint_t * endpoint,
 	ep = container_of(endpoint, cci__ep_t, endpoint);
 	sm_progress_ep(ep);
 
-	pthread_mutex_lock(&ep->lock);
-	ev = TAILQ_FIRST(&ep->evts);
+	ev = cci__dequeue_evt(ep);
 
 	sep = ep->priv;
 
 	if (ev) {
-		TAILQ_REMOVE(&ep->evts, ev, entry);
 		sm_read_fifo(ep, __func__);
 
 		debug(CCI_DB_EP, "%s: found %s", __func__,
@@ -2534,7 +2710,7 @@ static int ctp_sm_get_event(cci_endpoint_t * endpoint,
 		ret = CCI_EAGAIN;
 	}
 
-	if (0 && sep->fifo && TAILQ_EMPTY(&ep->evts)) {
+	if (0 && sep->fifo && cci__evtq_empty(&ep->evtq)) {
 		int rc = 0;
 		char one = 0;
 
@@ -2543,14 +2719,60 @@ static int ctp_sm_get_event(cci_endpoint_t * endpoint,
 			rc == 1 ? "success" : strerror(errno));
 	}
 
-	pthread_mutex_unlock(&ep->lock);
-
 	*event = &ev->event;
 
 	CCI_EXIT;
 	return ret;
 }
 
+static int ctp_sm_get_events(cci_endpoint_t * endpoint,
+			      cci_event_t ** events, uint32_t max,
+			      uint32_t * count)
+{
+	int ret = 0;
+	uint32_t cnt = 0;
+	cci__ep_t *ep = NULL;
+	cci__evt_t *ev = NULL;
+	sm_ep_t *sep = NULL;
+
+	CCI_ENTER;
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	sep = ep->priv;
+
+	/* walk the conn tree once for the whole batch */
+	sm_progress_ep(ep);
+
+	while (cnt < max && (ev = cci__dequeue_evt(ep))) {
+		events[cnt++] = &ev->event;
+
+		debug(CCI_DB_EP, "%s: found %s", __func__,
+				cci_event_type_str(ev->event.type));
+	}
+
+	if (cnt && sep->fifo) {
+		char buf[64];
+		uint32_t left = cnt;
+
+		/* consume one wakeup per event, as sm_read_fifo() does */
+		while (left) {
+			int rc = read(sep->fifo, buf,
+				left < sizeof(buf) ? left : sizeof(buf));
+			if (rc <= 0)
+				break;
+			left -= rc;
+		}
+	}
+
+	if (!cnt)
+		ret = CCI_EAGAIN;
+
+	*count = cnt;
+
+	CCI_EXIT;
+	return ret;
+}
+
 static int
 sm_return_connect_request(cci_event_t *event)
 {
@@ -2644,11 +2866,19 @@ sm_reserve_conn_buffer(sm_conn_buffer_t *cb, uint32_t len, int *offset)
 	return ret;
 }
 
-static void
-sm_release_conn_buffer(sm_conn_buffer_t *cb, uint32_t len, int offset)
+static inline uint64_t
+sm_conn_buffer_bits(uint32_t len, int offset)
 {
 	int cnt = (len & SM_MASK ? 1 : 0) + (len >> SM_SHIFT);
-	uint64_t avail = 0, bits = (((uint64_t)1 << cnt) - 1) << offset;
+
+	return (((uint64_t)1 << cnt) - 1) << offset;
+}
+
+/* Release one or more reservations in the buffer with a single CAS */
+static void
+sm_release_conn_bits(sm_conn_buffer_t *cb, uint64_t bits)
+{
+	uint64_t avail = 0;
 
     again:
 	avail = (uintptr_t) OPA_load_ptr(&cb->avail);
@@ -2665,6 +2895,14 @@ sm_release_conn_buffer(sm_conn_buffer_t *cb, uint32_t len, int offset)
 	return;
 }
 
+static void
+sm_release_conn_buffer(sm_conn_buffer_t *cb, uint32_t len, int offset)
+{
+	sm_release_conn_bits(cb, sm_conn_buffer_bits(len, offset));
+
+	return;
+}
+
 static int
 sm_reserve_rma_buffer(sm_rma_buffer_t *rb, uint32_t len, int *index)
 {
@@ -2772,6 +3010,88 @@ static int ctp_sm_return_event(cci_event_t * event)
 	return ret;
 }
 
+#define SM_RETURN_CONNS	(16)	/* conns tracked per return_events() pass */
+
+static void
+sm_return_conn_bits(sm_conn_t *sconn, uint64_t rx_bits, uint64_t tx_bits)
+{
+	debug(CCI_DB_MSG, "%s: releasing rx 0x%"PRIx64" tx 0x%"PRIx64" on %s",
+		__func__, rx_bits, tx_bits, sconn->conn->uri);
+
+	if (rx_bits)
+		sm_release_conn_bits(sconn->rx, rx_bits);
+	if (tx_bits)
+		sm_put_tx_bits(sconn, tx_bits);
+
+	return;
+}
+
+static int ctp_sm_return_events(cci_event_t ** events, uint32_t count)
+{
+	int ret = CCI_SUCCESS, rc = 0;
+	uint32_t i = 0;
+	int j = 0, nconns = 0;
+	struct {
+		sm_conn_t	*sconn;
+		uint64_t	rx_bits;	/* rx buffer lines to release */
+		uint64_t	tx_bits;	/* txs to make available */
+	} conns[SM_RETURN_CONNS];
+
+	CCI_ENTER;
+
+	for (i = 0; i < count; i++) {
+		cci_event_t *event = events[i];
+		cci__evt_t *evt = NULL;
+		sm_conn_t *sconn = NULL;
+
+		if (!event)
+			continue;
+
+		evt = container_of(event, cci__evt_t, event);
+
+		/* only RECVs and MSG SENDs are folded into per-conn bitmaps */
+		if (!(event->type == CCI_EVENT_RECV ||
+			(event->type == CCI_EVENT_SEND && SM_IS_TX(evt->priv)))) {
+			rc = ctp_sm_return_event(event);
+			if (rc && !ret)
+				ret = rc;
+			continue;
+		}
+
+		sconn = evt->conn->priv;
+		for (j = 0; j < nconns; j++) {
+			if (conns[j].sconn == sconn)
+				break;
+		}
+		if (j == nconns) {
+			if (nconns == SM_RETURN_CONNS) {
+				/* table full, flush it */
+				for (j = 0; j < nconns; j++)
+					sm_return_conn_bits(conns[j].sconn,
+						conns[j].rx_bits, conns[j].tx_bits);
+				nconns = j = 0;
+			}
+			conns[j].sconn = sconn;
+			conns[j].rx_bits = 0;
+			conns[j].tx_bits = 0;
+			nconns++;
+		}
+
+		if (event->type == CCI_EVENT_RECV)
+			conns[j].rx_bits |= sm_conn_buffer_bits(event->recv.len,
+						(int)((uintptr_t)evt->priv));
+		else
+			conns[j].tx_bits |= 1ULL << SM_TX(evt->priv);
+	}
+
+	for (j = 0; j < nconns; j++)
+		sm_return_conn_bits(conns[j].sconn, conns[j].rx_bits,
+				conns[j].tx_bits);
+
+	CCI_EXIT;
+	return ret;
+}
+
 static int
 sm_progress_conn_ring(cci__ep_t *ep, cci__conn_t *conn)
 {
@@ -2838,10 +3158,8 @@ sm_progress_rma(sm_rma_t *rma)
 					free(rma);
 				} else {
 					rma->evt.event.send.status = ret;
-					pthread_mutex_lock(&ep->lock);
-					TAILQ_INSERT_TAIL(&ep->evts, &rma->evt, entry);
+					cci__queue_evt(ep, &rma->evt);
 					sm_ep_notify(ep);
-					pthread_mutex_unlock(&ep->lock);
 				}
 			}
 		}
@@ -2897,6 +3215,8 @@ sm_progress_rma(sm_rma_t *rma)
 		ret = ring_insert(&sconn->rma->ring, *((uint32_t*)&hdr.u32));
 		if (ret)
 			goto insert;
+		CCI_TRACE(CCI_TRACE_RMA, CCI_TRACE_TP_SM, conn,
+			rma->offset - len, len);
 
 		sm_conn_notify(ep, conn);
 	} while ((rma->pending < SM_RMA_DEPTH) && (rma->offset < rma->hdr.len));
@@ -3004,16 +3324,20 @@ static int ctp_sm_send(cci_connection_t * connection,
 
     again:
 	ret = ring_insert(&sconn->tx->ring, *((uint32_t*)&hdr.u32));
-	if (ret)
+	if (ret) {
+		if (ret == ENOBUFS)
+			CCI_STAT_ADD(ep, conn, ring_full, 1);
 		goto again;
+	}
+	CCI_TRACE(CCI_TRACE_SEND, CCI_TRACE_TP_SM, conn, offset, hdr.send.len);
+	CCI_STAT_ADD(ep, conn, msgs_sent, 1);
+	CCI_STAT_ADD(ep, conn, bytes_sent, hdr.send.len);
 
 	sm_conn_notify(ep, conn);
 
 	if (!(flags & CCI_FLAG_SILENT) && !(flags & CCI_FLAG_BLOCKING)) {
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
+		cci__queue_evt(ep, evt);
 		sm_ep_notify(ep);
-		pthread_mutex_unlock(&ep->lock);
 	} else if (flags & CCI_FLAG_BLOCKING) {
 		sm_put_tx(evt);
 	}
@@ -3022,8 +3346,10 @@ static int ctp_sm_send(cci_connection_t * connection,
 	debug(CCI_DB_MSG, "%s: sending %u bytes to %s %s (%d)", __func__,
 		msg_len, conn->uri, ret ? "failed" : "succeeded", ret);
 
-	if (ret)
+	if (ret) {
+		CCI_STAT_ADD(ep, conn, no_bufs, 1);
 		sm_put_tx(evt);
+	}
 
 	CCI_EXIT;
 	return ret;
@@ -3085,29 +3411,215 @@ static int ctp_sm_sendv(cci_connection_t * connection,
 
     again:
 	ret = ring_insert(&sconn->tx->ring, *((uint32_t*)&hdr.u32));
-	if (ret)
+	if (ret) {
+		if (ret == ENOBUFS)
+			CCI_STAT_ADD(ep, conn, ring_full, 1);
 		goto again;
+	}
+	CCI_TRACE(CCI_TRACE_SEND, CCI_TRACE_TP_SM, conn, offset, hdr.send.len);
+	CCI_STAT_ADD(ep, conn, msgs_sent, 1);
+	CCI_STAT_ADD(ep, conn, bytes_sent, hdr.send.len);
 
 	sm_conn_notify(ep, conn);
 
 	if (!(flags & CCI_FLAG_SILENT)) {
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
+		cci__queue_evt(ep, evt);
 		sm_ep_notify(ep);
-		pthread_mutex_unlock(&ep->lock);
 	}
 
     out:
 	debug(CCI_DB_MSG, "%s: sending %u bytes to %s %s (%d)", __func__,
 		len, conn->uri, ret ? "failed" : "succeeded", ret);
 
-	if (ret)
+	if (ret) {
+		CCI_STAT_ADD(ep, conn, no_bufs, 1);
 		sm_put_tx(evt);
+	}
 
 	CCI_EXIT;
 	return ret;
 }
 
+#define SM_BATCH_CONNS		(16)	/* conns tracked per send_batch() pass */
+
+typedef struct sm_batch {
+	int			nconns;
+	struct {
+		cci__conn_t	*conn;
+		uint32_t	cnt;			/* headers to insert */
+		uint32_t	hdrs[RING_NUM_ELEMS];
+	} conns[SM_BATCH_CONNS];
+	uint32_t		nevts;			/* completions to queue */
+	TAILQ_HEAD(sm_batch_evts, cci__evt) evts;
+} sm_batch_t;
+
+/* Insert each conn's headers, notify each peer once, then queue all
+ * completions and notify the app once. */
+static void
+sm_flush_batch(cci__ep_t *ep, sm_batch_t *b)
+{
+	int i = 0;
+	sm_ep_t *sep = ep->priv;
+
+	/* make the payloads visible before publishing the headers */
+	OPA_write_barrier();
+
+	for (i = 0; i < b->nconns; i++) {
+		cci__conn_t *conn = b->conns[i].conn;
+		sm_conn_t *sconn = conn->priv;
+		uint32_t done = 0, n = 0;
+
+		while (done < b->conns[i].cnt) {
+			int rc = ring_insert_batch(&sconn->tx->ring,
+					&b->conns[i].hdrs[done],
+					b->conns[i].cnt - done, &n);
+			if (rc) {
+				if (rc == ENOBUFS)
+					CCI_STAT_ADD(ep, conn, ring_full, 1);
+				continue;
+			}
+			done += n;
+		}
+		sm_conn_notify(ep, conn);
+	}
+	b->nconns = 0;
+
+	if (b->nevts) {
+		char ones[64];
+
+		memset(ones, 1, sizeof(ones));
+
+		cci__queue_evt_list(ep, &b->evts);
+		TAILQ_INIT(&b->evts);
+		if (sep->fifo) {
+			uint32_t left = b->nevts;
+
+			while (left) {
+				int rc = write(sep->fifo, ones,
+					left < sizeof(ones) ? left : sizeof(ones));
+				if (rc <= 0) {
+					debug(CCI_DB_EP, "%s: write(fifo) returned %s",
+						__func__, strerror(errno));
+					break;
+				}
+				left -= rc;
+			}
+		}
+		b->nevts = 0;
+	}
+
+	return;
+}
+
+/* All descriptors must use the same endpoint (see cci_send_batch()) */
+static int ctp_sm_send_batch(cci_send_desc_t * descs, uint32_t count)
+{
+	int ret = 0, i = 0, offset = 0;
+	uint32_t j = 0;
+	cci__ep_t *ep = NULL;
+	sm_batch_t batch, *b = &batch;
+
+	CCI_ENTER;
+
+	if (!smglobals) {
+		for (j = 0; j < count; j++)
+			descs[j].status = CCI_ENODEV;
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	b->nconns = 0;
+	b->nevts = 0;
+	TAILQ_INIT(&b->evts);
+
+	ep = container_of(descs[0].connection->endpoint, cci__ep_t, endpoint);
+
+	for (j = 0; j < count; j++) {
+		cci_send_desc_t *d = &descs[j];
+		cci__conn_t *conn = container_of(d->connection, cci__conn_t,
+						 connection);
+		sm_conn_t *sconn = conn->priv;
+		cci__evt_t *evt = NULL;
+		sm_hdr_t hdr;
+
+		/* blocking sends use the regular path, after the batch so far */
+		if (d->flags & CCI_FLAG_BLOCKING) {
+			sm_flush_batch(ep, b);
+			d->status = ctp_sm_send(d->connection, d->msg_ptr,
+					d->msg_len, d->context, d->flags);
+			continue;
+		}
+
+		for (i = 0; i < b->nconns; i++) {
+			if (b->conns[i].conn == conn)
+				break;
+		}
+		if (i == b->nconns || b->conns[i].cnt == RING_NUM_ELEMS) {
+			if (i == SM_BATCH_CONNS || i < b->nconns) {
+				sm_flush_batch(ep, b);
+				i = 0;
+			}
+			b->conns[i].conn = conn;
+			b->conns[i].cnt = 0;
+			b->nconns = i + 1;
+		}
+
+		if (!(d->flags & CCI_FLAG_SILENT)) {
+			evt = sm_get_tx(sconn);
+			if (!evt) {
+				CCI_STAT_ADD(ep, conn, no_bufs, 1);
+				d->status = CCI_ENOBUFS;
+				continue;
+			}
+
+			evt->event.send.status = CCI_SUCCESS; /* for now */
+			evt->event.send.connection = d->connection;
+			evt->event.send.context = (void *)d->context;
+		}
+
+		offset = 0;
+		if (d->msg_len) {
+			void *addr = NULL;
+
+			ret = sm_reserve_conn_buffer(sconn->tx, d->msg_len, &offset);
+			if (ret) {
+				if (evt)
+					sm_put_tx(evt);
+				CCI_STAT_ADD(ep, conn, no_bufs, 1);
+				d->status = CCI_ENOBUFS;
+				continue;
+			}
+
+			addr = &sconn->tx->buf[offset * SM_LINE];
+			memcpy(addr, d->msg_ptr, d->msg_len);
+		}
+
+		hdr.u32 = 0;
+		hdr.send.type = SM_MSG_SEND;
+		hdr.send.offset = offset;
+		hdr.send.len = d->msg_len;
+		b->conns[i].hdrs[b->conns[i].cnt++] = hdr.u32;
+		CCI_TRACE(CCI_TRACE_SEND, CCI_TRACE_TP_SM, conn,
+			offset, d->msg_len);
+		CCI_STAT_ADD(ep, conn, msgs_sent, 1);
+		CCI_STAT_ADD(ep, conn, bytes_sent, d->msg_len);
+
+		if (evt) {
+			TAILQ_INSERT_TAIL(&b->evts, evt, entry);
+			b->nevts++;
+		}
+		d->status = CCI_SUCCESS;
+
+		debug(CCI_DB_MSG, "%s: batching %u bytes to %s", __func__,
+			d->msg_len, conn->uri);
+	}
+
+	sm_flush_batch(ep, b);
+
+	CCI_EXIT;
+	return CCI_SUCCESS;
+}
+
 static int ctp_sm_rma_register(cci_endpoint_t * endpoint,
 				 void *start, uint64_t length,
 				 int flags, cci_rma_handle_t ** rma_handle)
@@ -3268,10 +3780,8 @@ static int ctp_sm_rma(cci_connection_t * connection,
 			free(rma);
 			rma = NULL;
 		} else {
-			pthread_mutex_lock(&ep->lock);
-			TAILQ_INSERT_TAIL(&ep->evts, &rma->evt, entry);
+			cci__queue_evt(ep, &rma->evt);
 			sm_ep_notify(ep);
-			pthread_mutex_unlock(&ep->lock);
 		}
 	} else
 #elif HAVE_CMA_H
@@ -3319,10 +3829,8 @@ static int ctp_sm_rma(cci_connection_t * connection,
 			free(rma);
 			rma = NULL;
 		} else {
-			pthread_mutex_lock(&ep->lock);
-			TAILQ_INSERT_TAIL(&ep->evts, &rma->evt, entry);
+			cci__queue_evt(ep, &rma->evt);
 			sm_ep_notify(ep);
-			pthread_mutex_unlock(&ep->lock);
 		}
 		goto out;
 	}
@@ -55,6 +55,42 @@ int ring_insert(ring_t *r, uint32_t elem)
 	return 0;
 }
 
+int ring_insert_batch(ring_t *r, const uint32_t *elems, uint32_t cnt,
+		uint32_t *inserted)
+{
+	uint32_t t, h, i, avail, num = r->num_elem0;
+
+	*inserted = 0;
+
+	/* Bottom bit means someone is updating now. */
+	while ((h = OPA_load_acquire_int(&r->head)) & 1) {
+		wait_for_change_int(&r->head, h);
+	}
+	t = OPA_load_acquire_int(&r->tail);
+
+	avail = num - ((h - t) / 2);
+	if (avail == 0) {
+		sched_yield();
+		return ENOBUFS;
+	}
+	if (cnt > avail)
+		cnt = avail;
+
+	/* This tells everyone we're updating. */
+	if ((uint32_t)OPA_cas_int(&r->head, h, h+1) != h) {
+		sched_yield();
+		return EAGAIN;
+	}
+
+	for (i = 0; i < cnt; i++)
+		OPA_store_release_int(&r->elems[((h/2) + i) % num], elems[i]);
+	assert((uint32_t)OPA_load_acquire_int(&r->head) == h + 1);
+	OPA_store_release_int(&r->head, h + (cnt * 2));
+
+	*inserted = cnt;
+	return 0;
+}
+
 int ring_remove(ring_t *r, uint32_t *elemp)
 {
 	uint32_t h, t, num = r->num_elem1;
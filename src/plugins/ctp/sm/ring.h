@@ -61,6 +61,18 @@ void ring_init(ring_t *r, uint32_t num);
  */
 int ring_insert(ring_t *r, uint32_t elem);
 
+/**
+ * ring_insert_batch - add several elements to the ring at once
+ * @r: the ring
+ * @elems: the elements to add
+ * @cnt: the number of elements
+ * @inserted: how many of the leading elements were added
+ *
+ * Claims the ring once and publishes as many elements as fit.
+ */
+int ring_insert_batch(ring_t *r, const uint32_t *elems, uint32_t cnt,
+		uint32_t *inserted);
+
 /**
  * ring_remove - remove an element to the ring
  * @r: the ring
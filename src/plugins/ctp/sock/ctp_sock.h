@@ -16,6 +16,7 @@
 #include "cci/private_config.h"
 
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <assert.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
@@ -31,6 +32,7 @@ BEGIN_C_DECLS
 #define SOCK_DEFAULT_MSS        (SOCK_UDP_MAX - SOCK_MAX_HDR_SIZE)	/* assume jumbo frames */
 #define SOCK_DEFAULT_RMA_MSS    (SOCK_DEFAULT_MSS - 20)
 #define SOCK_MIN_MSS            (1000 - SOCK_MAX_HDR_SIZE)
+#define SOCK_PMTU_OFF           ((uint32_t) -1)	/* pmtu = off */
 #define SOCK_MAX_SACK           (4)	/* pairs of start/end acks */
 #define SOCK_ACK_DELAY          (1)	/* send an ack after every Nth send */
 #define SOCK_EP_TX_TIMEOUT_SEC  (64)	/* seconds for now */
@@ -44,13 +46,44 @@ BEGIN_C_DECLS
     /* 1048576 conns per endpoint */
 #define SOCK_PROG_TIME_US       (100)	/* try to progress every N microseconds */
 #define SOCK_RESEND_TIME_SEC    (1)	/* time between resends in seconds */
-#define SOCK_PEEK_LEN           (32)	/* large enough for RMA header */
+#define SOCK_RTO_INIT_US        (SOCK_RESEND_TIME_SEC * 1000000)	/* before any RTT sample */
+#define SOCK_RTO_MIN_US         (1000)	/* RTO floor, covers delayed acks */
+#define SOCK_RTO_MAX_US         (8 * 1000000)	/* RTO ceiling after backoff */
+#define SOCK_FAST_RESEND_THRESH (3)	/* later seqs acked before a fast resend */
+#define SOCK_PASS_BYTES         (64 * 1024)	/* data a progress pass puts on the wire */
+#define SOCK_CC_INITIAL_CWND    (10)	/* cwnd of a new conn under a controller */
+#define SOCK_PACE_BURST         (8)	/* msgs a paced conn may send back to back */
+#define SOCK_PEEK_LEN           (64)	/* large enough for any header (RMA ones) */
+#define SOCK_DIRECT_MIN         (4096)	/* smallest RMA payload received in place */
 #define SOCK_CONN_REQ_HDR_LEN   ((int) (sizeof(struct sock_header_r)))
     /* header + seqack */
 #define SOCK_RMA_DEPTH          (256)	/* how many in-flight msgs per RMA */
 #define ACK_TIMEOUT             (100) /* Timeout associated to ACK blocks */
 #define PENDING_ACK_THRESHOLD   (SOCK_RMA_DEPTH/4) /* Maximum size of a ACK block */
 #define SOCK_EP_NUM_EVTS        (64)
+#define SOCK_RX_BATCH           (16)	/* datagrams per recvmmsg() */
+#define SOCK_RX_BATCH_MAX       (64)	/* upper bound for rx_batch= */
+#define SOCK_TX_BATCH           (32)	/* datagrams per sendmmsg() */
+#define SOCK_GSO_MAX_BYTES      (SOCK_UDP_MAX)	/* payload of one GSO send */
+#define SOCK_GRO_BATCH          (4)	/* coalesced datagrams per recvmmsg() */
+#define SOCK_GRO_BUF_SIZE       (65536)	/* room for one coalesced datagram */
+
+#define SOCK_MAX_SHARDS         (8)	/* upper bound for shards= */
+#define SOCK_SHARD_POLL_MS      (10)	/* shard recv threads check closing */
+
+#define SOCK_TIMER_TICK_US      (64)	/* timer wheel resolution */
+#define SOCK_TIMER_LVL_BITS     (6)	/* 64 slots per level */
+#define SOCK_TIMER_LVL_SIZE     (1 << SOCK_TIMER_LVL_BITS)
+#define SOCK_TIMER_LVL_MASK     (SOCK_TIMER_LVL_SIZE - 1)
+#define SOCK_TIMER_LEVELS       (4)	/* ~17 minutes at 64 us */
+#define SOCK_TIMER_SPAN         (1ULL << (SOCK_TIMER_LEVELS * SOCK_TIMER_LVL_BITS))
+
+#if defined(HAVE_SENDMMSG) && defined(UDP_SEGMENT)
+#define SOCK_HAVE_GSO           1
+#endif
+#if defined(HAVE_RECVMMSG) && defined(UDP_GRO)
+#define SOCK_HAVE_GRO           1
+#endif
 
 /*
  * System Parameters
@@ -98,6 +131,8 @@ static inline uint64_t sock_get_usecs(void)
  * A sock device may have these items:
  *
  * mtu = 9000             # MTU less headers will become max_send_size
+ * pmtu = off             # do not probe the path MTU to each peer, or
+ * pmtu = 1500            # assume this path MTU to every peer
  * min_port = 4444        # lowest port to use for endpoints
  * max_port = 5555        # highest port to use for endpoints
  */
@@ -817,6 +852,31 @@ sock_pack_rma_write_done(sock_rma_header_t * write, uint16_t data_len,
 
 /************* Windowing and Acking *******************/
 
+struct sock_conn;
+
+/*! Congestion control. A controller keeps the cwnd and ssthresh (in
+ * messages) of the reliable connections of an endpoint, chosen with the
+ * device's cc= key. Without one, the window is not enforced. Controllers
+ * are called with ep->lock held.
+ */
+typedef struct sock_cc_ops {
+	/*! Name used in the config file */
+	const char *name;
+
+	/*! Set up a connection that just became ready */
+	void (*init)(struct sock_conn *sconn, uint64_t now);
+
+	/*! An ack completed acked txs, rtt is its sample (usecs) or 0 */
+	void (*ack)(struct sock_conn *sconn, uint32_t acked, uint32_t rtt,
+	            uint64_t now);
+
+	/*! A tx is resent: on a SACK gap, or on its RTO if timeout */
+	void (*loss)(struct sock_conn *sconn, int timeout, uint64_t now);
+} sock_cc_ops_t;
+
+/*! Look a controller up by name, NULL if unknown (see ctp_sock_cc.c) */
+const sock_cc_ops_t *sock_cc_find(const char *name);
+
 /************* SOCK private structures ****************/
 
 typedef struct sock_iov {
@@ -824,6 +884,54 @@ typedef struct sock_iov {
 	uint16_t len;
 } sock_iov_t;
 
+typedef enum sock_timer_type {
+	/*! Resend or time out a pending tx */
+	SOCK_TIMER_TX = 0,
+
+	/*! Send the delayed acks of a connection */
+	SOCK_TIMER_ACK,
+
+	/*! Check that we heard from a peer within its keepalive timeout */
+	SOCK_TIMER_KEEPALIVE,
+
+	/*! Let a paced connection send again */
+	SOCK_TIMER_PACE
+} sock_timer_type_t;
+
+/*! A deadline on the endpoint's timer wheel, embedded in its owner.
+ *
+ * \ingroup messages */
+typedef struct sock_timer {
+	/*! Entry for hanging on a wheel slot */
+	TAILQ_ENTRY(sock_timer) entry;
+
+	/*! Deadline in microseconds */
+	uint64_t deadline;
+
+	/*! What the owner is (see container_of()) */
+	sock_timer_type_t type;
+
+	/*! Wheel slot holding the timer while armed */
+	uint8_t level;
+	uint8_t slot;
+
+	/*! On the wheel? */
+	uint8_t armed;
+} sock_timer_t;
+
+/*! Hierarchical timer wheel: level n has SOCK_TIMER_LVL_SIZE slots of
+ * SOCK_TIMER_LVL_SIZE^n ticks each. Protected by ep->lock. */
+typedef struct sock_timer_wheel {
+	/*! Next tick to expire */
+	uint64_t tick;
+
+	/*! Armed timers per level */
+	uint32_t count[SOCK_TIMER_LEVELS];
+
+	TAILQ_HEAD(s_timers, sock_timer)
+		slots[SOCK_TIMER_LEVELS][SOCK_TIMER_LVL_SIZE];
+} sock_timer_wheel_t;
+
 typedef enum sock_tx_state_t {
 	/*! available, held by endpoint */
 	SOCK_TX_IDLE = 0,
@@ -835,7 +943,10 @@ typedef enum sock_tx_state_t {
 	SOCK_TX_PENDING,
 
 	/*! completed with status set */
-	SOCK_TX_COMPLETED
+	SOCK_TX_COMPLETED,
+
+	/*! blocking send completed, status set, not queued as an event */
+	SOCK_TX_BLOCKING_DONE
 } sock_tx_state_t;
 
 typedef enum sock_ctx {
@@ -891,6 +1002,9 @@ typedef struct sock_tx {
 	/*! Timeout in microseconds */
 	uint64_t timeout_us;
 
+	/*! Next resend or timeout while pending */
+	sock_timer_t timer;
+
 	/*! Owning RMA op if not active message */
 	struct sock_rma_op *rma_op;
 
@@ -917,11 +1031,22 @@ typedef struct sock_rx {
 	/*! Buffer length */
 	uint16_t len;
 
-	/*! Entry for hanging on ep->idle_rxs, ep->loaned */
+	/*! Entry for hanging on shard->idle_rxs, ep->loaned */
 	TAILQ_ENTRY(sock_rx) entry;
 
 	/*! Peer's sockaddr_in for connection requests */
 	struct sockaddr_in sin;
+
+	/*! Length of the datagram if it was received whole (batched
+	    receive), 0 if it is still in the socket */
+	uint32_t dgram_len;
+
+	/*! Bytes at the head of a datagram still in the socket that were
+	    peeked into buffer already */
+	uint32_t peek_len;
+
+	/*! Receive shard owning this buffer */
+	struct sock_shard *shard;
 } sock_rx_t;
 
 typedef struct sock_rma_handle {
@@ -994,6 +1119,48 @@ typedef struct sock_rma_op {
 	char *msg_ptr;
 } sock_rma_op_t;
 
+/*
+ * A receive shard: one of the sockets sharing the endpoint's port
+ * (SO_REUSEPORT), with its own receive thread and RX buffers. The kernel
+ * steers each peer to the shard sock_ip_hash() % nshards, so a shard only
+ * handles the peers of its own conn_hash buckets.
+ */
+typedef struct sock_shard {
+	/*! Socket for receiving (shard 0's is also the sending socket) */
+	cci_os_handle_t sock;
+
+	/*! Index in sep->shards */
+	uint32_t index;
+
+	/*! Owning endpoint */
+	cci__ep_t *ep;
+
+	/*! Receive thread (shard 0 uses sep->recv_tid) */
+	pthread_t recv_tid;
+
+	/*! Held while receiving a batch of datagrams */
+	pthread_mutex_t recv_mutex;
+
+	/*! Protects idle_rxs, never held while taking another lock */
+	pthread_mutex_t lock;
+
+	/*! List of idle rxs */
+	TAILQ_HEAD(s_rxsi, sock_rx) idle_rxs;
+
+	/*! Receive buffers for UDP_GRO coalesced datagrams, NULL if off */
+	void *gro_buf;
+
+	/*! RMA read replies deferred while a receive batch is handled */
+	struct sock_reply_batch *replies;
+
+	/*! Reliable data messages seen, to pick the ones to drop */
+	uint32_t drop_count;
+
+	/*! The last datagram carried a large RMA payload: receive the next
+	    one alone so that its payload goes straight to the target */
+	int direct;
+} sock_shard_t;
+
 typedef struct sock_ep {
 	int event_fd;
 	int fd[2];
@@ -1007,6 +1174,16 @@ typedef struct sock_ep {
 	pthread_mutex_t progress_mutex;
 	pthread_cond_t  wait_condition;
 
+	/*! Work for the progress thread, protected by progress_mutex */
+	int progress_kick;
+
+	/*! Deadline the progress thread last went to sleep until, under
+	    ep->lock */
+	uint64_t sleep_until;
+
+	/*! Retransmit, ack-delay and keepalive timers */
+	sock_timer_wheel_t timers;
+
 	/* Our IP and port */
 	struct sockaddr_in sin;
 
@@ -1034,8 +1211,29 @@ typedef struct sock_ep {
 	/*! List of all rxs */
 	sock_rx_t *rxs;
 
-	/*! List of idle rxs */
-	TAILQ_HEAD(s_rxsi, sock_rx) idle_rxs;
+	/*! Receive shards, shards[0].sock is sock */
+	uint32_t nshards;
+	sock_shard_t shards[SOCK_MAX_SHARDS];
+
+	/*! Datagrams to receive per call (1 disables recvmmsg()) */
+	uint32_t rx_batch;
+
+	/*! Coalesce same-size datagrams to a peer with UDP_SEGMENT */
+	int gso;
+
+	/*! Drop one in every drop reliable data messages received, 0 for none */
+	uint32_t drop;
+
+	/*! Congestion controller of reliable conns, NULL for none */
+	const sock_cc_ops_t *cc;
+
+	/*! Pace the sends of reliable conns (requires a controller) */
+	int pace;
+
+	/*! Path MTU to every peer, 0 to probe each one, SOCK_PMTU_OFF to
+	    rely on the device MTU */
+	uint32_t pmtu;
+
 
 	/*! Connection id blocks */
 	uint64_t *ids;
@@ -1046,11 +1244,6 @@ typedef struct sock_ep {
 	/*! Pending (in-flight) sends */
 	TAILQ_HEAD(s_pending, cci__evt) pending;
 
-	/*! List of all connections with keepalive enabled */
-	/* FIXME: revisit the code to use this 
-	TAILQ_HEAD(s_ka, tcp_conn) ka_conns;
-	*/
-
 	/*! List of active connections awaiting replies */
 	TAILQ_HEAD(s_active, sock_conn) active_hash[SOCK_EP_HASH_SIZE];
 
@@ -1083,20 +1276,34 @@ typedef enum sock_conn_status {
 	SOCK_CONN_READY
 } sock_conn_status_t;
 
-/* ACK_ONLY:    start == end, one item in list
- * ACK_UP_TO:   end > start, one item in list
- * SACK:        multiple items in list
+/* Seqs received from the peer: a cumulative point and a ring of one bit
+ * per seq past it, seq s at bit (s & (size - 1)). The ring trails the
+ * sock_conn_t in the same allocation and covers our receive buffer count,
+ * which caps the peer's max_tx_cnt toward us. Acks are built from it:
+ *
+ * ACK_UP_TO:   nothing received past base
+ * SACK:        base, then ranges received past it (scanning the ring)
+ * pb_ack:      base alone, the only seq since our last ack
  */
-typedef struct sock_ack {
-	/*! Starting seq inclusive */
-	uint32_t start;
+typedef struct sock_rwin {
+	/*! Every seq up to and including base has been received */
+	uint32_t base;
+
+	/*! Highest seq received */
+	uint32_t high;
 
-	/*! Ending seq inclusive */
-	uint32_t end;
+	/*! Seqs the ring covers past base, a power of two */
+	uint32_t size;
 
-	/*! Hang on sconn->to_ack */
-	 TAILQ_ENTRY(sock_ack) entry;
-} sock_ack_t;
+	/*! Seqs received (duplicates too) since our last ack */
+	uint32_t unacked;
+
+	/*! Where the next SACK resumes looking for ranges past base */
+	uint32_t sack_next;
+
+	/*! Seqs received in (base, base + size] */
+	uint64_t *bits;
+} sock_rwin_t;
 
 typedef struct sock_conn {
 	/*! Owning conn */
@@ -1136,18 +1343,65 @@ typedef struct sock_conn {
 	/*! Slow start threshhold */
 	uint32_t ssthresh;
 
+	/*! Txs on tx_seqs, what the congestion window limits */
+	uint32_t inflight;
+
+	/*! Controller state (see ctp_sock_cc.c) */
+	struct {
+		/*! Acks counted toward the next cwnd increase */
+		uint32_t cwnd_cnt;
+
+		/*! Sends are not reduced again for losses sent before */
+		uint64_t recover_us;
+
+		/*! CUBIC: cwnd before the last reduction */
+		uint32_t w_max;
+
+		/*! CUBIC: window the cubic grows back to */
+		uint32_t origin;
+
+		/*! CUBIC: msecs from epoch_us to reach origin */
+		uint32_t k_ms;
+
+		/*! CUBIC: start of the growth epoch; delay: of the round */
+		uint64_t epoch_us;
+
+		/*! Delay: lowest RTT seen, lowest RTT this round (usecs) */
+		uint32_t base_rtt;
+		uint32_t round_rtt;
+	} cc;
+
+	/*! Pacing token bucket, in thousandths of a message */
+	uint32_t pace_tokens;
+
+	/*! Last refill of the bucket */
+	uint64_t pace_us;
+
+	/*! Fires when a paced connection may send again */
+	sock_timer_t pace_timer;
+
 	/*! Pending sends waiting on acks */
 	 TAILQ_HEAD(s_tx_seqs, sock_tx) tx_seqs;
 
-	/*! Peer's last contiguous seqno acked (ACK_UP_TO) */
+	/*! Peer's cumulative seq (rwin.base) our last ack reported */
 	uint32_t acked;
 
 	/*! Peer's last seq received */
 	uint32_t last_recvd_seq;
 
-	/*! Peer's last timestamp received */
+	/*! Peer's timestamp to echo in our next ack, 0 if none */
 	uint32_t ts;
 
+	/*! Smoothed RTT and its mean deviation (usecs) */
+	uint32_t srtt;
+	uint32_t rttvar;
+
+	/*! Retransmission timeout (usecs), 0 until the first RTT sample */
+	uint32_t rto;
+
+	/*! Last time an ack completed one of our pending txs */
+	uint64_t last_acked_us;
+
 	/*! Seq of last ack tx */
 	uint32_t last_ack_seq;
 
@@ -1157,8 +1411,17 @@ typedef struct sock_conn {
 	/*! Do we have an ack queued to send? */
 	int ack_queued;
 
-	/*! List of sequence numbers to ack */
-	TAILQ_HEAD(s_acks, sock_ack) acks;
+	/*! Fires when delayed acks must go out */
+	sock_timer_t ack_timer;
+
+	/*! Last time we heard from the peer (keepalive) */
+	uint64_t last_recv_us;
+
+	/*! Fires when the keepalive timeout may have expired */
+	sock_timer_t ka_timer;
+
+	/*! Peer's seqs received so far */
+	sock_rwin_t rwin;
 
 	/*! Last RMA started */
 	uint32_t rma_id;
@@ -1170,40 +1433,6 @@ typedef struct sock_conn {
 	uint32_t rnr;
 } sock_conn_t;
 
-/*
- * Only call if holding the ep->lock and sconn->acks is not empty
- *
- * For ordered connections:
- * - If only one item, return 0
- * - If more than one item, return 1
- * For unordered connections, even if we have a single item, we need to issue
- * a SACK, because we limit the tracking of acked message, ACK_UP_TO is not
- * usable.
- */
-static inline int sock_need_sack(sock_conn_t * sconn)
-{
-	
-
-	if (sconn->conn->connection.attribute == CCI_CONN_ATTR_RU) {
-		sock_ack_t *ack = NULL;
-
-		/* If there are more than 1 msg to ACK, we should
-		   issue a SACK, otherwise ACK a single msg */
-		ack = TAILQ_FIRST(&sconn->acks);
-		if (TAILQ_FIRST(&sconn->acks) == TAILQ_LAST(&sconn->acks, s_acks))
-		{
-			if (ack->start == ack->end)
-				return 0;
-			else
-				return 1;
-		} else 
-			return 1;
-	} else {
-		/* Ordered connection */
-		return TAILQ_FIRST(&sconn->acks) != TAILQ_LAST(&sconn->acks, s_acks);
-	}
-}
-
 typedef struct sock_dev {
 	/*! Our IP address in network order */
 	in_addr_t ip;
@@ -1213,6 +1442,27 @@ typedef struct sock_dev {
 
 	/*! Set socket buffers sizes */
 	uint32_t bufsize;
+
+	/*! Datagrams to receive per call, 0 for the default */
+	uint32_t rx_batch;
+
+	/*! Use UDP GSO/GRO when the kernel supports it */
+	uint32_t gso;
+
+	/*! Receive sockets (and threads) per endpoint, 0 for one */
+	uint32_t shards;
+
+	/*! Drop one in every drop reliable data messages received (testing) */
+	uint32_t drop;
+
+	/*! Congestion controller, NULL for none */
+	const sock_cc_ops_t *cc;
+
+	/*! Pace sends */
+	uint32_t pace;
+
+	/*! Path MTU: 0 to probe, SOCK_PMTU_OFF, or fixed */
+	uint32_t pmtu;
 } sock_dev_t;
 
 typedef enum sock_fd_type {
@@ -20,6 +20,7 @@
 #pragma warning(disable:2259)
 #endif /*   __INTEL_COMPILER	*/
 
+#define _GNU_SOURCE
 #include "cci/private_config.h"
 
 #include <stdio.h>
@@ -41,9 +42,11 @@
 
 #ifdef HAVE_SYS_EPOLL_H
 #include <sys/epoll.h>
-#else
-#include <poll.h>
 #endif /* HAVE_SYS_EPOLL_H */
+#include <poll.h>
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
 
 #include "cci.h"
 #include "cci_lib_types.h"
@@ -102,6 +105,14 @@ static int ctp_sock_arm_os_handle(cci_endpoint_t * endpoint, int flags);
 static int ctp_sock_get_event(cci_endpoint_t * endpoint,
                               cci_event_t ** const event);
 static int ctp_sock_return_event(cci_event_t * event);
+static int ctp_sock_get_events(cci_endpoint_t * endpoint,
+                               cci_event_t ** const events,
+                               uint32_t max,
+                               uint32_t * count);
+static int ctp_sock_return_events(cci_event_t ** const events,
+                                  uint32_t count);
+static int ctp_sock_send_batch(cci_send_desc_t * descs, uint32_t count);
+static int ctp_sock_pollset_arm(cci_endpoint_t * endpoint);
 static int ctp_sock_send(cci_connection_t * connection,
                          const void *msg_ptr,
                          uint32_t msg_len,
@@ -130,14 +141,20 @@ static int ctp_sock_rma(cci_connection_t * connection,
                         const void *context,
                         int flags);
 static uint8_t sock_ip_hash(in_addr_t ip, uint16_t port);
-static void sock_progress_sends(cci__ep_t * ep);
+static int sock_progress_sends(cci__ep_t * ep);
 static void *sock_progress_thread(void *arg);
 static void *sock_recv_thread(void *arg);
+static void *sock_shard_thread(void *arg);
 static void sock_ack_conns(cci__ep_t * ep);
 static inline int pack_piggyback_ack(cci__ep_t *ep,
                                      sock_conn_t *sconn, sock_tx_t *tx);
-static inline int sock_ack_sconn(sock_ep_t *sep, sock_conn_t *sconn);
+static inline int sock_ack_sconn(sock_ep_t *sep, sock_conn_t *sconn,
+                                 sock_dgram_batch_t *batch);
+static cci__evt_t *sock_conn_timer(cci__ep_t *ep, sock_timer_t *timer,
+                                   uint64_t now, sock_dgram_batch_t *batch);
 static int sock_recvfrom_ep(cci__ep_t * ep);
+static int sock_recvfrom_shard(cci__ep_t * ep, sock_shard_t * shard);
+static void sock_flush_replies(cci__ep_t * ep, sock_shard_t * shard);
 int progress_recv (cci__ep_t *ep);
 
 /*
@@ -187,7 +204,11 @@ cci_plugin_ctp_t cci_ctp_sock_plugin = {
 	ctp_sock_sendv,
 	ctp_sock_rma_register,
 	ctp_sock_rma_deregister,
-	ctp_sock_rma
+	ctp_sock_rma,
+	ctp_sock_get_events,
+	ctp_sock_return_events,
+	ctp_sock_send_batch,
+	ctp_sock_pollset_arm
 };
 
 static inline int
@@ -297,9 +318,102 @@ static inline void sock_drop_msg(cci_os_handle_t sock)
         return;
 }
 
+/*
+ * Get len bytes of the datagram that rx is handling into rx->buffer.
+ * A datagram from the batched receive is already there; otherwise this
+ * reads (or peeks at) the socket, unless an earlier peek got them.
+ */
+static inline int
+sock_rx_recv (sock_rx_t *rx,
+              uint32_t len,
+              int flags,
+              struct sockaddr_in *sin_out)
+{
+	struct sockaddr_in sin;
+	socklen_t sin_len;
+	int ret;
+
+	if (rx->dgram_len) {
+		if (sin_out != NULL)
+			*sin_out = rx->sin;
+		return len < rx->dgram_len ? (int)len : (int)rx->dgram_len;
+	}
+
+	if (!(flags & MSG_PEEK)) {
+		rx->peek_len = 0;
+		return sock_recv_msg (rx->shard->sock, rx->buffer, len, flags,
+		                      sin_out);
+	}
+
+	if (len <= rx->peek_len && sin_out == NULL)
+		return len;
+
+	/* One peek, which may return less than len for a short datagram */
+	sin_len = sizeof(sin);
+	ret = recvfrom (rx->shard->sock, rx->buffer, len, flags,
+	                (struct sockaddr *)&sin, &sin_len);
+	if (ret < 0)
+		return ret;
+	rx->peek_len = ret;
+	if (sin_out != NULL)
+		*sin_out = sin;
+
+	return ret;
+}
+
+/*
+ * Get the payload that follows the hdr_len header of a datagram into ptr:
+ * copied out of rx if the batched receive got the whole datagram,
+ * otherwise received straight into ptr, the header going to rx->buffer.
+ */
+static inline int
+sock_rx_recv_payload (sock_rx_t *rx,
+                      uint32_t hdr_len,
+                      void *ptr,
+                      uint32_t len)
+{
+	struct sockaddr_in sin;
+	struct msghdr msg;
+	struct iovec iov[2];
+	int ret;
+
+	if (rx->dgram_len) {
+		if (rx->dgram_len < hdr_len + len)
+			return -1;
+		memcpy (ptr, (void*)((uintptr_t)rx->buffer + hdr_len), len);
+		return hdr_len + len;
+	}
+
+	/* We receive the entire message using an IOVEC: the first elt of the
+	   IOVEC is the header and the second one the actual data */
+	memset (&msg, 0, sizeof (msg));
+	msg.msg_name = (void*)&sin;
+	msg.msg_namelen = sizeof(sin);
+	iov[0].iov_len = hdr_len;
+	iov[0].iov_base = rx->buffer;
+	iov[1].iov_len = len;
+	iov[1].iov_base = ptr;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+again:
+	ret = recvmsg (rx->shard->sock, &msg, 0);
+	if (ret == -1 && errno == EAGAIN)
+		goto again;
+
+	return ret;
+}
+
+/* Discard the rest of the datagram that rx is handling */
+static inline void sock_rx_drop(sock_rx_t *rx)
+{
+	if (!rx->dgram_len)
+		sock_drop_msg(rx->shard->sock);
+}
+
 static inline int sock_create_threads (cci__ep_t *ep)
 {
 	int ret;
+	uint32_t i;
 	sock_ep_t *sep;
 
 	assert (ep);
@@ -310,6 +424,13 @@ static inline int sock_create_threads (cci__ep_t *ep)
 	if (ret)
 		goto out;
 
+	for (i = 1; i < sep->nshards; i++) {
+		ret = pthread_create(&sep->shards[i].recv_tid, NULL,
+		                     sock_shard_thread, &sep->shards[i]);
+		if (ret)
+			goto out;
+	}
+
 	ret = pthread_create(&sep->progress_tid, NULL, sock_progress_thread, (void*)ep);
 	if (ret)
 		goto out;
@@ -320,22 +441,36 @@ out:
 
 static inline int sock_terminate_threads (sock_ep_t *sep)
 {
+	uint32_t i;
+
 	CCI_ENTER;
 
 	assert (sep);
 
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_kick_progress(sep);
 
 	pthread_join(sep->progress_tid, NULL);
 	pthread_join(sep->recv_tid, NULL);
+	for (i = 1; i < sep->nshards; i++)
+		pthread_join(sep->shards[i].recv_tid, NULL);
 
 	CCI_EXIT;
 
 	return CCI_SUCCESS;
 }
 
+/*
+ * The largest max_send_size whose datagrams, with our header and the IP
+ * and UDP ones, fit in an MTU of mtu bytes (never below SOCK_MIN_MSS).
+ */
+static inline uint32_t sock_mtu_to_mss(uint32_t mtu)
+{
+	if (mtu < SOCK_MIN_MSS + SOCK_MAX_HDRS)
+		return SOCK_MIN_MSS;
+	mtu -= SOCK_MAX_HDRS;
+	return mtu > SOCK_DEFAULT_MSS ? SOCK_DEFAULT_MSS : mtu;
+}
+
 static int ctp_sock_init(cci_plugin_ctp_t *plugin,
 			uint32_t abi_ver, uint32_t flags, uint32_t * caps)
 {
@@ -436,11 +571,8 @@ static int ctp_sock_init(cci_plugin_ctp_t *plugin,
 					device->max_send_size = SOCK_DEFAULT_MSS;
 				} else {
 					/* compute mss from mtu */
-					if (mtu > SOCK_UDP_MAX)
-						mtu = SOCK_UDP_MAX;
-					mtu -= SOCK_MAX_HDR_SIZE;
-					assert(mtu >= SOCK_MIN_MSS); /* FIXME rather ignore the device? */
-					device->max_send_size = mtu;
+					device->max_send_size =
+						sock_mtu_to_mss(mtu);
 				}
 
 				cci__add_dev(dev);
@@ -511,6 +643,40 @@ static int ctp_sock_init(cci_plugin_ctp_t *plugin,
 					const char *size_str = *arg + 8;
 					sdev->bufsize = strtol(size_str,
 					                       NULL, 0);
+				} else if (0 == strncmp("rx_batch=", *arg, 9)) {
+					const char *batch_str = *arg + 9;
+					sdev->rx_batch = strtol(batch_str,
+					                        NULL, 0);
+				} else if (0 == strncmp("gso=", *arg, 4)) {
+					const char *gso_str = *arg + 4;
+					sdev->gso = strtol(gso_str, NULL, 0);
+				} else if (0 == strncmp("shards=", *arg, 7)) {
+					const char *shards_str = *arg + 7;
+					sdev->shards = strtol(shards_str,
+					                      NULL, 0);
+				} else if (0 == strncmp("drop=", *arg, 5)) {
+					const char *drop_str = *arg + 5;
+					sdev->drop = strtol(drop_str, NULL, 0);
+				} else if (0 == strncmp("cc=", *arg, 3)) {
+					const char *cc_str = *arg + 3;
+
+					sdev->cc = sock_cc_find(cc_str);
+					if (!sdev->cc && strcmp(cc_str, "none"))
+						debug(CCI_DB_WARN, "%s: unknown "
+						      "congestion control %s, "
+						      "using none", __func__,
+						      cc_str);
+				} else if (0 == strncmp("pace=", *arg, 5)) {
+					const char *pace_str = *arg + 5;
+					sdev->pace = strtol(pace_str, NULL, 0);
+				} else if (0 == strncmp("pmtu=", *arg, 5)) {
+					const char *pmtu_str = *arg + 5;
+
+					if (0 == strcmp(pmtu_str, "off"))
+						sdev->pmtu = SOCK_PMTU_OFF;
+					else
+						sdev->pmtu = strtol(pmtu_str,
+						                    NULL, 0);
 				} else if (0 == strncmp("interface=",
 				                        *arg, 10))
 				{
@@ -556,11 +722,8 @@ static int ctp_sock_init(cci_plugin_ctp_t *plugin,
 					device->max_send_size = SOCK_DEFAULT_MSS;
 				} else {
 					/* compute mss from mtu */
-					if (mtu > SOCK_UDP_MAX)
-						mtu = SOCK_UDP_MAX;
-					mtu -= SOCK_MAX_HDR_SIZE;
-					assert(mtu >= SOCK_MIN_MSS); /* FIXME rather ignore the device? */
-					device->max_send_size = mtu;
+					device->max_send_size =
+						sock_mtu_to_mss(mtu);
 				}
 				/* queue to the main device list now */
 				TAILQ_REMOVE(&globals->configfile_devs, dev, entry);
@@ -672,6 +835,150 @@ sock_set_nonblocking(cci_os_handle_t sock, sock_fd_type_t type, void *p)
 	return 0;
 }
 
+/*
+ * Turn on UDP segmentation offload for sends and UDP GRO for receives if
+ * the kernel knows about them. Either one may be missing, in which case
+ * the endpoint keeps using plain datagrams for that direction.
+ */
+static void sock_enable_gso(cci__ep_t *ep)
+{
+	sock_ep_t *sep = ep->priv;
+	uint32_t i;
+	int val;
+
+#ifdef SOCK_HAVE_GSO
+	/* A zero segment size only probes the option, each send sets its own */
+	val = 0;
+	if (setsockopt(sep->sock, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)))
+		debug(CCI_DB_WARN, "%s: UDP GSO not available (%s)",
+		      __func__, strerror(errno));
+	else
+		sep->gso = 1;
+#else
+	debug(CCI_DB_WARN, "%s: UDP GSO not supported by this build",
+	      __func__);
+#endif
+
+#ifdef SOCK_HAVE_GRO
+	/* Coalesced datagrams are split in the batched receive path only */
+	for (i = 0; i < sep->nshards && sep->rx_batch > 1; i++) {
+		sock_shard_t *shard = &sep->shards[i];
+
+		val = 1;
+		if (setsockopt(shard->sock, SOL_UDP, UDP_GRO, &val,
+		               sizeof(val))) {
+			debug(CCI_DB_WARN, "%s: UDP GRO not available (%s)",
+			      __func__, strerror(errno));
+			break;
+		}
+		shard->gro_buf = malloc(SOCK_GRO_BATCH * SOCK_GRO_BUF_SIZE);
+		if (!shard->gro_buf) {
+			val = 0;
+			setsockopt(shard->sock, SOL_UDP, UDP_GRO, &val,
+			           sizeof(val));
+		}
+	}
+#endif
+	UNUSED_PARAM(i);
+	UNUSED_PARAM(val);
+
+	debug(CCI_DB_INFO, "%s: UDP GSO %s, GRO %s", __func__,
+	      sep->gso ? "on" : "off", sep->shards[0].gro_buf ? "on" : "off");
+}
+
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+/*
+ * Have the kernel hand each datagram to shard sock_ip_hash() % nshards of
+ * its source. sock_ip_hash() boils down to the xor of the bytes of the
+ * address and port, which a classic BPF program can compute from the IP
+ * and UDP headers (assuming no IP options).
+ */
+static int sock_steer_shards(sock_ep_t *sep)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 13),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 14),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 15),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 20),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 21),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, sep->nshards),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+
+	return setsockopt(sep->sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+	                  &prog, sizeof(prog));
+}
+#endif
+
+/*
+ * Open the sockets of the shards after the first one, on the address
+ * shard 0 is bound to.
+ */
+static int sock_open_shards(cci__ep_t *ep, unsigned int rcvbuf_size)
+{
+	sock_ep_t *sep = ep->priv;
+	uint32_t i;
+	int ret, one = 1;
+
+	if (sep->nshards < 2)
+		return 0;
+
+	for (i = 1; i < sep->nshards; i++) {
+		sock_shard_t *shard = &sep->shards[i];
+
+		shard->sock = socket(PF_INET, SOCK_DGRAM, 0);
+		if (shard->sock == -1)
+			return errno;
+
+		ret = setsockopt(shard->sock, SOL_SOCKET, SO_REUSEPORT,
+		                 &one, sizeof(one));
+		if (ret == -1)
+			return errno;
+
+		if (rcvbuf_size > 0) {
+			ret = setsockopt(shard->sock, SOL_SOCKET, SO_RCVBUF,
+			                 &rcvbuf_size, sizeof(rcvbuf_size));
+			if (ret == -1)
+				debug(CCI_DB_WARN, "%s: Cannot set recv buffer "
+				      "size", __func__);
+		}
+
+		ret = bind(shard->sock, (const struct sockaddr *)&sep->sin,
+		           sizeof(sep->sin));
+		if (ret == -1)
+			return errno;
+
+		ret = sock_set_nonblocking(shard->sock, SOCK_FD_EP, ep);
+		if (ret)
+			return ret;
+	}
+
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+	if (sock_steer_shards(sep))
+		debug(CCI_DB_WARN, "%s: cannot steer peers to shards (%s), "
+		      "the kernel will spread them", __func__,
+		      strerror(errno));
+#endif
+	debug(CCI_DB_INFO, "%s: %u receive shards", __func__, sep->nshards);
+
+	return 0;
+}
+
 static inline void sock_close_socket(cci_os_handle_t sock)
 {
 	close(sock);
@@ -732,6 +1039,15 @@ static int ctp_sock_create_endpoint_at(cci_device_t * device,
 	}
 	sep->closing = 0;
 	pthread_mutex_init (&sep->progress_mutex, NULL);
+	for (i = 0; i < SOCK_MAX_SHARDS; i++) {
+		sock_shard_t *shard = &sep->shards[i];
+
+		shard->index = i;
+		shard->ep = ep;
+		pthread_mutex_init (&shard->recv_mutex, NULL);
+		pthread_mutex_init (&shard->lock, NULL);
+		TAILQ_INIT(&shard->idle_rxs);
+	}
 	pthread_cond_init (&sep->wait_condition, NULL);
 
 	sep->sock = socket(PF_INET, SOCK_DGRAM, 0);
@@ -789,6 +1105,25 @@ static int ctp_sock_create_endpoint_at(cci_device_t * device,
 	}
 #endif
 
+	sep->shards[0].sock = sep->sock;
+	sep->nshards = 1;
+#ifdef SO_REUSEPORT
+	if (sdev->shards > 1) {
+		int one = 1;
+
+		ret = setsockopt (sep->sock, SOL_SOCKET, SO_REUSEPORT,
+		                  &one, sizeof (one));
+		if (ret == -1)
+			debug (CCI_DB_WARN, "%s: Cannot share the port (%s), "
+			       "using one receive shard", __func__,
+			       strerror (errno));
+		else if (sdev->shards > SOCK_MAX_SHARDS)
+			sep->nshards = SOCK_MAX_SHARDS;
+		else
+			sep->nshards = sdev->shards;
+	}
+#endif
+
 	/* bind socket to device */
 	memset(&sin, 0, sizeof(sin));
 	sin.sin_family = AF_INET;
@@ -813,6 +1148,10 @@ static int ctp_sock_create_endpoint_at(cci_device_t * device,
 		goto out;
 	}
 
+	ret = sock_open_shards(ep, rcvbuf_size);
+	if (ret)
+		goto out;
+
 	memset(name, 0, sizeof(name));
 	sprintf(name, "sock://");
 	sock_sin_to_name(sep->sin, name + (uintptr_t) 7, sizeof(name) - 7);
@@ -824,11 +1163,11 @@ static int ctp_sock_create_endpoint_at(cci_device_t * device,
 	}
 
 	TAILQ_INIT(&sep->idle_txs);
-	TAILQ_INIT(&sep->idle_rxs);
 	TAILQ_INIT(&sep->handles);
 	TAILQ_INIT(&sep->rma_ops);
 	TAILQ_INIT(&sep->queued);
 	TAILQ_INIT(&sep->pending);
+	sock_timer_wheel_init(&sep->timers, sock_get_usecs());
 
 	sep->tx_buf = calloc (1, ep->tx_buf_cnt * ep->buffer_len);
 	if (!sep->tx_buf) {
@@ -847,6 +1186,7 @@ static int ctp_sock_create_endpoint_at(cci_device_t * device,
 		sock_tx_t *tx = &sep->txs[i];
 
 		tx->ctx = SOCK_CTX_TX;
+		tx->timer.type = SOCK_TIMER_TX;
 		tx->evt.event.type = CCI_EVENT_SEND;
 		tx->evt.ep = ep;
 		tx->buffer = (void*)((uintptr_t)sep->tx_buf
@@ -877,8 +1217,39 @@ static int ctp_sock_create_endpoint_at(cci_device_t * device,
 		rx->buffer = (void*)((uintptr_t)sep->rx_buf
 		                     + (i * ep->buffer_len));
 		rx->len = 0;
-		TAILQ_INSERT_TAIL(&sep->idle_rxs, rx, entry);
+		rx->shard = &sep->shards[i % sep->nshards];
+		TAILQ_INSERT_TAIL(&rx->shard->idle_rxs, rx, entry);
+	}
+
+	sep->rx_batch = sdev->rx_batch ? sdev->rx_batch : SOCK_RX_BATCH;
+	if (sep->rx_batch > SOCK_RX_BATCH_MAX)
+		sep->rx_batch = SOCK_RX_BATCH_MAX;
+
+	if (sdev->gso)
+		sock_enable_gso(ep);
+
+	sep->drop = sdev->drop;
+
+	sep->cc = sdev->cc;
+	if (sdev->pace && !sep->cc)
+		debug(CCI_DB_WARN, "%s: pacing needs a congestion control "
+		      "(cc=), not pacing", __func__);
+	else
+		sep->pace = sdev->pace != 0;
+
+	sep->pmtu = sdev->pmtu;
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_WANT)
+	if (sep->pmtu != SOCK_PMTU_OFF) {
+		/* Set DF on what fits the known path MTU, so that the kernel
+		   learns when a path narrows (see sock_path_mss()) */
+		int val = IP_PMTUDISC_WANT;
+
+		if (setsockopt(sep->sock, IPPROTO_IP, IP_MTU_DISCOVER, &val,
+		               sizeof(val)))
+			debug(CCI_DB_WARN, "%s: Cannot set path MTU discovery "
+			      "(%s)", __func__, strerror(errno));
 	}
+#endif
 
 	ret = sock_set_nonblocking(sep->sock, SOCK_FD_EP, ep);
 	if (ret)
@@ -964,6 +1335,12 @@ out:
 			free(sep->ids);
 		if (sep->sock)
 			sock_close_socket(sep->sock);
+		for (i = 0; i < SOCK_MAX_SHARDS; i++) {
+			if (i > 0 && sep->shards[i].sock > 0)
+				sock_close_socket(sep->shards[i].sock);
+			if (sep->shards[i].gro_buf)
+				free(sep->shards[i].gro_buf);
+		}
 		free(sep);
 		ep->priv = NULL;
 	}
@@ -1031,6 +1408,8 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 
 		if (sep->sock)
 			sock_close_socket(sep->sock);
+		for (i = 1; i < (int)sep->nshards; i++)
+			sock_close_socket(sep->shards[i].sock);
 
 		for (i = 0; i < SOCK_EP_HASH_SIZE; i++) {
 			while (!TAILQ_EMPTY(&sep->conn_hash[i])) {
@@ -1054,6 +1433,10 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 
 		free (sep->rxs);
 		free (sep->rx_buf);
+		for (i = 0; i < (int)sep->nshards; i++) {
+			if (sep->shards[i].gro_buf)
+				free (sep->shards[i].gro_buf);
+		}
 
 		while (!TAILQ_EMPTY(&sep->rma_ops)) {
 			sock_rma_op_t *rma_op = TAILQ_FIRST(&sep->rma_ops);
@@ -1134,6 +1517,46 @@ static uint8_t sock_ip_hash(in_addr_t ip, uint16_t port)
 	return (port & 0x00FF) ^ ((port & 0xFF00) >> 8);
 }
 
+/*
+ * The max_send_size that fits the path MTU to a peer, 0 if we do not know
+ * better than the device MTU. The path MTU comes from the pmtu= device
+ * option, or from the kernel's route to the peer, which a connected probe
+ * socket reports with IP_MTU (including what ICMP "fragmentation needed"
+ * taught it since).
+ */
+static uint32_t sock_path_mss(sock_ep_t *sep, struct sockaddr_in sin)
+{
+	uint32_t mtu = sep->pmtu;
+
+	if (mtu == SOCK_PMTU_OFF)
+		return 0;
+
+#ifdef IP_MTU
+	if (!mtu) {
+		struct sockaddr_in local = sep->sin;
+		socklen_t len = sizeof(int);
+		int s, val;
+
+		s = socket(PF_INET, SOCK_DGRAM, 0);
+		if (s == -1)
+			return 0;
+		/* same source address, same route as the endpoint */
+		local.sin_port = 0;
+		if (!bind(s, (const struct sockaddr *)&local, sizeof(local)) &&
+		    !connect(s, (const struct sockaddr *)&sin, sizeof(sin)) &&
+		    !getsockopt(s, IPPROTO_IP, IP_MTU, &val, &len) && val > 0)
+			mtu = (uint32_t) val;
+		close(s);
+	}
+#endif
+	if (!mtu)
+		return 0;
+
+	debug(CCI_DB_CONN, "%s: path MTU %u to %s:%u", __func__, mtu,
+	      inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
+	return sock_mtu_to_mss(mtu);
+}
+
 static int ctp_sock_accept(cci_event_t *event, const void *context)
 {
 	uint8_t a;
@@ -1178,12 +1601,15 @@ static int ctp_sock_accept(cci_event_t *event, const void *context)
 	conn->plugin = ep->plugin;
 
 	conn->tx_timeout = ep->tx_timeout;
-	conn->priv = calloc(1, sizeof(*sconn));
+	/* the receive window's ring follows the sconn */
+	conn->priv = calloc(1, sizeof(*sconn) +
+	                    sock_rwin_size(ep->rx_buf_cnt) / 8);
 	if (!conn->priv) {
 		free(conn);
 		CCI_EXIT;
 		return CCI_ENOMEM;
 	}
+	sock_rwin_setup(conn->priv, sock_rwin_size(ep->rx_buf_cnt));
 
 	/* get a tx */
 	tx = sock_get_tx (ep);
@@ -1218,15 +1644,22 @@ static int ctp_sock_accept(cci_event_t *event, const void *context)
 	}
 	if (mss < conn->connection.max_send_size)
 		conn->connection.max_send_size = mss;
+	/* the path back may be narrower than the one the peer probed */
+	mss = sock_path_mss(sep, rx->sin);
+	if (mss && mss < conn->connection.max_send_size)
+		conn->connection.max_send_size = mss;
 
 	sconn = conn->priv;
 	TAILQ_INIT(&sconn->tx_seqs);
-	TAILQ_INIT(&sconn->acks);
 	TAILQ_INIT(&sconn->rmas);
+	sconn->ack_timer.type = SOCK_TIMER_ACK;
+	sconn->ka_timer.type = SOCK_TIMER_KEEPALIVE;
 	sconn->conn = conn;
 	sconn->cwnd = SOCK_INITIAL_CWND;
 	sconn->status = SOCK_CONN_READY;	/* set ready since the app thinks it is */
 	sconn->last_recvd_seq = 0;
+	sconn->acked = peer_seq;
+	sock_rwin_init(&sconn->rwin, peer_seq);
 	*((struct sockaddr_in *)&sconn->sin) = rx->sin;
 	sconn->peer_id = id;
 	sock_get_id(sep, &sconn->id);
@@ -1246,6 +1679,8 @@ static int ctp_sock_accept(cci_event_t *event, const void *context)
 	i = sock_ip_hash(sconn->sin.sin_addr.s_addr, sconn->sin.sin_port);
 	pthread_mutex_lock(&ep->lock);
 	TAILQ_INSERT_TAIL(&sep->conn_hash[i], sconn, entry);
+	sock_arm_keepalive(sep, sconn);
+	sock_cc_init(sep, sconn, sock_get_usecs());
 	pthread_mutex_unlock(&ep->lock);
 
 	debug_ep(ep, CCI_DB_CONN, "%s: accepting conn with hash %d",
@@ -1292,9 +1727,7 @@ static int ctp_sock_accept(cci_event_t *event, const void *context)
 	pthread_mutex_unlock(&ep->lock);
 
 	/* try to progress txs */
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_kick_progress(sep);
 	
 	CCI_EXIT;
 
@@ -1379,9 +1812,7 @@ static int ctp_sock_reject(cci_event_t *event)
 	pthread_mutex_unlock(&ep->lock);
 
 	/* try to progress txs */
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_kick_progress(sep);
 	
 #if CCI_DEBUG
 	{
@@ -1524,7 +1955,7 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint,
 	struct sockaddr_in *sin = NULL;
 	void *ptr = NULL;
 	in_addr_t ip;
-	uint32_t ts = 0;
+	uint32_t ts = 0, mss;
 	struct s_active *active_list;
 	sock_handshake_t *hs = NULL;
 	uint16_t port;
@@ -1540,6 +1971,8 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint,
 		return CCI_ENODEV;
 	}
 
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+
 	/* allocate a new connection */
 	conn = calloc(1, sizeof(*conn));
 	if (!conn) {
@@ -1547,16 +1980,20 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint,
 		return CCI_ENOMEM;
 	}
 
-	conn->priv = calloc(1, sizeof(*sconn));
+	/* the receive window's ring follows the sconn */
+	conn->priv = calloc(1, sizeof(*sconn) +
+	                    sock_rwin_size(ep->rx_buf_cnt) / 8);
 	if (!conn->priv) {
 		ret = CCI_ENOMEM;
 		goto out;
 	}
 	sconn = conn->priv;
 	sconn->conn = conn;
+	sock_rwin_setup(sconn, sock_rwin_size(ep->rx_buf_cnt));
 	TAILQ_INIT(&sconn->tx_seqs);
-	TAILQ_INIT(&sconn->acks);
 	TAILQ_INIT(&sconn->rmas);
+	sconn->ack_timer.type = SOCK_TIMER_ACK;
+	sconn->ka_timer.type = SOCK_TIMER_KEEPALIVE;
 
 	/* conn->tx_timeout = 0  by default */
 
@@ -1583,11 +2020,13 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint,
 	/* peer will assign id */
 
 	/* get our endpoint and device */
-	ep = container_of(endpoint, cci__ep_t, endpoint);
 	sep = ep->priv;
 	dev = ep->dev;
 
 	connection->max_send_size = dev->device.max_send_size;
+	mss = sock_path_mss(sep, *sin);
+	if (mss && mss < connection->max_send_size)
+		connection->max_send_size = mss;
 	conn->plugin = ep->plugin;
 
 	/* Dealing with keepalive, if set, include the keepalive timeout value into
@@ -1676,9 +2115,7 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint,
 	pthread_mutex_unlock(&ep->lock);
 
 	/* try to progress txs */
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_kick_progress(sep);
 
 	CCI_EXIT;
 	return CCI_SUCCESS;
@@ -1729,6 +2166,9 @@ static int ctp_sock_disconnect(cci_connection_t * connection)
 	i = sock_ip_hash(sconn->sin.sin_addr.s_addr, sconn->sin.sin_port);
 	pthread_mutex_lock(&ep->lock);
 	TAILQ_REMOVE(&sep->conn_hash[i], sconn, entry);
+	sock_timer_del(&sep->timers, &sconn->ack_timer);
+	sock_timer_del(&sep->timers, &sconn->ka_timer);
+	sock_timer_del(&sep->timers, &sconn->pace_timer);
 	pthread_mutex_unlock(&ep->lock);
 
 	free(sconn);
@@ -1818,6 +2258,47 @@ static int ctp_sock_get_opt(cci_opt_handle_t * handle,
 				*timeout = ep->keepalive_timeout;
 				break;
 			}
+		case CCI_OPT_ENDPT_STATS:
+			{
+				cci_stats_t *stats = val;
+				sock_ep_t *sep = ep->priv;
+				cci__evt_t *evt = NULL;
+
+				pthread_mutex_lock(&ep->lock);
+				TAILQ_FOREACH(evt, &sep->queued, entry)
+					stats->queued++;
+				TAILQ_FOREACH(evt, &sep->pending, entry)
+					stats->pending++;
+				pthread_mutex_unlock(&ep->lock);
+				break;
+			}
+		case CCI_OPT_CONN_STATS:
+			{
+				cci_stats_t *stats = val;
+				cci__conn_t *conn = container_of(handle,
+							cci__conn_t, connection);
+				sock_conn_t *sconn = conn->priv;
+				sock_ep_t *sep = NULL;
+				cci__evt_t *evt = NULL;
+
+				ep = container_of(conn->connection.endpoint,
+						cci__ep_t, endpoint);
+				sep = ep->priv;
+
+				pthread_mutex_lock(&ep->lock);
+				TAILQ_FOREACH(evt, &sep->queued, entry) {
+					if (evt->conn == conn)
+						stats->queued++;
+				}
+				stats->pending = sconn->pending;
+				stats->seq = sconn->seq;
+				stats->acked = sconn->acked;
+				stats->cwnd = sconn->cwnd;
+				if (stats->version >= 2)
+					stats->rtt = sconn->srtt;
+				pthread_mutex_unlock(&ep->lock);
+				break;
+			}
 		default:
 			/* Invalid opt name */
 			ret = CCI_EINVAL;
@@ -1844,13 +2325,30 @@ static int ctp_sock_arm_os_handle(cci_endpoint_t * endpoint, int flags)
 	return CCI_ERR_NOT_IMPLEMENTED;
 }
 
+/* The progress thread queues every event with cci__queue_evt(), which
+ * wakes the pollset, there is nothing to prepare */
+static int ctp_sock_pollset_arm(cci_endpoint_t * endpoint)
+{
+	CCI_ENTER;
+
+	UNUSED_PARAM (endpoint);
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	CCI_EXIT;
+	return CCI_SUCCESS;
+}
+
 static int
 ctp_sock_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
 {
 	int ret = CCI_SUCCESS;
 	cci__ep_t *ep;
 	sock_ep_t *sep;
-	cci__evt_t *ev = NULL, *e;
+	cci__evt_t *ev = NULL;
 
 	CCI_ENTER;
 
@@ -1864,49 +2362,26 @@ ctp_sock_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
 
 	/* try to progress sends... */
 	if (!sep->closing) {
-		pthread_mutex_lock(&sep->progress_mutex);
-		pthread_cond_signal(&sep->wait_condition);
-		pthread_mutex_unlock(&sep->progress_mutex);
+		sock_kick_progress(sep);
 	}
 
-	pthread_mutex_lock(&ep->lock);
-
-	/* give the user the first event */
-	TAILQ_FOREACH(e, &ep->evts, entry) {
-		if (e->event.type == CCI_EVENT_SEND) {
-			/* NOTE: if it is blocking, skip it since sock_sendv()
-			* is waiting on it
-			*/
-			sock_tx_t *tx = container_of(e, sock_tx_t, evt);
-			if (tx->flags & CCI_FLAG_BLOCKING) {
-				continue;
-			} else {
-				ev = e;
-				break;
-			}
-		} else {
-			ev = e;
-			break;
-		}
-	}
+	/* give the user the first event (blocking sends are never queued) */
+	ev = cci__dequeue_evt(ep);
 
 	if (ev) {
-		TAILQ_REMOVE(&ep->evts, ev, entry);
 		*event = &ev->event;
 	} else {
 		*event = NULL;
 		/* No event is available and there are no available
 		   receive buffers. The application must return events
 		   before any more messages can be received. */
-                if (TAILQ_EMPTY(&sep->idle_rxs)) {
+                if (sock_rx_exhausted(sep)) {
                         ret = CCI_ENOBUFS;
                 } else {
 			ret = CCI_EAGAIN;
 		}
 	}
 
-	pthread_mutex_unlock(&ep->lock);
-
 	/* We read on the fd to block again */
 	if (ev && sep->event_fd) {
 		char a[1];
@@ -1927,6 +2402,61 @@ ctp_sock_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
 	return ret;
 }
 
+static int ctp_sock_get_events(cci_endpoint_t * endpoint,
+                               cci_event_t ** const events,
+                               uint32_t max,
+                               uint32_t * count)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t cnt = 0;
+	cci__ep_t *ep;
+	sock_ep_t *sep;
+	cci__evt_t *e;
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	sep = ep->priv;
+
+	/* one progress pass for the whole batch */
+	if (!sep->closing) {
+		sock_kick_progress(sep);
+	}
+
+	while (cnt < max && (e = cci__dequeue_evt(ep)))
+		events[cnt++] = &e->event;
+
+	if (!cnt) {
+		if (sock_rx_exhausted(sep))
+			ret = CCI_ENOBUFS;
+		else
+			ret = CCI_EAGAIN;
+	}
+
+	*count = cnt;
+
+	/* We read on the fd to block again */
+	if (cnt && sep->event_fd) {
+		char a[1];
+		int rc;
+
+		if (event_queue_is_empty (ep)) {
+			rc = read (sep->fd[0], a, sizeof (a));
+			if (rc != sizeof (a)) {
+				ret = CCI_ERROR;
+			}
+		}
+	}
+
+	CCI_EXIT;
+	return ret;
+}
+
 static int ctp_sock_return_event(cci_event_t * event)
 {
 	cci__ep_t *ep;
@@ -1958,6 +2488,7 @@ static int ctp_sock_return_event(cci_event_t * event)
 	switch (event->type) {
 	case CCI_EVENT_SEND:
 	case CCI_EVENT_ACCEPT:
+	case CCI_EVENT_KEEPALIVE_TIMEDOUT:
 		tx = container_of(evt, sock_tx_t, evt);
 		pthread_mutex_lock(&ep->lock);
 		/* insert at head to keep it in cache */
@@ -1967,17 +2498,12 @@ static int ctp_sock_return_event(cci_event_t * event)
 	case CCI_EVENT_RECV:
 	case CCI_EVENT_CONNECT_REQUEST:
 		rx = container_of(evt, sock_rx_t, evt);
-		pthread_mutex_lock(&ep->lock);
-		/* insert at head to keep it in cache */
-		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-		pthread_mutex_unlock(&ep->lock);
+		sock_rx_put(rx);
 		break;
 	case CCI_EVENT_CONNECT:
 		rx = container_of (evt, sock_rx_t, evt);
 		if (rx->ctx == SOCK_CTX_RX) {
-			pthread_mutex_lock(&ep->lock);
-			TAILQ_INSERT_HEAD (&sep->idle_rxs, rx, entry);
-			pthread_mutex_unlock(&ep->lock);
+			sock_rx_put(rx);
 		} else {
 			tx = (sock_tx_t*)rx;
 			pthread_mutex_lock(&ep->lock);
@@ -1998,35 +2524,125 @@ static int ctp_sock_return_event(cci_event_t * event)
 	return ret;
 }
 
-static void sock_progress_pending(cci__ep_t * ep)
+/* All events must belong to the same endpoint (see cci_return_events()) */
+static int ctp_sock_return_events(cci_event_t ** const events,
+                                  uint32_t count)
 {
-	int ret;
-	uint64_t now;
+	cci__ep_t *ep = NULL;
+	sock_ep_t *sep;
+	cci__evt_t *evt;
 	sock_tx_t *tx;
-	cci__evt_t *evt, *tmp, *my_temp_evt;
-	union cci_event *event;	/* generic CCI event */
-	cci__conn_t *conn;
-	sock_conn_t *sconn 	= NULL;
-	sock_ep_t *sep 		= ep->priv;
+	sock_rx_t *rx;
+	uint32_t i;
+	int ret = CCI_SUCCESS;
 
-	TAILQ_HEAD(s_idle_txs, sock_tx) idle_txs
-		= TAILQ_HEAD_INITIALIZER(idle_txs);
-	TAILQ_HEAD(s_evts, cci__evt) evts = TAILQ_HEAD_INITIALIZER(evts);
-	TAILQ_INIT(&idle_txs);                                                  
-        TAILQ_INIT(&evts);
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	for (i = 0; i < count && !ep; i++) {
+		if (events[i])
+			ep = container_of(events[i], cci__evt_t, event)->ep;
+	}
+	if (!ep) {
+		CCI_EXIT;
+		return CCI_SUCCESS;
+	}
+	sep = ep->priv;
+
+	pthread_mutex_lock(&ep->lock);
+	for (i = 0; i < count; i++) {
+		if (!events[i])
+			continue;
+
+		evt = container_of(events[i], cci__evt_t, event);
+		assert(evt->ep == ep);
+
+		/* insert at head to keep them in cache */
+		switch (events[i]->type) {
+		case CCI_EVENT_SEND:
+		case CCI_EVENT_ACCEPT:
+		case CCI_EVENT_KEEPALIVE_TIMEDOUT:
+			tx = container_of(evt, sock_tx_t, evt);
+			TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
+			break;
+		case CCI_EVENT_RECV:
+		case CCI_EVENT_CONNECT_REQUEST:
+			rx = container_of(evt, sock_rx_t, evt);
+			sock_rx_put(rx);
+			break;
+		case CCI_EVENT_CONNECT:
+			rx = container_of (evt, sock_rx_t, evt);
+			if (rx->ctx == SOCK_CTX_RX) {
+				sock_rx_put(rx);
+			} else {
+				tx = (sock_tx_t*)rx;
+				TAILQ_INSERT_HEAD (&sep->idle_txs, tx, dentry);
+			}
+			break;
+		default:
+			debug (CCI_DB_EP,
+			       "%s: unhandled %s event", __func__,
+			       cci_event_type_str(events[i]->type));
+			ret = CCI_ERROR;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	CCI_EXIT;
+
+	return ret;
+}
+
+static void sock_progress_pending(cci__ep_t * ep, uint32_t *budget)
+{
+	int ret;
+	uint64_t now;
+	sock_tx_t *tx;
+	cci__evt_t *evt, *tmp, *my_temp_evt;
+	union cci_event *event;	/* generic CCI event */
+	cci__conn_t *conn;
+	sock_conn_t *sconn 	= NULL;
+	sock_ep_t *sep 		= ep->priv;
+	sock_timer_t *timer;
+	struct s_timers expired;
+	sock_dgram_batch_t batch;
+
+	TAILQ_HEAD(s_idle_txs, sock_tx) idle_txs
+		= TAILQ_HEAD_INITIALIZER(idle_txs);
+	TAILQ_HEAD(s_evts, cci__evt) evts = TAILQ_HEAD_INITIALIZER(evts);
+	TAILQ_INIT(&idle_txs);                                                  
+        TAILQ_INIT(&evts);
+	TAILQ_INIT(&expired);
+	sock_dgram_init(&batch);
 
 	CCI_ENTER; 
 
 	now = sock_get_usecs();
 
-	/* This is only for reliable messages.
-	* Do not dequeue txs, just walk the list.
-	*/
+	/* Only look at the timers that expired: pending txs (reliable and
+	   connection messages) due for a resend or a timeout, delayed acks
+	   and keepalives. */
 
 	pthread_mutex_lock (&ep->lock);
-	TAILQ_FOREACH_SAFE(evt, &sep->pending, entry, tmp) {
-		sock_tx_t *tx = container_of (evt, sock_tx_t, evt);
+	sock_timer_expire(&sep->timers, now, &expired);
+	while ((timer = TAILQ_FIRST(&expired))) {
+		TAILQ_REMOVE(&expired, timer, entry);
+
+		if (timer->type != SOCK_TIMER_TX) {
+			/* may hand back a keepalive timeout event */
+			evt = sock_conn_timer(ep, timer, now, &batch);
+			if (evt)
+				TAILQ_INSERT_TAIL(&evts, evt, entry);
+			continue;
+		}
 
+		tx = container_of (timer, sock_tx_t, timer);
+		evt = &tx->evt;
 		conn = evt->conn;
 		if (conn)
 			sconn = conn->priv;
@@ -2043,7 +2659,13 @@ static void sock_progress_pending(cci__ep_t * ep)
 			         __func__, sock_msg_type(tx->msg_type),
 			         tx->seq);
 
-			TAILQ_REMOVE(&sep->pending, &tx->evt, entry);
+			sock_pending_remove(sep, tx);
+			/* and off tx_seqs, where sock_progress_queued() put
+			   it, giving its place in the window back */
+			if (conn && cci_conn_is_reliable(conn) &&
+			    !(tx->msg_type == SOCK_MSG_CONN_REQUEST ||
+			      tx->msg_type == SOCK_MSG_CONN_REPLY))
+				sock_tx_seq_remove(sconn, tx);
 
 			/* set status and add to completed events */
 
@@ -2075,10 +2697,8 @@ static void sock_progress_pending(cci__ep_t * ep)
 				break;
 			case SOCK_MSG_RMA_READ_REQUEST:
 			case SOCK_MSG_RMA_WRITE:
-				pthread_mutex_lock(&ep->lock);
 				tx->rma_op->pending--;
 				tx->rma_op->status = CCI_ETIMEDOUT;
-				pthread_mutex_unlock(&ep->lock);
 				break;
 			case SOCK_MSG_CONN_REQUEST: {
 				int i;
@@ -2092,9 +2712,7 @@ static void sock_progress_pending(cci__ep_t * ep)
 				i = sock_ip_hash(sconn->sin.sin_addr.s_addr,
 				                 0);
 				active_list = &sep->active_hash[i];
-				pthread_mutex_lock(&ep->lock);
 				TAILQ_REMOVE(active_list, sconn, entry);
-				pthread_mutex_unlock(&ep->lock);
 				free(sconn);
 				free(conn);
 				sconn = NULL;
@@ -2125,9 +2743,13 @@ static void sock_progress_pending(cci__ep_t * ep)
 			}
 			case SOCK_MSG_CONN_ACK:
 			default:
-				/* TODO */
-				CCI_EXIT;
-				return;
+				/* TODO: nobody waits on these, drop them */
+				debug_ep(ep, CCI_DB_WARN,
+				         "%s: dropping %s msg", __func__,
+				         sock_msg_type(tx->msg_type));
+				tx->state = SOCK_TX_IDLE;
+				TAILQ_INSERT_HEAD(&idle_txs, tx, dentry);
+				continue;
 			}
 			/* if SILENT, put idle tx */
 			if (tx->flags & CCI_FLAG_SILENT &&
@@ -2147,15 +2769,25 @@ static void sock_progress_pending(cci__ep_t * ep)
 			continue;
 		}
 
-		/* is it time to resend? */
+		/* is it time to resend? The timer fires early when the
+		   deadline is beyond the wheel. */
 
-		if ((tx->last_attempt_us +
-		    ((1 << tx->send_count) * SOCK_RESEND_TIME_SEC * 1000000)) >
-		     now) {
+		if (SOCK_U64_LT(now, sock_tx_deadline(tx))) {
+			sock_timer_add(&sep->timers, &tx->timer,
+			               sock_tx_deadline(tx));
 			continue;
 		}
 
-		/* need to resend it */
+		/* need to resend it. Txs sent together time out together:
+		   past this pass's budget, the rest go out on the next ticks
+		   instead of overrunning the peer's socket buffer at once. */
+
+		if (!*budget) {
+			sock_timer_add(&sep->timers, &tx->timer,
+			               now + SOCK_TIMER_TICK_US);
+			continue;
+		}
+		sock_pass_spend(budget, tx->len + tx->rma_len);
 
 #if 0
 		if (tx->send_count == 1 && tx->msg_type == SOCK_MSG_SEND && 0) {
@@ -2171,14 +2803,21 @@ static void sock_progress_pending(cci__ep_t * ep)
 		}
 #endif
 
+		if (sconn)
+			sock_cc_loss(sep, sconn, tx, 1, now);
 		tx->last_attempt_us = now;
 		tx->send_count++;
+		sock_timer_add(&sep->timers, &tx->timer, sock_tx_deadline(tx));
+		CCI_TRACE(CCI_TRACE_RESEND, CCI_TRACE_TP_SOCK, sconn, tx->seq,
+			  tx->send_count);
+		CCI_STAT_ADD(ep, conn, resends, 1);
 
 		debug_ep(ep, CCI_DB_MSG,
 		         "%s: re-sending %s msg seq %u count %u",
 		         __func__, sock_msg_type(tx->msg_type), tx->seq,
 		         tx->send_count);
 		pack_piggyback_ack (ep, sconn, tx);
+		sock_tx_stamp(tx, now);
 		ret = sock_sendto(sep->sock, tx->buffer, tx->len, tx->rma_ptr,
 		                  tx->rma_len, sconn->sin);
 		if (tx->rma_ptr == NULL && ret != tx->len) {
@@ -2197,6 +2836,9 @@ static void sock_progress_pending(cci__ep_t * ep)
 			continue;
 		}
 	}
+	/* acks and keepalive probes */
+	if (batch.count)
+		sock_dgram_flush(sep, &batch);
 	pthread_mutex_unlock (&ep->lock);
 
 	/* transfer txs to sock ep's list */
@@ -2234,40 +2876,135 @@ static void sock_progress_pending(cci__ep_t * ep)
 static inline int 
 pack_piggyback_ack (cci__ep_t *ep, sock_conn_t *sconn, sock_tx_t *tx)
 {
-	sock_ack_t *ack = NULL;
-	uint64_t now = 0ULL;
+	sock_header_r_t *hdr_r = tx->buffer;
+	sock_rwin_t *w = &sconn->rwin;
 
 	UNUSED_PARAM (ep);
 
     if (!cci_conn_is_reliable(sconn->conn))
         return CCI_SUCCESS;
 
-	if (!TAILQ_EMPTY(&sconn->acks)) {
-		ack = TAILQ_FIRST(&sconn->acks);
-		if (1 == sock_need_sack(sconn)) {
-			/* Nothing to do */
-		} else if (ack != NULL && ack->start == ack->end) {
-			sock_header_r_t *hdr_r = tx->buffer;
-			hdr_r->pb_ack = ack->start;
-			TAILQ_REMOVE(&sconn->acks, ack, entry);
-			ack = TAILQ_FIRST(&sconn->acks);
-			/* We could get now from the caller if we wanted to */
-			now = sock_get_usecs();
-			sconn->last_ack_ts = now;
-		} else {
-			/* ACK_UP_TO, not handled at the moment */
-		}
+	/* pb_ack acks a single seq: only when base is the one seq we got
+	   since our last ack, anything else waits for an explicit ack */
+	if (w->unacked == 1 && w->high == w->base &&
+	    w->base == sconn->acked + 1) {
+		hdr_r->pb_ack = w->base;
+		sconn->acked = w->base;
+		w->unacked = 0;
+		/* a piggybacked ack carries no echo, do not let the next
+		   ack echo a stale timestamp */
+		sconn->ts = 0;
+		/* We could get now from the caller if we wanted to */
+		sconn->last_ack_ts = sock_get_usecs();
 	} else {
-		sock_header_r_t *hdr_r = tx->buffer;
 		hdr_r->pb_ack = 0;
 	}
 
 	return CCI_SUCCESS;
 }
 
-static void sock_progress_queued(cci__ep_t * ep)
+/*
+ * Put a batch of queued txs on the wire and move each one along: to
+ * pending (reliable and connection messages), to idle_txs, or back to
+ * the queue if the send failed. Called with ep->lock held.
+ */
+static void sock_queued_flush(cci__ep_t * ep, sock_dgram_batch_t * batch,
+                              sock_tx_t ** txs, struct s_txsi *idle_txs)
 {
-	int ret, is_reliable = 0;
+	int i, is_reliable;
+	sock_ep_t *sep = ep->priv;
+	sock_tx_t *tx;
+	cci__conn_t *conn;
+	sock_conn_t *sconn;
+
+	if (!batch->count)
+		return;
+
+	sock_dgram_flush(sep, batch);
+
+	for (i = 0; i < batch->count; i++) {
+		tx = txs[i];
+		if (tx->msg_type == SOCK_MSG_CONN_REPLY
+		    && tx->evt.event.connect.status == CCI_ECONNREFUSED) {
+			conn = NULL;
+			sconn = NULL;
+			is_reliable = 0;
+		} else {
+			conn = tx->evt.conn;
+			sconn = conn->priv;
+			is_reliable = cci_conn_is_reliable(conn);
+		}
+
+		if (batch->ret[i] == -1) {
+			switch (batch->err[i]) {
+			default:
+				debug((CCI_DB_MSG | CCI_DB_INFO),
+				      "%s: sendto() failed with %s\n",
+				      __func__, strerror(batch->err[i]));
+				/* fall through */
+			case EINTR:
+			case EAGAIN:
+			case ENOMEM:
+			case ENOBUFS:
+				if (is_reliable &&
+				    !(tx->msg_type == SOCK_MSG_CONN_REQUEST ||
+				      tx->msg_type == SOCK_MSG_CONN_REPLY))
+				{
+					sock_tx_seq_remove(sconn, tx);
+				}
+				if (tx->msg_type == SOCK_MSG_RMA_WRITE ||
+				    tx->msg_type == SOCK_MSG_RMA_READ_REQUEST)
+					tx->rma_op->pending--;
+				continue;
+			}
+		}
+
+		/* msg sent, dequeue */
+		TAILQ_REMOVE(&sep->queued, &tx->evt, entry);
+		CCI_TRACE(CCI_TRACE_SEND, CCI_TRACE_TP_SOCK, sconn,
+			  tx->seq, tx->len);
+		if (tx->msg_type == SOCK_MSG_SEND) {
+			sconn->pending++;
+			CCI_STAT_ADD(ep, conn, msgs_sent, 1);
+			CCI_STAT_ADD(ep, conn, bytes_sent, tx->len -
+				(is_reliable ? sizeof(sock_header_r_t) :
+				 sizeof(sock_header_t)));
+		}
+
+		/* If reliable or connection, add to pending
+		   else add to idle txs. Note that is we have a
+		   conn_reply with a conn_reject, we do not have a
+		   valid connection and therefore we cannot deal with
+		   a seq. As a result, we just send the conn_reply
+		   message, but we do _NOT_ wait for a ACK (the message
+		   does not go to the pending queue). */
+		if (is_reliable ||
+		    tx->msg_type == SOCK_MSG_CONN_REQUEST ||
+		    (tx->msg_type == SOCK_MSG_CONN_REPLY &&
+		     tx->evt.event.connect.status != CCI_ECONNREFUSED))
+		{
+
+			tx->state = SOCK_TX_PENDING;
+			sock_pending_insert(sep, tx);
+			debug((CCI_DB_CONN | CCI_DB_MSG),
+			      "%s: moving queued %s tx to pending "
+			      "(seq: %u)",
+			      __func__, sock_msg_type(tx->msg_type),
+			      tx->seq);
+		} else {
+			tx->state = SOCK_TX_COMPLETED;
+			TAILQ_INSERT_TAIL(idle_txs, tx, dentry);
+		}
+	}
+
+	sock_dgram_init(batch);
+}
+
+/* Send the queued txs, as many as budget allows. Returns 1 if some are
+ * left for the next pass. */
+static int sock_progress_queued(cci__ep_t * ep, uint32_t *budget)
+{
+	int is_reliable = 0, more = 0;
 	uint32_t timeout;
 	uint64_t now;
 	sock_tx_t *tx;
@@ -2276,23 +3013,31 @@ static void sock_progress_queued(cci__ep_t * ep)
 	sock_ep_t *sep = ep->priv;
 	sock_conn_t *sconn;
 	union cci_event *event = NULL;	/* generic CCI event */
+	sock_dgram_batch_t batch;
+	sock_tx_t *txs[SOCK_TX_BATCH];
 
-	TAILQ_HEAD(s_idle_txs, sock_tx) idle_txs
-		= TAILQ_HEAD_INITIALIZER(idle_txs);
+	struct s_txsi idle_txs = TAILQ_HEAD_INITIALIZER(idle_txs);
 	TAILQ_HEAD(s_evts, cci__evt) evts = TAILQ_HEAD_INITIALIZER(evts);
 
 	CCI_ENTER;
 
 	TAILQ_INIT(&idle_txs);
 	TAILQ_INIT(&evts);
+	sock_dgram_init(&batch);
 
 	if (!sep)
-		return;
+		return 0;
 
 	now = sock_get_usecs();
 
 	pthread_mutex_lock(&ep->lock);
 	TAILQ_FOREACH_SAFE(evt, &sep->queued, entry, tmp) {
+		/* the rest waits for the next pass, in order */
+		if (!*budget) {
+			more = 1;
+			break;
+		}
+
 		tx = container_of (evt, sock_tx_t, evt);
 		event = &evt->event;
 		/* If we deal with a CONN_REJECT, we do not have a
@@ -2359,9 +3104,11 @@ static void sock_progress_queued(cci__ep_t * ep)
 					      "%s: timeout of %s msg",
 					      __func__,
 					      sock_msg_type(tx->msg_type));
+					sock_queued_flush(ep, &batch, txs,
+					                  &idle_txs);
 					pthread_mutex_lock(&ep->lock);
 					CCI_EXIT;
-					return;
+					return more;
 				}
 				TAILQ_REMOVE(&sep->queued, evt, entry);
 
@@ -2391,12 +3138,22 @@ static void sock_progress_queued(cci__ep_t * ep)
 			}
 		}
 
-#if 0
-		if (sconn->pending > sconn->cwnd &&
-			tx->msg_type == SOCK_MSG_SEND && 0) {
-			continue;
+		/* For RMA Writes and RMA read request, we only allow a given
+		   number of messages to be in fly */
+		if (tx->msg_type == SOCK_MSG_RMA_WRITE ||
+		    tx->msg_type == SOCK_MSG_RMA_READ_REQUEST)
+		{
+			if (tx->rma_op->pending >= SOCK_RMA_DEPTH) {
+				continue;
+			}
 		}
-#endif
+
+		/* The congestion window and pacing hold back new reliable
+		   data; once a conn is held, its later txs are too for the
+		   rest of this pass, which keeps RO conns in order. */
+		if (is_reliable && sock_tx_is_data(tx) &&
+		    !sock_cc_can_send(sep, sconn, now))
+			continue;
 
 		tx->last_attempt_us = now;
 		tx->send_count = 1;
@@ -2405,7 +3162,7 @@ static void sock_progress_queued(cci__ep_t * ep)
 		    !(tx->msg_type == SOCK_MSG_CONN_REQUEST ||
 		      tx->msg_type == SOCK_MSG_CONN_REPLY))
 		{
-			TAILQ_INSERT_TAIL(&sconn->tx_seqs, tx, tx_seq);
+			sock_tx_seq_insert(sconn, tx);
 		}
 
 #if 0
@@ -2420,16 +3177,6 @@ static void sock_progress_queued(cci__ep_t * ep)
 		}
 #endif
 
-		/* For RMA Writes and RMA read request, we only allow a given
-		   number of messages to be in fly */
-		if (tx->msg_type == SOCK_MSG_RMA_WRITE ||
-		    tx->msg_type == SOCK_MSG_RMA_READ_REQUEST)
-		{
-			if (tx->rma_op->pending >= SOCK_RMA_DEPTH) {
-				continue;
-			}
-		}
-
 		/* need to send it */
 
 		debug_ep(ep, CCI_DB_MSG, "%s: sending %s msg seq %u",
@@ -2439,79 +3186,40 @@ static void sock_progress_queued(cci__ep_t * ep)
 		{
 			pack_piggyback_ack (ep, sconn, tx);
 		}
+		if (is_reliable)
+			sock_tx_stamp(tx, now);
 
 		/* If we deal with a CONN_REJECT, we do not have a
 		   valid connection */
 		if (tx->msg_type == SOCK_MSG_CONN_REPLY
 		    && tx->evt.event.connect.status == CCI_ECONNREFUSED) {
-			ret = sock_sendto(sep->sock, tx->buffer, tx->len,
-			                  tx->rma_ptr, tx->rma_len, tx->sin);
+			sock_dgram_add(&batch, tx->buffer, tx->len,
+			               tx->rma_ptr, tx->rma_len, tx->sin);
 		} else if (tx->msg_type == SOCK_MSG_RMA_WRITE_DONE) {
 			/* RMA_WRITE_DONE msg are normal messages even if
 			   associated to a RMA operation so we make sure it
 			   cannot be put on the wire as a RMA message. */
-			ret = sock_sendto(sep->sock, tx->buffer, tx->len,
-			                  NULL, 0, sconn->sin);
+			sock_dgram_add(&batch, tx->buffer, tx->len,
+			               NULL, 0, sconn->sin);
 		} else {
-			ret = sock_sendto(sep->sock, tx->buffer, tx->len,
-			                  tx->rma_ptr, tx->rma_len,
-			                  sconn->sin);
+			sock_dgram_add(&batch, tx->buffer, tx->len,
+			               tx->rma_ptr, tx->rma_len,
+			               sconn->sin);
 		}
-		if (ret == -1) {
-			switch (errno) {
-			default:
-				debug((CCI_DB_MSG | CCI_DB_INFO),
-				      "%s: sendto() failed with %s\n",
-				      __func__, strerror(errno));
-				/* fall through */
-			case EINTR:
-			case EAGAIN:
-			case ENOMEM:
-			case ENOBUFS:
-				if (is_reliable &&
-				    !(tx->msg_type == SOCK_MSG_CONN_REQUEST ||
-				      tx->msg_type == SOCK_MSG_CONN_REPLY))
-				{
-					TAILQ_REMOVE(&sconn->tx_seqs,
-					             tx, tx_seq);
-				}
-				continue;
-			}
-		} else {
-			/* msg sent, dequeue */
-			TAILQ_REMOVE(&sep->queued, &tx->evt, entry);
-			if (tx->msg_type == SOCK_MSG_SEND)
-				sconn->pending++;
-
-			/* If reliable or connection, add to pending
-			   else add to idle txs. Note that is we have a
-			   conn_reply with a conn_reject, we do not have a
-			   valid connection and therefore we cannot deal with
-			   a seq. As a result, we just send the conn_reply
-			   message, but we do _NOT_ wait for a ACK (the message
-			   does not go to the pending queue). */
-			if (is_reliable ||
-			    tx->msg_type == SOCK_MSG_CONN_REQUEST ||
-			    (tx->msg_type == SOCK_MSG_CONN_REPLY &&
-			     tx->evt.event.connect.status != CCI_ECONNREFUSED))
-			{
+		/* Count the RMA fragment now so that the depth check above
+		   holds for the rest of the batch */
+		if (tx->msg_type == SOCK_MSG_RMA_WRITE ||
+		    tx->msg_type == SOCK_MSG_RMA_READ_REQUEST)
+			tx->rma_op->pending++;
+		txs[batch.count - 1] = tx;
+		sock_pass_spend(budget, tx->len +
+		                (tx->msg_type == SOCK_MSG_RMA_WRITE_DONE ?
+		                 0 : tx->rma_len));
 
-				tx->state = SOCK_TX_PENDING;
-				TAILQ_INSERT_TAIL(&sep->pending, evt, entry);
-				debug((CCI_DB_CONN | CCI_DB_MSG),
-				      "%s: moving queued %s tx to pending "
-				      "(seq: %u)",
-				      __func__, sock_msg_type(tx->msg_type),
-				      tx->seq);
-				if (tx->msg_type == SOCK_MSG_RMA_WRITE ||
-				    tx->msg_type == SOCK_MSG_RMA_READ_REQUEST)
-					tx->rma_op->pending++;
-			} else {
-				tx->state = SOCK_TX_COMPLETED;
-				TAILQ_INSERT_TAIL(&idle_txs, tx, dentry);
-			}
-		}
+		if (sock_dgram_full(&batch))
+			sock_queued_flush(ep, &batch, txs, &idle_txs);
 	}
+	sock_queued_flush(ep, &batch, txs, &idle_txs);
 	pthread_mutex_unlock(&ep->lock);
 
 	/* transfer txs to sock ep's list */
@@ -2535,25 +3243,29 @@ static void sock_progress_queued(cci__ep_t * ep)
 			rc = write (sep->fd[1], "a", 1);
 			if (rc != 1) {
 				debug (CCI_DB_WARN, "%s: Write failed", __func__);
-				return;
+				return more;
 			}
 		}
 	}
 
 	CCI_EXIT;
 
-	return;
+	return more;
 }
 
-static void sock_progress_sends(cci__ep_t * ep)
+/* Resends first, then new sends, within one pass's budget. Returns 1 if
+ * queued txs are left for the next pass. */
+static int sock_progress_sends(cci__ep_t * ep)
 {
+	uint32_t budget = SOCK_PASS_BYTES;
+	int more;
+
 	CCI_ENTER;
-	sock_progress_pending (ep);
-	sock_ack_conns(ep);
-	sock_progress_queued (ep);
+	sock_progress_pending (ep, &budget);
+	more = sock_progress_queued (ep, &budget);
 	CCI_EXIT;
 
-	return;
+	return more;
 }
 
 static int ctp_sock_send(cci_connection_t * connection,
@@ -2574,47 +3286,32 @@ static int ctp_sock_send(cci_connection_t * connection,
 	return ctp_sock_sendv(connection, &iov, iovcnt, context, flags);
 }
 
-static int ctp_sock_sendv(cci_connection_t * connection,
+/* Get a tx and pack a SEND message into it. For reliable connections,
+ * the caller must still assign the seq (see sock_assign_seq_locked()). */
+static int sock_prepare_send_tx(cci__ep_t *ep, cci__conn_t *conn,
 			const struct iovec *data, uint32_t iovcnt,
-			const void *context, int flags)
+			const void *context, int flags, sock_tx_t **txp)
 {
-	int 		ret		= CCI_SUCCESS;
-	int 		is_reliable 	= 0;
+	int 		is_reliable 	= cci_conn_is_reliable(conn);
 	int		data_len 	= 0;
 	uint32_t 	i;
 	size_t 		s 		= 0;
-	cci_endpoint_t 	*endpoint 	= connection->endpoint;
-	cci__ep_t 	*ep;
-	cci__conn_t 	*conn;
-	sock_ep_t 	*sep;
-	sock_conn_t 	*sconn;
+	cci_connection_t *connection	= &conn->connection;
+	sock_ep_t 	*sep		= ep->priv;
+	sock_conn_t 	*sconn		= conn->priv;
 	sock_tx_t 	*tx 		= NULL;
 	sock_header_t 	*hdr;
 	void 		*ptr;
 	cci__evt_t 	*evt;
 	union cci_event	*event;	/* generic CCI event */
 
-	CCI_ENTER;
-
-	if (!sglobals) {
-		CCI_EXIT;
-		return CCI_ENODEV;
-	}
-
 	for (i = 0; i < iovcnt; i++)
 		data_len += data[i].iov_len;
 
-	ep = container_of(endpoint, cci__ep_t, endpoint);
-	sep = ep->priv;
-	conn = container_of(connection, cci__conn_t, connection);
-	sconn = conn->priv;
-
-	is_reliable = cci_conn_is_reliable(conn);
-
 	/* get a tx */
 	tx = sock_get_tx (ep);
 	if (!tx) {
-		CCI_EXIT;
+		CCI_STAT_ADD(ep, conn, no_bufs, 1);
 		return CCI_ENOBUFS;
 	}
 
@@ -2652,19 +3349,9 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 	sock_pack_send(hdr, data_len, sconn->peer_id);
 	tx->len = sizeof(*hdr);
 
-	/* if reliable, add seq and ack */
-
-	if (is_reliable) {
-		sock_header_r_t *hdr_r = tx->buffer;
-		uint32_t ts = 0;
-
-		pthread_mutex_lock(&ep->lock);
-		tx->seq = ++(sconn->seq);
-		pthread_mutex_unlock(&ep->lock);
-
-		sock_pack_seq_ts(&hdr_r->seq_ts, tx->seq, ts);
-		tx->len = sizeof(*hdr_r);
-	}
+	/* if reliable, leave room for seq and ack */
+	if (is_reliable)
+		tx->len = sizeof(sock_header_r_t);
 	ptr = (void*)((uintptr_t)tx->buffer + tx->len);
 
 	/* copy user data to buffer
@@ -2678,7 +3365,9 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 			       "Msg too big: %lu/%u\n",
 			       tx->len + data[i].iov_len,
 			       connection->max_send_size);
-			CCI_EXIT;
+			pthread_mutex_lock(&ep->lock);
+			TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
+			pthread_mutex_unlock(&ep->lock);
 			return CCI_EINVAL;
 		}
 		memcpy(ptr, data[i].iov_base, data[i].iov_len);
@@ -2687,6 +3376,64 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 		s += data[i].iov_len;
 	}
 
+	*txp = tx;
+	return CCI_SUCCESS;
+}
+
+/* Caller holds ep->lock */
+static inline void sock_assign_seq_locked(sock_conn_t *sconn, sock_tx_t *tx)
+{
+	sock_header_r_t *hdr_r = tx->buffer;
+	uint32_t ts = 0;
+
+	tx->seq = ++(sconn->seq);
+	sock_pack_seq_ts(&hdr_r->seq_ts, tx->seq, ts);
+}
+
+static int ctp_sock_sendv(cci_connection_t * connection,
+			const struct iovec *data, uint32_t iovcnt,
+			const void *context, int flags)
+{
+	int 		ret		= CCI_SUCCESS;
+	int 		is_reliable 	= 0;
+	cci_endpoint_t 	*endpoint 	= connection->endpoint;
+	cci__ep_t 	*ep;
+	cci__conn_t 	*conn;
+	sock_ep_t 	*sep;
+	sock_conn_t 	*sconn;
+	sock_tx_t 	*tx 		= NULL;
+	cci__evt_t 	*evt;
+	union cci_event	*event;	/* generic CCI event */
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	sep = ep->priv;
+	conn = container_of(connection, cci__conn_t, connection);
+	sconn = conn->priv;
+
+	is_reliable = cci_conn_is_reliable(conn);
+
+	ret = sock_prepare_send_tx(ep, conn, data, iovcnt, context, flags, &tx);
+	if (ret) {
+		CCI_EXIT;
+		return ret;
+	}
+	evt = &tx->evt;
+	event = &evt->event;
+
+	/* if reliable, add seq and ack */
+	if (is_reliable) {
+		pthread_mutex_lock(&ep->lock);
+		sock_assign_seq_locked(sconn, tx);
+		pthread_mutex_unlock(&ep->lock);
+	}
+
 	/* if unreliable, try to send */
 	if (!is_reliable) {
 		ret = sock_sendto (sep->sock,
@@ -2696,6 +3443,11 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 		                   tx->rma_len,
 		                   sconn->sin);
 		if (ret == tx->len) {
+			CCI_TRACE(CCI_TRACE_SEND, CCI_TRACE_TP_SOCK, sconn,
+				  tx->seq, tx->len);
+			CCI_STAT_ADD(ep, conn, msgs_sent, 1);
+			CCI_STAT_ADD(ep, conn, bytes_sent,
+				     tx->len - sizeof(sock_header_t));
 			/* queue event on enpoint's completed queue */
 			tx->state = SOCK_TX_COMPLETED;
 			sock_queue_event (ep, evt);
@@ -2712,9 +3464,7 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 			}
 
 			if (!sep->closing) {
-				pthread_mutex_lock(&sep->progress_mutex);
-				pthread_cond_signal(&sep->wait_condition);
-				pthread_mutex_unlock(&sep->progress_mutex);
+				sock_kick_progress(sep);
 			}
 
 			CCI_EXIT;
@@ -2742,9 +3492,7 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 
 	/* try to progress txs */
 	if (!sep->closing) {
-		pthread_mutex_lock(&sep->progress_mutex);
-		pthread_cond_signal(&sep->wait_condition);
-		pthread_mutex_unlock(&sep->progress_mutex);
+		sock_kick_progress(sep);
 	}
 
 	ret = CCI_SUCCESS;
@@ -2753,23 +3501,13 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 	if (tx->flags & CCI_FLAG_BLOCKING) {
 		struct timeval tv = { 0, SOCK_PROG_TIME_US / 2 };
 
-		while (tx->state != SOCK_TX_COMPLETED)
+		while (tx->state != SOCK_TX_BLOCKING_DONE)
 			select(0, NULL, NULL, NULL, &tv);
 
 		/* get status and cleanup */
+		OPA_read_barrier();
 		ret = event->send.status;
 
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_REMOVE(&ep->evts, evt, entry);
-		pthread_mutex_unlock(&ep->lock);
-		/* waking up the app thread if it is blocking on a OS handle */
-		if (sep->event_fd) {
-			int rc;
-			rc = write (sep->fd[1], "a", 1);
-			if (rc != 1)
-				ret = CCI_ERROR;
-		}
-
 		pthread_mutex_lock(&ep->lock);
 		TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
 		pthread_mutex_unlock(&ep->lock);
@@ -2779,6 +3517,84 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 	return ret;
 }
 
+TAILQ_HEAD(sock_batch, cci__evt);
+
+/* Assign seqs and move a batch of prepared txs to sep->queued under one
+ * lock acquisition, then wake the progress thread once. */
+static void sock_queue_batch(cci__ep_t *ep, struct sock_batch *batch)
+{
+	sock_ep_t *sep = ep->priv;
+	cci__evt_t *evt;
+
+	if (TAILQ_EMPTY(batch))
+		return;
+
+	pthread_mutex_lock(&ep->lock);
+	while ((evt = TAILQ_FIRST(batch))) {
+		sock_tx_t *tx = container_of(evt, sock_tx_t, evt);
+
+		TAILQ_REMOVE(batch, evt, entry);
+		sock_assign_seq_locked(evt->conn->priv, tx);
+		tx->state = SOCK_TX_QUEUED;
+		TAILQ_INSERT_TAIL(&sep->queued, evt, entry);
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	if (!sep->closing) {
+		sock_kick_progress(sep);
+	}
+}
+
+/* All descriptors must use the same endpoint (see cci_send_batch()) */
+static int ctp_sock_send_batch(cci_send_desc_t * descs, uint32_t count)
+{
+	uint32_t i;
+	cci__ep_t *ep;
+	struct sock_batch batch;
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		for (i = 0; i < count; i++)
+			descs[i].status = CCI_ENODEV;
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(descs[0].connection->endpoint, cci__ep_t, endpoint);
+	TAILQ_INIT(&batch);
+
+	for (i = 0; i < count; i++) {
+		cci_send_desc_t *d = &descs[i];
+		cci__conn_t *conn = container_of(d->connection, cci__conn_t,
+						 connection);
+		struct iovec iov = { (void *) d->msg_ptr, d->msg_len };
+		sock_tx_t *tx = NULL;
+
+		/* UU sends go out directly and blocking sends wait, so use
+		 * the regular path for them (after the batch so far, to
+		 * keep ordering). */
+		if (!cci_conn_is_reliable(conn) ||
+			(d->flags & CCI_FLAG_BLOCKING)) {
+			sock_queue_batch(ep, &batch);
+			d->status = ctp_sock_send(d->connection, d->msg_ptr,
+						d->msg_len, d->context, d->flags);
+			continue;
+		}
+
+		d->status = sock_prepare_send_tx(ep, conn, &iov,
+					d->msg_ptr && d->msg_len ? 1 : 0,
+					d->context, d->flags, &tx);
+		if (d->status == CCI_SUCCESS)
+			TAILQ_INSERT_TAIL(&batch, &tx->evt, entry);
+	}
+
+	sock_queue_batch(ep, &batch);
+
+	CCI_EXIT;
+	return CCI_SUCCESS;
+}
+
 static int ctp_sock_rma_register(cci_endpoint_t * endpoint,
 			     void *start, uint64_t length,
 			     int flags, cci_rma_handle_t ** rma_handle)
@@ -3016,6 +3832,7 @@ static int ctp_sock_rma(cci_connection_t * connection,
 		pthread_mutex_unlock(&ep->lock);
 
 		if (err) {
+			CCI_STAT_ADD(ep, conn, no_bufs, 1);
 			free(txs);
 			free(rma_op);
 			CCI_EXIT;
@@ -3116,115 +3933,66 @@ static int ctp_sock_rma(cci_connection_t * connection,
 /*!
 Handle incoming sequence number
 
+Remember the sender's timestamp ts so that our next ack echoes it
 If we have acked it
-	ignore it
-Walk sconn->acks:
-	if it exists in a current entry
-	do nothing
-	if it borders a current entry
-	add it to the entry
-	if it falls between two entries without boardering them
-	add a new entry between them
-	else
-	add a new entry at the tail
+	ack it again (our ack may have been lost)
+Record it in sconn->rwin, it is a duplicate if it was there already
+Count it toward our next ack, and send that ack now if enough seqs wait
+for it, or make sure it goes out after ACK_TIMEOUT otherwise
+
+An RMA_READ_REQUEST is acked by its RMA_READ_REPLY: pass ack 0 to only
+record its seq.
+
+Return 1 if seq is new, 0 for a duplicate and -1 if it is past the window
+and must be dropped (the sender resends it)
 
 */
-static inline void sock_handle_seq(sock_conn_t * sconn, uint32_t seq)
+static inline int sock_handle_seq(sock_conn_t * sconn, uint32_t seq,
+                                  uint32_t ts, int ack)
 {
-	int done = 0;
-	sock_ack_t *ack = NULL;
-	sock_ack_t *last = NULL;
-	sock_ack_t *tmp = NULL;
+	int new;
 	cci__conn_t *conn = sconn->conn;
 	cci_connection_t *connection = &conn->connection;
 	cci_endpoint_t *endpoint = connection->endpoint;
 	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
 
-	if (SOCK_SEQ_LTE(seq, sconn->acked)) {
-		debug(CCI_DB_MSG, "%s: ignoring seq %u (acked %u) ***",
-		      __func__, seq, sconn->acked);
-		return;
+	if (ack && SOCK_SEQ_LTE(seq, sconn->acked)) {
+		char buffer[SOCK_MAX_HDR_SIZE];
+		sock_header_r_t *hdr_r = (sock_header_r_t *) buffer;
+		sock_ep_t *sep = ep->priv;
+		uint32_t acked = sconn->acked;
+
+		debug(CCI_DB_MSG, "%s: re-acking seq %u (acked %u)",
+		      __func__, seq, acked);
+		memset(buffer, 0, sizeof(buffer));
+		sock_pack_ack(hdr_r, SOCK_MSG_ACK_UP_TO, sconn->peer_id, 0, 0,
+		              &acked, 1);
+		sock_sendto(sep->sock, buffer,
+		            sizeof(*hdr_r) + sizeof(acked), NULL, 0,
+		            sconn->sin);
+		return 0;
 	}
 
 	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH_SAFE(ack, &sconn->acks, entry, tmp) {
-		if (SOCK_SEQ_GTE(seq, ack->start) &&
-			SOCK_SEQ_LTE(seq, ack->end)) {
-			/* seq exists in this entry,
-			   do nothing */
-			debug(CCI_DB_MSG, "%s: seq %u exists between %u-%u",
-			      __func__, seq, ack->start, ack->end);
-			done = 1;
-			break;
-		} else if (seq == ack->start - 1) {
-			/* add it to start of this entry */
-			ack->start = seq;
-			debug(CCI_DB_MSG, "%s: seq %u exists before %u-%u",
-			      __func__, seq, ack->start, ack->end);
-			done = 1;
-			break;
-		} else if (seq == ack->end + 1) {
-			sock_ack_t *next = TAILQ_NEXT(ack, entry);
-
-			/* add it to the end of this entry */
-			debug(CCI_DB_MSG, "%s: seq %u exists after %u-%u",
-			      __func__, seq, ack->start, ack->end);
-			ack->end = seq;
-
-			/* did we plug a hole between entries? */
-			if (next) {
-				/* add this range to next and delete this entry */
-				debug(CCI_DB_MSG,
-				      "%s: merging acks %u-%u with %u-%u",
-				      __func__, ack->start, ack->end,
-				      next->start, next->end);
-				next->start = ack->start;
-				TAILQ_REMOVE(&sconn->acks, ack, entry);
-				free(ack);
-			}
-
-			/* Forcing ACK */
-			if (ack->end - ack->start >= PENDING_ACK_THRESHOLD) {
-				debug(CCI_DB_MSG, "%s: Forcing ACK", __func__);
-				pthread_mutex_unlock(&ep->lock);
-				sock_ack_conns (ep);
-				pthread_mutex_lock(&ep->lock);
-			}
-
-			done = 1;
-			break;
-		} else if (last && SOCK_SEQ_GT(seq, last->end) &&
-			SOCK_SEQ_LT(seq, ack->start)) {
-			sock_ack_t *new;
-
-			/* add a new entry before this entry */
-			new = calloc(1, sizeof(*new));
-			if (new) {
-				debug(CCI_DB_MSG,
-				      "%s: seq %u insert after %u-%u before %u-%u ",
-				      __func__, seq, last->start, last->end,
-				      ack->start, ack->end);
-				new->start = new->end = seq;
-				TAILQ_INSERT_BEFORE(ack, new, entry);
-			}
-			done = 1;
-			break;
-		}
-		last = ack;
-	}
-	if (!done) {
-		/* add new entry to tail */
-		ack = calloc(1, sizeof(*ack));
-		if (ack) {
-			ack->start = ack->end = seq;
-			TAILQ_INSERT_TAIL(&sconn->acks, ack, entry);
-			debug(CCI_DB_MSG, "%s: seq %u add at tail", __func__,
-			      seq);
+	new = sock_rwin_mark(&sconn->rwin, seq);
+	if (new < 0) {
+		debug(CCI_DB_MSG, "%s: seq %u past the window (base %u)",
+		      __func__, seq, sconn->rwin.base);
+	} else if (ack) {
+		/* echo the oldest timestamp we have not acked yet, the
+		   sample then includes our ack delay */
+		if (!sconn->ts)
+			sconn->ts = ts;
+		if (++sconn->rwin.unacked >= PENDING_ACK_THRESHOLD) {
+			debug(CCI_DB_MSG, "%s: Forcing ACK", __func__);
+			sock_ack_sconn(ep->priv, sconn, NULL);
+		} else {
+			sock_arm_ack(ep->priv, sconn);
 		}
 	}
 	pthread_mutex_unlock(&ep->lock);
 
-	return;
+	return new;
 }
 
 static void
@@ -3357,6 +4125,68 @@ sock_handle_nack (sock_conn_t * sconn,
 	return;
 }
 
+/* Note the seq and send time of a tx that an ack completed */
+static inline void
+sock_note_acked(sock_tx_t *tx, uint32_t *high, uint64_t *newest)
+{
+	if (!*newest || SOCK_SEQ_GT(tx->seq, *high))
+		*high = tx->seq;
+	if (SOCK_U64_LT(*newest, tx->last_attempt_us))
+		*newest = tx->last_attempt_us;
+}
+
+/*
+ * Fast resend: the pending txs of sconn that at least
+ * SOCK_FAST_RESEND_THRESH later seqs overtook (high being the highest seq
+ * just acked) are lost in all likelihood, resend them without waiting for
+ * their RTO. A tx sent again after the newest tx just acked (sent at
+ * newest) is skipped, so a loss is repaired once per round trip.
+ * Caller holds ep->lock.
+ */
+static void sock_fast_resend(cci__ep_t *ep, sock_conn_t *sconn,
+                             uint32_t high, uint64_t newest)
+{
+	sock_ep_t *sep = ep->priv;
+	sock_tx_t *tx;
+	uint64_t now = 0ULL;
+	int ret;
+
+	TAILQ_FOREACH(tx, &sconn->tx_seqs, tx_seq) {
+		if (SOCK_SEQ_GT(tx->seq + SOCK_FAST_RESEND_THRESH, high))
+			break;
+		if (tx->state != SOCK_TX_PENDING ||
+		    !SOCK_U64_LT(tx->last_attempt_us, newest))
+			continue;
+
+		if (!now)
+			now = sock_get_usecs();
+		sock_cc_loss(sep, sconn, tx, 0, now);
+		tx->last_attempt_us = now;
+		sock_arm_timer(sep, &tx->timer, sock_tx_deadline(tx));
+		CCI_TRACE(CCI_TRACE_RESEND, CCI_TRACE_TP_SOCK, sconn, tx->seq,
+			  tx->send_count);
+		CCI_STAT_ADD(ep, sconn->conn, resends, 1);
+
+		debug_ep(ep, CCI_DB_MSG, "%s: fast resend of %s msg seq %u "
+		         "(acked up to %u)", __func__,
+		         sock_msg_type(tx->msg_type), tx->seq, high);
+		pack_piggyback_ack(ep, sconn, tx);
+		sock_tx_stamp(tx, now);
+		/* RMA_WRITE_DONE msgs never carry RMA data (see
+		   sock_progress_queued()) */
+		if (tx->msg_type == SOCK_MSG_RMA_WRITE_DONE)
+			ret = sock_sendto(sep->sock, tx->buffer, tx->len,
+			                  NULL, 0, sconn->sin);
+		else
+			ret = sock_sendto(sep->sock, tx->buffer, tx->len,
+			                  tx->rma_ptr, tx->rma_len, sconn->sin);
+		if (ret == -1)
+			debug((CCI_DB_MSG | CCI_DB_INFO),
+			      "%s: sendto() failed with %s", __func__,
+			      strerror(errno));
+	}
+}
+
 /*!
 Handle incoming ack
 
@@ -3383,6 +4213,8 @@ sock_handle_ack(sock_conn_t * sconn,
 	sock_tx_t *tmp = NULL;
 	sock_header_r_t *hdr_r = rx->buffer;
 	uint32_t acks[SOCK_MAX_SACK * 2];
+	uint32_t seq, ts = 0, high = 0, rtt = 0;
+	uint64_t now, newest = 0ULL;
 
 	TAILQ_HEAD(s_idle_txs, sock_tx) idle_txs
 		= TAILQ_HEAD_INITIALIZER(idle_txs);
@@ -3424,6 +4256,8 @@ sock_handle_ack(sock_conn_t * sconn,
 		if (sconn->seq_pending == acks[0] - 1)
 			sconn->seq_pending = acks[0];
 	}
+	CCI_TRACE(CCI_TRACE_ACK_RX, CCI_TRACE_TP_SOCK, sconn, acks[0],
+		  acks[count - 1]);
 
 	/*
 	   If this is an explicit ACK message, we "extracted" all the info we
@@ -3434,13 +4268,18 @@ sock_handle_ack(sock_conn_t * sconn,
 	if (type == SOCK_MSG_ACK_ONLY || type == SOCK_MSG_ACK_UP_TO
 	                              || type == SOCK_MSG_SACK)
 	{
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-		pthread_mutex_unlock(&ep->lock);
+		/* only explicit acks echo one of our timestamps */
+		sock_parse_seq_ts(&hdr_r->seq_ts, &seq, &ts);
+		sock_rx_put(rx);
 	}
 
+	now = sock_get_usecs();
 	pthread_mutex_lock(&dev->lock);
 	pthread_mutex_lock(&ep->lock);
+	if (ts && (uint32_t) now - ts < SOCK_RTO_MAX_US) {
+		rtt = (uint32_t) now - ts;
+		sock_rtt_sample(sconn, rtt);
+	}
 	TAILQ_FOREACH_SAFE(tx, &sconn->tx_seqs, tx_seq, tmp) {
 		/* Note that type of msgs can include a piggybacked ACK */
 		if (type == SOCK_MSG_ACK_ONLY
@@ -3455,8 +4294,9 @@ sock_handle_ack(sock_conn_t * sconn,
 					debug(CCI_DB_MSG,
 						"%s: acking only seq %u", __func__,
 						acks[0]);
-					TAILQ_REMOVE(&sep->pending, &tx->evt, entry);
-					TAILQ_REMOVE(&sconn->tx_seqs, tx, tx_seq);
+					sock_pending_remove(sep, tx);
+					sock_note_acked(tx, &high, &newest);
+					sock_tx_seq_remove(sconn, tx);
 					if (tx->msg_type == SOCK_MSG_RMA_WRITE
 					    || tx->msg_type == SOCK_MSG_RMA_READ_REQUEST)
 						tx->rma_op->pending--;
@@ -3494,12 +4334,16 @@ sock_handle_ack(sock_conn_t * sconn,
 			}
 		} else if (type == SOCK_MSG_ACK_UP_TO) {
 			if (SOCK_SEQ_LTE(tx->seq, acks[0])) {
-				if (tx->state == SOCK_TX_PENDING) {
+				/* the peer's window covers our read requests
+				   too, only their reply acks them */
+				if (tx->state == SOCK_TX_PENDING &&
+				    tx->msg_type != SOCK_MSG_RMA_READ_REQUEST) {
 					debug(CCI_DB_MSG,
 						"%s: acking tx seq %u (up to seq %u)",
 						__func__, tx->seq, acks[0]);
-					TAILQ_REMOVE(&sep->pending, &tx->evt, entry);
-					TAILQ_REMOVE(&sconn->tx_seqs, tx, tx_seq);
+					sock_pending_remove(sep, tx);
+					sock_note_acked(tx, &high, &newest);
+					sock_tx_seq_remove(sconn, tx);
 					if (tx->msg_type == SOCK_MSG_RMA_WRITE)
 						tx->rma_op->pending--;
 					if (tx->msg_type == SOCK_MSG_SEND) {
@@ -3542,13 +4386,16 @@ sock_handle_ack(sock_conn_t * sconn,
 					if (sconn->seq_pending == acks[i] - 1)
 						sconn->seq_pending =
 							acks[i + 1];
-					if (tx->state == SOCK_TX_PENDING) {
+					if (tx->state == SOCK_TX_PENDING &&
+					    tx->msg_type !=
+					    SOCK_MSG_RMA_READ_REQUEST) {
 						debug(CCI_DB_MSG,
 						      "%s: sacking seq %u",
 						      __func__, tx->seq);
 						found++;
-						TAILQ_REMOVE(&sep->pending, &tx->evt, entry);
-						TAILQ_REMOVE(&sconn->tx_seqs, tx, tx_seq);
+						sock_pending_remove(sep, tx);
+						sock_note_acked(tx, &high, &newest);
+						sock_tx_seq_remove(sconn, tx);
 						if (tx->msg_type == SOCK_MSG_RMA_WRITE ||
 							tx->msg_type == SOCK_MSG_RMA_READ_REPLY)
 						{
@@ -3588,6 +4435,11 @@ sock_handle_ack(sock_conn_t * sconn,
 			}
 		}
 	}
+	if (newest) {
+		sconn->last_acked_us = now;
+		sock_cc_ack(sep, sconn, found, rtt, now);
+		sock_fast_resend(ep, sconn, high, newest);
+	}
 	pthread_mutex_unlock(&ep->lock);
 	pthread_mutex_unlock(&dev->lock);
 
@@ -3783,7 +4635,7 @@ sock_handle_ack(sock_conn_t * sconn,
 		cci__evt_t *evt;
 		evt = TAILQ_FIRST(&evts);
 		TAILQ_REMOVE(&evts, evt, entry);
-		TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
+		sock_queue_event (ep, evt);
 		/* waking up the app thread if it is blocking on a OS handle */
 		if (sep->event_fd) {
 			int rc;
@@ -3810,9 +4662,7 @@ sock_handle_ack(sock_conn_t * sconn,
 
 	/* We received a ACK so we wake up the send thread */
 	if (!sep->closing) {
-		pthread_mutex_lock(&sep->progress_mutex);
-		pthread_cond_signal(&sep->wait_condition);
-		pthread_mutex_unlock(&sep->progress_mutex);
+		sock_kick_progress(sep);
 	}
 
 	CCI_EXIT;
@@ -3941,13 +4791,11 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 				                      (enum cci_status)ret));
 			}
 
-			pthread_mutex_lock(&ep->lock);
-			TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-			pthread_mutex_unlock(&ep->lock);
-
 			/* We only did a peek of the header so far and we got enough
 			   data to move on so we drop the msg */
-			sock_drop_msg (sep->sock);
+			sock_rx_drop (rx);
+
+			sock_rx_put(rx);
 			CCI_EXIT;
 			return;
 		}
@@ -3989,10 +4837,9 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 			/* We finally get the entire message */
 			uint32_t total_size = sizeof (sock_header_r_t)
 			                      + sizeof (sock_handshake_t);
-			uint32_t recv_len = sock_recv_msg (sep->sock,
-			                                   rx->buffer,
-			                                   total_size, 0,
-			                                   NULL);
+			uint32_t recv_len = sock_rx_recv (rx,
+			                                  total_size, 0,
+			                                  NULL);
 			debug (CCI_DB_EP, "%s: We now have %d/%u bytes",
 			       __func__, recv_len, total_size);
 #if CCI_DEBUG
@@ -4017,7 +4864,7 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 			TAILQ_FOREACH_SAFE(e, &sep->pending, entry, tmp) {
 				t = container_of (e, sock_tx_t, evt);
 				if (t->seq == ack) {
-					TAILQ_REMOVE(&sep->pending, e, entry);
+					sock_pending_remove(sep, t);
 					tx = t;
 					break;
 				}
@@ -4064,10 +4911,13 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 			sconn->status = SOCK_CONN_READY;
 			*((struct sockaddr_in *)&sconn->sin) = sin;
 			sconn->acked = seq;
+			sock_rwin_init(&sconn->rwin, seq);
 
 			i = sock_ip_hash(sin.sin_addr.s_addr, sin.sin_port);
 			pthread_mutex_lock(&ep->lock);
 			TAILQ_INSERT_TAIL(&sep->conn_hash[i], sconn, entry);
+			sock_arm_keepalive(sep, sconn);
+			sock_cc_init(sep, sconn, sock_get_usecs());
 			pthread_mutex_unlock(&ep->lock);
 
 			debug(CCI_DB_CONN, "%s: conn ready on hash %d",
@@ -4081,10 +4931,9 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 
 			/* We finally get the entire message */
 			uint32_t total_size = sizeof (sock_header_r_t);
-			uint32_t recv_len = sock_recv_msg (sep->sock,
-			                                   rx->buffer,
-			                                   total_size, 0,
-			                                   NULL);
+			uint32_t recv_len = sock_rx_recv (rx,
+			                                  total_size, 0,
+			                                  NULL);
 			debug (CCI_DB_EP, "%s: We now have %d/%u bytes",
 			       __func__, recv_len, total_size);
 #if CCI_DEBUG
@@ -4115,7 +4964,7 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 			TAILQ_FOREACH_SAFE(e, &sep->pending, entry, tmp) {
 				t = container_of (e, sock_tx_t, evt);
 				if (t->seq == seq) {
-					TAILQ_REMOVE(&sep->pending, e, entry);
+					sock_pending_remove(sep, t);
 					tx = t;
 					break;
 				}
@@ -4138,7 +4987,7 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 				                      (enum cci_status)ret));
 			}
 		}
-		/* add rx->evt to ep->evts */
+		/* add rx->evt to ep->evtq */
 		sock_queue_event (ep, &rx->evt);
 
 		/* waking up the app thread if it is blocking on a OS handle */
@@ -4168,9 +5017,7 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 			debug_ep(ep, (CCI_DB_CONN | CCI_DB_MSG),
 			         "%s: no tx buff to send a conn_ack to %s",
 			         __func__, to);
-			pthread_mutex_lock(&ep->lock);
-			TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-			pthread_mutex_unlock(&ep->lock);
+			sock_rx_put(rx);
 
 			CCI_EXIT;
 			return;
@@ -4215,9 +5062,7 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,
 #endif
 
 	/* try to progress txs */
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_kick_progress(sep);
 
 	CCI_EXIT;
 
@@ -4240,9 +5085,6 @@ sock_handle_rma_read_reply(sock_conn_t *sconn,
 	sock_rma_handle_t *local, *h = NULL;
 	sock_header_r_t *hdr_r;
 	uint32_t seq, ts;
-	struct msghdr msg;
-	struct iovec iov[2];
-	struct sockaddr_in sin;
 
 	CCI_ENTER;
 
@@ -4275,41 +5117,30 @@ sock_handle_rma_read_reply(sock_conn_t *sconn,
 		/* local is no longer valid, send CCI_ERR_RMA_HANDLE */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: local handle not valid", __func__);
-		goto out;
+		goto drop;
 	} else if (local_offset > local->length) {
 		/* offset exceeds local handle's range, send nak */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: local offset not valid", __func__);
-		goto out;
+		goto drop;
 	} else if ((local_offset + len) > local->length) {
 		/* length exceeds local handle's range, send nak */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: local length not valid (%"PRIu64"/%"PRIu64")",
 		      __func__, local_offset + len, local->length);
-		goto out;
+		goto drop;
 	}
 
 	/* valid local handle, copy the data */
 	debug(CCI_DB_MSG, "%s: recv'ing data into target buffer (%u bytes)",
-	      __func__, len);
-
-	/* We receive the entire message using an IOVEC: the first elt of the
-	   IOVEC is the header and the second one the actual data */
-	memset (&msg, 0, sizeof (msg));
-	msg.msg_name = (void*)&sin;
-	msg.msg_namelen = sizeof(sin);
-	iov[0].iov_len = sizeof (sock_rma_header_t);
-	iov[0].iov_base = rx->buffer;
-	iov[1].iov_len = len;
-	iov[1].iov_base = (void*)((uintptr_t)h->start + (uintptr_t)local_offset);
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 2;
-again:
-	ret = recvmsg (sep->sock, &msg, 0);
+	      __func__, len);
+
+	ret = sock_rx_recv_payload (rx, sizeof (sock_rma_header_t),
+	                            (void*)((uintptr_t)h->start
+	                                    + (uintptr_t)local_offset),
+	                            len);
 	if (ret == -1) {
 		/* TODO we need to drain the message from the fd */
-		if (errno == EAGAIN)
-			goto again;
 		debug(CCI_DB_MSG,
                       "%s: recv'ing RMA READ payload failed with %s",
                       __func__, strerror(errno));
@@ -4321,11 +5152,15 @@ again:
                "%s: We now have %d/%lu bytes",
                __func__, ret,
                sizeof (sock_rma_header_t) + len);
+	goto out;
+
+drop:
+	/* The payload has nowhere to go */
+	sock_rx_drop(rx);
+
 out:
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-	pthread_mutex_unlock(&ep->lock);
+	sock_rx_put(rx);
 
 	CCI_EXIT;
 return;
@@ -4399,7 +5234,7 @@ sock_handle_conn_ack(sock_conn_t * sconn,
 			/* the conn_ack stores the ack for the conn_reply in ts */
 			t = container_of (e, sock_tx_t, evt);
 			if (t->seq == ts) {
-				TAILQ_REMOVE(&sep->pending, e, entry);
+				sock_pending_remove(sep, t);
 				tx = t;
 				debug(CCI_DB_CONN, "%s: found conn_reply",
 				      __func__);
@@ -4421,7 +5256,7 @@ sock_handle_conn_ack(sock_conn_t * sconn,
 				debug(CCI_DB_CONN,
                                       "%s: Generate the connect accept event",
 				      __func__);
-				TAILQ_INSERT_TAIL(&ep->evts, &tx->evt, entry);
+				cci__queue_evt(ep, &tx->evt);
 				/* waking up the app thread if it is blocking
 				   on a OS handle */
 				if (sep->event_fd) {
@@ -4441,13 +5276,9 @@ sock_handle_conn_ack(sock_conn_t * sconn,
 			pthread_mutex_unlock(&ep->lock);
 		}
 
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-		pthread_mutex_unlock(&ep->lock);
+		sock_rx_put(rx);
 	
-		pthread_mutex_lock(&sep->progress_mutex);
-		pthread_cond_signal(&sep->wait_condition);
-		pthread_mutex_unlock(&sep->progress_mutex);
+		sock_kick_progress(sep);
 	}
 
 	CCI_EXIT;
@@ -4568,6 +5399,18 @@ sock_handle_rma_read_request(sock_conn_t * sconn, sock_rx_t * rx,
 	       "%s: Send RMA_READ_REPLY, response to RMA_READ_REQUEST seq %u"
 	       " with %u bytes",
 	       __func__, seq, tx->rma_len);
+	if (rx->shard->replies) {
+		/* Replies to a batch of requests leave together, so that
+		   the fragments of a stream can be segmented by the kernel */
+		sock_reply_batch_t *rb = rx->shard->replies;
+
+		if (sock_dgram_full(&rb->dgrams))
+			sock_flush_replies(ep, rx->shard);
+		rb->txs[sock_dgram_add(&rb->dgrams, tx->buffer, tx->len,
+		                       tx->rma_ptr, tx->rma_len,
+		                       sconn->sin)] = tx;
+		goto out;
+	}
 	sock_sendto(sep->sock, tx->buffer, tx->len, tx->rma_ptr,
 	            tx->rma_len, sconn->sin);
 
@@ -4579,13 +5422,9 @@ sock_handle_rma_read_request(sock_conn_t * sconn, sock_rx_t * rx,
 	pthread_mutex_unlock (&ep->lock);
 
 out:
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-	pthread_mutex_unlock(&ep->lock);
+	sock_rx_put(rx);
 
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_kick_progress(sep);
 
 	return (ret);
 }
@@ -4601,9 +5440,6 @@ sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
 	uint64_t remote_handle;	/* our handle */
 	uint64_t remote_offset;	/* our offset */
 	sock_rma_handle_t *remote, *h;
-	struct sockaddr_in sin;
-	struct msghdr msg;
-	struct iovec iov[2];
 	sock_rma_header_t *rma_header;
 #if CCI_DEBUG
 	int ret;
@@ -4644,7 +5480,7 @@ sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
 		         piece, then we lost the race. We should defer
 		         the ack until we deliver the data. */
 
-		goto out;
+		goto drop;
 	}
 
 #if CCI_DEBUG
@@ -4664,7 +5500,7 @@ sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
 		         piece, then we lost the race. We should defer
 		         the ack until we deliver the data. */
 
-		goto out;
+		goto drop;
 	} else if (remote_offset + len > remote->length) {
 		/* length exceeds remote handle's range, send nak */
 		debug(CCI_DB_MSG, "%s: remote length not valid", __func__);
@@ -4674,7 +5510,7 @@ sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
 		         piece, then we lost the race. We should defer
 		         the ack until we deliver the data. */
 
-		goto out;
+		goto drop;
 	}
 
 	/* valid remote handle, copy the data */
@@ -4683,34 +5519,35 @@ sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
 	          "offset: %"PRIu64", len: %d",
 	          __func__, h->start, remote_offset, len);
 
-	/* We receive the entire message using an IOVEC: the first elt of the
-	   IOVEC is the header and the second one the actual data */
-	memset (&msg, 0, sizeof (msg));
-	msg.msg_name = (void*)&sin;
-	msg.msg_namelen = sizeof(sin);
-	iov[0].iov_len = sizeof (sock_rma_header_t);
-	iov[0].iov_base = rx->buffer;
-	iov[1].iov_len = len;
-	iov[1].iov_base = (void*)((uintptr_t)h->start + (uintptr_t)remote_offset);
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 2;
 #if CCI_DEBUG
-	ret = recvmsg (sep->sock, &msg, 0);
+	ret = sock_rx_recv_payload (rx, sizeof (sock_rma_header_t),
+	                            (void*)((uintptr_t)h->start
+	                                    + (uintptr_t)remote_offset),
+	                            len);
 	debug (CCI_DB_EP, "%s: We now have %d/%lu bytes",
 	       __func__, ret, sizeof (sock_rma_header_t) + len);
 	assert ((unsigned int)ret == (sizeof (sock_rma_header_t) + len));
 #else
-	recvmsg (sep->sock, &msg, 0);
+	sock_rx_recv_payload (rx, sizeof (sock_rma_header_t),
+	                      (void*)((uintptr_t)h->start
+	                              + (uintptr_t)remote_offset),
+	                      len);
 #endif
 
+	goto out;
+
+drop:
+	/* The payload has nowhere to go */
+	sock_rx_drop(rx);
+
 out:
 	/* We force the ACK */
 	pthread_mutex_lock(&ep->lock);
-	sock_ack_sconn (sep, sconn);
-	
-	TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+	sock_ack_sconn (sep, sconn, NULL);
 	pthread_mutex_unlock(&ep->lock);
 
+	sock_rx_put(rx);
+
 	return;
 }
 
@@ -4753,11 +5590,11 @@ sock_handle_rma_write_done(sock_conn_t * sconn,
 
 	total_len = sizeof (sock_rma_header_t) + sizeof(uint32_t) + *msg_len;
 #if CCI_DEBUG
-	ret = sock_recv_msg (sep->sock, rx->buffer, total_len, 0, NULL);
+	ret = sock_rx_recv (rx, total_len, 0, NULL);
         debug (CCI_DB_EP, "We now have %d/%d bytes\n", ret, total_len);
 	assert ((unsigned int)ret == total_len);
 #else
-	sock_recv_msg (sep->sock, rx->buffer, total_len, 0, NULL);
+	sock_rx_recv (rx, total_len, 0, NULL);
 #endif
 
 	/* get cci__evt_t to hang on ep->events */
@@ -4783,15 +5620,19 @@ sock_handle_rma_write_done(sock_conn_t * sconn,
 	}
 }
 
-static int sock_recvfrom_ep(cci__ep_t * ep)
+/*
+ * Receive and handle one message. If rx is not NULL, it already holds a
+ * whole datagram from the batched receive, otherwise the message is read
+ * from the socket as it is handled.
+ */
+static int sock_recv_one(cci__ep_t * ep, sock_shard_t * shard, sock_rx_t * rx)
 {
 	int ret = 0, drop_msg = 0, q_rx = 0, reply = 0, request = 0, again = 0;
-	int ka = 0;
+	int ka = 0, seen = 1;
 	size_t recv_len = 0;
 	uint8_t a;
 	uint16_t b;
 	uint32_t id;
-	sock_rx_t *rx = NULL;
 	struct sockaddr_in sin;
 	socklen_t sin_len = sizeof(sin);
 	sock_conn_t *sconn = NULL;
@@ -4807,12 +5648,16 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	if (!sep)
 		return 0;
 
-	pthread_mutex_lock(&ep->lock);
-	if (!TAILQ_EMPTY(&sep->idle_rxs)) {
-		rx = TAILQ_FIRST(&sep->idle_rxs);
-		TAILQ_REMOVE(&sep->idle_rxs, rx, entry);
+	if (rx) {
+		sin = rx->sin;
+		recv_len = rx->dgram_len;
+		goto handle;
+	}
+
+	if (sock_rx_get(shard, &rx, 1)) {
+		rx->dgram_len = 0;
+		rx->peek_len = 0;
 	}
-	pthread_mutex_unlock(&ep->lock);
 
 	/* If we run out of RX, we fall down to a special case: we have to use a
 	special buffer to receive the message, parse it. Ultimately, we need
@@ -4844,14 +5689,15 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	if (!rx) {
 		char tmp_buff[SOCK_UDP_MAX];
 		sock_header_t *hdr = NULL;
+		uint32_t dgram_len = 0;
 
 		debug(CCI_DB_INFO,
 		      "%s: no rx buffers available on endpoint %d",
-		      __func__, sep->sock);
+		      __func__, shard->sock);
 
 		/* We do the receive using a temporary buffer so we can get
 		   enough data to send a RNR NACK */
-		ret = recvfrom(sep->sock, (void *)tmp_buff, SOCK_UDP_MAX,
+		ret = recvfrom(shard->sock, (void *)tmp_buff, SOCK_UDP_MAX,
 				0, (struct sockaddr *)&sin, &sin_len);
 		if (ret == -1) {
 			debug (CCI_DB_INFO,
@@ -4867,6 +5713,7 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 			CCI_EXIT;
 			return 0;
 		}
+		dgram_len = ret;
 
 		/* Now we get the header and parse it so we can know if we are
 		   in the context of a reliable connection */
@@ -4912,6 +5759,8 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 					goto out;
 				}
 				memcpy (rx->buffer, tmp_buff, ep->buffer_len);
+				rx->dgram_len = dgram_len;
+				rx->shard = shard;
 			} else {
 				/* Otherwise we drop the msg */
 				drop_msg = 1;
@@ -4923,19 +5772,18 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 			return 0;
 		}
 	} else {
-		ret = sock_recv_msg (sep->sock,
-		                     rx->buffer,
-		                     sizeof(sock_header_t),
-				     MSG_PEEK,
-		                     &sin);
+		/* Peek at enough of the datagram for the largest header we
+		   parse (an RMA one), so that its payload can be received
+		   straight where it goes */
+		ret = sock_rx_recv (rx,
+		                    SOCK_PEEK_LEN,
+		                    MSG_PEEK,
+		                    &sin);
 		if (ret < 0 || ret < (int)sizeof(sock_header_t)) {
 			q_rx = 1;
 			goto out;
 		}
 		recv_len = ret;
-#if CCI_DEBUG
-		assert (recv_len == sizeof (sock_header_t));
-#endif
 		/* Getting here means we are in a normal execution code path
 		   so we assume that if we received successfully a message,
 		   another one may be already available right away, so it is
@@ -4945,9 +5793,15 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 
 	/* From here, we know we have the message in a valid RX buffer so we
 	   can parse it and handle the data */
-
+handle:
 	/* lookup connection from sin and id */
 	sock_parse_header(rx->buffer, &type, &a, &b, &id);
+
+	/* RMA fragments come in runs, guess the next datagram is one too */
+	shard->direct = (SOCK_MSG_RMA_WRITE == type ||
+	                 SOCK_MSG_RMA_READ_REPLY == type) &&
+	                b >= SOCK_DIRECT_MIN;
+
 	if (SOCK_MSG_CONN_REPLY == type) {
 		reply = 1;
 	} else if (SOCK_MSG_CONN_REQUEST == type) {
@@ -4961,6 +5815,9 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	if (!request) {
 		sconn = sock_find_conn(sep, sin.sin_addr.s_addr, sin.sin_port,
 		                       id, type);
+		/* we heard from the peer (see sock_conn_timer()) */
+		if (sconn && sconn->conn->keepalive_timeout)
+			sconn->last_recv_us = sock_get_usecs();
 	}
 
 #if CCI_DEBUG
@@ -4996,8 +5853,8 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		   a conn_reject */
 		if (SOCK_MSG_CONN_ACK == type) {
 			uint32_t total_size = sizeof (sock_header_r_t);
-			recv_len = sock_recv_msg (sep->sock, rx->buffer,
-			                          total_size, 0, NULL);
+			recv_len = sock_rx_recv (rx,
+			                         total_size, 0, NULL);
 			debug (CCI_DB_EP, "%s: We now have %u/%u bytes",
 			       __func__, (unsigned int)recv_len, total_size);
 #if CCI_DEBUG
@@ -5009,24 +5866,37 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 			   explicitely return the rx */
 			sock_handle_conn_ack(NULL, rx, a, b, id, sin);
 			/* Return the RX */
-			TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+			sock_rx_put(rx);
 		}
 		q_rx = 1;
 		goto out;
 	}
 
-	/* Some actions specific to reliable connections */
-	if (sconn && cci_conn_is_reliable(sconn->conn))
+	/* drop= device option: lose some reliable data msgs to exercise
+	   the resend paths */
+	if (sep->drop && sconn && cci_conn_is_reliable(sconn->conn) &&
+	    (type == SOCK_MSG_SEND || type == SOCK_MSG_RMA_WRITE) &&
+	    ++shard->drop_count % sep->drop == 0) {
+		debug(CCI_DB_MSG, "%s: dropping %s msg (drop=%u)", __func__,
+		      sock_msg_type(type), sep->drop);
+		sock_rx_drop(rx);
+		sock_rx_put(rx);
+		CCI_EXIT;
+		return again;
+	}
+
+	/* Some actions specific to reliable connections (keepalives have
+	   no seq) */
+	if (sconn && !ka && cci_conn_is_reliable(sconn->conn))
 	{
 		sock_header_r_t *hdr_r;
 
 		/* Make sure we receive the entire reliable header */
 		if (recv_len < sizeof (sock_header_r_t)) {
-			recv_len = sock_recv_msg (sep->sock,
-			                          rx->buffer,
-			                          sizeof (sock_header_r_t),
-			                          MSG_PEEK,
-			                          NULL);
+			recv_len = sock_rx_recv (rx,
+			                         sizeof (sock_header_r_t),
+			                         MSG_PEEK,
+			                         NULL);
 #if CCI_DEBUG
 			assert (recv_len == sizeof (sock_header_r_t));
 #endif
@@ -5047,7 +5917,11 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 				                 sep,
 				                 seq,
 				                 ts);				
-				goto out;
+				/* The message stays in the socket and is
+				   handled by the next call; a batched one
+				   has no second chance, so handle it now */
+				if (!rx->dgram_len)
+					goto out;
 			}
 		}
 
@@ -5058,13 +5932,19 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 			     RMA_READ_REPLY message
 			   - RMA_READ_REPLY message are not acked since they act as an
 			     ACK (not ack of acks). 
-			   - SOCK_MSG_RNR are not acked since they act as a NACK */
-			if (!(type == SOCK_MSG_RMA_READ_REQUEST)
-			    && !(type == SOCK_MSG_RMA_READ_REPLY)
+			   - SOCK_MSG_RNR are not acked since they act as a NACK
+			   - acks have no seq */
+			if (type == SOCK_MSG_RMA_READ_REQUEST) {
+				/* still, its seq moves the window */
+				seen = sock_handle_seq(sconn, seq, ts, 0);
+			} else if (!(type == SOCK_MSG_RMA_READ_REPLY)
 			    && !(type == SOCK_MSG_NACK)
-			    && !(type == SOCK_MSG_RNR))
+			    && !(type == SOCK_MSG_RNR)
+			    && !(type == SOCK_MSG_ACK_ONLY)
+			    && !(type == SOCK_MSG_ACK_UP_TO)
+			    && !(type == SOCK_MSG_SACK))
 			{
-				sock_handle_seq(sconn, seq);
+				seen = sock_handle_seq(sconn, seq, ts, 1);
 			}
 
 			if (hdr_r->pb_ack != 0) {
@@ -5073,6 +5953,21 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 				   to do it again */
 				hdr_r->pb_ack = 0;
 			}
+
+			/* A resend of data we already have (our ack was lost
+			   or late), it is acked again but not delivered twice;
+			   a msg past our window waits for its resend */
+			if (seen < 0 || (!seen && (type == SOCK_MSG_SEND ||
+			                 type == SOCK_MSG_RMA_WRITE ||
+			                 type == SOCK_MSG_RMA_WRITE_DONE))) {
+				debug(CCI_DB_MSG, "%s: dropping %s %s seq %u",
+				      __func__, seen < 0 ? "unexpected" :
+				      "duplicate", sock_msg_type(type), seq);
+				sock_rx_drop(rx);
+				sock_rx_put(rx);
+				CCI_EXIT;
+				return again;
+			}
 		}
 	}
 
@@ -5080,8 +5975,8 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	case SOCK_MSG_CONN_REQUEST: {
 		uint32_t total_size = sizeof (sock_header_r_t)
 		                      + sizeof (sock_handshake_t) + b;
-		recv_len = sock_recv_msg (sep->sock, rx->buffer,
-		                          total_size, 0, NULL);
+		recv_len = sock_rx_recv (rx,
+		                         total_size, 0, NULL);
 		debug (CCI_DB_EP,
 		       "%s: We now have %u/%u bytes",
 		       __func__,
@@ -5096,8 +5991,8 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		/* We first get the header and only the header to know if we
 		   are in the context of a connect accept or reject */
 		uint32_t total_size = sizeof (sock_header_r_t);
-		recv_len = sock_recv_msg (sep->sock, rx->buffer,
-		                          total_size, MSG_PEEK, NULL);
+		recv_len = sock_rx_recv (rx,
+		                         total_size, MSG_PEEK, NULL);
 #if CCI_DEBUG
 		assert (recv_len == total_size);
 #endif
@@ -5106,8 +6001,8 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	}
 	case SOCK_MSG_CONN_ACK: {
 		uint32_t total_size = sizeof (sock_header_r_t);
-		recv_len = sock_recv_msg (sep->sock, rx->buffer,
-		                          total_size, 0, NULL);
+		recv_len = sock_rx_recv (rx,
+		                         total_size, 0, NULL);
 		debug (CCI_DB_EP, "%s: We now have %u/%u bytes",
 		       __func__, (unsigned int)recv_len, total_size);
 #if CCI_DEBUG
@@ -5117,6 +6012,8 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		break;
 	}
 	case SOCK_MSG_DISCONNECT:
+		if (rx->dgram_len)
+			q_rx = 1;
 		break;
 	case SOCK_MSG_SEND: {
 		uint16_t total_size = b;
@@ -5126,16 +6023,18 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 			total_size += sizeof (sock_header_t);
 		}
 		/* Make sure we have the entire msg */
-		recv_len = sock_recv_msg (sep->sock,
-		                          rx->buffer,
-		                          total_size,
-		                          0,
-		                          NULL);
+		recv_len = sock_rx_recv (rx,
+		                         total_size,
+		                         0,
+		                         NULL);
 		debug (CCI_DB_EP, "%s: We now have %u/%u bytes",
 		       __func__, (unsigned int)recv_len, total_size);
 #if CCI_DEBUG
 		assert (recv_len == total_size);
 #endif
+		CCI_TRACE(CCI_TRACE_RECV, CCI_TRACE_TP_SOCK, sconn, seq, b);
+		CCI_STAT_ADD(ep, sconn->conn, msgs_recv, 1);
+		CCI_STAT_ADD(ep, sconn->conn, bytes_recv, b);
 		sock_handle_active_message(sconn, rx, b, id);
 		break;
 	}
@@ -5146,6 +6045,7 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		       "%s: Receiver not ready", __func__);
 
 		sock_parse_seq_ts(&hdr_r->seq_ts, &seq, &ts);
+		CCI_STAT_ADD(ep, sconn->conn, rnr, 1);
 		sock_handle_rnr(sconn, seq, ts);
 		/* No event is directly generated from the msg
 		   so we can reuse the RX buffer */
@@ -5153,15 +6053,17 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		break;
 	}
 	case SOCK_MSG_KEEPALIVE:
-		/* Nothing to do? */
+		/* Nothing to do, hearing from the peer was the point */
+		sock_rx_recv (rx, sizeof(sock_header_t), 0, NULL);
+		q_rx = 1;
 		break;
 	case SOCK_MSG_ACK_ONLY:
 	case SOCK_MSG_ACK_UP_TO:
 	case SOCK_MSG_SACK: {
 		uint32_t total_size = sizeof (sock_header_r_t)
 		                      + a * sizeof (uint32_t);
-		recv_len = sock_recv_msg (sep->sock, rx->buffer,
-		                       total_size, 0, NULL);
+		recv_len = sock_rx_recv (rx,
+		                         total_size, 0, NULL);
 		debug (CCI_DB_EP, "%s: We now have %u/%u bytes",
 		       __func__, (unsigned int)recv_len, total_size);
 #if CCI_DEBUG
@@ -5175,8 +6077,8 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		uint32_t total_size 	= sizeof (sock_header_r_t);
 
 		/* We just need to the data from the header */
-		recv_len = sock_recv_msg (sep->sock, rx->buffer,
-                                          total_size, 0, NULL);
+		recv_len = sock_rx_recv (rx,
+		                         total_size, 0, NULL);
                 debug (CCI_DB_EP, "%s: We now have %u/%u bytes",
                        __func__, (unsigned int)recv_len, total_size);
 #if CCI_DEBUG
@@ -5188,11 +6090,10 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	}
 	case SOCK_MSG_RMA_WRITE: {
 		/* At first we just need to make sure we have the header */
-		recv_len = sock_recv_msg (sep->sock,
-		                       rx->buffer,
-		                       sizeof (sock_rma_header_t),
-		                       MSG_PEEK,
-		                       NULL);
+		recv_len = sock_rx_recv (rx,
+		                         sizeof (sock_rma_header_t),
+		                         MSG_PEEK,
+		                         NULL);
 #if CCI_DEBUG
 		assert (recv_len == sizeof (sock_rma_header_t));
 #endif
@@ -5204,11 +6105,10 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		   and the length of the completion message */
 		uint32_t total_size = sizeof (sock_rma_header_t)
 		                      + sizeof (uint32_t);
-		recv_len = sock_recv_msg (sep->sock,
-		                          rx->buffer,
-		                          total_size,
-		                          MSG_PEEK,
-		                          NULL);
+		recv_len = sock_rx_recv (rx,
+		                         total_size,
+		                         MSG_PEEK,
+		                         NULL);
 #if CCI_DEBUG
 		assert (recv_len == total_size);
 #endif
@@ -5217,11 +6117,10 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	}
 	case SOCK_MSG_RMA_READ_REQUEST: {
 		uint32_t total_size = sizeof (sock_rma_header_t);
-		recv_len = sock_recv_msg (sep->sock,
-		                          rx->buffer,
-		                          total_size,
-		                          0,
-		                          NULL);
+		recv_len = sock_rx_recv (rx,
+		                         total_size,
+		                         0,
+		                         NULL);
 		debug (CCI_DB_EP, "%s: We now have %u/%u bytes",
 		       __func__, (unsigned int)recv_len, total_size);
 #if CCI_DEBUG
@@ -5232,11 +6131,10 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	}
 	case SOCK_MSG_RMA_READ_REPLY: {
 		/* At first we just need to make sure we have the header */
-		recv_len = sock_recv_msg (sep->sock,
-		                          rx->buffer,
-		                          sizeof (sock_rma_header_t),
-		                          MSG_PEEK,
-		                          NULL);
+		recv_len = sock_rx_recv (rx,
+		                         sizeof (sock_rma_header_t),
+		                         MSG_PEEK,
+		                         NULL);
 #if CCI_DEBUG
 		assert (recv_len == sizeof (sock_rma_header_t));
 #endif
@@ -5246,13 +6144,13 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	default:
 		debug(CCI_DB_MSG, "%s: unknown active message with type %u",
 		      __func__, (enum sock_msg_type)type);
+		if (rx->dgram_len)
+			q_rx = 1;
 	}
 
 out:
 	if (q_rx) {
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-		pthread_mutex_unlock(&ep->lock);
+		sock_rx_put(rx);
 	}
 
 	if (drop_msg) {
@@ -5287,7 +6185,7 @@ out:
 		}
 
 		/* Drop the message */
-		sock_drop_msg(sep->sock);
+		sock_drop_msg(shard->sock);
 	} else {
 		if (sconn && sconn->conn &&
 		    sconn->conn->connection.attribute == CCI_CONN_ATTR_RO)
@@ -5300,195 +6198,463 @@ out:
 }
 
 /*
- * Check whether a keeplive timeout expired for a given endpoint.
+ * Send the RMA read replies deferred during a receive batch and give
+ * their txs back.
  */
-static void sock_keepalive(cci__ep_t *ep)
+static void sock_flush_replies(cci__ep_t * ep, sock_shard_t * shard)
 {
-	cci__conn_t *conn;
-	uint64_t now = 0ULL;
-	uint32_t ka_timeout;
-	uint8_t i;
-	struct s_conns *conn_list;
-	sock_conn_t *sconn = NULL;
-	sock_dev_t *sdev;
-	cci__dev_t *dev;
-	sock_ep_t *sep = NULL;
+	int i;
+	sock_ep_t *sep = ep->priv;
+	sock_reply_batch_t *rb = shard->replies;
+
+	if (rb->dgrams.count == 0)
+		return;
+
+	sock_dgram_flush(sep, &rb->dgrams);
+
+	pthread_mutex_lock(&ep->lock);
+	for (i = 0; i < rb->dgrams.count; i++)
+		TAILQ_INSERT_TAIL(&sep->idle_txs, rb->txs[i], dentry);
+	pthread_mutex_unlock(&ep->lock);
+
+	sock_dgram_init(&rb->dgrams);
+}
+
+#ifdef SOCK_HAVE_GRO
+/*
+ * Split a datagram coalesced by UDP GRO into its segments (each one a
+ * datagram from the peer), copy them into idle rxs and handle them in
+ * order. Segments we have no rx for are dropped, reliable connections
+ * will resend them.
+ */
+static void
+sock_recv_gro_split(cci__ep_t * ep, sock_shard_t * shard, char *buf, int len,
+                    int seg, struct sockaddr_in *sin)
+{
+	int i, n, nseg;
+	sock_rx_t *rxs[SOCK_GRO_BUF_SIZE / SOCK_MIN_MSS + 1];
+
+	if (seg <= 0 || seg > len)
+		seg = len;
+	nseg = (len + seg - 1) / seg;
+	if (nseg > (int)(sizeof(rxs) / sizeof(rxs[0])))
+		nseg = sizeof(rxs) / sizeof(rxs[0]);
+
+	n = sock_rx_get(shard, rxs, nseg);
+
+	if (n < nseg)
+		debug(CCI_DB_INFO, "%s: no RX buffer for %d of %d segments",
+		      __func__, nseg - n, nseg);
+
+	for (i = 0; i < n; i++) {
+		sock_rx_t *rx = rxs[i];
+		int off = i * seg;
+		int l = (len - off) < seg ? (len - off) : seg;
+
+		if (l < (int)sizeof(sock_header_t) || l > (int)ep->buffer_len) {
+			debug(CCI_DB_INFO, "%s: dropping a %d bytes segment",
+			      __func__, l);
+			sock_rx_put(rx);
+			continue;
+		}
+		memcpy(rx->buffer, buf + off, l);
+		rx->dgram_len = l;
+		rx->sin = *sin;
+		sock_recv_one(ep, shard, rx);
+	}
+}
+
+/*
+ * Receive path used when UDP GRO is on: datagrams may arrive coalesced,
+ * so they land in shard->gro_buf and are split into rxs afterwards.
+ * Called with shard->recv_mutex held. Returns 1 if more datagrams may be
+ * waiting.
+ */
+static int sock_recv_gro(cci__ep_t * ep, sock_shard_t * shard)
+{
+	int ret, i;
+	struct mmsghdr msgs[SOCK_GRO_BATCH];
+	struct iovec iovs[SOCK_GRO_BATCH];
+	struct sockaddr_in sins[SOCK_GRO_BATCH];
+	char ctrl[SOCK_GRO_BATCH][CMSG_SPACE(sizeof(int))];
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < SOCK_GRO_BATCH; i++) {
+		iovs[i].iov_base = (char *)shard->gro_buf + i * SOCK_GRO_BUF_SIZE;
+		iovs[i].iov_len = SOCK_GRO_BUF_SIZE;
+		msgs[i].msg_hdr.msg_name = &sins[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(sins[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = ctrl[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+	}
+
+	ret = recvmmsg(shard->sock, msgs, SOCK_GRO_BATCH, MSG_DONTWAIT, NULL);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			debug(CCI_DB_INFO, "%s: recvmmsg() failed with %s",
+			      __func__, strerror(errno));
+		return 0;
+	}
+
+	for (i = 0; i < ret; i++) {
+		struct msghdr *msg = &msgs[i].msg_hdr;
+		struct cmsghdr *cm;
+		int seg = 0;
+
+		if (msg->msg_flags & MSG_TRUNC) {
+			debug(CCI_DB_INFO, "%s: dropping a truncated datagram",
+			      __func__);
+			continue;
+		}
+		for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+			if (cm->cmsg_level == SOL_UDP &&
+			    cm->cmsg_type == UDP_GRO)
+				memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+		}
+		sock_recv_gro_split(ep, shard, iovs[i].iov_base,
+		                    msgs[i].msg_len, seg, &sins[i]);
+	}
+
+	return ret == SOCK_GRO_BATCH;
+}
+#endif /* SOCK_HAVE_GRO */
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Receive up to sep->rx_batch datagrams with one recvmmsg() into idle
+ * rxs taken in one go, then handle them in order. Returns 1 if the batch
+ * was full and more datagrams may be waiting.
+ *
+ * Only one thread receives from a shard at a time; two batches handled
+ * concurrently would reorder messages. With GSO on, the RMA read replies
+ * generated while handling the batch are sent together at the end of it.
+ */
+static int sock_recvmmsg_shard(cci__ep_t * ep, sock_shard_t * shard)
+{
+	int ret = 0, i = 0, n = 0;
+	sock_ep_t *sep = ep->priv;
+	sock_rx_t *rxs[SOCK_RX_BATCH_MAX];
+	struct mmsghdr msgs[SOCK_RX_BATCH_MAX];
+	struct iovec iovs[SOCK_RX_BATCH_MAX];
+	sock_reply_batch_t replies;
 
 	CCI_ENTER;
 
-	now = sock_get_usecs();
-	dev = ep->dev;
-	sdev = dev->priv;
-	sep = ep->priv;
-	i = sock_ip_hash(sdev->ip, sdev->port);
-	conn_list = &sep->conn_hash[i];
-	TAILQ_FOREACH(sconn, conn_list, entry) {
-		conn = sconn->conn;
-		if (conn->keepalive_timeout == 0ULL)
-			return;
+	if (pthread_mutex_trylock(&shard->recv_mutex)) {
+		CCI_EXIT;
+		return 0;
+	}
 
-		/* The keepalive is assumed to expire if we did not hear
-		   anything from the peer since the last receive + keepalive
-		   timeout. */
-		ka_timeout = sconn->ts + conn->keepalive_timeout;
+	if (sep->gso) {
+		sock_dgram_init(&replies.dgrams);
+		shard->replies = &replies;
+	}
 
-		if (SOCK_U64_LT(now, ka_timeout)) {
-			int len;
-			char buffer[SOCK_MAX_HDR_SIZE];
-			sock_header_t *hdr = NULL;
-			cci_event_keepalive_timedout_t *event = NULL;
-			cci__evt_t *evt = NULL;
-			cci__ep_t *ep = NULL;
-			sock_ep_t *sep = NULL;
+#ifdef SOCK_HAVE_GRO
+	if (shard->gro_buf) {
+		ret = sock_recv_gro(ep, shard);
+		goto out;
+	}
+#endif
 
-			/*
-			* We generate a keepalive event
-			*/
+	/* Within a run of large RMA fragments, receive one datagram at a
+	   time: the header is peeked at and the payload goes straight into
+	   the registered memory rather than through an rx */
+	if (shard->direct) {
+		ret = sock_recv_one(ep, shard, NULL);
+		goto out;
+	}
 
-			TAILQ_HEAD(s_evts, cci__evt) evts
-				= TAILQ_HEAD_INITIALIZER(evts);
-			TAILQ_INIT(&evts);
-			evt = TAILQ_FIRST(&evts);
-			event = (cci_event_keepalive_timedout_t *) evt;
-			event->type = CCI_EVENT_KEEPALIVE_TIMEDOUT;
-			event->connection = &conn->connection;
-			TAILQ_REMOVE(&evts, evt, entry);
-			sock_queue_event (evt->ep, evt);
-
-			/* waking up the app thread if it is blocking on a OS
-			   handle */
-			if (sep->event_fd) {
-				int rc;
-				rc = write (sep->fd[1], "a", 1);
-				if (rc != 1) {
-					debug (CCI_DB_WARN,
-					       "%s: Write failed", __func__);
-					return;
-				}
-			}
+	n = sock_rx_get(shard, rxs, (int)sep->rx_batch);
 
-			/*
-			* Finally we send an heartbeat
-			*/
+	/* Out of RX buffers, the single receive path handles RNR */
+	if (n == 0) {
+		ret = sock_recv_one(ep, shard, NULL);
+		goto out;
+	}
 
-			/* Prepare and send the msg */
-			ep = container_of(conn->connection.endpoint, cci__ep_t, endpoint);
-			sep = ep->priv;
-			memset(buffer, 0, sizeof(buffer));
-			hdr = (sock_header_t *) buffer;
-			sock_pack_keepalive(hdr, sconn->peer_id);
-			len = sizeof(*hdr);
-			sock_sendto(sep->sock, buffer, len, NULL, 0, sconn->sin);
+	memset(msgs, 0, n * sizeof(*msgs));
+	for (i = 0; i < n; i++) {
+		iovs[i].iov_base = rxs[i]->buffer;
+		iovs[i].iov_len = ep->buffer_len;
+		msgs[i].msg_hdr.msg_name = &rxs[i]->sin;
+		msgs[i].msg_hdr.msg_namelen = sizeof(rxs[i]->sin);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = recvmmsg(shard->sock, msgs, n, MSG_DONTWAIT, NULL);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			debug(CCI_DB_INFO, "%s: recvmmsg() failed with %s",
+			      __func__, strerror(errno));
+		ret = 0;
+	}
+
+	/* Return the rxs that we did not use */
+	if (ret < n) {
+		pthread_mutex_lock(&shard->lock);
+		for (i = n - 1; i >= ret; i--)
+			TAILQ_INSERT_HEAD(&shard->idle_rxs, rxs[i], entry);
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	for (i = 0; i < ret; i++) {
+		sock_rx_t *rx = rxs[i];
+
+		if (msgs[i].msg_len < sizeof(sock_header_t) ||
+		    (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+			debug(CCI_DB_INFO, "%s: dropping a %u bytes datagram",
+			      __func__, msgs[i].msg_len);
+			sock_rx_put(rx);
+			continue;
 		}
+		rx->dgram_len = msgs[i].msg_len;
+		sock_recv_one(ep, shard, rx);
+	}
+	ret = (ret == n);
+
+out:
+	if (shard->replies) {
+		sock_flush_replies(ep, shard);
+		shard->replies = NULL;
 	}
+	pthread_mutex_unlock(&shard->recv_mutex);
 
 	CCI_EXIT;
-	return;
+
+	return ret;
+}
+#endif /* HAVE_RECVMMSG */
+
+static int sock_recvfrom_shard(cci__ep_t * ep, sock_shard_t * shard)
+{
+	sock_ep_t *sep = ep->priv;
+
+#ifdef HAVE_RECVMMSG
+	if (sep->rx_batch > 1)
+		return sock_recvmmsg_shard(ep, shard);
+#endif
+	return sock_recv_one(ep, shard, NULL);
+}
+
+static int sock_recvfrom_ep(cci__ep_t * ep)
+{
+	sock_ep_t *sep = ep->priv;
+
+	if (!sep)
+		return 0;
+
+	return sock_recvfrom_shard(ep, &sep->shards[0]);
 }
 
-static inline int sock_ack_sconn (sock_ep_t *sep, sock_conn_t *sconn)
+/*
+ * Send the pending acks of sconn, or add them to batch if not NULL (the
+ * caller flushes it).
+ *
+ * With nothing received past the window's base, an ACK_UP_TO acks it all.
+ * Otherwise a SACK acks the base, with a block going back the width of
+ * the window (some of our acks may have been lost), then the ranges
+ * received past it. When more ranges are pending than the SACK holds,
+ * the next SACK goes on from where this one stopped, and the ack timer is
+ * armed again so that it goes out even if nothing else arrives.
+ */
+static inline int sock_ack_sconn (sock_ep_t *sep, sock_conn_t *sconn,
+                                  sock_dgram_batch_t *batch)
 {
 	uint64_t now = 0ULL;
-	int count = 0;
+	int count = 0, more = 0;
+	sock_rwin_t *w = &sconn->rwin;
 
 	now = sock_get_usecs();
 
-	if (!TAILQ_EMPTY(&sconn->acks)) {
+	if (w->unacked) {
 		sock_header_r_t *hdr_r;
 		uint32_t acks[SOCK_MAX_SACK * 2];
-		sock_ack_t *ack = NULL;
 		sock_msg_type_t type = SOCK_MSG_ACK_UP_TO;
 		char buffer[SOCK_MAX_HDR_SIZE];
 		int len = 0;
 		int ret;
 
-		count = 1;
+		/* We check whether we want to ack now or delay acks */
+		if (SOCK_U64_LT(now, sconn->last_ack_ts + ACK_TIMEOUT) &&
+		    w->unacked < PENDING_ACK_THRESHOLD)
+		{
+			debug (CCI_DB_MSG,
+			       "%s: Delaying ACK", __func__);
+			sock_arm_ack(sep, sconn);
+			return 0;
+		}
+
 		memset(buffer, 0, sizeof(buffer));
-		
-		if (1 == sock_need_sack(sconn)) {
-			/* There are more than one element in the list of pending acks */
-			sock_ack_t *tmp;
-			
+		acks[0] = w->base;
+		count = 1;
+		if (w->high != w->base) {
+			uint32_t from = w->sack_next, seq, end;
+			int wrapped = 0;
+
 			type = SOCK_MSG_SACK;
-			count = 0;
-			
-			/* We first count the number of pending ACKs */
-			TAILQ_FOREACH_SAFE(ack, &sconn->acks, entry, tmp) {
-				count++;
-			}
-			
-			/* We check whether we want to ack now or delay acks */
-			if (SOCK_U64_LT(now, sconn->last_ack_ts + ACK_TIMEOUT) &&
-				count <= PENDING_ACK_THRESHOLD)
-			{
-				debug (CCI_DB_MSG,
-				       "%s: Delaying ACK", __func__);
-				return 0;
-			}
-			
-			count = 0;
-			TAILQ_FOREACH_SAFE(ack, &sconn->acks, entry, tmp) {
-				TAILQ_REMOVE (&sconn->acks, ack, entry);
-				acks[count++] = ack->start;
-				acks[count++] = ack->end;
-				free(ack);
-				if (count == SOCK_MAX_SACK * 2)
+			acks[0] = w->base - (w->size - 1);
+			acks[1] = w->base;
+			count = 2;
+
+			if (SOCK_SEQ_LTE(from, w->base) ||
+			    SOCK_SEQ_GT(from, w->high))
+				from = w->base + 1;
+			seq = from;
+			while (count < SOCK_MAX_SACK * 2) {
+				seq = sock_rwin_next(w, seq, 1);
+				if (wrapped && SOCK_SEQ_GTE(seq, from))
 					break;
+				if (SOCK_SEQ_GT(seq, w->high)) {
+					/* go around once, from the base */
+					if (wrapped || from == w->base + 1)
+						break;
+					wrapped = 1;
+					seq = w->base + 1;
+					continue;
+				}
+				end = sock_rwin_next(w, seq, 0);
+				if (wrapped && SOCK_SEQ_GT(end, from))
+					end = from;
+				acks[count++] = seq;
+				acks[count++] = end - 1;
+				seq = end;
 			}
-			if (acks[0] == sconn->acked + 1) {
-				sconn->acked = acks[1];
-			}
-		} else {
-			/* There is only one element in the list of pending acks */
-			ack = TAILQ_FIRST(&sconn->acks);
-			if (SOCK_U64_LT(now, sconn->last_ack_ts + ACK_TIMEOUT)
-				&& (ack->end - ack->start < PENDING_ACK_THRESHOLD))
-			{
-				debug (CCI_DB_MSG,
-				       "%s: Delaying ACK", __func__);
-				return 0;
-			}
-			TAILQ_REMOVE(&sconn->acks, ack, entry);
-			if (ack->start == sconn->acked)
-				sconn->acked = ack->end;
-			acks[0] = ack->end;
-			/* If we have a single pending ACK, we send a 
-			 SOCK_MSG_ACK_ONLY ACK, otherwise we send a
-			 SOCK_MSG_ACK_UP_TO ACK */
-			if (ack->start == ack->end)
-				type = SOCK_MSG_ACK_ONLY;
-			free(ack);
+			w->sack_next = seq;
+			/* full, with ranges left before the end of this pass */
+			more = count == SOCK_MAX_SACK * 2 && !wrapped &&
+			       SOCK_SEQ_LTE(sock_rwin_next(w, seq, 1), w->high);
 		}
+
 		hdr_r = (sock_header_r_t *) buffer;
-		sock_pack_ack(hdr_r, type, sconn->peer_id, 0, 0, acks, count);
-		
+		/* echo the sender's timestamp for its RTT estimate */
+		sock_pack_ack(hdr_r, type, sconn->peer_id, 0, sconn->ts,
+		              acks, count);
+		sconn->ts = 0;
+		sconn->acked = w->base;
+		w->unacked = more;
+
 		len = sizeof(*hdr_r) + (count * sizeof(acks[0]));
-		ret = sock_sendto(sep->sock, buffer, len, NULL, 0, sconn->sin);
+		if (batch) {
+			sock_dgram_add_copy(batch, buffer, len, sconn->sin);
+			ret = len;
+		} else {
+			ret = sock_sendto(sep->sock, buffer, len, NULL, 0,
+			                  sconn->sin);
+		}
 		if (ret == -1)
 			debug (CCI_DB_WARN, "%s: ACK send failed", __func__);
+		else
+			CCI_TRACE(CCI_TRACE_ACK_TX, CCI_TRACE_TP_SOCK, sconn,
+				  acks[0], acks[count - 1]);
 		sconn->last_ack_ts = now;
+		if (more)
+			sock_arm_ack(sep, sconn);
 	}
 	
 	return count;
 }
 
+/*
+ * A connection timer expired: send the delayed acks, let a paced
+ * connection send again, or send the periodic keepalive and check that we
+ * heard from the peer within the keepalive timeout. If not, hand back a
+ * KEEPALIVE_TIMEDOUT event for the caller to queue and stop watching (see
+ * CCI_OPT_ENDPT_KEEPALIVE_TIMEOUT). Caller holds ep->lock and flushes
+ * batch.
+ */
+static cci__evt_t *sock_conn_timer(cci__ep_t *ep, sock_timer_t *timer,
+                                   uint64_t now, sock_dgram_batch_t *batch)
+{
+	sock_ep_t *sep = ep->priv;
+	sock_conn_t *sconn;
+	cci__conn_t *conn;
+	cci__evt_t *evt = NULL;
+	sock_tx_t *tx;
+	uint32_t ka;
+
+	if (timer->type == SOCK_TIMER_ACK) {
+		sconn = container_of(timer, sock_conn_t, ack_timer);
+		sock_ack_sconn(sep, sconn, batch);
+		goto out;
+	}
+
+	/* a paced conn has tokens again, sock_progress_queued() follows */
+	if (timer->type == SOCK_TIMER_PACE)
+		goto out;
+
+	sconn = container_of(timer, sock_conn_t, ka_timer);
+	conn = sconn->conn;
+	ka = conn->keepalive_timeout;
+	if (!ka)
+		return NULL;
+
+	if (SOCK_U64_LT(now, sconn->last_recv_us + ka)) {
+		char buffer[SOCK_MAX_HDR_SIZE];
+		sock_header_t *hdr = (sock_header_t *) buffer;
+
+		/* a few per timeout so that a live peer always hears one */
+		memset(buffer, 0, sizeof(buffer));
+		sock_pack_keepalive(hdr, sconn->peer_id);
+		sock_dgram_add_copy(batch, buffer, sizeof(*hdr), sconn->sin);
+		sock_timer_add(&sep->timers, timer, now + ka / 3);
+		goto out;
+	}
+
+	tx = TAILQ_FIRST(&sep->idle_txs);
+	if (!tx) {
+		/* no tx to carry the event, try again later */
+		sock_timer_add(&sep->timers, timer, now + ka / 3);
+	} else {
+		debug(CCI_DB_CONN, "%s: keepalive timeout", __func__);
+		conn->keepalive_timeout = 0;
+		TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
+		evt = &tx->evt;
+		evt->ep = ep;
+		evt->conn = conn;
+		evt->event.keepalive.type = CCI_EVENT_KEEPALIVE_TIMEDOUT;
+		evt->event.keepalive.connection = &conn->connection;
+	}
+
+out:
+	if (sock_dgram_full(batch)) {
+		sock_dgram_flush(sep, batch);
+		sock_dgram_init(batch);
+	}
+	return evt;
+}
+
 static void sock_ack_conns(cci__ep_t * ep)
 {
 	int i;
 	sock_ep_t *sep = ep->priv;
 	sock_conn_t *sconn = NULL;
 	uint64_t now = 0ULL;
+	sock_dgram_batch_t batch;
 
 	CCI_ENTER;
 
+	sock_dgram_init(&batch);
+
 	pthread_mutex_lock(&ep->lock);
 	for (i = 0; i < SOCK_EP_HASH_SIZE; i++) {
 		if (!TAILQ_EMPTY(&sep->conn_hash[i])) {
 			TAILQ_FOREACH(sconn, &sep->conn_hash[i], entry) {
-				sock_ack_sconn (sep, sconn);
+				sock_ack_sconn (sep, sconn, &batch);
+				if (sock_dgram_full(&batch)) {
+					sock_dgram_flush(sep, &batch);
+					sock_dgram_init(&batch);
+				}
 			}
 		}
 	}
+
+	/* all acks in as few system calls as possible */
+	if (batch.count)
+		sock_dgram_flush(sep, &batch);
 	pthread_mutex_unlock(&ep->lock);
 
 	/* Since a ACK was issued, we try to receive more data */
@@ -5505,6 +6671,8 @@ static void *sock_progress_thread(void *arg)
 	sock_ep_t *sep;
 	int i;
 	sock_conn_t *sconn = NULL;
+	uint64_t next, soon;
+	int more;
 
 	assert (ep);
 	sep = ep->priv;
@@ -5514,17 +6682,37 @@ static void *sock_progress_thread(void *arg)
 
 		pthread_mutex_unlock(&ep->lock);
 
-		sock_keepalive (ep);
-		sock_progress_sends (ep);
+		more = sock_progress_sends (ep);
+
+		/* Sleep until the next timer is due, or the next tick if the
+		   last pass left sends queued. Arming an earlier timer or
+		   queuing a send kicks us (see sock_arm_timer()). */
+		pthread_mutex_lock(&ep->lock);
+		next = sock_timer_next(&sep->timers);
+		if (more) {
+			soon = sock_get_usecs() + SOCK_TIMER_TICK_US;
+			if (!next || soon < next)
+				next = soon;
+		}
+		sep->sleep_until = next ? next : UINT64_MAX;
+		pthread_mutex_unlock(&ep->lock);
+
+		pthread_mutex_lock(&sep->progress_mutex);
+		if (!sep->progress_kick && !sep->closing) {
+			if (next) {
+				struct timespec ts;
 
-		/* If the endpoint is in the process of closing, we just move
-		   on, otherwise, we wait for a signal to wake up and do progress */
-		if (!sep->closing) {
-			pthread_mutex_lock(&sep->progress_mutex);
-			pthread_cond_wait(&sep->wait_condition,
-			                  &sep->progress_mutex);
-			pthread_mutex_unlock(&sep->progress_mutex);
+				ts.tv_sec = next / 1000000;
+				ts.tv_nsec = (next % 1000000) * 1000;
+				pthread_cond_timedwait(&sep->wait_condition,
+				                       &sep->progress_mutex, &ts);
+			} else {
+				pthread_cond_wait(&sep->wait_condition,
+				                  &sep->progress_mutex);
+			}
 		}
+		sep->progress_kick = 0;
+		pthread_mutex_unlock(&sep->progress_mutex);
 
 		pthread_mutex_lock(&ep->lock);
 	}
@@ -5608,15 +6796,13 @@ int progress_recv (cci__ep_t *ep)
 			      __func__, strerror(errno));
 		}
 
-		/* We need to avoid the case where a message is lost and we do
-		   not handle a message timeout because we block */
+		/* Queued sends may be waiting on the acks we just received
+		   (RMA depth); pending ones are on the timer wheel */
 		pthread_mutex_lock(&ep->lock);
-		if (!TAILQ_EMPTY (&sep->queued) || !TAILQ_EMPTY (&sep->pending)) {
+		if (!TAILQ_EMPTY (&sep->queued)) {
 			/* If the send queue is not empty, wake up the send
 			   thread */
-			pthread_mutex_lock(&sep->progress_mutex);
-			pthread_cond_signal(&sep->wait_condition);
-			pthread_mutex_unlock(&sep->progress_mutex);
+			sock_kick_progress(sep);
 		}
 		pthread_mutex_unlock(&ep->lock);
 
@@ -5664,3 +6850,27 @@ static void *sock_recv_thread(void *arg)
 	return (NULL);		/* make pgcc happy */
 }
 
+/*
+ * Receive thread of the shards after the first one: wait for datagrams
+ * on the shard's socket and drain it.
+ */
+static void *sock_shard_thread(void *arg)
+{
+	sock_shard_t *shard = (sock_shard_t *)arg;
+	cci__ep_t *ep = shard->ep;
+	sock_ep_t *sep = ep->priv;
+	struct pollfd pfd;
+
+	pfd.fd = shard->sock;
+	pfd.events = POLLIN;
+	while (!sep->closing) {
+		if (poll(&pfd, 1, SOCK_SHARD_POLL_MS) <= 0)
+			continue;
+		while (sock_recvfrom_shard(ep, shard) == 1)
+			;
+	}
+
+	pthread_exit(NULL);
+	return (NULL);		/* make pgcc happy */
+}
+
@@ -0,0 +1,307 @@
+/*
+ * Copyright © 2010-2013 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+/*
+ * Congestion controllers of the sock transport (see sock_cc_ops_t).
+ *
+ * Windows are in messages. reno and cubic react to loss only (RFC 5681,
+ * RFC 8312), delay follows TCP Vegas and keeps a few messages queued in
+ * the network based on the RTT samples of the timestamp echo, falling
+ * back to reno on loss.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+#include "ctp_sock.h"
+
+/* cubic: C = 0.4, beta = 0.7 */
+#define CUBIC_C_DIV     (2500000000LL)	/* 1 / C in ms^3 per s^3 */
+#define CUBIC_BETA_NUM  (7)
+#define CUBIC_BETA_DEN  (10)
+
+/* delay: msgs queued in the network we aim at */
+#define DELAY_ALPHA     (2)
+#define DELAY_BETA      (4)
+#define DELAY_GAMMA     (1)	/* leave slow start past this */
+
+/* Is the window what limits sconn (rather than the application)? Only
+ * then may it grow. acked txs just left the flight. */
+static int sock_cc_cwnd_limited(sock_conn_t *sconn, uint32_t acked)
+{
+	return 2 * (sconn->inflight + acked) >= sconn->cwnd;
+}
+
+/* Grow by one msg per msg acked up to ssthresh, return the acks left */
+static uint32_t sock_cc_slow_start(sock_conn_t *sconn, uint32_t acked)
+{
+	uint32_t cwnd = sconn->cwnd + acked;
+
+	if (cwnd > sconn->ssthresh)
+		cwnd = sconn->ssthresh;
+	acked -= cwnd - sconn->cwnd;
+	sconn->cwnd = cwnd;
+	return acked;
+}
+
+/* Grow by one msg every w msgs acked */
+static void sock_cc_ai(sock_conn_t *sconn, uint32_t w, uint32_t acked)
+{
+	if (sconn->cc.cwnd_cnt >= w) {
+		sconn->cc.cwnd_cnt = 0;
+		sconn->cwnd++;
+	}
+	sconn->cc.cwnd_cnt += acked;
+	if (sconn->cc.cwnd_cnt >= w) {
+		uint32_t delta = sconn->cc.cwnd_cnt / w;
+
+		sconn->cc.cwnd_cnt -= delta * w;
+		sconn->cwnd += delta;
+	}
+}
+
+/* Halve the window, or restart from one msg after a timeout */
+static void sock_cc_halve(sock_conn_t *sconn, int timeout)
+{
+	sconn->ssthresh = sconn->cwnd / 2;
+	if (sconn->ssthresh < 2)
+		sconn->ssthresh = 2;
+	sconn->cwnd = timeout ? 1 : sconn->ssthresh;
+	sconn->cc.cwnd_cnt = 0;
+}
+
+/************* reno *******************/
+
+static void sock_reno_init(sock_conn_t *sconn, uint64_t now)
+{
+	UNUSED_PARAM(now);
+	sconn->cc.cwnd_cnt = 0;
+}
+
+static void sock_reno_ack(sock_conn_t *sconn, uint32_t acked, uint32_t rtt,
+                          uint64_t now)
+{
+	UNUSED_PARAM(rtt);
+	UNUSED_PARAM(now);
+
+	if (!sock_cc_cwnd_limited(sconn, acked))
+		return;
+	if (sconn->cwnd < sconn->ssthresh) {
+		acked = sock_cc_slow_start(sconn, acked);
+		if (!acked)
+			return;
+	}
+	sock_cc_ai(sconn, sconn->cwnd, acked);
+}
+
+static void sock_reno_loss(sock_conn_t *sconn, int timeout, uint64_t now)
+{
+	UNUSED_PARAM(now);
+	sock_cc_halve(sconn, timeout);
+}
+
+/************* cubic *******************/
+
+/* Integer cube root, a < 2^63 */
+static uint32_t sock_cc_cbrt(uint64_t a)
+{
+	uint64_t x = 0, y;
+	int b;
+
+	for (b = 20; b >= 0; b--) {
+		y = x | (1ULL << b);
+		if (y * y * y <= a)
+			x = y;
+	}
+	return (uint32_t) x;
+}
+
+static void sock_cubic_init(sock_conn_t *sconn, uint64_t now)
+{
+	UNUSED_PARAM(now);
+	sconn->cc.cwnd_cnt = 0;
+	sconn->cc.w_max = 0;
+	sconn->cc.epoch_us = 0;
+}
+
+static void sock_cubic_ack(sock_conn_t *sconn, uint32_t acked, uint32_t rtt,
+                           uint64_t now)
+{
+	int64_t d, target;
+	uint64_t t_us;
+	uint32_t cnt;
+
+	UNUSED_PARAM(rtt);
+
+	if (!sock_cc_cwnd_limited(sconn, acked))
+		return;
+	if (sconn->cwnd < sconn->ssthresh) {
+		acked = sock_cc_slow_start(sconn, acked);
+		if (!acked)
+			return;
+	}
+
+	if (!sconn->cc.epoch_us) {
+		/* a new epoch, find how long the cubic takes to climb back
+		   to where the window was cut */
+		sconn->cc.epoch_us = now;
+		sconn->cc.cwnd_cnt = 0;
+		if (sconn->cwnd < sconn->cc.w_max) {
+			sconn->cc.k_ms = sock_cc_cbrt((uint64_t)
+			                 (sconn->cc.w_max - sconn->cwnd) *
+			                 CUBIC_C_DIV);
+			sconn->cc.origin = sconn->cc.w_max;
+		} else {
+			sconn->cc.k_ms = 0;
+			sconn->cc.origin = sconn->cwnd;
+		}
+	}
+
+	/* where the cubic is one RTT from now */
+	t_us = now + sconn->srtt - sconn->cc.epoch_us;
+	d = (int64_t) (t_us / 1000) - sconn->cc.k_ms;
+	if (d > 1000000)
+		d = 1000000;
+	else if (d < -1000000)
+		d = -1000000;
+	target = (int64_t) sconn->cc.origin + d * d * d / CUBIC_C_DIV;
+
+	/* never slower than reno would be (TCP friendly region) */
+	if (sconn->srtt) {
+		int64_t w_est = (int64_t) sconn->cc.w_max * CUBIC_BETA_NUM /
+		                CUBIC_BETA_DEN +
+		                (int64_t) (t_us * 9 / (17 * (uint64_t) sconn->srtt));
+
+		if (w_est > target)
+			target = w_est;
+	}
+
+	if (target > sconn->cwnd)
+		cnt = sconn->cwnd / (uint32_t) (target - sconn->cwnd);
+	else
+		cnt = 100 * sconn->cwnd;
+	if (!cnt)
+		cnt = 1;
+	sock_cc_ai(sconn, cnt, acked);
+}
+
+static void sock_cubic_loss(sock_conn_t *sconn, int timeout, uint64_t now)
+{
+	UNUSED_PARAM(now);
+
+	sconn->cc.epoch_us = 0;
+	/* fast convergence: cut short of the window, (1 + beta) / 2, to
+	   release some room to newer flows */
+	if (sconn->cwnd < sconn->cc.w_max)
+		sconn->cc.w_max = sconn->cwnd * (CUBIC_BETA_DEN + CUBIC_BETA_NUM) /
+		                  (2 * CUBIC_BETA_DEN);
+	else
+		sconn->cc.w_max = sconn->cwnd;
+	sconn->ssthresh = sconn->cwnd * CUBIC_BETA_NUM / CUBIC_BETA_DEN;
+	if (sconn->ssthresh < 2)
+		sconn->ssthresh = 2;
+	sconn->cwnd = timeout ? 1 : sconn->ssthresh;
+	sconn->cc.cwnd_cnt = 0;
+}
+
+/************* delay *******************/
+
+static void sock_delay_init(sock_conn_t *sconn, uint64_t now)
+{
+	sconn->cc.cwnd_cnt = 0;
+	sconn->cc.base_rtt = 0;
+	sconn->cc.round_rtt = 0;
+	sconn->cc.epoch_us = now;
+}
+
+static void sock_delay_ack(sock_conn_t *sconn, uint32_t acked, uint32_t rtt,
+                           uint64_t now)
+{
+	uint32_t diff;
+	int limited = sock_cc_cwnd_limited(sconn, acked);
+
+	if (rtt) {
+		if (!sconn->cc.base_rtt || rtt < sconn->cc.base_rtt)
+			sconn->cc.base_rtt = rtt;
+		if (!sconn->cc.round_rtt || rtt < sconn->cc.round_rtt)
+			sconn->cc.round_rtt = rtt;
+	}
+
+	if (now - sconn->cc.epoch_us < sconn->srtt || !sconn->cc.round_rtt) {
+		/* within a round, only slow start grows the window */
+		if (limited && sconn->cwnd < sconn->ssthresh)
+			sock_cc_slow_start(sconn, acked);
+		return;
+	}
+
+	/* once per round: the msgs we keep queued in the network are the
+	   window times the share of the RTT spent waiting in queues */
+	diff = (uint32_t) ((uint64_t) sconn->cwnd *
+	                   (sconn->cc.round_rtt - sconn->cc.base_rtt) /
+	                   sconn->cc.round_rtt);
+	if (sconn->cwnd < sconn->ssthresh) {
+		if (diff > DELAY_GAMMA) {
+			/* queues build up, settle on what the path holds */
+			sconn->cwnd = (uint32_t) ((uint64_t) sconn->cwnd *
+			              sconn->cc.base_rtt /
+			              sconn->cc.round_rtt) + 1;
+			sconn->ssthresh = sconn->cwnd;
+		}
+	} else if (diff > DELAY_BETA) {
+		sconn->cwnd--;
+	} else if (diff < DELAY_ALPHA && limited) {
+		sconn->cwnd++;
+	}
+
+	sconn->cc.epoch_us = now;
+	sconn->cc.round_rtt = 0;
+}
+
+static void sock_delay_loss(sock_conn_t *sconn, int timeout, uint64_t now)
+{
+	sock_cc_halve(sconn, timeout);
+	sconn->cc.epoch_us = now;
+	sconn->cc.round_rtt = 0;
+}
+
+static const sock_cc_ops_t sock_cc_reno = {
+	"reno", sock_reno_init, sock_reno_ack, sock_reno_loss
+};
+
+static const sock_cc_ops_t sock_cc_cubic = {
+	"cubic", sock_cubic_init, sock_cubic_ack, sock_cubic_loss
+};
+
+static const sock_cc_ops_t sock_cc_delay = {
+	"delay", sock_delay_init, sock_delay_ack, sock_delay_loss
+};
+
+static const sock_cc_ops_t *sock_ccs[] = {
+	&sock_cc_reno,
+	&sock_cc_cubic,
+	&sock_cc_delay,
+	NULL
+};
+
+const sock_cc_ops_t *sock_cc_find(const char *name)
+{
+	int i;
+
+	for (i = 0; sock_ccs[i]; i++) {
+		if (0 == strcmp(name, sock_ccs[i]->name))
+			return sock_ccs[i];
+	}
+	return NULL;
+}
@@ -89,6 +89,265 @@ sock_sendto(cci_os_handle_t sock, void *buf, int len,
         return ret;
 }
 
+/**
+ * Datagrams collected to be put on the wire with as few system calls as
+ * possible (one sendmmsg() per batch where available).
+ */
+typedef struct sock_dgram_batch {
+        int count;
+        struct iovec iov[SOCK_TX_BATCH][2];
+        struct sockaddr_in sin[SOCK_TX_BATCH];
+#ifdef HAVE_SENDMMSG
+        struct mmsghdr msgs[SOCK_TX_BATCH];
+#endif
+        /*! Bytes sent for each datagram after a flush, or -1 */
+        int ret[SOCK_TX_BATCH];
+        /*! errno for each datagram that failed */
+        int err[SOCK_TX_BATCH];
+        /*! Storage for headers built on the stack (acks, keepalives) */
+        char hdr[SOCK_TX_BATCH][SOCK_MAX_HDR_SIZE];
+} sock_dgram_batch_t;
+
+static inline void sock_dgram_init(sock_dgram_batch_t *b)
+{
+        b->count = 0;
+}
+
+static inline int sock_dgram_full(sock_dgram_batch_t *b)
+{
+        return b->count == SOCK_TX_BATCH;
+}
+
+/**
+ * Add a datagram; buf (and rma_ptr) must stay valid until the flush.
+ * @return      Index of the datagram in the batch
+ */
+static inline int
+sock_dgram_add(sock_dgram_batch_t *b, void *buf, int len,
+               void *rma_ptr, uint16_t rma_len,
+               const struct sockaddr_in sin)
+{
+        int i = b->count++;
+
+        assert(i < SOCK_TX_BATCH);
+        b->iov[i][0].iov_base = buf;
+        b->iov[i][0].iov_len = len;
+        b->iov[i][1].iov_base = rma_ptr;
+        b->iov[i][1].iov_len = rma_ptr ? rma_len : 0;
+        b->sin[i] = sin;
+
+        return i;
+}
+
+/**
+ * Add a copy of a small datagram (at most SOCK_MAX_HDR_SIZE bytes).
+ */
+static inline int
+sock_dgram_add_copy(sock_dgram_batch_t *b, void *buf, int len,
+                    const struct sockaddr_in sin)
+{
+        assert(len <= SOCK_MAX_HDR_SIZE);
+        memcpy(b->hdr[b->count], buf, len);
+
+        return sock_dgram_add(b, b->hdr[b->count], len, NULL, 0, sin);
+}
+
+static inline int sock_dgram_len(sock_dgram_batch_t *b, int i)
+{
+        return (int)(b->iov[i][0].iov_len + b->iov[i][1].iov_len);
+}
+
+/**
+ * Number of datagrams starting at i that can go out as one UDP_SEGMENT
+ * send: same peer, all of the same size but the last one which may be
+ * shorter. The iovs of a batch are contiguous so such a run is simply
+ * &b->iov[i][0] with twice as many entries.
+ */
+static inline int sock_dgram_gso_run(sock_dgram_batch_t *b, int i)
+{
+        int j = i + 1;
+        int seg = sock_dgram_len(b, i);
+        int total = seg;
+
+        while (j < b->count
+               && sock_dgram_len(b, j - 1) == seg
+               && sock_dgram_len(b, j) <= seg
+               && total + sock_dgram_len(b, j) <= SOCK_GSO_MAX_BYTES
+               && b->sin[j].sin_addr.s_addr == b->sin[i].sin_addr.s_addr
+               && b->sin[j].sin_port == b->sin[i].sin_port) {
+                total += sock_dgram_len(b, j);
+                j++;
+        }
+
+        return j - i;
+}
+
+/**
+ * Send all datagrams of the batch and record the outcome of each in
+ * b->ret and b->err. A datagram that fails does not stop the others.
+ *
+ * With sep->gso, runs of datagrams for the same peer are handed to the
+ * kernel as one message that it segments (UDP_SEGMENT). If such a send
+ * is refused, its datagrams are sent one by one and GSO is turned off
+ * for the endpoint.
+ * @return      Number of datagrams that were sent
+ */
+static inline int sock_dgram_flush(sock_ep_t *sep, sock_dgram_batch_t *b)
+{
+        int i, sent = 0;
+        cci_os_handle_t sock = sep->sock;
+#ifdef HAVE_SENDMMSG
+        int ret, k, m = 0;
+        int first[SOCK_TX_BATCH];
+        int nseg[SOCK_TX_BATCH];
+#ifdef SOCK_HAVE_GSO
+        char ctrl[SOCK_TX_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+#endif
+
+        memset(b->msgs, 0, b->count * sizeof(b->msgs[0]));
+        for (i = 0; i < b->count; i += nseg[m++]) {
+                struct msghdr *msg = &b->msgs[m].msg_hdr;
+
+                first[m] = i;
+                nseg[m] = 1;
+                msg->msg_name = (void *)&b->sin[i];
+                msg->msg_namelen = sizeof(b->sin[i]);
+                msg->msg_iov = b->iov[i];
+                msg->msg_iovlen = b->iov[i][1].iov_base ? 2 : 1;
+#ifdef SOCK_HAVE_GSO
+                if (sep->gso)
+                        nseg[m] = sock_dgram_gso_run(b, i);
+                if (nseg[m] > 1) {
+                        struct cmsghdr *cm;
+
+                        msg->msg_iovlen = 2 * nseg[m];
+                        msg->msg_control = ctrl[m];
+                        msg->msg_controllen = sizeof(ctrl[m]);
+                        cm = CMSG_FIRSTHDR(msg);
+                        cm->cmsg_level = SOL_UDP;
+                        cm->cmsg_type = UDP_SEGMENT;
+                        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                        *((uint16_t *)CMSG_DATA(cm)) =
+                                (uint16_t) sock_dgram_len(b, i);
+                }
+#endif
+        }
+
+        k = 0;
+        while (k < m) {
+                ret = sendmmsg(sock, &b->msgs[k], m - k, 0);
+                if (ret == -1) {
+                        int err = errno;
+
+                        debug(CCI_DB_MSG, "%s: sendmmsg() failed with %s",
+                              __func__, strerror(err));
+                        if (nseg[k] > 1) {
+                                /* the kernel or the route cannot segment */
+                                debug(CCI_DB_WARN, "%s: UDP GSO send failed "
+                                      "(%s), disabling it", __func__,
+                                      strerror(err));
+                                sep->gso = 0;
+                        }
+                        /* the first one failed, skip it and go on */
+                        for (i = first[k]; i < first[k] + nseg[k]; i++) {
+                                b->ret[i] = -1;
+                                b->err[i] = err;
+                                if (nseg[k] == 1)
+                                        continue;
+                                b->ret[i] = sock_sendmsg(sock, b->iov[i],
+                                                b->iov[i][1].iov_base ? 2 : 1,
+                                                b->sin[i]);
+                                if (b->ret[i] == -1)
+                                        b->err[i] = errno;
+                                else
+                                        sent++;
+                        }
+                        k++;
+                        continue;
+                }
+                for (; ret > 0; ret--, k++) {
+                        for (i = first[k]; i < first[k] + nseg[k]; i++) {
+                                b->ret[i] = sock_dgram_len(b, i);
+                                sent++;
+                        }
+                }
+        }
+        debug(CCI_DB_EP, "%s: sent %d of %d datagrams in %d messages",
+              __func__, sent, b->count, m);
+#else
+        for (i = 0; i < b->count; i++) {
+                b->ret[i] = sock_sendmsg(sock, b->iov[i],
+                                         b->iov[i][1].iov_base ? 2 : 1,
+                                         b->sin[i]);
+                if (b->ret[i] == -1)
+                        b->err[i] = errno;
+                else
+                        sent++;
+        }
+        debug(CCI_DB_EP, "%s: sent %d of %d datagrams", __func__, sent,
+              b->count);
+#endif
+
+        return sent;
+}
+
+/**
+ * RMA read replies built while a batch of datagrams is handled, sent
+ * together once the batch is done. The txs go back to the idle list
+ * after the flush.
+ */
+typedef struct sock_reply_batch {
+        sock_dgram_batch_t dgrams;
+        sock_tx_t *txs[SOCK_TX_BATCH];
+} sock_reply_batch_t;
+
+/**
+ * Give an RX buffer back to its shard (at the head, to keep it in cache).
+ */
+static inline void sock_rx_put(sock_rx_t *rx)
+{
+	sock_shard_t *shard = rx->shard;
+
+	pthread_mutex_lock(&shard->lock);
+	TAILQ_INSERT_HEAD(&shard->idle_rxs, rx, entry);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Take up to max idle RX buffers from a shard.
+ * @return      Number of buffers stored in rxs
+ */
+static inline int sock_rx_get(sock_shard_t *shard, sock_rx_t **rxs, int max)
+{
+	int n = 0;
+
+	pthread_mutex_lock(&shard->lock);
+	while (n < max && !TAILQ_EMPTY(&shard->idle_rxs)) {
+		rxs[n] = TAILQ_FIRST(&shard->idle_rxs);
+		TAILQ_REMOVE(&shard->idle_rxs, rxs[n], entry);
+		n++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return n;
+}
+
+/**
+ * @return      1 if a shard ran out of RX buffers, 0 otherwise
+ */
+static inline int sock_rx_exhausted(sock_ep_t *sep)
+{
+	uint32_t i;
+	int empty = 0;
+
+	for (i = 0; i < sep->nshards && !empty; i++) {
+		pthread_mutex_lock(&sep->shards[i].lock);
+		empty = TAILQ_EMPTY(&sep->shards[i].idle_rxs);
+		pthread_mutex_unlock(&sep->shards[i].lock);
+	}
+
+	return empty;
+}
 
 /**
  * Allocate and initialize a single RX buffer.
@@ -172,23 +431,538 @@ update_rnr_mode (sock_conn_t *sconn, uint32_t seq)
 static inline int
 event_queue_is_empty (cci__ep_t *ep)
 {
-	int ret;
-	pthread_mutex_lock(&ep->lock);
-	if (TAILQ_EMPTY (&ep->evts))
-		ret = 1;
-	else
-		ret = 0;
-	pthread_mutex_unlock(&ep->lock);
-
-	return ret;
+	return cci__evtq_empty(&ep->evtq);
 }
 
 static inline void
 sock_queue_event (cci__ep_t *ep, cci__evt_t *evt)
 {
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	/* A blocking send is reaped by sock_sendv(), which is polling the
+	   tx state. It never goes on the completion queue. Send events
+	   (RMA completions included) are carried by txs, tagged
+	   SOCK_CTX_TX. */
+	if (evt->event.type == CCI_EVENT_SEND) {
+		sock_tx_t *tx = container_of(evt, sock_tx_t, evt);
+
+		if (tx->ctx == SOCK_CTX_TX &&
+		    (tx->flags & CCI_FLAG_BLOCKING)) {
+			OPA_write_barrier();
+			tx->state = SOCK_TX_BLOCKING_DONE;
+			return;
+		}
+	}
+	cci__queue_evt(ep, evt);
+}
+
+/*
+ * Timer wheel. A timer goes to the lowest level whose span covers its
+ * distance from the current tick; each time a level wraps, the next slot
+ * of the level above is cascaded down. Expiring only visits the slots of
+ * the ticks that went by. All callers hold ep->lock.
+ */
+static inline void sock_timer_wheel_init(sock_timer_wheel_t *w, uint64_t now)
+{
+	int level, slot;
+
+	for (level = 0; level < SOCK_TIMER_LEVELS; level++) {
+		w->count[level] = 0;
+		for (slot = 0; slot < SOCK_TIMER_LVL_SIZE; slot++)
+			TAILQ_INIT(&w->slots[level][slot]);
+	}
+	w->tick = now / SOCK_TIMER_TICK_US;
+}
+
+static inline void sock_timer_place(sock_timer_wheel_t *w, sock_timer_t *t)
+{
+	/* round up so that a timer never fires before its deadline */
+	uint64_t expires = (t->deadline + SOCK_TIMER_TICK_US - 1) /
+	                   SOCK_TIMER_TICK_US;
+	uint64_t delta;
+	int level;
+
+	if (expires < w->tick)
+		expires = w->tick;
+	delta = expires - w->tick;
+	if (delta >= SOCK_TIMER_SPAN) {
+		/* beyond the wheel: park it in the last slot, it is placed
+		   again when that slot cascades */
+		delta = SOCK_TIMER_SPAN - 1;
+		expires = w->tick + delta;
+	}
+	for (level = 0; level < SOCK_TIMER_LEVELS - 1; level++) {
+		if (delta < (1ULL << ((level + 1) * SOCK_TIMER_LVL_BITS)))
+			break;
+	}
+
+	t->level = level;
+	t->slot = (expires >> (level * SOCK_TIMER_LVL_BITS)) &
+	          SOCK_TIMER_LVL_MASK;
+	TAILQ_INSERT_TAIL(&w->slots[level][t->slot], t, entry);
+	w->count[level]++;
+}
+
+static inline void sock_timer_del(sock_timer_wheel_t *w, sock_timer_t *t)
+{
+	if (!t->armed)
+		return;
+	TAILQ_REMOVE(&w->slots[t->level][t->slot], t, entry);
+	w->count[t->level]--;
+	t->armed = 0;
+}
+
+/* Arm t for deadline (usecs), moving it if it is already armed */
+static inline void sock_timer_add(sock_timer_wheel_t *w, sock_timer_t *t,
+                                  uint64_t deadline)
+{
+	sock_timer_del(w, t);
+	t->deadline = deadline;
+	sock_timer_place(w, t);
+	t->armed = 1;
+}
+
+static inline int sock_timer_empty(sock_timer_wheel_t *w)
+{
+	int level;
+
+	for (level = 0; level < SOCK_TIMER_LEVELS; level++) {
+		if (w->count[level])
+			return 0;
+	}
+	return 1;
+}
+
+/* Move the timers due at now (usecs) to expired, disarmed */
+static inline void sock_timer_expire(sock_timer_wheel_t *w, uint64_t now,
+                                     struct s_timers *expired)
+{
+	uint64_t now_tick = now / SOCK_TIMER_TICK_US;
+	struct s_timers *slot;
+	sock_timer_t *t;
+	int level;
+
+	while (w->tick <= now_tick) {
+		if (sock_timer_empty(w)) {
+			w->tick = now_tick + 1;
+			break;
+		}
+
+		/* cascade from the top so that a timer moved down to a slot
+		   that is due now is cascaded again right away */
+		for (level = SOCK_TIMER_LEVELS - 1; level > 0; level--) {
+			uint64_t mask = (1ULL << (level * SOCK_TIMER_LVL_BITS)) - 1;
+			struct s_timers moving;
+
+			if (w->tick & mask)
+				continue;
+			slot = &w->slots[level]
+			                [(w->tick >> (level * SOCK_TIMER_LVL_BITS))
+			                 & SOCK_TIMER_LVL_MASK];
+			TAILQ_INIT(&moving);
+			TAILQ_CONCAT(&moving, slot, entry);
+			while ((t = TAILQ_FIRST(&moving))) {
+				TAILQ_REMOVE(&moving, t, entry);
+				w->count[level]--;
+				sock_timer_place(w, t);
+			}
+		}
+
+		slot = &w->slots[0][w->tick & SOCK_TIMER_LVL_MASK];
+		while ((t = TAILQ_FIRST(slot))) {
+			TAILQ_REMOVE(slot, t, entry);
+			w->count[0]--;
+			t->armed = 0;
+			TAILQ_INSERT_TAIL(expired, t, entry);
+		}
+		w->tick++;
+
+		/* nothing due on level 0: skip to the next cascade */
+		if (!w->count[0]) {
+			uint64_t next = (w->tick | SOCK_TIMER_LVL_MASK) + 1;
+
+			if (w->tick & SOCK_TIMER_LVL_MASK)
+				w->tick = next < now_tick + 1 ? next : now_tick + 1;
+		}
+	}
+}
+
+/* When the next timer is due or, for the upper levels, when its slot
+ * cascades (usecs); 0 if the wheel is empty */
+static inline uint64_t sock_timer_next(sock_timer_wheel_t *w)
+{
+	uint64_t best = 0, base, tick;
+	int level, k;
+
+	for (level = 0; level < SOCK_TIMER_LEVELS; level++) {
+		if (!w->count[level])
+			continue;
+		/* the current upper slot still cascades if tick is on its
+		   boundary, otherwise it already has */
+		base = w->tick >> (level * SOCK_TIMER_LVL_BITS);
+		k = w->tick & ((1ULL << (level * SOCK_TIMER_LVL_BITS)) - 1) ?
+		    1 : 0;
+		for (; k <= SOCK_TIMER_LVL_SIZE; k++) {
+			if (TAILQ_EMPTY(&w->slots[level][(base + k) &
+			                                 SOCK_TIMER_LVL_MASK]))
+				continue;
+			tick = (base + k) << (level * SOCK_TIMER_LVL_BITS);
+			if (!best || tick < best)
+				best = tick;
+			break;
+		}
+	}
+	return best * SOCK_TIMER_TICK_US;
+}
+
+/* Wake the progress thread */
+static inline void sock_kick_progress(sock_ep_t *sep)
+{
+	pthread_mutex_lock(&sep->progress_mutex);
+	sep->progress_kick = 1;
+	pthread_cond_signal(&sep->wait_condition);
+	pthread_mutex_unlock(&sep->progress_mutex);
+}
+
+/* Arm t and wake the progress thread if it sleeps past the deadline.
+ * Caller holds ep->lock. */
+static inline void sock_arm_timer(sock_ep_t *sep, sock_timer_t *t,
+                                  uint64_t deadline)
+{
+	sock_timer_add(&sep->timers, t, deadline);
+	if (deadline < sep->sleep_until)
+		sock_kick_progress(sep);
+}
+
+/* Ring size, in seqs, of the receive window of a conn on an endpoint with
+ * cnt receive buffers */
+static inline uint32_t sock_rwin_size(uint32_t cnt)
+{
+	uint32_t size = 64;
+
+	while (size < cnt)
+		size <<= 1;
+	return size;
+}
+
+/* Point w at its ring, which follows sconn in its allocation */
+static inline void sock_rwin_setup(sock_conn_t *sconn, uint32_t size)
+{
+	sconn->rwin.size = size;
+	sconn->rwin.bits = (uint64_t *) (sconn + 1);
+}
+
+/* Start the receive window after the peer's initial seq */
+static inline void sock_rwin_init(sock_rwin_t *w, uint32_t seq)
+{
+	memset(w->bits, 0, w->size / 8);
+	w->base = w->high = w->sack_next = seq;
+	w->unacked = 0;
+}
+
+/*
+ * First seq from seq on (up to high) whose bit is set, or clear if !set.
+ * Returns high + 1 if there is none.
+ */
+static inline uint32_t sock_rwin_next(const sock_rwin_t *w, uint32_t seq,
+                                      int set)
+{
+	while (SOCK_SEQ_LTE(seq, w->high)) {
+		uint32_t i = seq & (w->size - 1);
+		uint64_t word = w->bits[i / 64];
+
+		if (!set)
+			word = ~word;
+		word >>= i % 64;
+		if (word) {
+			seq += ffsll((long long) word) - 1;
+			break;
+		}
+		seq += 64 - i % 64;
+	}
+	return SOCK_SEQ_MIN(seq, w->high + 1);
+}
+
+/*
+ * Record a received seq. Return 1 if it is new, 0 if it was received
+ * already and -1 if it is past the window (it is not recorded, the peer
+ * resends it). Caller holds ep->lock.
+ */
+static inline int sock_rwin_mark(sock_rwin_t *w, uint32_t seq)
+{
+	uint32_t i = seq & (w->size - 1), end, n;
+
+	if (SOCK_SEQ_LTE(seq, w->base))
+		return 0;
+	if (seq - w->base > w->size)
+		return -1;
+	if (w->bits[i / 64] & (1ULL << (i % 64)))
+		return 0;
+	if (SOCK_SEQ_GT(seq, w->high))
+		w->high = seq;
+	if (seq != w->base + 1) {
+		w->bits[i / 64] |= 1ULL << (i % 64);
+		return 1;
+	}
+
+	/* slide the base over the seqs now contiguous, a word at a time */
+	end = sock_rwin_next(w, seq + 1, 0);
+	for (seq++; seq != end; seq += n) {
+		i = seq & (w->size - 1);
+		n = 64 - i % 64;
+		if (n > end - seq)
+			n = end - seq;
+		w->bits[i / 64] &= ~((n == 64 ? ~0ULL : (1ULL << n) - 1) <<
+		                     (i % 64));
+	}
+	w->base = end - 1;
+	return 1;
+}
+
+/*
+ * Feed an RTT sample (usecs) to the connection's estimator and compute
+ * its RTO the RFC 6298 way, clock granularity being a timer tick.
+ * Caller holds ep->lock.
+ */
+static inline void sock_rtt_sample(sock_conn_t *sconn, uint32_t rtt)
+{
+	uint32_t var, rto;
+
+	if (!sconn->srtt) {
+		sconn->srtt = rtt ? rtt : 1;
+		sconn->rttvar = rtt / 2;
+	} else {
+		uint32_t err = rtt > sconn->srtt ? rtt - sconn->srtt :
+		                                   sconn->srtt - rtt;
+
+		sconn->rttvar = (3 * sconn->rttvar + err) / 4;
+		sconn->srtt = (7 * sconn->srtt + rtt) / 8;
+	}
+
+	var = 4 * sconn->rttvar;
+	if (var < SOCK_TIMER_TICK_US)
+		var = SOCK_TIMER_TICK_US;
+	rto = sconn->srtt + var;
+	if (rto < SOCK_RTO_MIN_US)
+		rto = SOCK_RTO_MIN_US;
+	else if (rto > SOCK_RTO_MAX_US)
+		rto = SOCK_RTO_MAX_US;
+	sconn->rto = rto;
+}
+
+/* Is tx a reliable data message (as opposed to a connection message)? */
+static inline int sock_tx_is_data(sock_tx_t *tx)
+{
+	switch (tx->msg_type) {
+	case SOCK_MSG_SEND:
+	case SOCK_MSG_RMA_WRITE:
+	case SOCK_MSG_RMA_WRITE_DONE:
+	case SOCK_MSG_RMA_READ_REQUEST:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Take len bytes off what is left of a progress pass's budget (see
+ * SOCK_PASS_BYTES) */
+static inline void sock_pass_spend(uint32_t *budget, uint32_t len)
+{
+	*budget = len < *budget ? *budget - len : 0;
+}
+
+/* Stamp a reliable data message with its send time, the ack echoes it
+ * (connection messages use the timestamp for other purposes) */
+static inline void sock_tx_stamp(sock_tx_t *tx, uint64_t now)
+{
+	sock_header_r_t *hdr_r = tx->buffer;
+
+	if (sock_tx_is_data(tx))
+		hdr_r->seq_ts.ts = htonl((uint32_t) now);
+}
+
+/*
+ * When a pending tx must be looked at again: its next resend or its
+ * timeout, whichever comes first. The resend is due one RTO, doubled for
+ * each resend, after the later of its last send and the last ack that
+ * completed a tx on the connection; while acks keep coming, the tx is
+ * waiting in a queue rather than lost (fast resends catch the losses).
+ */
+static inline uint64_t sock_tx_deadline(sock_tx_t *tx)
+{
+	cci__conn_t *conn = tx->evt.conn;
+	sock_conn_t *sconn = conn ? conn->priv : NULL;
+	uint64_t rto = SOCK_RTO_INIT_US, start = tx->last_attempt_us, resend;
+	uint32_t backoff = tx->send_count > 1 ? tx->send_count - 1 : 0;
+
+	if (sconn) {
+		if (sconn->rto)
+			rto = sconn->rto;
+		if (SOCK_U64_LT(start, sconn->last_acked_us))
+			start = sconn->last_acked_us;
+	}
+	rto = backoff < 16 ? rto << backoff : SOCK_RTO_MAX_US;
+	if (rto > SOCK_RTO_MAX_US)
+		rto = SOCK_RTO_MAX_US;
+	resend = start + rto;
+
+	if (tx->timeout_us && SOCK_U64_LT(tx->timeout_us, resend))
+		return tx->timeout_us;
+	return resend;
+}
+
+/* Put a sent tx on sep->pending. Caller holds ep->lock. */
+static inline void sock_pending_insert(sock_ep_t *sep, sock_tx_t *tx)
+{
+	TAILQ_INSERT_TAIL(&sep->pending, &tx->evt, entry);
+	sock_arm_timer(sep, &tx->timer, sock_tx_deadline(tx));
+}
+
+/* Take a tx off sep->pending. Caller holds ep->lock. */
+static inline void sock_pending_remove(sock_ep_t *sep, sock_tx_t *tx)
+{
+	TAILQ_REMOVE(&sep->pending, &tx->evt, entry);
+	sock_timer_del(&sep->timers, &tx->timer);
+}
+
+/* Put a sent tx on sconn->tx_seqs, where it counts against the congestion
+ * window until acked. Caller holds ep->lock. */
+static inline void sock_tx_seq_insert(sock_conn_t *sconn, sock_tx_t *tx)
+{
+	TAILQ_INSERT_TAIL(&sconn->tx_seqs, tx, tx_seq);
+	sconn->inflight++;
+}
+
+/* Take a tx off sconn->tx_seqs. Caller holds ep->lock. */
+static inline void sock_tx_seq_remove(sock_conn_t *sconn, sock_tx_t *tx)
+{
+	TAILQ_REMOVE(&sconn->tx_seqs, tx, tx_seq);
+	sconn->inflight--;
+}
+
+/* Hand a connection that just became ready to the endpoint's congestion
+ * controller, if any. Caller holds ep->lock. */
+static inline void sock_cc_init(sock_ep_t *sep, sock_conn_t *sconn,
+                                uint64_t now)
+{
+	sconn->pace_timer.type = SOCK_TIMER_PACE;
+	if (!sep->cc || !cci_conn_is_reliable(sconn->conn))
+		return;
+	sconn->cwnd = SOCK_CC_INITIAL_CWND;
+	sconn->ssthresh = sconn->max_tx_cnt;
+	sep->cc->init(sconn, now);
+}
+
+/* Window bounds: the peer's receive buffers, and one message */
+static inline void sock_cc_clamp(sock_conn_t *sconn)
+{
+	if (sconn->cwnd > sconn->max_tx_cnt)
+		sconn->cwnd = sconn->max_tx_cnt;
+	if (sconn->cwnd < 1)
+		sconn->cwnd = 1;
+}
+
+/* An ack completed acked txs of sconn. Caller holds ep->lock. */
+static inline void sock_cc_ack(sock_ep_t *sep, sock_conn_t *sconn,
+                               uint32_t acked, uint32_t rtt, uint64_t now)
+{
+	if (!sep->cc || !acked || sconn->status != SOCK_CONN_READY)
+		return;
+	sep->cc->ack(sconn, acked, rtt, now);
+	sock_cc_clamp(sconn);
+}
+
+/* tx is about to be resent, on a SACK gap or on its RTO if timeout. The
+ * window is cut once per round trip: a tx last sent before the previous
+ * cut was in flight when it happened. Caller holds ep->lock. */
+static inline void sock_cc_loss(sock_ep_t *sep, sock_conn_t *sconn,
+                                sock_tx_t *tx, int timeout, uint64_t now)
+{
+	if (!sep->cc || !sock_tx_is_data(tx) ||
+	    sconn->status != SOCK_CONN_READY ||
+	    SOCK_U64_LT(tx->last_attempt_us, sconn->cc.recover_us))
+		return;
+	sep->cc->loss(sconn, timeout, now);
+	sock_cc_clamp(sconn);
+	sconn->cc.recover_us = now;
+}
+
+/*
+ * May sconn put one more tx in flight? Not beyond its congestion window
+ * and, if the endpoint paces, not faster than a token bucket filled at
+ * about cwnd per RTT (twice that in slow start, a quarter more after, so
+ * that the window can grow). A paced connection out of tokens arms its
+ * pace timer for the next one. Caller holds ep->lock.
+ */
+static inline int sock_cc_can_send(sock_ep_t *sep, sock_conn_t *sconn,
+                                   uint64_t now)
+{
+	uint64_t rate, burst, tokens;
+
+	if (!sep->cc)
+		return 1;
+	if (sconn->inflight >= sconn->cwnd)
+		return 0;
+	if (!sep->pace || !sconn->srtt)
+		return 1;
+
+	/* msgs per second */
+	rate = (uint64_t) sconn->cwnd * 1000000 / sconn->srtt;
+	if (sconn->cwnd < sconn->ssthresh)
+		rate *= 2;
+	else
+		rate = rate * 5 / 4;
+	if (!rate)
+		rate = 1;
+
+	/* the timer wheel cannot space sends closer than a tick or two */
+	burst = rate * 2 * SOCK_TIMER_TICK_US / 1000000;
+	if (burst < SOCK_PACE_BURST)
+		burst = SOCK_PACE_BURST;
+	burst *= 1000;
+
+	if (now - sconn->pace_us >= 1000000) {
+		tokens = burst;
+	} else {
+		tokens = (now - sconn->pace_us) * rate / 1000;
+		if (tokens)
+			tokens += sconn->pace_tokens;
+		else
+			tokens = sconn->pace_tokens;	/* keep the credit */
+	}
+	if (tokens != sconn->pace_tokens)
+		sconn->pace_us = now;
+	sconn->pace_tokens = tokens > burst ? burst : tokens;
+
+	if (sconn->pace_tokens >= 1000) {
+		sconn->pace_tokens -= 1000;
+		return 1;
+	}
+	if (!sconn->pace_timer.armed)
+		sock_arm_timer(sep, &sconn->pace_timer, now +
+		               ((1000 - sconn->pace_tokens) * 1000 + rate - 1) /
+		               rate);
+	return 0;
+}
+
+/* Make sure the delayed acks of sconn go out once ACK_TIMEOUT has passed
+ * since the last ack. Caller holds ep->lock. */
+static inline void sock_arm_ack(sock_ep_t *sep, sock_conn_t *sconn)
+{
+	if (!sconn->rwin.unacked || sconn->ack_timer.armed)
+		return;
+	sock_arm_timer(sep, &sconn->ack_timer,
+	               sconn->last_ack_ts + ACK_TIMEOUT);
+}
+
+/* Start watching the keepalive timeout of a ready connection, if it has
+ * one. Caller holds ep->lock. */
+static inline void sock_arm_keepalive(sock_ep_t *sep, sock_conn_t *sconn)
+{
+	uint32_t ka = sconn->conn->keepalive_timeout;
+
+	if (!ka)
+		return;
+	sconn->last_recv_us = sock_get_usecs();
+	sock_arm_timer(sep, &sconn->ka_timer, sconn->last_recv_us + ka / 3);
 }
 
 #define INIT_TX(tx) do { \
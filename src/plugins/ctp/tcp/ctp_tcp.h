@@ -20,6 +20,9 @@
 #include <arpa/inet.h>
 #include <sys/select.h>
 #include <poll.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include "cci.h"
 #include "cci_lib_types.h"
@@ -35,12 +38,21 @@ BEGIN_C_DECLS
 #define TCP_PROG_TIME_MS       (10)	/* try to progress every N milliseconds */
 
 #define TCP_HDR_LEN            (8)	/* common header size */
+#define TCP_RBUF_SIZE          (16*1024)	/* per conn read-ahead buffer */
+#define TCP_SEND_IOVS          (64)	/* iovecs per gathered write */
 
 #define TCP_RMA_DEPTH          (16)	/* how many in-flight msgs per RMA */
 #define TCP_RMA_FRAG_SIZE      (1024*1024)
 #define TCP_RMA_FRAG_MAX       (1024*1024)
 
 #define TCP_EP_MAX_CONNS       (1024)
+#define TCP_EP_POLL_EVENTS     (64)	/* conns handled per progress call */
+#define TCP_ZC_RING            (64)	/* zerocopy sends held per conn */
+#define TCP_MAX_STREAMS        (8)	/* sockets per conn, primary included */
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define TCP_HAVE_ZEROCOPY      1
+#endif
 
 static inline uint64_t tcp_tv_to_usecs(struct timeval tv)
 {
@@ -77,6 +89,7 @@ static inline uint64_t tcp_get_usecs(void)
  * mtu = 9000             # MTU less headers will become max_send_size
  * min_port = 4444        # lowest port to use for endpoints
  * max_port = 5555        # highest port to use for endpoints
+ * streams = 4            # sockets per reliable conn to stripe RMAs over
  */
 
 /* Message types */
@@ -98,6 +111,7 @@ typedef enum tcp_msg_type {
 	TCP_MSG_RMA_READ_REQUEST,
 	TCP_MSG_RMA_READ_REPLY,
 	TCP_MSG_RMA_INVALID,	/* invalid handle */
+	TCP_MSG_CONN_STREAM,	/* extra data socket joining its conn */
 	TCP_MSG_TYPE_MAX
 } tcp_msg_type_t;
 
@@ -178,12 +192,15 @@ typedef struct tcp_handshake {
 	uint32_t mss;		/* lower of each endpoint */
 	uint32_t keepalive;	/* keepalive timeout (when activated) */
 	uint32_t server_tx_id;  /* id of server's tx */
+	uint32_t streams;	/* sockets wanted (request) or granted (reply) */
+	uint32_t stream_key;	/* key the extra sockets present */
 } tcp_handshake_t;
 
 static inline void
 tcp_pack_handshake(tcp_handshake_t * hs,
 		    uint32_t max_recv_buffer_count, uint32_t mss,
-		    uint32_t keepalive, uint32_t server_tx_id)
+		    uint32_t keepalive, uint32_t server_tx_id,
+		    uint32_t streams, uint32_t stream_key)
 {
 	assert(mss <= (TCP_MAX_MSS));
 	assert(mss >= TCP_MIN_MSS);
@@ -192,17 +209,22 @@ tcp_pack_handshake(tcp_handshake_t * hs,
 	hs->mss = htonl(mss);
 	hs->keepalive = htonl(keepalive);
 	hs->server_tx_id = htonl(server_tx_id);
+	hs->streams = htonl(streams);
+	hs->stream_key = htonl(stream_key);
 }
 
 static inline void
 tcp_parse_handshake(tcp_handshake_t * hs,
 		     uint32_t * max_recv_buffer_count, uint32_t * mss,
-		     uint32_t * ka, uint32_t *server_tx_id)
+		     uint32_t * ka, uint32_t *server_tx_id,
+		     uint32_t * streams, uint32_t * stream_key)
 {
 	*max_recv_buffer_count = ntohl(hs->max_recv_buffer_count);
 	*mss = ntohl(hs->mss);
 	*ka = ntohl(hs->keepalive);
 	*server_tx_id = ntohl(hs->server_tx_id);
+	*streams = ntohl(hs->streams);
+	*stream_key = ntohl(hs->stream_key);
 }
 
 /* connection request header:
@@ -224,6 +246,10 @@ tcp_parse_handshake(tcp_handshake_t * hs,
    +-------------------------------+
    |          server tx_id         |
    +-------------------------------+
+   |            streams            |
+   +-------------------------------+
+   |           stream key          |
+   +-------------------------------+
 
    The peer uses the id when sending to us.
    The user data follows the header.
@@ -235,6 +261,8 @@ tcp_parse_handshake(tcp_handshake_t * hs,
    mss: max send size
    keepalive: if keepalive is activated, this specifies the keepalive timeout
    server tx_id: 0 in conn_request and set by server in conn_reply
+   streams: sockets the client would like to use, primary included
+   stream key: 0 in conn_request and set by server in conn_reply
  */
 
 static inline void
@@ -264,6 +292,10 @@ tcp_pack_conn_request(tcp_header_t * header, cci_conn_attribute_t attr,
    +-------------------------------+
    |          server tx_id         |
    +-------------------------------+
+   |            streams            |
+   +-------------------------------+
+   |           stream key          |
+   +-------------------------------+
 
    The reply is 0 for success else errno.
    The tx id is from the active client (to lookup its tx)
@@ -271,6 +303,8 @@ tcp_pack_conn_request(tcp_header_t * header, cci_conn_attribute_t attr,
    reply: CCI_EVENT_CONNECT_[ACCEPTED|REJECTED]
    mss: max app payload (user header and user data)
    server tx_id: set by server, client will return in conn_ack
+   streams: sockets the server allows, 1 for none besides this one
+   stream key: identifies this conn to the client's extra sockets
  */
 
 static inline void
@@ -296,6 +330,30 @@ static inline void tcp_pack_conn_ack(tcp_header_t * header, uint32_t server_tx_i
 	tcp_pack_header(header, TCP_MSG_CONN_ACK, 0, server_tx_id);
 }
 
+/* connection stream header:
+
+    <----------- 32 bits ---------->
+    <---------- 28b ---------->  4b
+   +----------------------------+----+
+   |           index            |type|
+   +----------------------------+----+
+   |           stream key            |
+   +---------------------------------+
+
+   The first message on an extra socket of a reliable connection, once
+   the conn_reply granted more than one stream. There is no reply, the
+   client uses the socket as soon as it is connected.
+
+   index: which of the conn's streams (1 to streams - 1) this socket is
+   stream key: from the conn_reply
+ */
+
+static inline void
+tcp_pack_conn_stream(tcp_header_t * header, uint32_t index, uint32_t key)
+{
+	tcp_pack_header(header, TCP_MSG_CONN_STREAM, index, key);
+}
+
 /* send header:
 
     <----------- 32 bits ---------->
@@ -672,6 +730,13 @@ typedef struct tcp_rma_op {
 	/*! Last fragment acked */
 	int32_t acked;
 
+	/*! Number of fragments acked, they may be acked out of order when
+	 *  the conn stripes them over several sockets */
+	uint32_t acks;
+
+	/*! Socket turn of fragment 0, so that small RMAs spread too */
+	uint32_t stripe;
+
 	/*! Number of fragments pending */
 	uint32_t pending;
 
@@ -687,6 +752,12 @@ typedef struct tcp_rma_op {
 	/*! Application completion msg len */
 	uint16_t msg_len;
 
+	/*! Fragments sent with MSG_ZEROCOPY that the kernel still holds */
+	uint16_t zc_pending;
+
+	/*! Set if the RMA completed while zc_pending was not 0 */
+	uint16_t zc_wait;
+
 	/*! Flags */
 	int flags;
 } tcp_rma_op_t;
@@ -698,20 +769,23 @@ struct tcp_ep {
 	/*! List of all connections */
 	TAILQ_HEAD(s_conns, tcp_conn) conns;
 
-	/*! Last conn polled */
+	/*! Last conn polled (poll() fallback only) */
 	tcp_conn_t *poll_conn;
 
-	/*! Number of bitmap 64-bit blocks */
-	int blocks;
+	/*! epoll set of the conns' sockets, data.ptr is the tcp_conn_t */
+	int epfd;
+
+	/*! Threads between epoll_wait() and taking refs on its conns */
+	int pollers;
 
-	/*! Poll FD bitmap */
-	uint64_t *fd_bits;
+	/*! Conns released while pollers > 0, freed by the last one */
+	TAILQ_HEAD(s_dead, tcp_conn) dead;
 
-	/*! Number of pollfds */
-	nfds_t nfds;
+	/*! Conns left with data to read, retried before the next poll */
+	TAILQ_HEAD(s_ready, tcp_conn) ready;
 
-	/*! Arrary of poll fds - multiples of 64 */
-	struct pollfd *fds;
+	/*! Last stream key handed to a peer */
+	uint32_t stream_keys;
 
 	/*! TX common buffer */
 	void *tx_buf;
@@ -816,23 +890,48 @@ struct tcp_conn {
 	/*! Reference count */
 	int refcnt;
 
-	/*! poll fd */
-	struct pollfd *pfd;
+	/*! Socket */
+	int fd;
 
-	/*! partial receive */
+	/*! Events the progress engine waits for (POLLIN, POLLOUT) */
+	short events;
+
+	/*! Read-ahead buffer, bytes [rhead, rtail) are not parsed yet */
+	char *rbuf;
+	uint32_t rhead;
+	uint32_t rtail;
+
+	/*! Partial receive, its header and body fill rx->buffer up to
+	 *  rx_len. It stays here while its RMA payload is received. */
 	tcp_rx_t *rx;
+	uint32_t rx_len;
+
+	/*! RMA payload left to receive to rx_rma_ptr (dropped if NULL)
+	 *  and the status it completes with */
+	void *rx_rma_ptr;
+	uint32_t rx_rma_len;
+	int rx_status;
 
 	/*! Is this the endpoint's listening socket? */
 	unsigned int is_listener	: 1;
+	/*! Is a thread reading from fd? */
 	unsigned int is_busy		: 1;
-	unsigned int pad		:30;
-
-	/*! Poll fd index */
-	int idx;
+	/*! Is fd in the progress engine's set? */
+	unsigned int is_watched		: 1;
+	/*! Did fd become readable while is_busy? */
+	unsigned int rx_again		: 1;
+	/*! Is it on tep->ready? */
+	unsigned int is_ready		: 1;
+	/*! Send large RMA payloads with MSG_ZEROCOPY? */
+	unsigned int zerocopy		: 1;
+	unsigned int pad		:26;
 
 	/*! Entry to hang on tcp_ep->conns */
 	 TAILQ_ENTRY(tcp_conn) entry;
 
+	/*! Entry to hang on tcp_ep->ready */
+	TAILQ_ENTRY(tcp_conn) rentry;
+
 	/*! Queued sends */
 	TAILQ_HEAD(s_queued, cci__evt) queued;
 
@@ -850,6 +949,28 @@ struct tcp_conn {
 
 	/*! Flag to know if the receiver is ready or not */
 	uint32_t rnr;
+
+	/*! Id the kernel gives the next MSG_ZEROCOPY send */
+	uint32_t zc_next;
+
+	/*! Zerocopy sends the kernel still holds, one bit per slot (id %
+	 *  TCP_ZC_RING), and the RMA op each holds (NULL for read replies) */
+	uint64_t zc_busy;
+	tcp_rma_op_t *zc_ops[TCP_ZC_RING];
+
+	/*! Conn this extra data socket belongs to, NULL for a conn */
+	cci__conn_t *primary;
+
+	/*! Key the peer's extra sockets present to join this conn */
+	uint32_t stream_key;
+
+	/*! RMA fragments take turns on streams[], streams[0] is this
+	 *  conn and a slot is NULL until its socket is connected */
+	uint32_t nstreams;
+	cci__conn_t *streams[TCP_MAX_STREAMS];
+
+	/*! Socket turn of the next RMA's first fragment */
+	uint32_t stripe;
 };
 
 struct tcp_dev {
@@ -861,6 +982,12 @@ struct tcp_dev {
 
 	/*! Set socket buffers sizes */
 	uint32_t bufsize;
+
+	/*! Smallest RMA payload sent with MSG_ZEROCOPY, 0 to always copy */
+	uint32_t zerocopy;
+
+	/*! Sockets per reliable conn, primary included */
+	uint32_t streams;
 };
 
 struct tcp_globals {
@@ -906,8 +1033,34 @@ struct tcp_globals {
 
 #define TCP_CONN_IS_BLOCKING(tep) (tep->pipe[0] != -1)
 
-#define TCP_QUEUE_EVT(queue,evt,tep) do {       \
-        TAILQ_INSERT_TAIL(queue, evt, entry);   \
+/* Blocking sends and RMAs are reaped by the thread waiting in
+ * ctp_tcp_sendv() or ctp_tcp_rma(), never by get_event(). */
+static inline int
+tcp_evt_is_blocking(cci__evt_t *evt)
+{
+	tcp_tx_t *tx = NULL;
+
+	if (evt->event.type != CCI_EVENT_SEND)
+		return 0;
+
+	tx = container_of(evt, tcp_tx_t, evt);
+	if (tx->ctx == TCP_CTX_TX)
+		return !!(tx->flags & CCI_FLAG_BLOCKING);
+	if (tx->ctx == TCP_CTX_RMA)
+		return !!(container_of(evt, tcp_rma_op_t, evt)->flags &
+				CCI_FLAG_BLOCKING);
+	return 0;
+}
+
+static inline void
+tcp_queue_evt(cci__ep_t *ep, cci__evt_t *evt)
+{
+	if (!tcp_evt_is_blocking(evt))
+		cci__queue_evt(ep, evt);
+}
+
+#define TCP_QUEUE_EVT(ep,evt,tep) do {          \
+        tcp_queue_evt(ep, evt);                 \
         if (TCP_CONN_IS_BLOCKING(tep)) {        \
             tcp_wakeup_app_thread(tep);         \
         }                                       \
@@ -916,15 +1069,16 @@ struct tcp_globals {
 static inline int
 tcp_event_queue_is_empty (cci__ep_t *ep)
 {
-        int ret;
-        pthread_mutex_lock(&ep->lock);
-        if (TAILQ_EMPTY (&ep->evts))
-                ret = 1;
-        else
-                ret = 0;
-        pthread_mutex_unlock(&ep->lock);
-
-        return ret;
+	return cci__evtq_empty(&ep->evtq);
+}
+
+/* Are all the rxs out with the application? Read without ep->lock: only a
+ * hint for get_event(), which an rx returned at the same time may beat. */
+static inline int
+tcp_rxs_exhausted(tcp_ep_t *tep)
+{
+	return __atomic_load_n(&TAILQ_FIRST(&tep->idle_rxs),
+			__ATOMIC_RELAXED) == NULL;
 }
 
 typedef enum device_state {
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sched.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
@@ -31,6 +32,9 @@
 #include <ifaddrs.h>
 #endif
 #include <strings.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
 
 #include "cci.h"
 #include "cci_lib_types.h"
@@ -79,6 +83,12 @@ static int ctp_tcp_arm_os_handle(cci_endpoint_t * endpoint, int flags);
 static int ctp_tcp_get_event(cci_endpoint_t * endpoint,
 			  cci_event_t ** const event);
 static int ctp_tcp_return_event(cci_event_t * event);
+static int ctp_tcp_get_events(cci_endpoint_t * endpoint,
+			  cci_event_t ** const events, uint32_t max,
+			  uint32_t * count);
+static int ctp_tcp_return_events(cci_event_t ** const events, uint32_t count);
+static int ctp_tcp_send_batch(cci_send_desc_t * descs, uint32_t count);
+static int ctp_tcp_pollset_arm(cci_endpoint_t * endpoint);
 static int ctp_tcp_send(cci_connection_t * connection,
 		     const void *msg_ptr, uint32_t msg_len, const void *context, int flags);
 static int ctp_tcp_sendv(cci_connection_t * connection,
@@ -96,7 +106,7 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 
 static void *tcp_progress_thread(void *arg);
 static int tcp_progress_ep(cci__ep_t *ep);
-static int tcp_poll_events(cci__ep_t *ep);
+static int tcp_poll_events(cci__ep_t *ep, int timeout);
 static int tcp_sendto(cci_os_handle_t sock, void *buf, int len,
 			void *rma_ptr, uint32_t rma_len, uintptr_t *offset);
 static inline void tcp_progress_conn_sends(cci__ep_t *ep, cci__conn_t *conn);
@@ -149,7 +159,11 @@ cci_plugin_ctp_t cci_ctp_tcp_plugin = {
 	ctp_tcp_sendv,
 	ctp_tcp_rma_register,
 	ctp_tcp_rma_deregister,
-	ctp_tcp_rma
+	ctp_tcp_rma,
+	ctp_tcp_get_events,
+	ctp_tcp_return_events,
+	ctp_tcp_send_batch,
+	ctp_tcp_pollset_arm
 };
 
 static inline void
@@ -187,6 +201,8 @@ static inline const char *tcp_msg_type(tcp_msg_type_t type)
 		return "RMA read reply";
 	case TCP_MSG_RMA_INVALID:
 		return "invalid RMA handle";
+	case TCP_MSG_CONN_STREAM:
+		return "conn_stream";
 	case TCP_MSG_INVALID:
 		assert(0);
 		return "invalid";
@@ -314,6 +330,7 @@ static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 				device->pci.bus = -1;       /* per CCI spec */
 				device->pci.dev = -1;       /* per CCI spec */
 				device->pci.func = -1;      /* per CCI spec */
+				tdev->streams = 1;
 				/* try to get the actual values */
 				cci__get_dev_ifaddrs_info(dev, addr);
 
@@ -375,6 +392,7 @@ static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 			device->pci.bus = -1;	/* per CCI spec */
 			device->pci.dev = -1;	/* per CCI spec */
 			device->pci.func = -1;	/* per CCI spec */
+			tdev->streams = 1;
 
 			/* parse conf_argv */
 			for (arg = device->conf_argv; *arg != NULL; arg++) {
@@ -395,6 +413,16 @@ static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 					tdev->bufsize = strtol(size_str, NULL, 0);
 				} else if (0 == strncmp("interface=", *arg, 10)) {
 					interface = *arg + 10;
+				} else if (0 == strncmp("zerocopy=", *arg, 9)) {
+					const char *zc_str = *arg + 9;
+					tdev->zerocopy = strtoul(zc_str, NULL, 0);
+				} else if (0 == strncmp("streams=", *arg, 8)) {
+					const char *streams_str = *arg + 8;
+					tdev->streams = strtoul(streams_str, NULL, 0);
+					if (tdev->streams < 1)
+						tdev->streams = 1;
+					else if (tdev->streams > TCP_MAX_STREAMS)
+						tdev->streams = TCP_MAX_STREAMS;
 				}
 			}
 			if (tdev->ip != 0 || interface) {
@@ -549,8 +577,23 @@ queue_conn(cci__ep_t *ep, cci__conn_t *conn);
 static void
 conn_decref(cci__ep_t *ep, cci__conn_t *conn);
 
+static int
+tcp_watch_conn(cci__ep_t *ep, cci__conn_t *conn);
+
+static void
+delete_conn_locked(cci__ep_t *ep, cci__conn_t *conn);
+
+static void
+tcp_conn_close_fd(tcp_conn_t *tconn);
+
+static void
+tcp_rma_op_done_locked(cci__ep_t *ep, tcp_rma_op_t *rma_op);
+
+static void
+tcp_zc_drop_locked(cci__ep_t *ep, tcp_conn_t *tconn);
+
 static void
-release_pollfd(cci__ep_t *ep, tcp_conn_t *tconn);
+tcp_rma_op_decref_locked(tcp_rma_op_t *rma_op);
 
 static int ctp_tcp_create_endpoint_at(cci_device_t * device,
 				      const char * service,
@@ -599,22 +642,19 @@ static int ctp_tcp_create_endpoint_at(cci_device_t * device,
 	tep = ep->priv;
 	tep->pipe[0] = -1;
 	tep->pipe[1] = -1;
+	tep->epfd = -1;
 
 	TAILQ_INIT(&tep->conns);
+	TAILQ_INIT(&tep->dead);
+	TAILQ_INIT(&tep->ready);
 
-	tep->blocks = 1;
-	tep->fd_bits = malloc(sizeof(*tep->fd_bits));
-	if (!tep->fd_bits) {
-		ret = CCI_ENOMEM;
-		goto out;
-	}
-	memset(tep->fd_bits, -1, sizeof(*tep->fd_bits));
-
-	tep->fds = calloc(64, sizeof(*tep->fds));
-	if (!tep->fds) {
-		ret = CCI_ENOMEM;
+#ifdef HAVE_SYS_EPOLL_H
+	tep->epfd = epoll_create(TCP_EP_POLL_EVENTS);
+	if (tep->epfd == -1) {
+		ret = errno;
 		goto out;
 	}
+#endif
 
 	TAILQ_INIT(&tep->idle_txs);
 	TAILQ_INIT(&tep->idle_rxs);
@@ -671,7 +711,6 @@ static int ctp_tcp_create_endpoint_at(cci_device_t * device,
 	tconn = conn->priv;
 	tconn->status = TCP_CONN_PASSIVE1;
 	tconn->is_listener = 1;
-	tconn->pfd->events = POLLIN;
 	queue_conn(ep, conn);
 
 	tep->tx_buf = calloc(1, ep->tx_buf_cnt * ep->buffer_len);
@@ -735,6 +774,10 @@ static int ctp_tcp_create_endpoint_at(cci_device_t * device,
 		goto out;
 	}
 
+	ret = tcp_watch_conn(ep, conn);
+	if (ret)
+		goto out;
+
 	if (fd) {
 		ret = pipe(tep->pipe);
 		if (ret) {
@@ -759,10 +802,7 @@ out:
 			pthread_mutex_lock(&ep->lock);
 			TAILQ_REMOVE(&tep->conns, tconn, entry);
 			pthread_mutex_unlock(&ep->lock);
-			if (tconn->pfd->fd) {
-				close(tconn->pfd->fd);
-				release_pollfd(ep, tconn);
-			}
+			tcp_conn_close_fd(tconn);
 		}
 		free((char*)conn->uri);
 		free(conn->priv);
@@ -776,8 +816,8 @@ out:
 		free(tep->rxs);
 		free(tep->rx_buf);
 
-		free(tep->fds);
-		free(tep->fd_bits);
+		if (tep->epfd != -1)
+			close(tep->epfd);
 
 		if (sock)
 			tcp_close_socket(sock);
@@ -820,10 +860,7 @@ tcp_conn_set_closed_locked(cci__ep_t *ep, cci__conn_t *conn)
 			tconn->status == TCP_CONN_CLOSING) {
 		if (tep->poll_conn == tconn)
 			tep->poll_conn = NULL;
-		if (tconn->pfd->fd) {
-			close(tconn->pfd->fd);
-			release_pollfd(ep, tconn);
-		}
+		tcp_conn_close_fd(tconn);
 	}
 	tconn->status = TCP_CONN_CLOSED;
 
@@ -850,28 +887,28 @@ tcp_conn_set_closing_locked(cci__ep_t *ep, cci__conn_t *conn)
 {
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
+	uint32_t i;
 
 	while (0 && !TAILQ_EMPTY(&tconn->queued))
 		tcp_progress_conn_sends(ep, conn);
 
 	if (tconn->status > TCP_CONN_INIT) {
-		if (tconn->pfd->fd) {
-			close(tconn->pfd->fd);
-			release_pollfd(ep, tconn);
-		}
+		tcp_conn_close_fd(tconn);
 		tconn->status = TCP_CONN_CLOSING;
 
+		/* no notifications will come for the zerocopy sends */
+		tcp_zc_drop_locked(ep, tconn);
+
 		/* TODO complete queued and pending sends */
 		while (!TAILQ_EMPTY(&tconn->queued)) {
 			cci__evt_t *evt = TAILQ_FIRST(&tconn->queued);
 			tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
-			tcp_rma_op_t *rma_op = NULL;
 
 			TAILQ_REMOVE(&tconn->queued, evt, entry);
 
 			switch (tx->msg_type) {
 			case TCP_MSG_ACK:
-				tcp_sendto(tconn->pfd->fd, tx->buffer, tx->len,
+				tcp_sendto(tconn->fd, tx->buffer, tx->len,
 					tx->rma_ptr, tx->rma_len, &tx->offset);
 				if (tx->evt.ep)
 					tcp_put_tx_locked(tep, tx);
@@ -879,21 +916,22 @@ tcp_conn_set_closing_locked(cci__ep_t *ep, cci__conn_t *conn)
 					free(tx);
 				break;
 			case TCP_MSG_SEND:
-				evt->event.send.status = CCI_ERR_DISCONNECTED;
-				TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-				break;
+				if (!tx->rma_op) {
+					evt->event.send.status =
+						CCI_ERR_DISCONNECTED;
+					tcp_queue_evt(ep, evt);
+					break;
+				}
+				/* the completion MSG of an RMA */
+				/* fall through */
 			case TCP_MSG_RMA_WRITE:
 			case TCP_MSG_RMA_READ_REQUEST:
-				rma_op = tx->rma_op;
-				rma_op->evt.event.send.status = CCI_ERR_DISCONNECTED;
-				rma_op->pending--;
-
-				if (tx->rma_op->pending == 0) {
-					/* last segment, queue event */
-					TAILQ_INSERT_TAIL(&ep->evts, &rma_op->evt, entry);
-				} else {
-					tcp_put_tx_locked(tep, tx);
-				}
+				/* the RMA completes in the walk of tep->rma_ops
+				 * below, for the conn it was started on */
+				tx->rma_op->evt.event.send.status =
+					CCI_ERR_DISCONNECTED;
+				tcp_rma_op_decref_locked(tx->rma_op);
+				tcp_put_tx_locked(tep, tx);
 				break;
 			default:
 				debug(CCI_DB_WARN, "%s: tconn->queued has %d",
@@ -909,27 +947,27 @@ tcp_conn_set_closing_locked(cci__ep_t *ep, cci__conn_t *conn)
 		while (!TAILQ_EMPTY(&tconn->pending)) {
 			cci__evt_t *evt = TAILQ_FIRST(&tconn->pending);
 			tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
-			tcp_rma_op_t *rma_op = NULL;
 
-			TAILQ_REMOVE(&tconn->queued, evt, entry);
+			TAILQ_REMOVE(&tconn->pending, evt, entry);
 
 			switch (tx->msg_type) {
 			case TCP_MSG_SEND:
-				evt->event.send.status = CCI_ERR_DISCONNECTED;
-				TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-				break;
+				if (!tx->rma_op) {
+					evt->event.send.status =
+						CCI_ERR_DISCONNECTED;
+					tcp_queue_evt(ep, evt);
+					break;
+				}
+				/* the completion MSG of an RMA */
+				/* fall through */
 			case TCP_MSG_RMA_WRITE:
 			case TCP_MSG_RMA_READ_REQUEST:
-				rma_op = tx->rma_op;
-				rma_op->evt.event.send.status = CCI_ERR_DISCONNECTED;
-				rma_op->pending--;
-
-				if (tx->rma_op->pending == 0) {
-					/* last segment, queue event */
-					TAILQ_INSERT_TAIL(&ep->evts, &rma_op->evt, entry);
-				} else {
-					tcp_put_tx_locked(tep, tx);
-				}
+				/* the RMA completes in the walk of tep->rma_ops
+				 * below, for the conn it was started on */
+				tx->rma_op->evt.event.send.status =
+					CCI_ERR_DISCONNECTED;
+				tcp_rma_op_decref_locked(tx->rma_op);
+				tcp_put_tx_locked(tep, tx);
 				break;
 			case TCP_MSG_ACK:
 				if (tx->evt.ep)
@@ -967,8 +1005,10 @@ tcp_conn_set_closing_locked(cci__ep_t *ep, cci__conn_t *conn)
 						__func__, (void*) op);
 				tconn->rma_ops_cnt--;
 				TAILQ_REMOVE(&tep->rma_ops, &op->evt, entry);
-				TAILQ_INSERT_TAIL(&ep->evts, &op->evt, entry);
-				assert(op->pending == 0);
+				if (op->evt.event.send.status == CCI_SUCCESS)
+					op->evt.event.send.status =
+						CCI_ERR_DISCONNECTED;
+				tcp_rma_op_done_locked(ep, op);
 				if (0 && tconn->rma_ops_cnt == 0)
 					break;
 			}
@@ -976,6 +1016,16 @@ tcp_conn_set_closing_locked(cci__ep_t *ep, cci__conn_t *conn)
 
 		if (tep->poll_conn == tconn)
 			tep->poll_conn = NULL;
+
+		/* a conn and its extra data sockets fail together, each
+		 * carries fragments of the conn's RMAs */
+		if (tconn->primary)
+			tcp_conn_set_closing_locked(ep, tconn->primary);
+		for (i = 1; i < tconn->nstreams; i++) {
+			if (tconn->streams[i])
+				tcp_conn_set_closing_locked(ep,
+						tconn->streams[i]);
+		}
 	}
 
 	debug(CCI_DB_CONN, "%s: closing conn %p tconn %p status %s",
@@ -993,9 +1043,32 @@ tcp_conn_set_closing(cci__ep_t *ep, cci__conn_t *conn)
 	return;
 }
 
+/* Close an extra data socket that carried nothing yet, e.g. one that
+ * could not connect, without closing its conn.
+ * NOTE: the caller holds ep->lock */
+static void
+tcp_conn_drop_stream_locked(cci__ep_t *ep, cci__conn_t *conn)
+{
+	tcp_conn_t *tconn = conn->priv;
+	tcp_conn_t *ptconn = tconn->primary->priv;
+	uint32_t i;
+
+	for (i = 1; i < ptconn->nstreams; i++) {
+		if (ptconn->streams[i] == conn)
+			ptconn->streams[i] = NULL;
+	}
+	tconn->primary = NULL;
+	tcp_conn_set_closing_locked(ep, conn);
+
+	return;
+}
+
 static void
 tcp_rma_op_decref(cci__ep_t *ep, tcp_rma_op_t *rma_op);
 
+static void
+tcp_rma_op_decref_locked(tcp_rma_op_t *rma_op);
+
 static int ctp_tcp_destroy_endpoint(cci_endpoint_t * endpoint)
 {
 	cci__ep_t *ep = NULL;
@@ -1045,6 +1118,16 @@ static int ctp_tcp_destroy_endpoint(cci_endpoint_t * endpoint)
 					__func__, (void*)conn, tconn->rma_ops_cnt);
 			TAILQ_REMOVE(&tep->conns, tconn, entry);
 			free((char*)conn->uri);
+			free(tconn->rbuf);
+			free(tconn);
+			free(conn);
+		}
+		while (!TAILQ_EMPTY(&tep->dead)) {
+			tconn = TAILQ_FIRST(&tep->dead);
+			conn = tconn->conn;
+			TAILQ_REMOVE(&tep->dead, tconn, entry);
+			free((char*)conn->uri);
+			free(tconn->rbuf);
 			free(tconn);
 			free(conn);
 		}
@@ -1067,8 +1150,8 @@ static int ctp_tcp_destroy_endpoint(cci_endpoint_t * endpoint)
 			free(handle);
 		}
 
-		free(tep->fds);
-		free(tep->fd_bits);
+		if (tep->epfd != -1)
+			close(tep->epfd);
 
 		if (tep->pipe[0] != -1)
 			close(tep->pipe[0]);
@@ -1256,20 +1339,14 @@ static int ctp_tcp_accept(cci_event_t *event, const void *context)
 		debug(CCI_DB_CONN, "%s: unable to get tx for conn %p (%s)",
 				__func__, (void*) conn, conn->uri);
 
-		if (tconn->pfd->fd) {
-			close(tconn->pfd->fd);
-			release_pollfd(ep, tconn);
-		}
-
 		pthread_mutex_lock(&ep->lock);
+		tcp_conn_close_fd(tconn);
 		if (tep->poll_conn == tconn)
 			tep->poll_conn = TAILQ_NEXT(tconn, entry);
 		TAILQ_REMOVE(&tep->conns, tconn, entry);
+		delete_conn_locked(ep, conn);
 		pthread_mutex_unlock(&ep->lock);
 
-		free((char*)conn->uri);
-		free(conn->priv);
-		free(conn);
 		CCI_EXIT;
 		return CCI_ENOBUFS;
 	}
@@ -1300,18 +1377,18 @@ static int ctp_tcp_accept(cci_event_t *event, const void *context)
 	tcp_pack_conn_reply(hdr, CCI_SUCCESS, client_tx_id);
 	hs = (tcp_handshake_t *) ((uintptr_t)tx->buffer + sizeof(*hdr));
 	tcp_pack_handshake(hs, ep->rx_buf_cnt,
-			   conn->connection.max_send_size, 0, tx->id);
+			   conn->connection.max_send_size, 0, tx->id,
+			   tconn->nstreams, tconn->stream_key);
 
 	tx->len = sizeof(*hdr) + sizeof(*hs);
 
 	pthread_mutex_lock(&ep->lock);
 	tx->state = TCP_TX_PENDING;
-	tcp_sendto(tconn->pfd->fd, tx->buffer, tx->len, NULL, 0, &offset);
+	tcp_sendto(tconn->fd, tx->buffer, tx->len, NULL, 0, &offset);
 
 	assert((uint32_t)offset == tx->len);
 
 	TAILQ_INSERT_HEAD(&tconn->pending, &tx->evt, entry);
-	tconn->pfd->events = POLLIN | POLLOUT;
 	pthread_mutex_unlock(&ep->lock);
 
 	CCI_EXIT;
@@ -1362,7 +1439,7 @@ static int ctp_tcp_reject(cci_event_t *event)
 	memset(&reject, 0, sizeof(reject));
 	tcp_pack_conn_reply(&reject, CCI_ECONNREFUSED, b);
 
-	tcp_sendto(tconn->pfd->fd, &reject, sizeof(reject),
+	tcp_sendto(tconn->fd, &reject, sizeof(reject),
 			NULL, 0, &offset);
 
 	memset(name, 0, sizeof(name));
@@ -1427,88 +1504,95 @@ static int tcp_getaddrinfo(const char *uri, in_addr_t * in, uint16_t * port)
 	return CCI_SUCCESS;
 }
 
-/* This function will loop until it can successfully assign a pollfd.
- * If either realloc() fails, it tries again. In a low memory state,
- * this may try forever.
+/* What the progress engine waits for on a conn: input always, output only
+ * while sends are queued (which includes the CONN_REQUEST of a connect()
+ * in progress).
+ *
+ * Caller holds ep->lock
  */
-static void
-assign_pollfd(cci__ep_t *ep, tcp_conn_t *tconn)
+static inline short
+tcp_conn_wanted_events(tcp_conn_t *tconn)
 {
-	int i = 0;
-	int idx = -1;
-	tcp_ep_t *tep = ep->priv;
-
-	pthread_mutex_lock(&ep->lock);
-
-    again:
-	for (i = 0; i < tep->blocks; i++) {
-		uint64_t *bits = &tep->fd_bits[i];
-
-		if (!(*bits))
-			continue;
-
-		idx = ffsll(*bits) - 1;
-
-		*bits = *bits & ~((uint64_t)1 << idx);
-		idx += i * 64;
-	}
-
-	if (idx == -1) {
-		uint64_t *tmp = NULL;
-		struct pollfd *fds = NULL;
-
-		tep->blocks++;
+	if (!tconn->is_listener && !TAILQ_EMPTY(&tconn->queued))
+		return POLLIN | POLLOUT;
+	return POLLIN;
+}
 
-		tmp = realloc(tep->fd_bits, tep->blocks * sizeof(*tep->fd_bits));
-		if (!tmp)
-			goto again; /* will retry */
+#ifdef HAVE_SYS_EPOLL_H
+/* Conns are edge-triggered, each ready socket is reported once and its
+ * handler reads or writes until EAGAIN. The listener stays level-triggered
+ * since tcp_handle_listen_socket() accepts one conn at a time. */
+static int
+tcp_epoll_ctl(tcp_ep_t *tep, tcp_conn_t *tconn, int op)
+{
+	struct epoll_event ev;
 
-		tep->fd_bits = tmp;
-		tmp = &tep->fd_bits[tep->blocks - 1];
-		memset(tmp, -1, sizeof(*tmp));
+	memset(&ev, 0, sizeof(ev));
+	ev.events = tconn->events;	/* EPOLLIN/OUT match POLLIN/OUT */
+	if (!tconn->is_listener)
+		ev.events |= EPOLLET;
+	ev.data.ptr = tconn;
 
-    again_fds:
-		fds = realloc(tep->fds, tep->blocks * sizeof(*tep->fds) * 64);
-		if (!fds) {
-			usleep(1000);
-			goto again_fds; /* will retry */
-		}
+	return epoll_ctl(tep->epfd, op, tconn->fd, &ev);
+}
+#endif /* HAVE_SYS_EPOLL_H */
 
-		tep->fds = fds;
-		fds = (void*)((uintptr_t)tep->fds +
-				(uintptr_t)((tep->blocks - 1) * sizeof(*tep->fds)));
-		memset(fds, 0, sizeof(tep->fds) * 64);
+/* Add the conn's socket to the progress engine */
+static int
+tcp_watch_conn(cci__ep_t *ep, cci__conn_t *conn)
+{
+	int ret = CCI_SUCCESS;
+	tcp_conn_t *tconn = conn->priv;
 
-		goto again;
+	pthread_mutex_lock(&ep->lock);
+	tconn->events = tcp_conn_wanted_events(tconn);
+	tconn->is_watched = 1;
+#ifdef HAVE_SYS_EPOLL_H
+	if (tcp_epoll_ctl(ep->priv, tconn, EPOLL_CTL_ADD)) {
+		ret = errno;
+		tconn->is_watched = 0;
+		debug(CCI_DB_CONN, "%s: epoll_ctl() for conn %p returned %s",
+			__func__, (void*)conn, strerror(ret));
 	}
-
-	if (tep->nfds < (nfds_t) idx + 1)
-		tep->nfds = (nfds_t) idx + 1;
-
+#endif
 	pthread_mutex_unlock(&ep->lock);
 
-	tconn->idx = idx;
-	tconn->pfd = &tep->fds[idx];
-
-	return;
+	return ret;
 }
 
+/* Wait for output only while sends are queued.
+ *
+ * Caller holds ep->lock
+ */
 static void
-release_pollfd(cci__ep_t *ep, tcp_conn_t *tconn)
+tcp_conn_update_events_locked(cci__ep_t *ep, tcp_conn_t *tconn)
 {
-	int i = 0, idx = 0;
-	tcp_ep_t *tep = ep->priv;
-	uint64_t *bits = NULL;
+	short events = tcp_conn_wanted_events(tconn);
+
+	if (!tconn->is_watched || events == tconn->events)
+		return;
 
-	i = tconn->idx / 64;
-	idx = tconn->idx % 64;
+	tconn->events = events;
+#ifdef HAVE_SYS_EPOLL_H
+	if (tcp_epoll_ctl(ep->priv, tconn, EPOLL_CTL_MOD))
+		debug(CCI_DB_CONN, "%s: epoll_ctl() for conn %p returned %s",
+			__func__, (void*)tconn->conn, strerror(errno));
+#else
+	(void) ep;
+#endif
+}
 
-	bits = &tep->fd_bits[i];
-	*bits = *bits | ((uint64_t)1 << idx);
+/* Close the conn's socket, which also removes it from the epoll set */
+static void
+tcp_conn_close_fd(tcp_conn_t *tconn)
+{
+	if (tconn->fd <= 0)
+		return;
 
-	tconn->pfd->fd = -1;
-	tconn->pfd->events = 0;
-	tconn->idx = -1;
+	close(tconn->fd);
+	tconn->fd = -1;
+	tconn->events = 0;
+	tconn->is_watched = 0;
 
 	return;
 }
@@ -1540,15 +1624,21 @@ tcp_new_conn(cci__ep_t *ep, struct sockaddr_in sin, int fd, cci__conn_t **connp)
 	tconn->conn = conn;
 	tconn->refcnt = 1; /* one for the caller */
 
-	assign_pollfd(ep, tconn);
+	tconn->rbuf = malloc(TCP_RBUF_SIZE);
+	if (!tconn->rbuf) {
+		ret = CCI_ENOMEM;
+		goto out_with_tconn;
+	}
 
-	tconn->pfd->fd = fd;
+	tconn->fd = fd;
 	if (fd != -1)
 		tconn->status = TCP_CONN_ACTIVE1;
 	else
 		tconn->status = TCP_CONN_PASSIVE1;
 	TAILQ_INIT(&tconn->queued);
 	TAILQ_INIT(&tconn->pending);
+	tconn->nstreams = 1;
+	tconn->streams[0] = conn;
 
 	memcpy(&tconn->sin, &sin, sizeof(sin));
 
@@ -1558,24 +1648,27 @@ tcp_new_conn(cci__ep_t *ep, struct sockaddr_in sin, int fd, cci__conn_t **connp)
 
 	return ret;
 
+out_with_tconn:
+	free(conn->priv);
 out_with_conn:
 	free(conn);
 	return ret;
 }
 
+/* Set up a conn's socket before tcp_watch_conn() */
 static inline int
-tcp_monitor_fd(cci__ep_t *ep, cci__conn_t *conn, int events)
+tcp_setup_fd(cci__ep_t *ep, cci__conn_t *conn)
 {
 	int ret = CCI_SUCCESS, one = 1;
 	cci__dev_t *dev = ep->dev;
 	tcp_dev_t *tdev = dev->priv;
 	tcp_conn_t *tconn = conn->priv;
 
-	ret = tcp_set_nonblocking(tconn->pfd->fd);
+	ret = tcp_set_nonblocking(tconn->fd);
 	if (ret)
 		goto out;
 
-	ret = setsockopt(tconn->pfd->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	ret = setsockopt(tconn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 	if (ret)
 		goto out;
 
@@ -1586,20 +1679,27 @@ tcp_monitor_fd(cci__ep_t *ep, cci__conn_t *conn, int events)
 		debug(CCI_DB_CONN, "%s: setting socket buffer sizes to %u",
 			__func__, bufsize);
 
-		ret = setsockopt(tconn->pfd->fd, SOL_SOCKET, SO_SNDBUF, &bufsize, opt_len);
+		ret = setsockopt(tconn->fd, SOL_SOCKET, SO_SNDBUF, &bufsize, opt_len);
 		if (ret) debug(CCI_DB_EP, "%s: unable to set SO_SNDBUF (%s)",
 				__func__, strerror(errno));
 
-		ret = setsockopt(tconn->pfd->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, opt_len);
+		ret = setsockopt(tconn->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, opt_len);
 		if (ret) debug(CCI_DB_EP, "%s: unable to set SO_RCVBUF (%s)",
 				__func__, strerror(errno));
 
 		ret = 0;
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	tconn->pfd->events = events;
-	pthread_mutex_unlock(&ep->lock);
+#ifdef TCP_HAVE_ZEROCOPY
+	if (tdev->zerocopy) {
+		if (setsockopt(tconn->fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+				sizeof(one)))
+			debug(CCI_DB_CONN, "%s: unable to set SO_ZEROCOPY (%s), "
+				"copying RMA payloads", __func__, strerror(errno));
+		else
+			tconn->zerocopy = 1;
+	}
+#endif
 
 out:
 	return ret;
@@ -1643,6 +1743,7 @@ static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	void *ptr = NULL;
 	in_addr_t ip;
 	tcp_handshake_t *hs = NULL;
+	tcp_dev_t *tdev = NULL;
 	uint16_t port;
 	uint32_t keepalive = 0ULL;
 
@@ -1656,6 +1757,7 @@ static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	/* get our endpoint and device */
 	ep = container_of(endpoint, cci__ep_t, endpoint);
 	tep = ep->priv;
+	tdev = ep->dev->priv;
 
 	memset(&sin, 0, sizeof(sin));
 	sin.sin_family = AF_INET;
@@ -1725,7 +1827,8 @@ static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	if (keepalive != 0UL)
 		conn->keepalive_timeout = keepalive;
 	tcp_pack_handshake(hs, ep->rx_buf_cnt,
-			    conn->connection.max_send_size, keepalive, 0);
+			    conn->connection.max_send_size, keepalive, 0,
+			    tdev->streams, 0);
 
 	tx->len += sizeof(*hs);
 	ptr = (void*)((uintptr_t)tx->buffer + tx->len);
@@ -1738,10 +1841,7 @@ static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	tx->len += data_len;
 	assert(tx->len <= ep->buffer_len);
 
-	/* we will have to check for POLLOUT to determine when
-	 * the connect completed
-	 */
-	ret = tcp_monitor_fd(ep, conn, POLLOUT);
+	ret = tcp_setup_fd(ep, conn);
 	if (ret)
 		goto out;
 
@@ -1751,12 +1851,11 @@ static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	pthread_mutex_lock(&ep->lock);
 	queue_conn_locked(ep, conn);
 	TAILQ_INSERT_TAIL(&tconn->queued, &tx->evt, entry);
-	tconn->pfd->events = POLLIN | POLLOUT;
 	pthread_mutex_unlock(&ep->lock);
 
 again:
 	/* ok, initiate connect()... */
-	ret = connect(tconn->pfd->fd, (struct sockaddr *)&sin, slen);
+	ret = connect(tconn->fd, (struct sockaddr *)&sin, slen);
 	if (ret) {
 		ret = errno;
 		if (ret == EINTR) {
@@ -1771,11 +1870,16 @@ again:
 			goto out;
 		}
 	} else {
-		/* TODO connect completed, send CONN_REQUEST */
 		debug(CCI_DB_CONN, "%s: connect() completed", __func__);
-		tconn->pfd->events = POLLIN | POLLOUT;
 	}
 
+	/* The queued CONN_REQUEST makes us wait for POLLOUT, which tells
+	 * when the connect completed. An unconnected socket would report
+	 * POLLHUP, so it is only watched from now on. */
+	ret = tcp_watch_conn(ep, conn);
+	if (ret)
+		goto out;
+
 	conn_decref(ep, conn); /* drop our reference */
 
 	CCI_EXIT;
@@ -1868,6 +1972,15 @@ static int ctp_tcp_set_opt(cci_opt_handle_t * handle,
 static int ctp_tcp_get_opt(cci_opt_handle_t * handle,
 			cci_opt_name_t name, void *val)
 {
+	int ret = CCI_SUCCESS;
+	cci__ep_t *ep = NULL;
+	cci__conn_t *conn = NULL;
+	tcp_ep_t *tep = NULL;
+	tcp_conn_t *tconn = NULL;
+	cci_stats_t *stats = val;
+	cci__evt_t *evt = NULL;
+	uint32_t i;
+
 	CCI_ENTER;
 
 	if (!tglobals) {
@@ -1875,9 +1988,47 @@ static int ctp_tcp_get_opt(cci_opt_handle_t * handle,
 		return CCI_ENODEV;
 	}
 
+	switch (name) {
+	case CCI_OPT_ENDPT_STATS:
+		ep = container_of(handle, cci__ep_t, endpoint);
+		tep = ep->priv;
+
+		pthread_mutex_lock(&ep->lock);
+		TAILQ_FOREACH(tconn, &tep->conns, entry) {
+			TAILQ_FOREACH(evt, &tconn->queued, entry)
+				stats->queued++;
+			TAILQ_FOREACH(evt, &tconn->pending, entry)
+				stats->pending++;
+		}
+		pthread_mutex_unlock(&ep->lock);
+		break;
+	case CCI_OPT_CONN_STATS:
+		conn = container_of(handle, cci__conn_t, connection);
+		ep = container_of(conn->connection.endpoint, cci__ep_t, endpoint);
+		tconn = conn->priv;
+
+		/* count the sends of its extra data sockets as well */
+		pthread_mutex_lock(&ep->lock);
+		for (i = 0; i < tconn->nstreams; i++) {
+			tcp_conn_t *stconn;
+
+			if (!tconn->streams[i])
+				continue;
+			stconn = tconn->streams[i]->priv;
+			TAILQ_FOREACH(evt, &stconn->queued, entry)
+				stats->queued++;
+			TAILQ_FOREACH(evt, &stconn->pending, entry)
+				stats->pending++;
+		}
+		pthread_mutex_unlock(&ep->lock);
+		break;
+	default:
+		ret = CCI_EINVAL;
+	}
+
 	CCI_EXIT;
 
-	return CCI_EINVAL;
+	return ret;
 }
 
 static int ctp_tcp_arm_os_handle(cci_endpoint_t * endpoint, int flags)
@@ -1893,12 +2044,13 @@ static int ctp_tcp_arm_os_handle(cci_endpoint_t * endpoint, int flags)
 	return CCI_ERR_NOT_IMPLEMENTED;
 }
 
-static int ctp_tcp_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
+/* A pollset sleeps until the progress thread queues an event. Without
+ * an OS handle the thread was never started. */
+static int ctp_tcp_pollset_arm(cci_endpoint_t * endpoint)
 {
 	int ret = CCI_SUCCESS;
-	cci__ep_t *ep;
-	cci__evt_t *ev = NULL, *e;
-	tcp_ep_t *tep;
+	cci__ep_t *ep = NULL;
+	tcp_ep_t *tep = NULL;
 
 	CCI_ENTER;
 
@@ -1910,39 +2062,38 @@ static int ctp_tcp_get_event(cci_endpoint_t * endpoint, cci_event_t ** const eve
 	ep = container_of(endpoint, cci__ep_t, endpoint);
 	tep = ep->priv;
 
-	if (0 && !TCP_CONN_IS_BLOCKING(tep))
-		tcp_progress_ep(ep);
+	if (ep->poll && !tep->tid)
+		ret = tcp_create_thread(ep);
 
-	pthread_mutex_lock(&ep->lock);
+	CCI_EXIT;
+	return ret;
+}
 
-	/* give the user the first event */
-	TAILQ_FOREACH(e, &ep->evts, entry) {
-		if (e->event.type == CCI_EVENT_SEND) {
-			/* NOTE: if it is blocking, skip it because someone
-			 *       is waiting on it
-			 */
-			tcp_tx_t *tx = container_of(e, tcp_tx_t, evt);
-			tcp_rma_op_t *rma_op = NULL;
+static int ctp_tcp_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
+{
+	int ret = CCI_SUCCESS, idle = 0;
+	cci__ep_t *ep;
+	cci__evt_t *ev = NULL;
+	tcp_ep_t *tep;
 
-			if (tx->ctx == TCP_CTX_TX) {
-				if (tx->flags & CCI_FLAG_BLOCKING)
-					continue;
-			} else if (tx->ctx == TCP_CTX_RMA) {
-				rma_op = container_of(e, tcp_rma_op_t, evt);
-				if (rma_op->flags & CCI_FLAG_BLOCKING)
-					continue;
-			}
+	CCI_ENTER;
 
-			ev = e;
-			break;
-		} else {
-			ev = e;
-			break;
-		}
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
 	}
 
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	tep = ep->priv;
+
+	/* without a progress thread, the application drives progress */
+	if (!tep->tid)
+		idle = tcp_progress_ep(ep) == CCI_EAGAIN;
+
+	/* give the user the first event (blocking sends are never queued) */
+	ev = cci__dequeue_evt(ep);
+
 	if (ev) {
-		TAILQ_REMOVE(&ep->evts, ev, entry);
 		debug(CCI_DB_EP, "%s: found %s on conn %p", __func__,
 			cci_event_type_str(ev->event.type), (void*)ev->conn);
 		if (ev->event.type == CCI_EVENT_NONE) {
@@ -1955,12 +2106,14 @@ static int ctp_tcp_get_event(cci_endpoint_t * endpoint, cci_event_t ** const eve
 		}
 	} else {
 		ret = CCI_EAGAIN;
-		if (TAILQ_EMPTY(&tep->idle_rxs))
+		if (tcp_rxs_exhausted(tep))
 			ret = CCI_ENOBUFS;
+		/* a polling application would keep the CPU from the peer
+		 * whose message it waits for */
+		if (idle)
+			sched_yield();
 	}
 
-	pthread_mutex_unlock(&ep->lock);
-
 	/* drain fd so that they can block again */
 	if (ev && TCP_CONN_IS_BLOCKING(tep)) {
 		char a[1];
@@ -1979,6 +2132,63 @@ static int ctp_tcp_get_event(cci_endpoint_t * endpoint, cci_event_t ** const eve
 	return ret;
 }
 
+static int ctp_tcp_get_events(cci_endpoint_t * endpoint,
+			  cci_event_t ** const events, uint32_t max,
+			  uint32_t * count)
+{
+	int ret = CCI_SUCCESS, idle = 0;
+	uint32_t cnt = 0;
+	cci__ep_t *ep;
+	cci__evt_t *e;
+	tcp_ep_t *tep;
+
+	CCI_ENTER;
+
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	tep = ep->priv;
+
+	if (!tep->tid)
+		idle = tcp_progress_ep(ep) == CCI_EAGAIN;
+
+	while (cnt < max && (e = cci__dequeue_evt(ep))) {
+		debug(CCI_DB_EP, "%s: found %s on conn %p", __func__,
+			cci_event_type_str(e->event.type), (void*)e->conn);
+		events[cnt++] = &e->event;
+	}
+
+	if (!cnt) {
+		ret = CCI_EAGAIN;
+		if (tcp_rxs_exhausted(tep))
+			ret = CCI_ENOBUFS;
+		if (idle)
+			sched_yield();
+	}
+
+	/* drain one byte per event so that they can block again */
+	if (cnt && TCP_CONN_IS_BLOCKING(tep)) {
+		char a[64];
+		uint32_t left = cnt;
+
+		while (left) {
+			int rc = read(tep->pipe[0], a,
+				left < sizeof(a) ? left : sizeof(a));
+			if (rc <= 0)
+				break;
+			left -= rc;
+		}
+	}
+
+	*count = cnt;
+
+	CCI_EXIT;
+	return ret;
+}
+
 static int ctp_tcp_return_event(cci_event_t * event)
 {
 	cci__evt_t *evt;
@@ -2033,130 +2243,456 @@ static int ctp_tcp_return_event(cci_event_t * event)
 	return CCI_SUCCESS;
 }
 
-static int tcp_sendto(cci_os_handle_t sock, void *buf, int len,
-			void *rma_ptr, uint32_t rma_len, uintptr_t *offset)
+/* All events must belong to the same endpoint (see cci_return_events()) */
+static int ctp_tcp_return_events(cci_event_t ** const events, uint32_t count)
 {
+	uint32_t i;
+	cci__ep_t *ep = NULL;
+	cci__evt_t *evt;
+	tcp_ep_t *tep;
+	tcp_tx_t *tx;
+	tcp_rx_t *rx;
 	int ret = CCI_SUCCESS;
-	uintptr_t off = *offset;
-
-	if (off < (uintptr_t) len) {
-		ret = send(sock, (void*)((uintptr_t)buf + off), (int)((uintptr_t)len - off), 0);
-		if (ret != -1) {
-			off += ret;
-			*offset += ret;
-			ret = CCI_SUCCESS;
-		} else {
-			ret = errno;
-			goto out;
-		}
-	}
-	if (rma_ptr && (off >= (uintptr_t)len)) {
-		off -= len;
-		ret = send(sock, (void*)((uintptr_t)rma_ptr + off), rma_len - off, 0);
-		if (ret != -1) {
-			*offset += ret;
-			ret = CCI_SUCCESS;
-		} else {
-			ret = errno;
-			goto out;
-		}
-	}
-out:
-	return ret;
-}
 
-static inline void
-tcp_progress_conn_sends(cci__ep_t *ep, cci__conn_t *conn)
-{
-	int ret;
-	tcp_conn_t *tconn = conn->priv;
-	tcp_tx_t *put_tx = NULL;
+	CCI_ENTER;
 
-	if (!conn || !conn->priv)
-		return;
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
 
-	tconn = conn->priv;
+	for (i = 0; i < count && !ep; i++) {
+		if (events[i])
+			ep = container_of(events[i], cci__evt_t, event)->ep;
+	}
+	if (!ep) {
+		CCI_EXIT;
+		return CCI_SUCCESS;
+	}
+	tep = ep->priv;
 
 	pthread_mutex_lock(&ep->lock);
-	while (!TAILQ_EMPTY(&tconn->queued)) {
-		cci__evt_t *evt = TAILQ_FIRST(&tconn->queued);
-		tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
-		int off = tx->offset;
-
-		if (tx->msg_type == TCP_MSG_CONN_REQUEST &&
-			tconn->status == TCP_CONN_ACTIVE1)
-			break;
-
-		if (tx->msg_type == TCP_MSG_RMA_WRITE ||
-			tx->msg_type == TCP_MSG_RMA_READ_REQUEST) {
-			if (tx->rma_op->pending >= TCP_RMA_DEPTH &&
-					tx->offset == 0)
-				/* don't start this RMA fragment yet */
-				break;
-		}
+	for (i = 0; i < count; i++) {
+		if (!events[i])
+			continue;
 
-		debug(CCI_DB_MSG, "%s: sending %s to conn %p",
-			__func__, tcp_msg_type(tx->msg_type), (void*)conn);
+		evt = container_of(events[i], cci__evt_t, event);
+		assert(evt->ep == ep);
 
-		debug(CCI_DB_MSG, "%s: buffer %p len %u rma_ptr %p rma_len %u "
-			"offset %"PRIuPTR" tx %u", __func__, (void*)tx->buffer,
-			tx->len, (void*)tx->rma_ptr, tx->rma_len, tx->offset, tx->id);
+		switch (events[i]->type) {
+		case CCI_EVENT_SEND:
+		case CCI_EVENT_ACCEPT:
+			tx = container_of(evt, tcp_tx_t, evt);
+			if (tx->ctx == TCP_CTX_TX) {
+				tcp_put_tx_locked(tep, tx);
+			} else if (tx->ctx == TCP_CTX_RMA) {
+				tcp_rma_op_decref_locked(container_of(evt,
+							tcp_rma_op_t, evt));
+			}
+			break;
+		case CCI_EVENT_RECV:
+		case CCI_EVENT_CONNECT_REQUEST:
+			rx = container_of(evt, tcp_rx_t, evt);
+			tcp_put_rx_locked(tep, rx);
+			break;
+		case CCI_EVENT_CONNECT:
+			rx = container_of(evt, tcp_rx_t, evt);
+			tx = (tcp_tx_t*)rx;
+			if (rx->ctx == TCP_CTX_RX)
+				tcp_put_rx_locked(tep, rx);
+			else
+				tcp_put_tx_locked(tep, tx);
+			break;
+		default:
+			debug(CCI_DB_EP, "%s: unhandled %s event", __func__,
+				cci_event_type_str(events[i]->type));
+			ret = CCI_ERROR;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ep->lock);
 
-		ret = tcp_sendto(tconn->pfd->fd, tx->buffer, tx->len,
-				tx->rma_ptr, tx->rma_len, &tx->offset);
-		if (ret) {
-			if (ret == EAGAIN || ret == EINTR) {
-				debug(CCI_DB_MSG, "%s: sending %s returned %s",
-					__func__, tcp_msg_type(tx->msg_type),
-					strerror(ret));
+	CCI_EXIT;
+
+	return ret;
+}
+
+/* Release the zerocopy send in slot and, with it, the hold on its RMA op.
+ *
+ * Caller holds ep->lock
+ */
+static void
+tcp_zc_release_locked(cci__ep_t *ep, tcp_conn_t *tconn, uint32_t slot)
+{
+	tcp_rma_op_t *rma_op = tconn->zc_ops[slot];
+
+	if (!(tconn->zc_busy & (1ULL << slot)))
+		return;
+
+	tconn->zc_busy &= ~(1ULL << slot);
+	tconn->zc_ops[slot] = NULL;
+	if (!rma_op)
+		return;
+
+	rma_op->zc_pending--;
+	if (!rma_op->zc_pending && rma_op->zc_wait)
+		tcp_rma_op_done_locked(ep, rma_op);
+	tcp_rma_op_decref_locked(rma_op);
+}
+
+/* Release all the zerocopy sends of a conn whose socket is closed.
+ *
+ * Caller holds ep->lock
+ */
+static void
+tcp_zc_drop_locked(cci__ep_t *ep, tcp_conn_t *tconn)
+{
+	uint32_t slot;
+
+	for (slot = 0; tconn->zc_busy && slot < TCP_ZC_RING; slot++)
+		tcp_zc_release_locked(ep, tconn, slot);
+}
+
+#ifdef TCP_HAVE_ZEROCOPY
+/* Should the rest of tx's RMA payload be sent with MSG_ZEROCOPY? Only if
+ * a slot is free to hold it until the kernel releases it.
+ *
+ * Caller holds ep->lock
+ */
+static inline int
+tcp_tx_zerocopy(cci__ep_t *ep, tcp_conn_t *tconn, tcp_tx_t *tx)
+{
+	tcp_dev_t *tdev = ep->dev->priv;
+
+	if (!tconn->zerocopy || !tx->rma_ptr || tx->rma_len < tdev->zerocopy)
+		return 0;
+	if (tx->msg_type != TCP_MSG_RMA_WRITE &&
+		tx->msg_type != TCP_MSG_RMA_READ_REPLY)
+		return 0;
+	return !(tconn->zc_busy & (1ULL << (tconn->zc_next % TCP_ZC_RING)));
+}
+
+/* The kernel took a MSG_ZEROCOPY send of tx's payload and will notify
+ * when it no longer needs the pages. Until then, an RMA write holds its
+ * op, which does not complete. A read reply is only tracked: the target
+ * does not complete anything for it.
+ *
+ * Caller holds ep->lock
+ */
+static void
+tcp_zc_hold_locked(tcp_conn_t *tconn, tcp_tx_t *tx)
+{
+	uint32_t slot = tconn->zc_next++ % TCP_ZC_RING;
+	tcp_rma_op_t *rma_op = NULL;
+
+	if (tx->msg_type == TCP_MSG_RMA_WRITE)
+		rma_op = tx->rma_op;
+
+	tconn->zc_busy |= 1ULL << slot;
+	tconn->zc_ops[slot] = rma_op;
+	if (rma_op) {
+		rma_op->zc_pending++;
+		rma_op->refcnt++;
+	}
+}
+
+/* Read the zerocopy notifications off the socket's error queue and
+ * release the sends they cover. Returns the number read.
+ */
+static int
+tcp_zc_complete(cci__ep_t *ep, tcp_conn_t *tconn)
+{
+	int cnt = 0;
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+			sizeof(struct sockaddr_in))];
+
+	for (;;) {
+		struct msghdr msg;
+		struct cmsghdr *cm;
+		struct sock_extended_err *serr;
+		uint32_t id;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(tconn->fd, &msg, MSG_ERRQUEUE) == -1)
+			break;
+
+		cm = CMSG_FIRSTHDR(&msg);
+		if (!cm)
+			continue;
+		serr = (void*)CMSG_DATA(cm);
+		if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno)
+			continue;
+		cnt++;
+
+		debug(CCI_DB_MSG, "%s: conn %p zerocopy sends %u-%u released%s",
+			__func__, (void*)tconn->conn, serr->ee_info,
+			serr->ee_data, serr->ee_code &
+			SO_EE_CODE_ZEROCOPY_COPIED ? " (copied)" : "");
+
+		pthread_mutex_lock(&ep->lock);
+		if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED &&
+			tconn->zerocopy) {
+			/* the device cannot send from our pages, a deferred
+			 * copy costs more than a plain send */
+			debug(CCI_DB_CONN, "%s: conn %p falls back to copying "
+				"RMA payloads", __func__, (void*)tconn->conn);
+			tconn->zerocopy = 0;
+		}
+		id = serr->ee_info;
+		do {
+			tcp_zc_release_locked(ep, tconn, id % TCP_ZC_RING);
+		} while (id++ != serr->ee_data);
+		pthread_mutex_unlock(&ep->lock);
+	}
+	return cnt;
+}
+#endif /* TCP_HAVE_ZEROCOPY */
+
+/* Describe the bytes of a message left to send past offset, its header
+ * buffer and then its RMA payload, in up to two iovecs. Returns the number
+ * of iovecs used. */
+static inline int
+tcp_msg_iov(void *buf, uint32_t len, void *rma_ptr, uint32_t rma_len,
+		uintptr_t offset, struct iovec *iov)
+{
+	int cnt = 0;
+
+	if (offset < len) {
+		iov[cnt].iov_base = (void*)((uintptr_t)buf + offset);
+		iov[cnt++].iov_len = len - offset;
+		offset = len;
+	}
+	if (rma_ptr && offset < (uintptr_t)len + rma_len) {
+		offset -= len;
+		iov[cnt].iov_base = (void*)((uintptr_t)rma_ptr + offset);
+		iov[cnt++].iov_len = rma_len - offset;
+	}
+	return cnt;
+}
+
+static int tcp_sendto(cci_os_handle_t sock, void *buf, int len,
+			void *rma_ptr, uint32_t rma_len, uintptr_t *offset)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t rc;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = tcp_msg_iov(buf, len, rma_ptr, rma_len, *offset, iov);
+	if (!msg.msg_iovlen)
+		return CCI_SUCCESS;
+
+	rc = sendmsg(sock, &msg, 0);
+	if (rc == -1)
+		return errno;
+
+	*offset += rc;
+	return CCI_SUCCESS;
+}
+
+/* Send as many queued txs as the socket takes.
+ *
+ * The headers and payloads of consecutive txs are gathered in one iovec
+ * array and written with a single sendmsg(). The bytes written are then
+ * charged to the txs in order; a tx only partly written keeps its offset
+ * and is resumed on POLLOUT.
+ *
+ * An RMA payload sent with MSG_ZEROCOPY goes alone, after its header was
+ * gathered with the messages before it.
+ */
+static inline void
+tcp_progress_conn_sends(cci__ep_t *ep, cci__conn_t *conn)
+{
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn = conn->priv;
+	TAILQ_HEAD(s_put_txs, cci__evt) put_txs = TAILQ_HEAD_INITIALIZER(put_txs);
+
+	if (!conn || !conn->priv)
+		return;
+
+	tconn = conn->priv;
+
+	pthread_mutex_lock(&ep->lock);
+	while (!TAILQ_EMPTY(&tconn->queued)) {
+		int i, cnt = 0, iovcnt = 0, flags = 0, hdr_only = 0, full = 0;
+		ssize_t sent = 0;
+		struct iovec iov[TCP_SEND_IOVS];
+		struct msghdr msg;
+		cci__evt_t *evt;
+
+		TAILQ_FOREACH(evt, &tconn->queued, entry) {
+			tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
+
+			if (iovcnt + 2 > TCP_SEND_IOVS)
 				break;
-			} else {
-				/* close connection */
-				tcp_conn_set_closing(ep, conn);
-			}
-		} else {
-			debug(CCI_DB_MSG, "%s: sent %u bytes to conn %p (offset %u off %u)",
-				__func__, (int) tx->offset - off, (void*)conn, (int) tx->offset, off);
-			if (tx->offset == (tx->len + tx->rma_len)) {
-				debug(CCI_DB_MSG, "%s: completed %s send to conn %p",
-					__func__, tcp_msg_type(tx->msg_type), (void*)conn);
-				TAILQ_REMOVE(&tconn->queued, evt, entry);
-				switch (tx->msg_type) {
-				default:
-					TAILQ_INSERT_TAIL(&tconn->pending, evt, entry);
-					break;
-				case TCP_MSG_RMA_READ_REPLY:
-					put_tx = tx;
+
+			if ((tx->msg_type == TCP_MSG_CONN_REQUEST ||
+				tx->msg_type == TCP_MSG_CONN_STREAM) &&
+				tconn->status == TCP_CONN_ACTIVE1)
+				break;
+
+			if (tx->msg_type == TCP_MSG_RMA_WRITE ||
+				tx->msg_type == TCP_MSG_RMA_READ_REQUEST) {
+				if (tx->rma_op->pending >= TCP_RMA_DEPTH &&
+						tx->offset == 0)
+					/* don't start this RMA fragment yet */
 					break;
-				case TCP_MSG_CONN_ACK:
-					put_tx = tx;
+			}
+
+			debug(CCI_DB_MSG, "%s: sending %s to conn %p",
+				__func__, tcp_msg_type(tx->msg_type), (void*)conn);
+
+			debug(CCI_DB_MSG, "%s: buffer %p len %u rma_ptr %p "
+				"rma_len %u offset %"PRIuPTR" tx %u", __func__,
+				(void*)tx->buffer, tx->len, (void*)tx->rma_ptr,
+				tx->rma_len, tx->offset, tx->id);
+
+#ifdef TCP_HAVE_ZEROCOPY
+			if (tcp_tx_zerocopy(ep, tconn, tx)) {
+				if (tx->offset < tx->len) {
+					iovcnt += tcp_msg_iov(tx->buffer, tx->len,
+							NULL, 0, tx->offset,
+							&iov[iovcnt]);
+					hdr_only = 1;
+				} else if (!cnt) {
+					iovcnt += tcp_msg_iov(tx->buffer, tx->len,
+							tx->rma_ptr, tx->rma_len,
+							tx->offset, &iov[iovcnt]);
+					flags = MSG_ZEROCOPY;
+				} else {
 					break;
-				case TCP_MSG_ACK:
-					if (!tx->evt.ep) {
-						debug(CCI_DB_MSG, "%s: freeing "
-							"tx %p", __func__, (void*)tx);
-						free(tx->buffer);
-						free(tx);
-					} else {
-						put_tx = tx;
-					}
+				}
+				cnt++;
+				break;
+			}
+#endif
+			iovcnt += tcp_msg_iov(tx->buffer, tx->len, tx->rma_ptr,
+					tx->rma_len, tx->offset, &iov[iovcnt]);
+			cnt++;
+		}
+		if (!cnt)
+			break;
+
+		if (iovcnt) {
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = iovcnt;
+
+			sent = sendmsg(tconn->fd, &msg, flags);
+			if (sent == -1) {
+				int ret = errno;
+
+#ifdef TCP_HAVE_ZEROCOPY
+				if (flags && ret == ENOBUFS) {
+					/* no room to queue notifications */
+					debug(CCI_DB_CONN, "%s: conn %p falls back "
+						"to copying RMA payloads", __func__,
+						(void*)conn);
+					tconn->zerocopy = 0;
+					continue;
+				}
+#endif
+
+				debug(CCI_DB_MSG, "%s: sending %d msgs to conn "
+					"%p returned %s", __func__, cnt,
+					(void*)conn, strerror(ret));
+				if (ret != EAGAIN && ret != EWOULDBLOCK &&
+					ret != EINTR)
+					/* close connection */
+					tcp_conn_set_closing_locked(ep, conn);
+				break;
+			}
+			debug(CCI_DB_MSG, "%s: sent %zd bytes of %d msgs to "
+				"conn %p", __func__, sent, cnt, (void*)conn);
+#ifdef TCP_HAVE_ZEROCOPY
+			if (flags)
+				tcp_zc_hold_locked(tconn, container_of(
+					TAILQ_FIRST(&tconn->queued), tcp_tx_t, evt));
+#endif
+		}
+
+		/* charge the bytes sent to the txs in order */
+		for (i = 0; i < cnt; i++) {
+			tcp_tx_t *tx;
+			uintptr_t left;
+
+			evt = TAILQ_FIRST(&tconn->queued);
+			tx = container_of(evt, tcp_tx_t, evt);
+			left = tx->len + tx->rma_len - tx->offset;
+
+			if ((uintptr_t) sent < left) {
+				tx->offset += sent;
+				/* unless only the header of a zerocopy payload was
+				 * to go, the socket buffer is full */
+				if (!hdr_only || i < cnt - 1 || tx->offset != tx->len)
+					full = 1;
+				break;
+			}
+			tx->offset += left;
+			sent -= left;
+
+			debug(CCI_DB_MSG, "%s: completed %s send to conn %p",
+				__func__, tcp_msg_type(tx->msg_type), (void*)conn);
+			TAILQ_REMOVE(&tconn->queued, evt, entry);
+			if (tx->msg_type == TCP_MSG_SEND) {
+				CCI_TRACE(CCI_TRACE_SEND, CCI_TRACE_TP_TCP,
+					conn, tx->id, tx->len);
+				CCI_STAT_ADD(ep, conn, msgs_sent, 1);
+				CCI_STAT_ADD(ep, conn, bytes_sent,
+					tx->len - sizeof(tcp_header_t));
+			} else if (tx->msg_type == TCP_MSG_RMA_WRITE) {
+				CCI_TRACE(CCI_TRACE_RMA, CCI_TRACE_TP_TCP,
+					conn, tx->id, tx->rma_len);
+			}
+			switch (tx->msg_type) {
+			case TCP_MSG_SEND:
+				if (!cci_conn_is_reliable(conn)) {
+					/* no ack will come, complete it now */
+					tx->state = TCP_TX_COMPLETED;
+					TCP_QUEUE_EVT(ep, evt, tep);
 					break;
 				}
-			} else {
+				/* fall through */
+			default:
+				TAILQ_INSERT_TAIL(&tconn->pending, evt, entry);
+				break;
+			case TCP_MSG_RMA_READ_REPLY:
+			case TCP_MSG_CONN_ACK:
+			case TCP_MSG_CONN_STREAM:
+				TAILQ_INSERT_TAIL(&put_txs, evt, entry);
+				break;
+			case TCP_MSG_ACK:
+				if (!tx->evt.ep) {
+					debug(CCI_DB_MSG, "%s: freeing "
+						"tx %p", __func__, (void*)tx);
+					free(tx->buffer);
+					free(tx);
+				} else {
+					TAILQ_INSERT_TAIL(&put_txs, evt, entry);
+				}
 				break;
 			}
 		}
+		if (full) {
+			/* the socket buffer is full */
+			CCI_STAT_ADD(ep, conn, partial_sends, 1);
+			break;
+		}
 	}
-	/* If nothing queued, unset POLLOUT */
-	if (tconn->status == TCP_CONN_READY &&
-			TAILQ_EMPTY(&tconn->queued) &&
-			TAILQ_EMPTY(&tconn->pending) &&
-			tconn->rma_ops_cnt > 0)
-		tconn->pfd->events = POLLIN;
+	/* wait for POLLOUT only if the socket buffer filled up */
+	tcp_conn_update_events_locked(ep, tconn);
 	pthread_mutex_unlock(&ep->lock);
 
-	if (put_tx) {
-		tcp_put_tx(put_tx);
+	/* several txs may complete per call, put them all back */
+	while (!TAILQ_EMPTY(&put_txs)) {
+		cci__evt_t *evt = TAILQ_FIRST(&put_txs);
+
+		TAILQ_REMOVE(&put_txs, evt, entry);
+		tcp_put_tx(container_of(evt, tcp_tx_t, evt));
 	}
 
 	return;
@@ -2165,62 +2701,66 @@ tcp_progress_conn_sends(cci__ep_t *ep, cci__conn_t *conn)
 static int
 tcp_progress_ep(cci__ep_t *ep)
 {
-	int ret = CCI_EAGAIN;
-
-	tcp_poll_events(ep);
-
-	return ret;
+	return tcp_poll_events(ep, 0);
 }
 
+/* Queue a tx and try to send it right away, tcp_progress_conn_sends()
+ * waits for POLLOUT if the socket buffer is full */
 static inline void
 tcp_queue_tx(cci__ep_t *ep, tcp_conn_t *tconn, cci__evt_t *evt)
 {
 	pthread_mutex_lock(&ep->lock);
 	TAILQ_INSERT_TAIL(&tconn->queued, evt, entry);
-	tconn->pfd->events = POLLIN | POLLOUT;
 	pthread_mutex_unlock(&ep->lock);
+
+	tcp_progress_conn_sends(ep, tconn->conn);
 }
 
-static int tcp_send_common(cci_connection_t * connection,
+/* The socket that carries fragment i of an RMA on a conn: its extra
+ * data sockets take turns with it, starting with the RMA's own turn, and
+ * those not connected (yet) are skipped.
+ * NOTE: the caller holds ep->lock */
+static inline tcp_conn_t *
+tcp_rma_stream_locked(tcp_conn_t *tconn, tcp_rma_op_t *rma_op, uint32_t i)
+{
+	cci__conn_t *sconn =
+		tconn->streams[(rma_op->stripe + i) % tconn->nstreams];
+
+	if (sconn && ((tcp_conn_t *)sconn->priv)->status == TCP_CONN_READY)
+		return sconn->priv;
+	return tconn;
+}
+
+/* Get a tx and pack a SEND message into it. If the connection is no
+ * longer usable, the completion is queued right away with
+ * CCI_ERR_DISCONNECTED and *txp is set to NULL. */
+static int tcp_prepare_send_tx(cci__ep_t *ep, cci__conn_t *conn,
 		      struct iovec *data, uint32_t iovcnt,
 		      const void *context, int flags,
-		      tcp_rma_op_t *rma_op)
+		      tcp_rma_op_t *rma_op, tcp_tx_t **txp)
 {
-	int i, ret = CCI_SUCCESS, is_reliable = 0, data_len = 0;
-	char *func = iovcnt < 2 ? "send" : "sendv";
-	cci_endpoint_t *endpoint = connection->endpoint;
-	cci__ep_t *ep;
-	cci__conn_t *conn;
-	tcp_ep_t *tep;
-	tcp_conn_t *tconn;
+	int i, is_reliable = 0, data_len = 0;
+	cci_connection_t *connection = &conn->connection;
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn = conn->priv;
 	tcp_tx_t *tx = NULL;
 	tcp_header_t *hdr;
 	void *ptr = NULL;
 	cci__evt_t *evt;
 	union cci_event *event;	/* generic CCI event */
 
-	debug(CCI_DB_FUNC, "entering %s", func);
-
-	if (!tglobals) {
-		debug(CCI_DB_FUNC, "exiting %s", func);
-		return CCI_ENODEV;
-	}
+	*txp = NULL;
 
 	for (i = 0; i < (int) iovcnt; i++)
 		data_len += data[i].iov_len;
 
 	if (connection->max_send_size < (uint32_t) data_len) {
 		debug(CCI_DB_MSG, "%s: total send length (%d) larger than "
-			"max_send_size (%u)", func, data_len, connection->max_send_size);
-		CCI_EXIT;
+			"max_send_size (%u)", __func__, data_len,
+			connection->max_send_size);
 		return CCI_EMSGSIZE;
 	}
 
-	ep = container_of(endpoint, cci__ep_t, endpoint);
-	tep = ep->priv;
-	conn = container_of(connection, cci__conn_t, connection);
-	tconn = conn->priv;
-
 	is_reliable = cci_conn_is_reliable(conn);
 
 	/* get a tx */
@@ -2229,9 +2769,8 @@ static int tcp_send_common(cci_connection_t * connection,
 	} else {
 		tx = tcp_get_tx(ep, conn, 0);
 		if (!tx) {
+			CCI_STAT_ADD(ep, conn, no_bufs, 1);
 			tcp_progress_ep(ep);
-
-			debug(CCI_DB_FUNC, "exiting %s", func);
 			return CCI_ENOBUFS;
 		}
 	}
@@ -2264,10 +2803,8 @@ static int tcp_send_common(cci_connection_t * connection,
 			__func__, (void*)conn, tcp_conn_status_str(tconn->status));
 		tx->state = TCP_TX_COMPLETED;
 		event->send.status = CCI_ERR_DISCONNECTED;
-		pthread_mutex_lock(&ep->lock);
-		TCP_QUEUE_EVT(&ep->evts, evt, tep);
-		pthread_mutex_unlock(&ep->lock);
-		goto out;
+		TCP_QUEUE_EVT(ep, evt, tep);
+		return CCI_SUCCESS;
 	}
 
 	/* pack buffer */
@@ -2294,42 +2831,57 @@ static int tcp_send_common(cci_connection_t * connection,
 		tx->rma_op->msg_len = 0;
 	}
 
-	/* if unreliable, try to send */
-	if (!is_reliable) {
-    again:
-		ret = tcp_sendto(tconn->pfd->fd, tx->buffer, tx->len, tx->rma_ptr,
-				tx->rma_len, &tx->offset);
-		if (ret == CCI_SUCCESS) {
-			if (tx->offset < tx->len)
-				goto again;
-			/* queue event on enpoint's completed queue */
-			tx->state = TCP_TX_COMPLETED;
-			pthread_mutex_lock(&ep->lock);
-			TCP_QUEUE_EVT(&ep->evts, evt, tep);
-			pthread_mutex_unlock(&ep->lock);
-			debug(CCI_DB_MSG, "sent UU msg with %d bytes",
-			      tx->len - (int)sizeof(tcp_header_t));
+	*txp = tx;
+	return CCI_SUCCESS;
+}
 
-			debug(CCI_DB_FUNC, "exiting %s", func);
+static int tcp_send_common(cci_connection_t * connection,
+		      struct iovec *data, uint32_t iovcnt,
+		      const void *context, int flags,
+		      tcp_rma_op_t *rma_op)
+{
+	int ret = CCI_SUCCESS, is_reliable = 0;
+	char *func = iovcnt < 2 ? "send" : "sendv";
+	cci_endpoint_t *endpoint = connection->endpoint;
+	cci__ep_t *ep;
+	cci__conn_t *conn;
+	tcp_ep_t *tep;
+	tcp_conn_t *tconn;
+	tcp_tx_t *tx = NULL;
+	cci__evt_t *evt;
+	union cci_event *event;	/* generic CCI event */
 
-			return CCI_SUCCESS;
-		}
+	debug(CCI_DB_FUNC, "entering %s", func);
 
-		/* if error, fall through */
-		/* FIXME if disconnected, need to return error */
+	if (!tglobals) {
+		debug(CCI_DB_FUNC, "exiting %s", func);
+		return CCI_ENODEV;
 	}
 
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	tep = ep->priv;
+	conn = container_of(connection, cci__conn_t, connection);
+	tconn = conn->priv;
+
+	is_reliable = cci_conn_is_reliable(conn);
+
+	ret = tcp_prepare_send_tx(ep, conn, data, iovcnt, context, flags,
+				rma_op, &tx);
+	if (ret || !tx)
+		goto out;
+
+	evt = &tx->evt;
+	event = &evt->event;
+
 	/* insert at tail of sock device's queued list */
 
 	debug(CCI_DB_MSG, "%s: queuing MSG %p to conn %p", __func__, (void*)tx, (void*)conn);
 
+	/* an unreliable send completes once written, see
+	 * tcp_progress_conn_sends() */
 	tx->state = TCP_TX_QUEUED;
 	tcp_queue_tx(ep, tconn, evt);
 
-	/* try to progress txs */
-
-	tcp_progress_conn_sends(ep, conn);
-
 	/* if unreliable, we are done since it is buffered internally */
 	if (!is_reliable) {
 		debug(CCI_DB_FUNC, "exiting %s", func);
@@ -2349,12 +2901,8 @@ static int tcp_send_common(cci_connection_t * connection,
 		if (ret == CCI_SUCCESS && tconn->status != TCP_CONN_READY)
 			ret = CCI_ERR_DISCONNECTED;
 
-		/* NOTE race with get_event()
-		 *      get_event() must ignore sends with
-		 *      flags & CCI_FLAG_BLOCKING */
-
+		/* the completion was not queued, see tcp_queue_evt() */
 		pthread_mutex_lock(&ep->lock);
-		TAILQ_REMOVE(&ep->evts, evt, entry);
 		tcp_put_tx_locked(tep, tx);
 		pthread_mutex_unlock(&ep->lock);
 	}
@@ -2399,6 +2947,94 @@ static int ctp_tcp_sendv(cci_connection_t * connection,
 	return ret;
 }
 
+TAILQ_HEAD(tcp_batch, cci__evt);
+
+/* Append a batch of prepared txs to their conns' queues under one lock
+ * acquisition, then flush each conn once. */
+static void tcp_queue_batch(cci__ep_t *ep, struct tcp_batch *batch)
+{
+	cci__evt_t *evt;
+	cci__conn_t *conns[16];
+	int i, nconns = 0;
+
+	while (!TAILQ_EMPTY(batch)) {
+		pthread_mutex_lock(&ep->lock);
+		while ((evt = TAILQ_FIRST(batch))) {
+			tcp_conn_t *tconn = evt->conn->priv;
+
+			for (i = 0; i < nconns; i++) {
+				if (conns[i] == evt->conn)
+					break;
+			}
+			if (i == nconns) {
+				if (nconns == (int) (sizeof(conns) / sizeof(conns[0])))
+					break;
+				conns[nconns++] = evt->conn;
+			}
+
+			TAILQ_REMOVE(batch, evt, entry);
+			TAILQ_INSERT_TAIL(&tconn->queued, evt, entry);
+		}
+		pthread_mutex_unlock(&ep->lock);
+
+		for (i = 0; i < nconns; i++)
+			tcp_progress_conn_sends(ep, conns[i]);
+		nconns = 0;
+	}
+}
+
+/* All descriptors must use the same endpoint (see cci_send_batch()) */
+static int ctp_tcp_send_batch(cci_send_desc_t * descs, uint32_t count)
+{
+	uint32_t i;
+	cci__ep_t *ep;
+	struct tcp_batch batch;
+
+	CCI_ENTER;
+
+	if (!tglobals) {
+		for (i = 0; i < count; i++)
+			descs[i].status = CCI_ENODEV;
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(descs[0].connection->endpoint, cci__ep_t, endpoint);
+	TAILQ_INIT(&batch);
+
+	for (i = 0; i < count; i++) {
+		cci_send_desc_t *d = &descs[i];
+		cci__conn_t *conn = container_of(d->connection, cci__conn_t,
+						 connection);
+		struct iovec iov = { (void *) d->msg_ptr, d->msg_len };
+		tcp_tx_t *tx = NULL;
+
+		/* UU sends go out directly and blocking sends wait, so use
+		 * the regular path for them (after the batch so far, to
+		 * keep ordering). */
+		if (!cci_conn_is_reliable(conn) ||
+			(d->flags & CCI_FLAG_BLOCKING)) {
+			tcp_queue_batch(ep, &batch);
+			d->status = ctp_tcp_send(d->connection, d->msg_ptr,
+						d->msg_len, d->context, d->flags);
+			continue;
+		}
+
+		d->status = tcp_prepare_send_tx(ep, conn, &iov,
+					d->msg_ptr && d->msg_len ? 1 : 0,
+					d->context, d->flags, NULL, &tx);
+		if (d->status == CCI_SUCCESS && tx) {
+			tx->state = TCP_TX_QUEUED;
+			TAILQ_INSERT_TAIL(&batch, &tx->evt, entry);
+		}
+	}
+
+	tcp_queue_batch(ep, &batch);
+
+	CCI_EXIT;
+	return CCI_SUCCESS;
+}
+
 static int ctp_tcp_rma_register(cci_endpoint_t * endpoint,
 			     void *start, uint64_t length,
 			     int flags, cci_rma_handle_t ** rma_handle)
@@ -2485,9 +3121,8 @@ static int ctp_tcp_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t *
 }
 
 static void
-tcp_rma_op_decref(cci__ep_t *ep, tcp_rma_op_t *rma_op)
+tcp_rma_op_decref_locked(tcp_rma_op_t *rma_op)
 {
-	pthread_mutex_lock(&ep->lock);
 	rma_op->refcnt--;
 	if (rma_op->refcnt == 0) {
 		/* the op should not be on any queues */
@@ -2496,17 +3131,49 @@ tcp_rma_op_decref(cci__ep_t *ep, tcp_rma_op_t *rma_op)
 		free(rma_op->msg_ptr);
 		free(rma_op);
 	}
+	return;
+}
+
+static void
+tcp_rma_op_decref(cci__ep_t *ep, tcp_rma_op_t *rma_op)
+{
+	pthread_mutex_lock(&ep->lock);
+	tcp_rma_op_decref_locked(rma_op);
 	pthread_mutex_unlock(&ep->lock);
 	return;
 }
 
+/* Complete an RMA, unless the kernel still holds some of its zerocopy
+ * fragments; the last one released completes it then.
+ *
+ * Caller holds ep->lock
+ */
+static void
+tcp_rma_op_done_locked(cci__ep_t *ep, tcp_rma_op_t *rma_op)
+{
+	tcp_ep_t *tep = ep->priv;
+
+	if (rma_op->zc_pending) {
+		debug(CCI_DB_MSG, "%s: rma_op %p waits for %u zerocopy sends",
+			__func__, (void*)rma_op, rma_op->zc_pending);
+		rma_op->zc_wait = 1;
+		return;
+	}
+
+	rma_op->zc_wait = 0;
+	if (!(rma_op->flags & CCI_FLAG_BLOCKING))
+		TCP_QUEUE_EVT(ep, &rma_op->evt, tep);
+	rma_op->state = TCP_RMA_DONE;
+	return;
+}
+
 static int ctp_tcp_rma(cci_connection_t * connection,
 		    const void *msg_ptr, uint32_t msg_len,
 		    cci_rma_handle_t * local_handle, uint64_t local_offset,
 		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
 		    uint64_t data_len, const void *context, int flags)
 {
-	int ret = CCI_SUCCESS, i, cnt, err = 0;
+	int ret = CCI_SUCCESS, i, cnt, err = 0, nwires = 0;
 	cci__ep_t *ep = NULL;
 	cci__conn_t *conn = NULL;
 	tcp_ep_t *tep = NULL;
@@ -2516,6 +3183,7 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 	tcp_rma_handle_t *h = NULL;
 	tcp_rma_op_t *rma_op = NULL;
 	tcp_tx_t **txs = NULL;
+	tcp_conn_t *wires[TCP_MAX_STREAMS];
 	tcp_msg_type_t msg_type = flags & CCI_FLAG_WRITE ?
 		TCP_MSG_RMA_WRITE : TCP_MSG_RMA_READ_REQUEST;
 
@@ -2633,6 +3301,7 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 	pthread_mutex_unlock(&ep->lock);
 
 	if (err) {
+		CCI_STAT_ADD(ep, conn, no_bufs, 1);
 		free(txs);
 		free(rma_op->msg_ptr);
 		free(rma_op);
@@ -2696,11 +3365,17 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 		}
 	}
 	pthread_mutex_lock(&ep->lock);
-	for (i = 0; i < cnt; i++)
-		TAILQ_INSERT_TAIL(&tconn->queued, &(txs[i])->evt, entry);
+	rma_op->stripe = tconn->stripe++;
+	for (i = 0; i < cnt; i++) {
+		tcp_conn_t *wire = tcp_rma_stream_locked(tconn, rma_op, i);
+
+		TAILQ_INSERT_TAIL(&wire->queued, &(txs[i])->evt, entry);
+		/* the first nstreams fragments cover every socket used */
+		if (i < (int)tconn->nstreams)
+			wires[nwires++] = wire;
+	}
 
 	tconn->rma_ops_cnt++;
-	tconn->pfd->events = POLLIN | POLLOUT;
 
 	TAILQ_INSERT_TAIL(&tep->rma_ops, &rma_op->evt, entry);
 	pthread_mutex_unlock(&ep->lock);
@@ -2710,7 +3385,8 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 
 	ret = CCI_SUCCESS;
 
-	tcp_progress_conn_sends(ep, conn);
+	for (i = 0; i < nwires; i++)
+		tcp_progress_conn_sends(ep, wires[i]->conn);
 
 	if (flags & CCI_FLAG_BLOCKING) {
 		while (rma_op->state != TCP_RMA_DONE && tconn->status == TCP_CONN_READY)
@@ -2720,15 +3396,9 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 		if (ret == CCI_SUCCESS && tconn->status != TCP_CONN_READY)
 			ret = CCI_ERR_DISCONNECTED;
 
-		/* NOTE race with get_event()
-		 *      get_event() must ignore sends with
-		 *      flags & CCI_FLAG_BLOCKING
-		 */
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_REMOVE(&ep->evts, &rma_op->evt, entry);
-		/* we still have one reference from above,
+		/* the completion was not queued, see tcp_queue_evt(),
+		 * and we still have one reference from above,
 		 * keep it until below */
-		pthread_mutex_unlock(&ep->lock);
 	}
 
 out:
@@ -2763,16 +3433,17 @@ tcp_handle_listen_socket(cci__ep_t *ep, cci__conn_t *listen_conn)
 
 	tconn = conn->priv;
 
-	ret = accept(listen_tconn->pfd->fd, (struct sockaddr *)&sin, &slen);
+	ret = accept(listen_tconn->fd, (struct sockaddr *)&sin, &slen);
 	if (ret == -1) {
 		ret = errno;
 		debug(CCI_DB_CONN, "%s: accept() failed with %s (%d)",
 			__func__, strerror(ret), ret);
 		goto out;
 	}
-	tconn->pfd->fd = ret;
+	tconn->fd = ret;
+	memcpy(&tconn->sin, &sin, sizeof(sin));
 
-	ret = tcp_monitor_fd(ep, conn, POLLIN);
+	ret = tcp_setup_fd(ep, conn);
 	if (ret)
 		goto out;
 
@@ -2782,6 +3453,10 @@ tcp_handle_listen_socket(cci__ep_t *ep, cci__conn_t *listen_conn)
 
 	queue_conn(ep, conn);
 
+	ret = tcp_watch_conn(ep, conn);
+	if (ret)
+		goto out;
+
 	conn_decref(ep, conn); /* drop our ref */
 
 	CCI_EXIT;
@@ -2794,104 +3469,162 @@ out:
 	return;
 }
 
-static inline int
-tcp_recv_msg(int fd, void *ptr, uint32_t len)
-{
-	int ret = CCI_SUCCESS;
-	uint32_t offset = 0;
-	static int count = 0;
-
-	if (!len || !fd)
-		goto out;
-
-again:
-	do {
-		ret = recv(fd, (void*)((uintptr_t)ptr + offset), len - offset, 0);
-		if (ret < 0) {
-			ret = errno;
-			if ((count++ & 0xFFFF) == 0xFFFF)
-				debug(CCI_DB_MSG, "%s: recv() failed with %s (%u of %u bytes) "
-					"ptr=%p", __func__, strerror(ret), offset, len,
-					(void*)ptr);
-			if (ret == EAGAIN)
-				goto again;
-			goto out;
-		} else if (ret == 0) {
-			debug(CCI_DB_MSG, "%s: recv() failed - peer closed "
-				"connection", __func__);
-			ret = ECONNRESET;
-			goto out;
-		}
-		offset += ret;
-	} while (offset < len);
-
-	ret = CCI_SUCCESS;
-out:
-	return ret;
-}
-
 /* Caller has ref on conn and will release it */
 static void
 tcp_handle_conn_request(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx, uint32_t a)
 {
-	int ret;
 	tcp_conn_t *tconn = conn->priv;
 	tcp_header_t *hdr = rx->buffer;
 	tcp_handshake_t *hs = (void*)((uintptr_t)rx->buffer + sizeof(*hdr));
 	cci_conn_attribute_t attr = a & 0xF;
 	uint32_t len = (a >> 4) & 0xFFFF;
-	uint32_t total = len + sizeof(*hs);
-	uint32_t rx_cnt, mss, ka, ignore;
+	uint32_t rx_cnt, mss, ka, ignore, streams;
 	tcp_ep_t *tep = ep->priv;
+	tcp_dev_t *tdev = ep->dev->priv;
 
-	ret = tcp_recv_msg(tconn->pfd->fd, hdr->data, total);
-	if (ret) {
-		/* TODO handle error */
-		debug(CCI_DB_CONN, "%s: unable to recv conn %p handshake - %s",
-				__func__, (void*)conn, cci_strerror(&ep->endpoint, ret));
-		goto out;
+	tconn->status = TCP_CONN_PASSIVE2;
+
+	tcp_parse_handshake(hs, &rx_cnt, &mss, &ka, &ignore, &streams, &ignore);
+
+	conn->keepalive_timeout = ka;
+	if (mss < conn->connection.max_send_size)
+		conn->connection.max_send_size = mss;
+
+	conn->connection.attribute = attr;
+
+	if (cci_conn_is_reliable(conn)) {
+		tconn->max_tx_cnt = rx_cnt < ep->tx_buf_cnt ?
+				    rx_cnt : ep->tx_buf_cnt;
+
+		/* grant as many sockets as we use ourselves, the conn_reply
+		 * tells the peer how many and the key they present */
+		if (streams > tdev->streams)
+			streams = tdev->streams;
+		if (streams > 1) {
+			pthread_mutex_lock(&ep->lock);
+			tconn->nstreams = streams;
+			tconn->stream_key = ++tep->stream_keys;
+			pthread_mutex_unlock(&ep->lock);
+		}
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	tconn->is_busy = 0;
-	pthread_mutex_unlock(&ep->lock);
+	rx->evt.event.type = CCI_EVENT_CONNECT_REQUEST;
+	rx->evt.event.request.attribute = attr;
+	rx->evt.event.request.data_len = len;
+	if (len)
+		rx->evt.event.request.data_ptr = hdr->data + (uintptr_t) sizeof(*hs);
+	else
+		rx->evt.event.request.data_ptr = NULL;
+
+	/* queue event on endpoint's completed event queue */
+
+	debug(CCI_DB_CONN, "%s: recv'd conn request on conn %p", __func__, (void*)conn);
+
+	TCP_QUEUE_EVT(ep, &rx->evt, tep);
+
+	return;
+}
+
+/* Open the extra data sockets the server granted a reliable conn. Each
+ * one connects on its own and starts with a CONN_STREAM message, RMA
+ * fragments use it once it is connected. The conn goes on with the
+ * sockets opened so far if one fails. */
+static void
+tcp_open_streams(cci__ep_t *ep, cci__conn_t *conn, uint32_t n, uint32_t key)
+{
+	int ret;
+	tcp_conn_t *tconn = conn->priv;
+	uint32_t i;
+
+	if (n > TCP_MAX_STREAMS)
+		n = TCP_MAX_STREAMS;
+
+	for (i = 1; i < n; i++) {
+		int fd;
+		cci__conn_t *sconn = NULL;
+		tcp_conn_t *stconn = NULL;
+		tcp_tx_t *tx = NULL;
 
-	tconn->status = TCP_CONN_PASSIVE2;
+		fd = socket(PF_INET, SOCK_STREAM, 0);
+		if (fd == -1) {
+			debug(CCI_DB_CONN, "%s: socket returned %s",
+				__func__, strerror(errno));
+			break;
+		}
 
-	tcp_parse_handshake(hs, &rx_cnt, &mss, &ka, &ignore);
+		ret = tcp_new_conn(ep, tconn->sin, fd, &sconn);
+		if (ret) {
+			tcp_close_socket(fd);
+			break;
+		}
+		stconn = sconn->priv;
+		sconn->connection.attribute = conn->connection.attribute;
+		sconn->connection.max_send_size = conn->connection.max_send_size;
+		stconn->max_tx_cnt = tconn->max_tx_cnt;
+
+		ret = tcp_setup_fd(ep, sconn);
+		if (!ret) {
+			tx = tcp_get_tx(ep, sconn, 0);
+			if (!tx)
+				ret = CCI_ENOBUFS;
+		}
+		if (ret) {
+			if (tx)
+				tcp_put_tx(tx);
+			tcp_close_socket(fd);
+			free(stconn->rbuf);
+			free(stconn);
+			free(sconn);
+			break;
+		}
 
-	conn->keepalive_timeout = ka;
-	if (mss < conn->connection.max_send_size)
-		conn->connection.max_send_size = mss;
+		tx->msg_type = TCP_MSG_CONN_STREAM;
+		tx->evt.event.type = CCI_EVENT_NONE;
+		tx->len = sizeof(tcp_header_t);
+		tcp_pack_conn_stream(tx->buffer, i, key);
+		tx->state = TCP_TX_QUEUED;
 
-	conn->connection.attribute = attr;
+		pthread_mutex_lock(&ep->lock);
+		queue_conn_locked(ep, sconn);
+		TAILQ_INSERT_TAIL(&stconn->queued, &tx->evt, entry);
+		pthread_mutex_unlock(&ep->lock);
 
-	if (cci_conn_is_reliable(conn)) {
-		tconn->max_tx_cnt = rx_cnt < ep->tx_buf_cnt ?
-				    rx_cnt : ep->tx_buf_cnt;
-	}
+		do {
+			ret = connect(fd, (struct sockaddr *)&tconn->sin,
+					sizeof(tconn->sin));
+		} while (ret && errno == EINTR);
+		if (ret && errno != EINPROGRESS) {
+			debug(CCI_DB_CONN, "%s: connect() returned %s",
+				__func__, strerror(errno));
+			tcp_conn_set_closing(ep, sconn);
+			conn_decref(ep, sconn); /* drop our ref */
+			break;
+		}
 
-	rx->evt.event.type = CCI_EVENT_CONNECT_REQUEST;
-	rx->evt.event.request.attribute = attr;
-	rx->evt.event.request.data_len = len;
-	if (len)
-		rx->evt.event.request.data_ptr = hdr->data + (uintptr_t) sizeof(*hs);
-	else
-		rx->evt.event.request.data_ptr = NULL;
+		/* POLLOUT makes it ready rather than waiting for a reply */
+		pthread_mutex_lock(&ep->lock);
+		stconn->primary = conn;
+		tconn->streams[i] = sconn;
+		pthread_mutex_unlock(&ep->lock);
 
-	/* queue event on endpoint's completed event queue */
+		ret = tcp_watch_conn(ep, sconn);
+		if (ret) {
+			pthread_mutex_lock(&ep->lock);
+			tcp_conn_drop_stream_locked(ep, sconn);
+			pthread_mutex_unlock(&ep->lock);
+			conn_decref(ep, sconn); /* drop our ref */
+			break;
+		}
 
-	debug(CCI_DB_CONN, "%s: recv'd conn request on conn %p", __func__, (void*)conn);
+		conn_decref(ep, sconn); /* drop our ref */
+	}
 
 	pthread_mutex_lock(&ep->lock);
-	TCP_QUEUE_EVT (&ep->evts, &rx->evt, tep);
+	tconn->nstreams = i;
 	pthread_mutex_unlock(&ep->lock);
 
-	return;
-out:
-	tcp_conn_set_closing(ep, conn);
-
-	tcp_put_rx(rx);
+	debug(CCI_DB_CONN, "%s: conn %p uses %u sockets", __func__,
+		(void*)conn, i);
 
 	return;
 }
@@ -2907,8 +3640,7 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	tcp_header_t *hdr = rx->buffer;
 	tcp_handshake_t *hs = (void*)((uintptr_t)rx->buffer + sizeof(*hdr));
 	int reply = a & 0xFF, accepted = 0;
-	uint32_t total = sizeof(*hs);
-	uint32_t rx_cnt, mss, ka, server_tx_id;
+	uint32_t rx_cnt, mss, ka, server_tx_id, streams = 1, key = 0;
 	tcp_tx_t *tx = &tep->txs[tx_id];
 
 	accepted = reply == CCI_SUCCESS ? 1 : 0;
@@ -2925,18 +3657,8 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 		rx->evt.event.connect.connection = NULL;
 
 	if (accepted) {
-		ret = tcp_recv_msg(tconn->pfd->fd, hdr->data, total);
-		if (ret) {
-			/* TODO handle error */
-			debug(CCI_DB_CONN, "%s: recv_msg() failed with %d",
-					__func__, ret);
-			tcp_conn_set_closing(ep, conn);
-			rx->evt.event.connect.status = CCI_ERROR;
-			rx->evt.event.connect.connection = NULL;
-			goto out;
-		}
-
-		tcp_parse_handshake(hs, &rx_cnt, &mss, &ka, &server_tx_id);
+		tcp_parse_handshake(hs, &rx_cnt, &mss, &ka, &server_tx_id,
+				    &streams, &key);
 
 		if (mss < conn->connection.max_send_size)
 			conn->connection.max_send_size = mss;
@@ -2950,10 +3672,6 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 		goto out;
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	tconn->is_busy = 0;
-	pthread_mutex_unlock(&ep->lock);
-
 	tx->msg_type = TCP_MSG_CONN_ACK;
 	tx->rma_op = NULL;
 	tx->rma_ptr = NULL;
@@ -2975,7 +3693,6 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	pthread_mutex_lock(&ep->lock);
 	TAILQ_REMOVE(&tconn->pending, &tx->evt, entry);
 	TAILQ_INSERT_TAIL(&tconn->queued, &tx->evt, entry);
-	tconn->pfd->events = POLLIN | POLLOUT;
 	tconn->status = TCP_CONN_READY;
 	tconn->refcnt++; /* for the calling application */
 	pthread_mutex_unlock(&ep->lock);
@@ -2983,10 +3700,11 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	/* try to progress txs */
 	tcp_progress_conn_sends(ep, conn);
 
+	if (streams > 1 && cci_conn_is_reliable(conn))
+		tcp_open_streams(ep, conn, streams, key);
+
 out:
-	pthread_mutex_lock(&ep->lock);
-	TCP_QUEUE_EVT (&ep->evts, &rx->evt, tep);
-	pthread_mutex_unlock(&ep->lock);
+	TCP_QUEUE_EVT(ep, &rx->evt, tep);
 
 	if (ret) {
 		pthread_mutex_lock(&ep->lock);
@@ -3012,46 +3730,85 @@ tcp_handle_conn_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx, uint32_t tx_
 	debug(CCI_DB_CONN, "%s: recv'd conn_ack from conn %p",
 		__func__, (void*)conn);
 
-	pthread_mutex_lock(&ep->lock);
-	tconn->is_busy = 0;
-	pthread_mutex_unlock(&ep->lock);
-
 	pthread_mutex_lock(&ep->lock);
 	TAILQ_REMOVE(&tconn->pending, &tx->evt, entry);
 	tconn->status = TCP_CONN_READY;
 	tconn->refcnt++; /* for calling the application */
 	/* passive's refcnt goes to conns */
-	TCP_QUEUE_EVT (&ep->evts, &tx->evt, tep);
 	pthread_mutex_unlock(&ep->lock);
 
+	TCP_QUEUE_EVT(ep, &tx->evt, tep);
+
 	debug(CCI_DB_CONN, "%s: conn %p ready", __func__, (void*)conn);
 
 	return;
 }
 
+/* A new socket presented the stream key of a conn we accepted, it
+ * becomes one of the conn's extra data sockets.
+ * Caller has a ref on conn and will release it */
+static void
+tcp_handle_conn_stream(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
+			uint32_t index, uint32_t key)
+{
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn = conn->priv, *ptconn = NULL;
+
+	pthread_mutex_lock(&ep->lock);
+	if (tconn->status == TCP_CONN_PASSIVE1 && key) {
+		TAILQ_FOREACH(ptconn, &tep->conns, entry) {
+			if (ptconn->stream_key == key &&
+				ptconn->status > TCP_CONN_INIT &&
+				index > 0 && index < ptconn->nstreams &&
+				!ptconn->streams[index] &&
+				ptconn->sin.sin_addr.s_addr ==
+				tconn->sin.sin_addr.s_addr)
+				break;
+		}
+	}
+	if (ptconn) {
+		cci__conn_t *pconn = ptconn->conn;
+
+		conn->connection.attribute = pconn->connection.attribute;
+		conn->connection.max_send_size =
+			pconn->connection.max_send_size;
+		tconn->max_tx_cnt = ptconn->max_tx_cnt;
+		tconn->primary = pconn;
+		tconn->status = TCP_CONN_READY;
+		ptconn->streams[index] = conn;
+	} else {
+		tcp_conn_set_closing_locked(ep, conn);
+	}
+	tcp_put_rx_locked(tep, rx);
+	pthread_mutex_unlock(&ep->lock);
+
+	if (ptconn) {
+		debug(CCI_DB_CONN, "%s: conn %p is stream %u of conn %p",
+			__func__, (void*)conn, index, (void*)ptconn->conn);
+	} else {
+		debug(CCI_DB_CONN, "%s: no conn for stream key %u on conn %p",
+			__func__, key, (void*)conn);
+		conn_decref(ep, conn); /* drop list ref */
+	}
+
+	return;
+}
+
 static void
 tcp_handle_send(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 		uint32_t a, uint32_t tx_id)
 {
-	int ret;
 	tcp_conn_t *tconn = conn->priv;
 	tcp_header_t *hdr = rx->buffer;
 	uint32_t len = a & 0xFFFF;
-	uint32_t total = len;
     tcp_ep_t *tep = ep->priv;
 
 	debug(CCI_DB_MSG, "%s: recv'd MSG from conn %p with len %u",
 		__func__, (void*)conn, len);
 
-	ret = tcp_recv_msg(tconn->pfd->fd, hdr->data, total);
-	if (ret) {
-		/* TODO handle error */
-		goto out;
-	}
-
-	pthread_mutex_lock(&ep->lock);
-	tconn->is_busy = 0;
-	pthread_mutex_unlock(&ep->lock);
+	CCI_TRACE(CCI_TRACE_RECV, CCI_TRACE_TP_TCP, conn, tx_id, len);
+	CCI_STAT_ADD(ep, conn, msgs_recv, 1);
+	CCI_STAT_ADD(ep, conn, bytes_recv, len);
 
 	rx->evt.event.type = CCI_EVENT_RECV;
 	if (len)
@@ -3063,12 +3820,8 @@ tcp_handle_send(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 
 	/* queue event on endpoint's completed event queue */
 
-	pthread_mutex_lock(&ep->lock);
-	TCP_QUEUE_EVT(&ep->evts, &rx->evt, tep);
-	pthread_mutex_unlock(&ep->lock);
+	TCP_QUEUE_EVT(ep, &rx->evt, tep);
 
-	ret = CCI_SUCCESS;
-out:
 	if (cci_conn_is_reliable(conn)) {
 		tcp_tx_t *tx = NULL;
 		tcp_header_t *ack;
@@ -3079,41 +3832,34 @@ out:
 		tx->len = sizeof(*ack);
 
 		ack = tx->buffer;
-		tcp_pack_ack(ack, tx_id, ret);
+		tcp_pack_ack(ack, tx_id, CCI_SUCCESS);
 
 		debug(CCI_DB_MSG, "%s: queuing ack for received tx %u", __func__, tx_id);
+		CCI_TRACE(CCI_TRACE_ACK_TX, CCI_TRACE_TP_TCP, conn, tx_id, tx_id);
 
 		tcp_queue_tx(ep, tconn, &tx->evt);
 	}
 
-	/* TODO close conn */
-
 	return;
 }
 
+/* The handles of an RMA write arrived, have tcp_recv_msgs() receive its
+ * payload into the target buffer (or drop it if the handle is not valid)
+ * and call tcp_handle_rma_write_done(). */
 static void
 tcp_handle_rma_write(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 			uint32_t len, uint32_t tx_id)
 {
-	int ret = 0, valid = 1;
+	int ret = 0;
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
-	tcp_tx_t *tx = NULL;
-	tcp_header_t *ack;
-	tcp_rma_header_t *rma_header = rx->buffer; /* need to read more */
-	uint32_t handle_len = 2 * sizeof(rma_header->local);
+	tcp_rma_header_t *rma_header = rx->buffer;
 	uint64_t remote_handle, remote_offset;
 	tcp_rma_handle_t *remote, *h = NULL;
 	void *ptr = NULL;
 
-	debug(CCI_DB_MSG, "%s: recv'ing RMA_WRITE on conn %p with len %u",
-		__func__, (void*)conn, len);
-
-	ret = tcp_recv_msg(tconn->pfd->fd, rma_header->header.data, handle_len);
-	if (ret) {
-		/* TODO handle error */
-		goto out;
-	}
+	debug(CCI_DB_MSG, "%s: recv'ing RMA_WRITE on conn %p with len %u "
+		"(tx %u)", __func__, (void*)conn, len, tx_id);
 
 	tcp_parse_rma_handle_offset(&rma_header->remote, &remote_handle,
 				     &remote_offset);
@@ -3131,47 +3877,39 @@ tcp_handle_rma_write(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 		/* remote is no longer valid, send CCI_ERR_RMA_HANDLE */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_MSG, "%s: remote handle not valid", __func__);
-		valid = 0;
 	} else if (remote_offset > remote->length) {
 		/* offset exceeds remote handle's range, send nak */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_MSG, "%s: remote offset not valid", __func__);
-		valid = 0;
 	} else if ((remote_offset + len) > remote->length) {
 		/* length exceeds remote handle's range, send nak */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_MSG, "%s: remote length not valid", __func__);
-		valid = 0;
+	} else {
+		/* valid remote handle, the data goes to the target buffer */
+		ptr = (void*)((uintptr_t)remote->start + (uintptr_t) remote_offset);
 	}
+	if (ret)
+		debug(CCI_DB_INFO, "%s: dumping %u bytes", __func__, len);
 
-	if (valid) {
-		/* valid remote handle, copy the data */
-		debug(CCI_DB_INFO, "%s: recv'ing data into target buffer", __func__);
-		ptr = (void*)((uintptr_t)remote->start + (uintptr_t) remote_offset);
-		ret = tcp_recv_msg(tconn->pfd->fd, ptr, len);
-		debug(CCI_DB_MSG, "%s: recv'd data into target buffer", __func__);
-		if (ret)
-			debug(CCI_DB_MSG, "%s: recv'ing RMA WRITE payload failed with %s",
-				__func__, strerror(ret));
-	} else {
-		int l = 0;
-		uint32_t offset = 0;
-		char tmp[32];
+	tconn->rx = rx;
+	tconn->rx_rma_ptr = ptr;
+	tconn->rx_rma_len = len;
+	tconn->rx_status = ret;
 
-		debug(CCI_DB_INFO, "%s: dumping %u bytes", __func__, len);
-		do {
-			l = sizeof(tmp);
-			if (l > (int) (len - offset))
-				l = len - offset;
+	return;
+}
 
-			tcp_recv_msg(tconn->pfd->fd, tmp, l);
-			offset += l;
-		} while (offset < len);
-	}
-out:
-	pthread_mutex_lock(&ep->lock);
-	tconn->is_busy = 0;
-	pthread_mutex_unlock(&ep->lock);
+/* The payload of an RMA write was received, ack it */
+static void
+tcp_handle_rma_write_done(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
+			uint32_t tx_id)
+{
+	tcp_conn_t *tconn = conn->priv;
+	tcp_tx_t *tx = NULL;
+	tcp_header_t *ack;
+
+	debug(CCI_DB_MSG, "%s: recv'd data into target buffer", __func__);
 
 	tx = tcp_get_tx(ep, conn, 1);
 
@@ -3179,7 +3917,7 @@ out:
 	tx->len = sizeof(*ack);
 
 	ack = tx->buffer;
-	tcp_pack_ack(ack, tx_id, ret);
+	tcp_pack_ack(ack, tx_id, tconn->rx_status);
 
 	tcp_queue_tx(ep, tconn, &tx->evt);
 
@@ -3192,29 +3930,18 @@ static void
 tcp_handle_rma_read_request(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 			uint32_t len, uint32_t tx_id)
 {
-	int ret;
+	int ret = CCI_SUCCESS;
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
 	tcp_tx_t *tx = NULL;
-	tcp_rma_header_t *read_request = rx->buffer; /* need to read more */
+	tcp_rma_header_t *read_request = rx->buffer;
 	tcp_rma_header_t *read_reply = NULL;
-	uint32_t handle_len = 2 * sizeof(read_request->local);
 	uint64_t local_handle, local_offset, remote_handle, remote_offset;
 	tcp_rma_handle_t *remote, *h = NULL;
 
 	debug(CCI_DB_MSG, "%s: recv'ing RMA_READ_REQUEST on conn %p with len %u",
 		__func__, (void*)conn, len);
 
-	ret = tcp_recv_msg(tconn->pfd->fd, read_request->header.data, handle_len);
-	if (ret) {
-		/* TODO handle error */
-		goto out;
-	}
-
-	pthread_mutex_lock(&ep->lock);
-	tconn->is_busy = 0;
-	pthread_mutex_unlock(&ep->lock);
-
 	tcp_parse_rma_handle_offset(&read_request->local, &local_handle,
 				     &local_offset);
 	tcp_parse_rma_handle_offset(&read_request->remote, &remote_handle,
@@ -3294,91 +4021,120 @@ out:
 	return;
 }
 
+/* The ack of an RMA fragment, or of its completion MSG, arrived on
+ * wire_conn, which is the RMA's conn or one of its extra data sockets.
+ *
+ * Acks of fragments striped over several sockets may be handled by
+ * several threads at once. Which fragment goes next, and whether this
+ * ack completes the RMA, is decided under ep->lock so that each fragment
+ * is sent and the RMA completed exactly once.
+ */
 static void
-tcp_progress_rma(cci__ep_t *ep, cci__conn_t *conn,
+tcp_progress_rma(cci__ep_t *ep, cci__conn_t *wire_conn,
 			tcp_rx_t *rx, uint32_t status, tcp_tx_t *tx)
 {
 	tcp_ep_t *tep = ep->priv;
-	tcp_conn_t *tconn = conn->priv;
-	tcp_rma_op_t *rma_op = tx->rma_op;
-	tcp_msg_type_t msg_type = tx->msg_type;
+	tcp_conn_t *wire = wire_conn->priv;
+	tcp_rma_op_t *rma_op;
+	cci__conn_t *conn;
+	tcp_conn_t *tconn;
+	tcp_msg_type_t msg_type;
+	int i = -1, done = 0, send_msg = 0;
 
 	pthread_mutex_lock(&ep->lock);
-	rma_op->acked = tx->rma_id;
+	if (wire->status <= TCP_CONN_INIT) {
+		/* tcp_conn_set_closing_locked() released the tx and
+		 * failed the RMA */
+		pthread_mutex_unlock(&ep->lock);
+		tcp_put_rx(rx);
+		return;
+	}
+
+	rma_op = tx->rma_op;
+	conn = rma_op->evt.conn;
+	tconn = conn->priv;
+	msg_type = tx->msg_type;
 
 	if (status && (rma_op->evt.event.send.status == CCI_SUCCESS))
 		rma_op->evt.event.send.status = status;
 
-	TAILQ_REMOVE(&tconn->pending, &tx->evt, entry);
-	if ((rma_op->evt.event.send.status && rma_op->pending == 0) ||
-		(tx->rma_id == (rma_op->num_msgs - 1)) ||
-		(rma_op->state == TCP_RMA_MSG_DONE))
+	TAILQ_REMOVE(&wire->pending, &tx->evt, entry);
+	if (msg_type == TCP_MSG_SEND) {
+		/* the completion MSG */
+		rma_op->state = TCP_RMA_MSG_DONE;
+		done = 1;
+	} else {
+		rma_op->acked = tx->rma_id;
+		rma_op->acks++;
+		if (rma_op->evt.event.send.status ||
+			rma_op->acks == rma_op->num_msgs)
+			/* after an error, start no more fragments and
+			 * complete once those in flight are acked */
+			done = rma_op->acks == rma_op->next;
+		else if (rma_op->next < rma_op->num_msgs)
+			i = rma_op->next++;
+	}
+
+	if (done && msg_type != TCP_MSG_SEND && rma_op->msg_ptr &&
+		rma_op->evt.event.send.status == CCI_SUCCESS) {
+		/* FIXME: This sends the completion MSG after the last
+		 * RMA fragment is acked which adds a MSG latency
+		 * on top of the RMA latency. Ideally, we would
+		 * send the MSG just after sending the last
+		 * RMA fragment which would knock off most of
+		 * the MSG latency.
+		 */
+		send_msg = 1;
+		rma_op->state = TCP_RMA_WAITING_MSG;
+		rma_op->tx = tx;
+		tx->offset = 0;
+	} else if (done) {
+		/* last ack, complete the RMA with the tx's reference */
 		rma_op->state = TCP_RMA_ALMOST_DONE;
+		tconn->rma_ops_cnt--;
+		TAILQ_REMOVE(&tep->rma_ops, &rma_op->evt, entry);
+		tcp_rma_op_done_locked(ep, rma_op);
+		tcp_rma_op_decref_locked(rma_op);
+		tcp_put_tx_locked(tep, tx);
+	} else if (i < 0) {
+		/* no more fragments, we don't need this tx anymore */
+		debug(CCI_DB_MSG, "%s: releasing tx %p", __func__, (void*)tx);
+		tcp_rma_op_decref_locked(rma_op);
+		tcp_put_tx_locked(tep, tx);
+	}
 	pthread_mutex_unlock(&ep->lock);
 
-	if (rma_op->state == TCP_RMA_ALMOST_DONE) {
+	if (send_msg) {
 		int ret;
-
-		/* last segment - complete rma */
-
-		/* if error or no completion message, queue now */
-		if (!rma_op->msg_ptr) {
+		struct iovec iov;
+
+		iov.iov_base = rma_op->msg_ptr;
+		iov.iov_len = rma_op->msg_len;
+
+		/* its ack completes the RMA, even a blocking one, here */
+		debug(CCI_DB_MSG, "%s: sending RMA completion MSG ***",
+			__func__);
+		ret = tcp_send_common(&conn->connection,
+					&iov,
+					1,
+					rma_op->evt.event.send.context,
+					rma_op->flags & ~CCI_FLAG_BLOCKING,
+					rma_op);
+		if (ret) {
 			pthread_mutex_lock(&ep->lock);
+			rma_op->evt.event.send.status = ret;
 			tconn->rma_ops_cnt--;
 			TAILQ_REMOVE(&tep->rma_ops, &rma_op->evt, entry);
-			if (!(rma_op->flags & CCI_FLAG_BLOCKING))
-				TCP_QUEUE_EVT(&ep->evts, &rma_op->evt, tep);
-			rma_op->state = TCP_RMA_DONE;
-			pthread_mutex_unlock(&ep->lock);
-			debug(CCI_DB_MSG, "%s: completed %s ***",
-				__func__, tcp_msg_type(msg_type));
-			tcp_put_tx(tx);
-		} else {
-			/* FIXME: This sends the completion MSG after the last
-			 * RMA fragment is acked which adds a MSG latency
-			 * on top of the RMA latency. Ideally, we would
-			 * send the MSG just after sending the last
-			 * RMA fragment which would knock off most of
-			 * the MSG latency.
-			 */
-			struct iovec iov;
-
-			iov.iov_base = rma_op->msg_ptr;
-			iov.iov_len = rma_op->msg_len;
-
-			pthread_mutex_lock(&ep->lock);
-			rma_op->state = TCP_RMA_WAITING_MSG;
-			rma_op->tx = tx;
-			tx->offset = 0;
+			tcp_rma_op_done_locked(ep, rma_op);
+			tcp_rma_op_decref_locked(rma_op);
+			tcp_put_tx_locked(tep, tx);
 			pthread_mutex_unlock(&ep->lock);
-			debug(CCI_DB_MSG, "%s: sending RMA completion MSG ***",
-				__func__);
-			ret = tcp_send_common(&conn->connection,
-						&iov,
-						1,
-						rma_op->evt.event.send.context,
-						rma_op->flags,
-						rma_op);
-			if (ret) {
-				pthread_mutex_lock(&ep->lock);
-				rma_op->evt.event.send.status = ret;
-				tconn->rma_ops_cnt--;
-				TAILQ_REMOVE(&tep->rma_ops, &rma_op->evt, entry);
-				if (!(rma_op->flags & CCI_FLAG_BLOCKING))
-					TCP_QUEUE_EVT(&ep->evts, &rma_op->evt, tep);
-				rma_op->state = TCP_RMA_DONE;
-				pthread_mutex_unlock(&ep->lock);
-				tcp_put_tx(tx);
-			}
 		}
-	} else if (rma_op->next == rma_op->num_msgs) {
-		/* no more fragments, we don't need this tx anymore */
-		debug(CCI_DB_MSG, "%s: releasing tx %p", __func__, (void*)tx);
-		tcp_rma_op_decref(ep, rma_op);
-		tcp_put_tx(tx);
-	} else {
+	} else if (done) {
+		debug(CCI_DB_MSG, "%s: completed %s ***",
+			__func__, tcp_msg_type(msg_type));
+	} else if (i >= 0) {
 		/* send next fragment (or read fragment request) */
-		int i = rma_op->next++;
 		uint64_t offset =
 		    (uint64_t) i * (uint64_t) TCP_RMA_FRAG_SIZE;
 		tcp_rma_header_t *rma_hdr =
@@ -3423,7 +4179,20 @@ tcp_progress_rma(cci__ep_t *ep, cci__conn_t *conn,
 			tx->rma_len = 0;
 		}
 
-		tcp_queue_tx(ep, tconn, &tx->evt);
+		pthread_mutex_lock(&ep->lock);
+		wire = tcp_rma_stream_locked(tconn, rma_op, i);
+		if (wire->status > TCP_CONN_INIT) {
+			TAILQ_INSERT_TAIL(&wire->queued, &tx->evt, entry);
+		} else {
+			/* closed meanwhile, the RMA has failed */
+			tcp_rma_op_decref_locked(rma_op);
+			tcp_put_tx_locked(tep, tx);
+			wire = NULL;
+		}
+		pthread_mutex_unlock(&ep->lock);
+
+		if (wire)
+			tcp_progress_conn_sends(ep, wire->conn);
 	}
 
 	tcp_put_rx(rx);
@@ -3431,30 +4200,23 @@ tcp_progress_rma(cci__ep_t *ep, cci__conn_t *conn,
 	return;
 }
 
+/* The handles of an RMA read reply arrived, have tcp_recv_msgs() receive
+ * its payload into the local buffer (or drop it if the handle is not
+ * valid) and call tcp_handle_rma_read_reply_done(). */
 static void
 tcp_handle_rma_read_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 				uint32_t len, uint32_t tx_id)
 {
-	int ret;
+	int ret = CCI_SUCCESS;
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
-	tcp_rma_header_t *rma_header = rx->buffer; /* need to read more */
-	uint32_t handle_len = 2 * sizeof(rma_header->local);
+	tcp_rma_header_t *rma_header = rx->buffer;
 	uint64_t local_handle, local_offset;
 	tcp_rma_handle_t *local, *h = NULL;
 	void *ptr = NULL;
-	tcp_tx_t *tx = &tep->txs[tx_id];
 
-	debug(CCI_DB_MSG, "%s: recv'ing RMA_READ_REPLY on conn %p with len %u",
-		__func__, (void*)conn, len);
-
-	ret = tcp_recv_msg(tconn->pfd->fd, rma_header->header.data, handle_len);
-	if (ret) {
-		/* TODO handle error */
-		debug(CCI_DB_MSG, "%s: recv_msg() returned %s",
-			__func__, strerror(ret));
-		goto out;
-	}
+	debug(CCI_DB_MSG, "%s: recv'ing RMA_READ_REPLY on conn %p with len %u "
+		"(tx %u)", __func__, (void*)conn, len, tx_id);
 
 	tcp_parse_rma_handle_offset(&rma_header->local, &local_handle,
 				     &local_offset);
@@ -3472,33 +4234,39 @@ tcp_handle_rma_read_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 		/* local is no longer valid, send CCI_ERR_RMA_HANDLE */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_MSG, "%s: local handle not valid", __func__);
-		goto out;
 	} else if (local_offset > local->length) {
 		/* offset exceeds local handle's range, send nak */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_MSG, "%s: local offset not valid", __func__);
-		goto out;
 	} else if ((local_offset + len) > local->length) {
 		/* length exceeds local handle's range, send nak */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_MSG, "%s: local length not valid", __func__);
-		goto out;
+	} else {
+		/* valid local handle, the data goes to the target buffer */
+		ptr = (void*)((uintptr_t)local->start + (uintptr_t) local_offset);
 	}
 
-	/* valid local handle, copy the data */
-	debug(CCI_DB_INFO, "%s: recv'ing data into target buffer", __func__);
-	ptr = (void*)((uintptr_t)local->start + (uintptr_t) local_offset);
-	ret = tcp_recv_msg(tconn->pfd->fd, ptr, len);
+	tconn->rx = rx;
+	tconn->rx_rma_ptr = ptr;
+	tconn->rx_rma_len = len;
+	tconn->rx_status = ret;
+
+	return;
+}
+
+/* The payload of an RMA read reply was received, complete the fragment */
+static void
+tcp_handle_rma_read_reply_done(cci__ep_t *ep, cci__conn_t *conn,
+				tcp_rx_t *rx, uint32_t tx_id)
+{
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn = conn->priv;
+	tcp_tx_t *tx = &tep->txs[tx_id];
+
 	debug(CCI_DB_MSG, "%s: recv'd data into target buffer", __func__);
-	if (ret)
-		debug(CCI_DB_MSG, "%s: recv'ing RMA READ payload failed with %s",
-			__func__, strerror(ret));
-out:
-	pthread_mutex_lock(&ep->lock);
-	tconn->is_busy = 0;
-	pthread_mutex_unlock(&ep->lock);
 
-	tcp_progress_rma(ep, conn, rx, ret, tx);
+	tcp_progress_rma(ep, conn, rx, tconn->rx_status, tx);
 
 	return;
 }
@@ -3510,15 +4278,13 @@ tcp_handle_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
 	tcp_tx_t *tx = &tep->txs[tx_id];
+	cci__evt_t *done = NULL;
 	uint32_t status = a & 0xFF;
 
 	debug(CCI_DB_MSG, "%s: conn %p acked tx %p (%s) with status %u (conn "
 		"status %s)", __func__, (void*)conn, (void*)tx,
 		tcp_msg_type(tx->msg_type), status, tcp_conn_status_str(tconn->status));
-
-	pthread_mutex_lock(&ep->lock);
-	tconn->is_busy = 0;
-	pthread_mutex_unlock(&ep->lock);
+	CCI_TRACE(CCI_TRACE_ACK_RX, CCI_TRACE_TP_TCP, conn, tx_id, tx_id);
 
 	/* If disconnect() called, complete with disconnected */
 	if (tconn->status < TCP_CONN_INIT)
@@ -3526,6 +4292,11 @@ tcp_handle_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 
 	switch (tx->msg_type) {
 	case TCP_MSG_SEND:
+		if (tx->rma_op) {
+			/* the completion MSG of an RMA */
+			tcp_progress_rma(ep, conn, rx, status, tx);
+			break;
+		}
 		tx->evt.event.send.status = status ? CCI_ERR_DISCONNECTED : CCI_SUCCESS;
 		if (status)
 			debug((CCI_DB_MSG|CCI_DB_CONN), "%s: peer reported send completed "
@@ -3535,15 +4306,13 @@ tcp_handle_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 		pthread_mutex_lock(&ep->lock);
 		TAILQ_REMOVE(&tconn->pending, &tx->evt, entry);
 
-		if (tx->rma_op) {
-			tx->rma_op->state = TCP_RMA_MSG_DONE;
-		} else if (!(tx->msg_type == TCP_MSG_CONN_REPLY &&
+		if (!(tx->msg_type == TCP_MSG_CONN_REPLY &&
 			tconn->status == TCP_CONN_CLOSING)) {
 			if (tx->flags & CCI_FLAG_SILENT) {
 				tcp_put_tx_locked(tep, tx);
 			} else {
 				tx->state = TCP_TX_COMPLETED;
-				TCP_QUEUE_EVT(&ep->evts, &tx->evt, tep);
+				done = &tx->evt;
 			}
 		} else {
 			/* We rejected this conn, clean it up */
@@ -3553,8 +4322,8 @@ tcp_handle_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 		}
 		tcp_put_rx_locked(tep, rx);
 		pthread_mutex_unlock(&ep->lock);
-		if (tx->rma_op)
-			tcp_progress_rma(ep, conn, rx, status, tx);
+		if (done)
+			TCP_QUEUE_EVT(ep, done, tep);
 		break;
 	case TCP_MSG_RMA_WRITE:
 	case TCP_MSG_RMA_READ_REQUEST:
@@ -3568,60 +4337,96 @@ tcp_handle_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	return;
 }
 
-static void
-tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
+/* Length of the header and body, which an rx buffers, of the message
+ * starting with hdr. RMA payloads follow and are received apart. */
+static uint32_t
+tcp_msg_len(tcp_header_t *hdr)
 {
-	int ret = CCI_EAGAIN;
-	tcp_conn_t *tconn = conn->priv;
-	tcp_rx_t *rx = NULL;
-	tcp_header_t *hdr = NULL;
-	uint32_t len = sizeof(*hdr);
 	tcp_msg_type_t type;
-	uint32_t a, b;
-	uint32_t q_rx = 0;
-	int dbg = CCI_DB_MSG;
+	uint32_t a, b, len = sizeof(*hdr);
 
-	debug(CCI_DB_MSG, "%s: conn %p recv'd message", __func__, (void*)conn);
+	tcp_parse_header(hdr, &type, &a, &b);
 
-	pthread_mutex_lock(&ep->lock);
-	if (tconn->is_busy) {
-		pthread_mutex_unlock(&ep->lock);
-		return;
+	switch (type) {
+	case TCP_MSG_CONN_REQUEST:
+		len += sizeof(tcp_handshake_t) + ((a >> 4) & 0xFFFF);
+		break;
+	case TCP_MSG_CONN_REPLY:
+		if ((a & 0xFF) == CCI_SUCCESS)
+			len += sizeof(tcp_handshake_t);
+		break;
+	case TCP_MSG_SEND:
+		len += a & 0xFFFF;
+		break;
+	case TCP_MSG_RMA_WRITE:
+	case TCP_MSG_RMA_READ_REQUEST:
+	case TCP_MSG_RMA_READ_REPLY:
+		len += 2 * sizeof(tcp_rma_handle_offset_t);
+		break;
+	default:
+		break;
 	}
-	tconn->is_busy = 1; /* release as soon as the payload is read */
-	pthread_mutex_unlock(&ep->lock);
+	return len;
+}
 
-	rx = tcp_get_rx(ep);
-	if (!rx) {
-		debug(CCI_DB_MSG, "%s: no rxs available", __func__);
-		pthread_mutex_lock(&ep->lock);
-		tconn->is_busy = 0;
-		pthread_mutex_unlock(&ep->lock);
-		/* TODO peek at header, get msg id, send RNR */
-		return;
+/* Move up to len bytes of the stream to ptr, or drop them if ptr is NULL.
+ *
+ * Read-ahead bytes go first. Once they are used up, the socket is read
+ * once: straight into ptr if len does not fit in the read-ahead buffer,
+ * else as much as the buffer holds. *n is set to the bytes moved.
+ *
+ * Returns 0, EAGAIN if the socket had nothing, ECONNRESET if the peer
+ * closed it or the recv() errno.
+ */
+static int
+tcp_conn_read(tcp_conn_t *tconn, void *ptr, uint32_t len, uint32_t *n)
+{
+	uint32_t avail = tconn->rtail - tconn->rhead;
+	ssize_t rc;
+
+	*n = 0;
+
+	if (!avail) {
+		if (ptr && len >= TCP_RBUF_SIZE) {
+			rc = recv(tconn->fd, ptr, len, 0);
+			if (rc <= 0)
+				return rc ? errno : ECONNRESET;
+			*n = (uint32_t) rc;
+			return 0;
+		}
+		tconn->rhead = tconn->rtail = 0;
+		rc = recv(tconn->fd, tconn->rbuf, TCP_RBUF_SIZE, 0);
+		if (rc <= 0)
+			return rc ? errno : ECONNRESET;
+		tconn->rtail = avail = (uint32_t) rc;
 	}
 
-	rx->evt.conn = conn;
-	hdr = rx->buffer;
+	if (avail > len)
+		avail = len;
+	if (ptr)
+		memcpy(ptr, tconn->rbuf + tconn->rhead, avail);
+	tconn->rhead += avail;
+	*n = avail;
 
-	ret = tcp_recv_msg(tconn->pfd->fd, hdr, len);
-	if (ret) {
-		/* TODO handle error */
-		debug(CCI_DB_MSG, "%s: tcp_recv_msg() returned %d (rx=%p hdr=%p)",
-			__func__, ret, (void*)rx, (void*)hdr);
-		q_rx = 1;
-		pthread_mutex_lock(&ep->lock);
-		tconn->is_busy = 0;
-		pthread_mutex_unlock(&ep->lock);
-		tcp_conn_set_closing(ep, conn);
-		goto out;
-	}
+	return 0;
+}
+
+/* Handle a message whose header and body are in rx. The handler owns rx,
+ * RMA handlers leave it in tconn->rx until their payload is received. */
+static void
+tcp_handle_msg(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx)
+{
+	tcp_header_t *hdr = rx->buffer;
+	tcp_msg_type_t type;
+	uint32_t a, b;
+	int dbg = CCI_DB_MSG;
 
 	tcp_parse_header(hdr, &type, &a, &b);
 
 	if (type == TCP_MSG_CONN_REQUEST ||
 		type == TCP_MSG_CONN_REPLY ||
-		type == TCP_MSG_CONN_ACK)
+		type == TCP_MSG_CONN_ACK ||
+		type == TCP_MSG_CONN_STREAM)
 		dbg = CCI_DB_CONN;
 
 	debug(dbg, "%s: msg type %s a=%u b=%u conn=%p",
@@ -3636,6 +4441,7 @@ tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
 		break;
 	case TCP_MSG_CONN_ACK:
 		tcp_handle_conn_ack(ep, conn, rx, b);
+		tcp_put_rx(rx);
 		break;
 	case TCP_MSG_SEND:
 		tcp_handle_send(ep, conn, rx, a, b);
@@ -3643,10 +4449,6 @@ tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
 	case TCP_MSG_ACK:
 		tcp_handle_ack(ep, conn, rx, a, b);
 		break;
-	case TCP_MSG_RNR:
-		break;
-	case TCP_MSG_KEEPALIVE:
-		break;
 	case TCP_MSG_RMA_WRITE:
 		tcp_handle_rma_write(ep, conn, rx, a, b);
 		break;
@@ -3659,17 +4461,216 @@ tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
 	case TCP_MSG_RMA_INVALID:
 		debug(CCI_DB_MSG, "%s: recv'd RMA_INVALID msg on conn %p",
 			__func__, (void*)conn);
+		tcp_put_rx(rx);
+		break;
+	case TCP_MSG_CONN_STREAM:
+		tcp_handle_conn_stream(ep, conn, rx, a, b);
 		break;
 	default:
-		debug(CCI_DB_MSG, "%s: invalid msg type %d", __func__, type);
+		debug(CCI_DB_MSG, "%s: ignoring %s msg", __func__,
+			tcp_msg_type(type));
+		tcp_put_rx(rx);
 		break;
 	}
-out:
-	if (q_rx)
-		tcp_put_rx(rx);
-	return;
 }
 
+/* The RMA payload of the message in rx was received */
+static void
+tcp_handle_rma_done(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx)
+{
+	tcp_msg_type_t type;
+	uint32_t a, b;
+
+	tcp_parse_header(rx->buffer, &type, &a, &b);
+
+	if (type == TCP_MSG_RMA_WRITE)
+		tcp_handle_rma_write_done(ep, conn, rx, b);
+	else
+		tcp_handle_rma_read_reply_done(ep, conn, rx, b);
+}
+
+/* Receive and handle what the socket holds, without blocking.
+ *
+ * A message is received in three steps, each of which may stop when the
+ * socket runs dry and resume on the next call: its header and then its
+ * body into an rx, then the RMA payload, if any, into the target buffer.
+ * Small messages are parsed from the read-ahead buffer, many per recv().
+ *
+ * Caller has set tconn->is_busy. Returns CCI_SUCCESS once the socket is
+ * drained, CCI_ENOBUFS if no rx is available or the error that closed
+ * the conn.
+ */
+static int
+tcp_recv_msgs(cci__ep_t *ep, cci__conn_t *conn)
+{
+	int ret = CCI_SUCCESS;
+	tcp_conn_t *tconn = conn->priv;
+	tcp_rx_t *rx;
+	uint32_t n;
+
+	while (tconn->status > TCP_CONN_INIT) {
+		rx = tconn->rx;
+
+		if (rx && tconn->rx_rma_len) {
+			/* RMA payload */
+			ret = tcp_conn_read(tconn, tconn->rx_rma_ptr,
+					tconn->rx_rma_len, &n);
+			if (ret)
+				break;
+			tconn->rx_rma_len -= n;
+			if (tconn->rx_rma_ptr)
+				tconn->rx_rma_ptr = (void*)((uintptr_t)
+						tconn->rx_rma_ptr + n);
+			continue;
+		}
+		if (rx && rx->offset == tconn->rx_len) {
+			/* RMA payload done */
+			tconn->rx = NULL;
+			tcp_handle_rma_done(ep, conn, rx);
+			continue;
+		}
+
+		if (!rx) {
+			/* a new message, wait for its first byte */
+			if (tconn->rhead == tconn->rtail) {
+				ret = tcp_conn_read(tconn, NULL, 0, &n);
+				if (ret)
+					break;
+			}
+			rx = tcp_get_rx(ep);
+			if (!rx) {
+				/* TODO peek at header, get msg id, send RNR */
+				debug(CCI_DB_MSG, "%s: no rxs available",
+					__func__);
+				ret = CCI_ENOBUFS;
+				break;
+			}
+			rx->evt.conn = conn;
+			rx->offset = 0;
+			tconn->rx = rx;
+			tconn->rx_len = sizeof(tcp_header_t);
+		}
+
+		/* header, then body */
+		ret = tcp_conn_read(tconn, (void*)((uintptr_t)rx->buffer +
+				rx->offset), tconn->rx_len - rx->offset, &n);
+		if (ret)
+			break;
+		rx->offset += n;
+		if (rx->offset < tconn->rx_len)
+			continue;
+
+		if (tconn->rx_len == sizeof(tcp_header_t)) {
+			tconn->rx_len = tcp_msg_len(rx->buffer);
+			if (tconn->rx_len > ep->buffer_len) {
+				debug(CCI_DB_MSG, "%s: conn %p sent a %u bytes "
+					"message", __func__, (void*)conn,
+					tconn->rx_len);
+				ret = CCI_EMSGSIZE;
+				break;
+			}
+			if (rx->offset < tconn->rx_len)
+				continue;
+		}
+
+		tconn->rx = NULL;
+		tcp_handle_msg(ep, conn, rx);
+	}
+
+	if (ret == EAGAIN || ret == EWOULDBLOCK || ret == EINTR) {
+		ret = CCI_SUCCESS;
+	} else if (ret && ret != CCI_ENOBUFS) {
+		debug(CCI_DB_MSG, "%s: conn %p recv failed with %s",
+			__func__, (void*)conn, strerror(ret));
+		tcp_conn_set_closing(ep, conn);
+	}
+
+	return ret;
+}
+
+/* Receive on a conn that is readable.
+ *
+ * Only one thread reads a conn at a time. A thread finding it busy has
+ * the reader try again once done, so that no data is left behind on an
+ * edge-triggered socket.
+ *
+ * Returns CCI_SUCCESS, CCI_EAGAIN if another thread is reading from the
+ * conn, CCI_ENOBUFS if no rx is available or the error that closed it.
+ */
+static int
+tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
+{
+	int ret;
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn = conn->priv;
+
+	pthread_mutex_lock(&ep->lock);
+	if (tconn->is_busy) {
+		tconn->rx_again = 1;
+		pthread_mutex_unlock(&ep->lock);
+		return CCI_EAGAIN;
+	}
+	tconn->is_busy = 1;
+	pthread_mutex_unlock(&ep->lock);
+
+	do {
+		ret = tcp_recv_msgs(ep, conn);
+
+		pthread_mutex_lock(&ep->lock);
+		if (ret == CCI_ENOBUFS && !tconn->is_ready) {
+			/* the socket was not drained, no new edge will report
+			 * it, tcp_recv_ready() resumes it */
+			tconn->is_ready = 1;
+			TAILQ_INSERT_TAIL(&tep->ready, tconn, rentry);
+		}
+		if (tconn->rx_again && ret == CCI_SUCCESS) {
+			tconn->rx_again = 0;
+			ret = CCI_EAGAIN;
+		} else {
+			tconn->rx_again = 0;
+			tconn->is_busy = 0;
+		}
+		pthread_mutex_unlock(&ep->lock);
+	} while (ret == CCI_EAGAIN);
+
+	return ret;
+}
+
+/* Resume reading, up to TCP_EP_POLL_EVENTS of the conns that ran out of
+ * rxs, once some are returned.
+ *
+ * Returns the number of conns read from
+ */
+static int
+tcp_recv_ready(cci__ep_t *ep)
+{
+	int i, cnt = 0;
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn;
+	cci__conn_t *conns[TCP_EP_POLL_EVENTS];
+
+	pthread_mutex_lock(&ep->lock);
+	while (cnt < TCP_EP_POLL_EVENTS && !TAILQ_EMPTY(&tep->ready) &&
+		!TAILQ_EMPTY(&tep->idle_rxs)) {
+		tconn = TAILQ_FIRST(&tep->ready);
+		TAILQ_REMOVE(&tep->ready, tconn, rentry);
+		tconn->is_ready = 0;
+		if (tconn->refcnt < 1 || tconn->status <= TCP_CONN_INIT)
+			continue;
+		tconn->refcnt++;
+		conns[cnt++] = tconn->conn;
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	for (i = 0; i < cnt; i++) {
+		tcp_handle_recv(ep, conns[i]);
+		conn_decref(ep, conns[i]);
+	}
+
+	return cnt;
+}
+
+#ifndef HAVE_SYS_EPOLL_H
 /* Get next conn from tep->conns
  *
  * Caller holds ep->lock
@@ -3717,14 +4718,24 @@ get_conn_locked(cci__ep_t *ep, cci__conn_t **connp)
 	*connp = conn;
 	return ret;
 }
+#endif /* ! HAVE_SYS_EPOLL_H */
 
 /* Caller holds ep->lock */
 static void
-delete_conn_locked(cci__conn_t *conn)
+delete_conn_locked(cci__ep_t *ep, cci__conn_t *conn)
 {
+	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
 
-	assert(tconn->rx == NULL);
+	/* drop a message cut short */
+	if (tconn->rx) {
+		tcp_put_rx_locked(tep, tconn->rx);
+		tconn->rx = NULL;
+	}
+	if (tconn->is_ready) {
+		TAILQ_REMOVE(&tep->ready, tconn, rentry);
+		tconn->is_ready = 0;
+	}
 	assert(TAILQ_EMPTY(&tconn->queued));
 	assert(TAILQ_EMPTY(&tconn->pending));
 	if (tconn->rma_ops_cnt)
@@ -3732,8 +4743,16 @@ delete_conn_locked(cci__conn_t *conn)
 				__func__, (void*)conn, tconn->rma_ops_cnt);
 	//assert(tconn->rma_ops_cnt == 0);
 
+	if (tep->pollers) {
+		/* epoll_wait() may have just returned it, the last poller
+		 * frees it, see tcp_poll_events() */
+		TAILQ_INSERT_TAIL(&tep->dead, tconn, entry);
+		return;
+	}
+
 	free((char *)conn->uri);
 
+	free(tconn->rbuf);
 	free(tconn);
 	free(conn);
 	return;
@@ -3755,7 +4774,7 @@ conn_decref_locked(cci__ep_t *ep, cci__conn_t *conn)
 		debug(CCI_DB_ALL, "%s: conn %p", __func__, (void*)conn);
 		assert(tconn->status < TCP_CONN_INIT);
 		TAILQ_REMOVE(&tep->conns, tconn, entry);
-		delete_conn_locked(conn);
+		delete_conn_locked(ep, conn);
 		goto out;
 	}
     out:
@@ -3772,28 +4791,6 @@ conn_decref(cci__ep_t *ep, cci__conn_t *conn)
 	return;
 }
 
-/* Get the next conn to poll
- *
- * Maybe active, passive, or ready
- * Adds tconn->refcnt for the caller
- *
- * Return CCI_SUCCESS or CCI_EAGAIN
- */
-static int
-get_next_conn(cci__ep_t *ep, cci__conn_t **connp)
-{
-	int ret = CCI_EAGAIN;
-
-	if (ep->closing)
-		goto out;
-
-	pthread_mutex_lock(&ep->lock);
-	ret = get_conn_locked(ep, connp);
-	pthread_mutex_unlock(&ep->lock);
-    out:
-	return ret;
-}
-
 static void
 events(short revents, char *str, int len)
 {
@@ -3839,47 +4836,19 @@ events(short revents, char *str, int len)
 
 #define POLL_EVENTS_LEN	(64)
 
-static int
-tcp_poll_events(cci__ep_t *ep)
+/* Handle the events the progress engine found on a conn
+ *
+ * Caller has a ref on conn
+ */
+static void
+tcp_handle_conn_events(cci__ep_t *ep, cci__conn_t *conn, short revents)
 {
-	int ret = CCI_EAGAIN;
 	char str[POLL_EVENTS_LEN];
 	tcp_ep_t *tep = ep->priv;
-	cci__conn_t *conn = NULL;
-	tcp_conn_t *tconn = NULL;
-	short revents = 0;
-
-	if (!tep)
-		return CCI_ENODEV;
-
-	ret = get_next_conn(ep, &conn);
-	if (ret)
-		return CCI_EAGAIN;
-
-	tconn = conn->priv;
-	/* Note: we have a ref on this conn */
-
-	if (!tconn->is_listener && tconn->status > TCP_CONN_INIT)
-		tconn->pfd->events = POLLIN | POLLOUT;
-
-	/* Another thread may have called disconnect() since we got it above and
-	 * closed the conn's fd. If so, we will get POLLNVAL. */
-	ret = poll(tconn->pfd, 1, 0);
-	if (ret < 1) {
-		if (ret == -1) {
-			ret = errno;
-			debug(CCI_DB_EP, "%s: poll() on conn %p returned %s",
-				__func__, (void*)conn, strerror(ret));
-		} else {
-			ret = CCI_EAGAIN;
-		}
-		goto out;
-	}
-
-	revents = tconn->pfd->revents;
+	tcp_conn_t *tconn = conn->priv;
 
 	events(revents, str, POLL_EVENTS_LEN);
-	debug(CCI_DB_EP, "%s: poll() on conn %p found events %s", __func__,
+	debug(CCI_DB_EP, "%s: conn %p has events %s", __func__,
 		(void*)conn, str);
 
 	if (revents & POLLHUP) {
@@ -3887,10 +4856,23 @@ tcp_poll_events(cci__ep_t *ep)
 		cci__evt_t *evt = NULL;
 		tcp_tx_t *tx = NULL;
 
+		/* the messages the peer sent before hanging up are still
+		 * to be read, the read ends with the hangup */
+		if (revents & POLLIN && old_status == TCP_CONN_READY)
+			tcp_handle_recv(ep, conn);
+
 		/* handle disconnect */
 		debug(CCI_DB_CONN, "%s: got POLLHUP on conn %p (%s) revents (0x%x)",
 			__func__, (void*)conn, tcp_conn_status_str(tconn->status), revents);
 
+		if (tconn->primary && old_status == TCP_CONN_ACTIVE1) {
+			/* an extra data socket that could not connect */
+			pthread_mutex_lock(&ep->lock);
+			tcp_conn_drop_stream_locked(ep, conn);
+			pthread_mutex_unlock(&ep->lock);
+			return;
+		}
+
 		tcp_conn_set_closing(ep, conn);
 
 		switch (old_status) {
@@ -3904,9 +4886,6 @@ tcp_poll_events(cci__ep_t *ep)
 				!TAILQ_EMPTY(&tconn->queued)) {
 				evt = TAILQ_FIRST(&tconn->queued);
 				TAILQ_REMOVE(&tconn->queued, evt, entry);
-				/* If nothing queued, unset POLLOUT */
-				if (0 && TAILQ_EMPTY(&tconn->queued))
-					tconn->pfd->events = POLLIN;
 			} else {
 				evt = TAILQ_FIRST(&tconn->pending);
 				TAILQ_REMOVE(&tconn->pending, evt, entry);
@@ -3915,9 +4894,9 @@ tcp_poll_events(cci__ep_t *ep)
 			evt->event.connect.status = CCI_ETIMEDOUT;
 			tx = container_of(evt, tcp_tx_t, evt);
 			tx->state = TCP_TX_COMPLETED;
-
-			TCP_QUEUE_EVT(&ep->evts, evt, tep);
 			pthread_mutex_unlock(&ep->lock);
+
+			TCP_QUEUE_EVT(ep, evt, tep);
 			break;
 		case TCP_CONN_PASSIVE1:
 		case TCP_CONN_PASSIVE2:
@@ -3935,20 +4914,33 @@ tcp_poll_events(cci__ep_t *ep)
 
 		tcp_conn_set_closed(ep, conn);
 
-		goto out;
+		return;
+	}
+#ifdef TCP_HAVE_ZEROCOPY
+	if (revents & POLLERR) {
+		int err = 0;
+		socklen_t slen = sizeof(err);
+
+		/* zerocopy notifications, which release the held RMAs, are
+		 * not an error. Another thread may have read them first. */
+		tcp_zc_complete(ep, tconn);
+		if (!getsockopt(tconn->fd, SOL_SOCKET, SO_ERROR, &err, &slen) &&
+			!err)
+			revents &= ~POLLERR;
 	}
+#endif
 	if (revents & POLLERR || revents & POLLNVAL) {
 		/* handle error */
 		/* TODO close connection */
 		tcp_conn_set_closing(ep, conn);
-		goto out;
+		return;
 	}
 	if (revents & POLLIN) {
 		if (tconn->is_listener == 1) {
 			/* handle accept */
 			tcp_handle_listen_socket(ep, conn);
 		} else {
-			/* process recv */
+			/* edge-triggered, reads until the socket is drained */
 			tcp_handle_recv(ep, conn);
 		}
 		revents &= ~POLLIN;
@@ -3959,33 +4951,45 @@ tcp_poll_events(cci__ep_t *ep)
 
 		if (tconn->status == TCP_CONN_ACTIVE1) {
     again:
-			rc = getsockopt(tconn->pfd->fd, SOL_SOCKET, SO_ERROR, (void*)pe, &slen);
+			rc = getsockopt(tconn->fd, SOL_SOCKET, SO_ERROR, (void*)pe, &slen);
 			if (rc) {
 				debug(CCI_DB_CONN, "%s: getsockopt() for conn %p (fd %d) "
 					"failed with %s", __func__, (void*)conn,
-					tconn->pfd->fd, strerror(errno));
+					tconn->fd, strerror(errno));
 				if (errno == EBADF) {
 					/* TODO close connection */
 					assert(0);
-					goto out;
+					return;
 				} else if (errno == ENOMEM || errno == ENOBUFS) {
 					goto again;
 				}
 			}
 
 			if (err == 0) {
-				/*  send CONN_REQUEST on new connection */
+				/*  send CONN_REQUEST on new connection, or
+				 *  CONN_STREAM on an extra data socket, which
+				 *  needs no reply */
 				debug(CCI_DB_CONN, "%s: conn %p connect() completed",
 					__func__, (void*)conn);
 				pthread_mutex_lock(&ep->lock);
-				tconn->status = TCP_CONN_ACTIVE2;
-				tconn->pfd->events = POLLIN | POLLOUT;
+				if (tconn->primary)
+					tconn->status = TCP_CONN_READY;
+				else
+					tconn->status = TCP_CONN_ACTIVE2;
+				pthread_mutex_unlock(&ep->lock);
+			} else if (tconn->primary) {
+				debug(CCI_DB_CONN, "%s: conn %p connect() failed "
+					"with %s", __func__, (void*)conn,
+					strerror(err));
+				pthread_mutex_lock(&ep->lock);
+				tcp_conn_drop_stream_locked(ep, conn);
 				pthread_mutex_unlock(&ep->lock);
+				return;
 			} else {
 				/* TODO close connection */
 				assert(0);
 				tcp_conn_set_closing(ep, conn);
-				goto out;
+				return;
 			}
 		}
 		tcp_progress_conn_sends(ep, conn);
@@ -3996,45 +5000,140 @@ tcp_poll_events(cci__ep_t *ep)
 		debug(CCI_DB_WARN, "%s: conn %p has unhandled revents %s",
 			__func__, (void*)conn, str);
 	}
-out:
-	conn_decref(ep, conn);
-	return ret;
+	return;
 }
 
-static void *tcp_progress_thread(void *arg)
+#ifdef HAVE_SYS_EPOLL_H
+/* Wait up to timeout ms and handle the ready conns
+ *
+ * Return CCI_SUCCESS if any conn was ready or CCI_EAGAIN
+ */
+static int
+tcp_poll_events(cci__ep_t *ep, int timeout)
 {
-	cci__ep_t *ep = (cci__ep_t *) arg;
-	tcp_ep_t *tep = NULL;
+	int i, n, cnt, ready;
+	tcp_ep_t *tep = ep->priv;
+	struct epoll_event evs[TCP_EP_POLL_EVENTS];
+	cci__conn_t *conns[TCP_EP_POLL_EVENTS];
+	short revents[TCP_EP_POLL_EVENTS];
 
-	assert (ep);
+	if (!tep)
+		return CCI_ENODEV;
 
-	tep = ep->priv;
+	if (ep->closing)
+		return CCI_EAGAIN;
 
-	while (!ep->closing) {
-		int ret = 0;
-		struct pollfd *fds = NULL;
-		nfds_t nfds = 0;
-		size_t len = 0;
+	/* first the conns whose data is left in their socket */
+	ready = tcp_recv_ready(ep);
 
-		pthread_mutex_lock(&ep->lock);
-		nfds = tep->nfds;
-		len = nfds * sizeof(*fds);
-		fds = malloc(len);
-		if (fds)
-			memcpy(fds, tep->fds, len);
-		pthread_mutex_unlock(&ep->lock);
+	pthread_mutex_lock(&ep->lock);
+	tep->pollers++;
+	if (ready || !TAILQ_EMPTY(&tep->ready))
+		timeout = 0;
+	pthread_mutex_unlock(&ep->lock);
 
-		if (!fds)
-			continue;
+	n = epoll_wait(tep->epfd, evs, TCP_EP_POLL_EVENTS, timeout);
+	if (n == -1 && errno != EINTR)
+		debug(CCI_DB_EP, "%s: epoll_wait() returned %s",
+			__func__, strerror(errno));
+
+	/* A conn released since epoll_wait() returned is not freed until
+	 * we are done here (see delete_conn_locked()), but it is closed. */
+	cnt = 0;
+	pthread_mutex_lock(&ep->lock);
+	for (i = 0; i < n; i++) {
+		tcp_conn_t *tconn = evs[i].data.ptr;
 
-		ret = poll(fds, nfds, 1000);
-		free(fds);
-		if (ret < 1)
+		if (tconn->status <= TCP_CONN_INIT || tconn->refcnt < 1)
 			continue;
+		tconn->refcnt++;
+		conns[cnt] = tconn->conn;
+		revents[cnt++] = (short) evs[i].events;
+	}
+	if (--tep->pollers == 0) {
+		while (!TAILQ_EMPTY(&tep->dead)) {
+			tcp_conn_t *tconn = TAILQ_FIRST(&tep->dead);
+
+			TAILQ_REMOVE(&tep->dead, tconn, entry);
+			delete_conn_locked(ep, tconn->conn);
+		}
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	for (i = 0; i < cnt; i++) {
+		tcp_handle_conn_events(ep, conns[i], revents[i]);
+		conn_decref(ep, conns[i]);
+	}
+
+	return cnt || ready ? CCI_SUCCESS : CCI_EAGAIN;
+}
+#else /* ! HAVE_SYS_EPOLL_H */
+/* Without epoll, poll() up to TCP_EP_POLL_EVENTS conns in turn */
+static int
+tcp_poll_events(cci__ep_t *ep, int timeout)
+{
+	int i, n = 0, cnt;
+	tcp_ep_t *tep = ep->priv;
+	struct pollfd fds[TCP_EP_POLL_EVENTS];
+	cci__conn_t *conns[TCP_EP_POLL_EVENTS];
+
+	if (!tep)
+		return CCI_ENODEV;
+
+	if (ep->closing)
+		return CCI_EAGAIN;
+
+	/* first the conns that ran out of rxs */
+	cnt = tcp_recv_ready(ep);
+
+	pthread_mutex_lock(&ep->lock);
+	while (n < TCP_EP_POLL_EVENTS &&
+		!get_conn_locked(ep, &conns[n])) {
+		tcp_conn_t *tconn = conns[n]->priv;
+
+		if (n && conns[n] == conns[0]) {
+			/* went around */
+			tconn->refcnt--;
+			break;
+		}
+		fds[n].fd = tconn->fd;
+		fds[n].events = tconn->events;
+		fds[n].revents = 0;
+		n++;
+	}
+	if (cnt || !TAILQ_EMPTY(&tep->ready))
+		timeout = 0;
+	pthread_mutex_unlock(&ep->lock);
 
-		tcp_progress_ep(ep);
+	/* do not sleep on a subset of the conns */
+	if (n == TCP_EP_POLL_EVENTS)
+		timeout = 0;
+
+	if (poll(fds, n, timeout) > 0) {
+		for (i = 0; i < n; i++) {
+			if (!fds[i].revents)
+				continue;
+			tcp_handle_conn_events(ep, conns[i], fds[i].revents);
+			cnt++;
+		}
 	}
 
+	for (i = 0; i < n; i++)
+		conn_decref(ep, conns[i]);
+
+	return cnt ? CCI_SUCCESS : CCI_EAGAIN;
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+static void *tcp_progress_thread(void *arg)
+{
+	cci__ep_t *ep = (cci__ep_t *) arg;
+
+	assert (ep);
+
+	while (!ep->closing)
+		tcp_poll_events(ep, 1000);
+
 	pthread_exit(NULL);
 	return (NULL);		/* make pgcc happy */
 }
@@ -109,7 +109,11 @@ cci_plugin_ctp_t cci_ctp_template_plugin = {
 	ctp_template_sendv,
 	ctp_template_rma_register,
 	ctp_template_rma_deregister,
-	ctp_template_rma
+	ctp_template_rma,
+	NULL,			/* get_events, the API loops on get_event */
+	NULL,			/* return_events */
+	NULL,			/* send_batch, the API loops on send */
+	NULL			/* pollset_arm, no pollset support */
 };
 
 static int ctp_template_init(cci_plugin_ctp_t *plugin, uint32_t abi_ver, uint32_t flags, uint32_t * caps)
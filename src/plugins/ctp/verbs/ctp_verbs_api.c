@@ -130,7 +130,11 @@ cci_plugin_ctp_t cci_ctp_verbs_plugin = {
 	ctp_verbs_sendv,
 	ctp_verbs_rma_register,
 	ctp_verbs_rma_deregister,
-	ctp_verbs_rma
+	ctp_verbs_rma,
+	NULL,			/* get_events, the API loops on get_event */
+	NULL,			/* return_events */
+	NULL,			/* send_batch, the API loops on send */
+	NULL			/* pollset_arm, no pollset support */
 };
 
 static uint32_t verbs_mtu_val(enum ibv_mtu mtu)
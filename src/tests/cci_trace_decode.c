@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2013 UT-Battelle, LLC.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Print a trace file written by a CCI library built with --enable-trace.
+ * Records from all threads are merged in timestamp order.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "cci_trace.h"
+
+typedef struct rec {
+	uint64_t thread;
+	cci_trace_rec_t r;
+} rec_t;
+
+static int compare_recs(const void *pa, const void *pb)
+{
+	const rec_t *a = pa, *b = pb;
+
+	if (a->r.ts < b->r.ts)
+		return -1;
+	if (a->r.ts > b->r.ts)
+		return 1;
+	return 0;
+}
+
+static void usage(char *procname)
+{
+	fprintf(stderr, "usage: %s <trace file>\n", procname);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *f = NULL;
+	cci_trace_file_hdr_t fhdr;
+	rec_t *recs = NULL;
+	uint64_t i, num = 0, dropped = 0, t0 = 0;
+	uint32_t r;
+
+	if (argc != 2)
+		usage(argv[0]);
+
+	f = fopen(argv[1], "r");
+	if (!f) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fread(&fhdr, sizeof(fhdr), 1, f) != 1 ||
+	    memcmp(fhdr.magic, CCI_TRACE_MAGIC, sizeof(fhdr.magic))) {
+		fprintf(stderr, "%s is not a CCI trace file\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	if (fhdr.version != CCI_TRACE_VERSION) {
+		fprintf(stderr, "unsupported trace version %u (expected %d)\n",
+			fhdr.version, CCI_TRACE_VERSION);
+		exit(EXIT_FAILURE);
+	}
+
+	for (r = 0; r < fhdr.num_rings; r++) {
+		cci_trace_ring_hdr_t rhdr;
+
+		if (fread(&rhdr, sizeof(rhdr), 1, f) != 1) {
+			fprintf(stderr, "truncated trace file\n");
+			exit(EXIT_FAILURE);
+		}
+
+		recs = realloc(recs, (num + rhdr.count) * sizeof(*recs));
+		if (!recs) {
+			fprintf(stderr, "unable to allocate records\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < rhdr.count; i++) {
+			recs[num + i].thread = rhdr.thread;
+			if (fread(&recs[num + i].r, sizeof(recs[0].r), 1, f) != 1) {
+				fprintf(stderr, "truncated trace file\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		num += rhdr.count;
+		dropped += rhdr.dropped;
+	}
+	fclose(f);
+
+	qsort(recs, num, sizeof(*recs), compare_recs);
+
+	printf("# pid %"PRIu64" threads %u records %"PRIu64" dropped %"PRIu64"\n",
+		fhdr.pid, fhdr.num_rings, num, dropped);
+	printf("# %14s %6s %5s %-8s %18s %18s %18s\n", "time_ns", "thread",
+		"ctp", "event", "arg0", "arg1", "arg2");
+
+	if (num)
+		t0 = recs[0].r.ts;
+
+	for (i = 0; i < num; i++) {
+		cci_trace_rec_t *rec = &recs[i].r;
+
+		printf("%16"PRIu64" %6"PRIu64" %5s %-8s 0x%016"PRIx64" %18"PRIu64
+			" %18"PRIu64"\n", rec->ts - t0, recs[i].thread,
+			cci_trace_tp_str(rec->transport), cci_trace_id_str(rec->id),
+			rec->arg[0], rec->arg[1], rec->arg[2]);
+	}
+
+	free(recs);
+
+	return 0;
+}
@@ -0,0 +1,388 @@
+/*
+ * Copyright © 2012 inria.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+/*
+ * Many-client stream: the client process runs one thread per client, each
+ * with its own endpoint, streaming messages to a single server endpoint.
+ * The server reports the aggregate rate it received. With -k, the client
+ * first opens that many idle connections to the server, to measure how
+ * the server copes with many connections of which few are busy.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "cci.h"
+
+#define CLIENTS     4
+#define MSG_LEN     1024
+#define DURATION    5		/* seconds */
+#define MAX_PENDING 16
+
+/* Globals */
+int is_server = 0;
+int clients = CLIENTS;
+uint32_t msg_len = MSG_LEN;
+int duration = DURATION;
+int in_flight = MAX_PENDING;
+int idle = 0;
+char *name;
+char *server_uri;
+cci_conn_attribute_t attr = CCI_CONN_ATTR_RU;
+
+typedef struct client {
+	pthread_t tid;
+	int id;
+	uint64_t sent;
+	int ret;
+} client_t;
+
+static void print_usage(void)
+{
+	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-n <clients>] "
+		"[-l <len>] [-t <secs>] [-i <in-flight>] [-c <type>] "
+		"[-k <idle>]\n", name);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tServer's URI\n");
+	fprintf(stderr, "\t-s\tSet to run as the server\n");
+	fprintf(stderr, "\t-n\tNumber of clients (client and server, "
+		"default %d)\n", CLIENTS);
+	fprintf(stderr, "\t-l\tMessage length (default %d)\n", MSG_LEN);
+	fprintf(stderr, "\t-t\tSeconds each client streams (default %d)\n",
+		DURATION);
+	fprintf(stderr, "\t-i\tMax number of messages in-flight per client "
+		"(default %d)\n", MAX_PENDING);
+	fprintf(stderr,
+		"\t-c\tConnection type (RU or RO) set by client only\n");
+	fprintf(stderr, "\t-k\tNumber of idle connections the client keeps "
+		"open while streaming (default 0)\n\n");
+	fprintf(stderr, "Example:\n");
+	fprintf(stderr, "server$ %s -s -n 8\n", name);
+	fprintf(stderr, "client$ %s -h sock://foo:2211 -n 8\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static double usecs(struct timeval start, struct timeval end)
+{
+	return ((double)(end.tv_sec - start.tv_sec)) * 1000000.0 +
+	    ((double)(end.tv_usec - start.tv_usec));
+}
+
+static void *client_thread(void *arg)
+{
+	int ret, i, pending = 0, bye = 0;
+	client_t *c = arg;
+	char *buffer = NULL;
+	cci_endpoint_t *endpoint = NULL;
+	cci_connection_t *connection = NULL;
+	cci_event_t *event;
+	struct timeval start, now;
+
+	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "client %d: cci_create_endpoint() failed "
+			"with %s\n", c->id, cci_strerror(NULL, ret));
+		goto out;
+	}
+
+	ret = cci_connect(endpoint, server_uri, NULL, 0, attr, NULL, 0, NULL);
+	if (ret) {
+		fprintf(stderr, "client %d: cci_connect() failed with %s\n",
+			c->id, cci_strerror(endpoint, ret));
+		goto out;
+	}
+
+	while (!connection) {
+		if (cci_get_event(endpoint, &event))
+			continue;
+		if (event->type == CCI_EVENT_CONNECT) {
+			connection = event->connect.connection;
+			if (!connection) {
+				fprintf(stderr, "client %d: connection "
+					"failed\n", c->id);
+				cci_return_event(event);
+				ret = CCI_ERROR;
+				goto out;
+			}
+		}
+		cci_return_event(event);
+	}
+
+	if (msg_len > connection->max_send_size)
+		msg_len = connection->max_send_size;
+	buffer = calloc(1, msg_len);
+	if (!buffer) {
+		ret = CCI_ENOMEM;
+		goto out;
+	}
+	memset(buffer, 'a', msg_len);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < in_flight; i++) {
+		if (cci_send(connection, buffer, msg_len, NULL, 0) == 0)
+			pending++;
+	}
+
+	while (pending || !bye) {
+		if (!pending && !bye) {
+			/* the server counts a 1 byte message as a goodbye */
+			ret = cci_send(connection, "b", 1, NULL, 0);
+			if (ret)
+				goto out;
+			pending++;
+			bye = 1;
+			continue;
+		}
+		if (cci_get_event(endpoint, &event))
+			continue;
+		if (event->type == CCI_EVENT_SEND) {
+			pending--;
+			if (event->send.status == CCI_SUCCESS)
+				c->sent++;
+			gettimeofday(&now, NULL);
+			if (!bye && usecs(start, now) < duration * 1000000.0) {
+				if (cci_send(connection, buffer, msg_len,
+					     NULL, 0) == 0)
+					pending++;
+			}
+		}
+		cci_return_event(event);
+	}
+	/* do not count the goodbye */
+	c->sent--;
+	ret = 0;
+
+out:
+	c->ret = ret;
+	if (endpoint)
+		cci_destroy_endpoint(endpoint);
+	free(buffer);
+	return NULL;
+}
+
+/* Open idle connections from one endpoint and wait until they are all
+ * connected. The endpoint is returned, with the connections, so that they
+ * stay open until the caller destroys it. */
+static cci_endpoint_t *open_idle(void)
+{
+	int ret, i, done = 0, connected = 0;
+	cci_endpoint_t *endpoint = NULL;
+	cci_event_t *event;
+
+	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "idle: cci_create_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		return NULL;
+	}
+
+	for (i = 0; i < idle; i++) {
+		ret = cci_connect(endpoint, server_uri, NULL, 0, attr, NULL,
+				  0, NULL);
+		if (ret) {
+			fprintf(stderr, "idle: cci_connect() failed with %s\n",
+				cci_strerror(endpoint, ret));
+			break;
+		}
+	}
+
+	while (done < i) {
+		if (cci_get_event(endpoint, &event))
+			continue;
+		if (event->type == CCI_EVENT_CONNECT) {
+			done++;
+			if (event->connect.connection)
+				connected++;
+		}
+		cci_return_event(event);
+	}
+
+	printf("%d idle connections open\n", connected);
+	return endpoint;
+}
+
+static void do_client(void)
+{
+	int i;
+	uint64_t sent = 0;
+	client_t *c;
+	cci_endpoint_t *idle_ep = NULL;
+
+	c = calloc(clients, sizeof(*c));
+	if (!c) {
+		fprintf(stderr, "unable to alloc clients\n");
+		return;
+	}
+
+	if (idle)
+		idle_ep = open_idle();
+
+	for (i = 0; i < clients; i++) {
+		c[i].id = i;
+		pthread_create(&c[i].tid, NULL, client_thread, &c[i]);
+	}
+	for (i = 0; i < clients; i++) {
+		pthread_join(c[i].tid, NULL);
+		if (c[i].ret == 0)
+			sent += c[i].sent;
+	}
+
+	printf("%d clients sent %" PRIu64 " messages of %u bytes\n",
+	       clients, sent, msg_len);
+	if (idle_ep)
+		cci_destroy_endpoint(idle_ep);
+	free(c);
+}
+
+static void do_server(void)
+{
+	int ret, byes = 0, started = 0, conns = 0;
+	uint64_t recv = 0, bytes = 0;
+	double secs;
+	cci_endpoint_t *endpoint = NULL;
+	cci_event_t *event;
+	char *uri = NULL;
+	struct timeval start, end;
+
+	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "cci_create_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_get_opt(endpoint, CCI_OPT_ENDPT_URI, &uri);
+	if (ret) {
+		fprintf(stderr, "cci_get_opt() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+	printf("Opened %s\n", uri);
+	free(uri);
+
+	while (byes < clients) {
+		if (cci_get_event(endpoint, &event))
+			continue;
+		switch (event->type) {
+		case CCI_EVENT_CONNECT_REQUEST:
+			if (cci_accept(event, NULL) == 0)
+				conns++;
+			break;
+		case CCI_EVENT_RECV:
+			if (event->recv.len == 1) {
+				byes++;
+				break;
+			}
+			if (!started) {
+				gettimeofday(&start, NULL);
+				started = 1;
+			}
+			recv++;
+			bytes += event->recv.len;
+			break;
+		default:
+			break;
+		}
+		cci_return_event(event);
+	}
+	gettimeofday(&end, NULL);
+
+	secs = started ? usecs(start, end) / 1000000.0 : 0.0;
+	printf("%d clients (%d conns): %" PRIu64 " messages in %.3f s, "
+	       "%.0f msgs/s, %.2f MB/s\n", clients, conns, recv, secs,
+	       secs > 0.0 ? recv / secs : 0.0,
+	       secs > 0.0 ? bytes / secs / 1000000.0 : 0.0);
+
+	cci_destroy_endpoint(endpoint);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret, c;
+	uint32_t caps = 0;
+
+	name = argv[0];
+
+	while ((c = getopt(argc, argv, "h:sn:l:t:i:c:k:")) != -1) {
+		switch (c) {
+		case 'h':
+			server_uri = strdup(optarg);
+			break;
+		case 's':
+			is_server = 1;
+			break;
+		case 'n':
+			clients = strtol(optarg, NULL, 0);
+			if (clients < 1)
+				print_usage();
+			break;
+		case 'l':
+			msg_len = strtoul(optarg, NULL, 0);
+			if (msg_len < 2)
+				print_usage();
+			break;
+		case 't':
+			duration = strtol(optarg, NULL, 0);
+			break;
+		case 'i':
+			in_flight = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			if (strncasecmp("ru", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_RU;
+			else if (strncasecmp("ro", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_RO;
+			else
+				print_usage();
+			break;
+		case 'k':
+			idle = strtol(optarg, NULL, 0);
+			if (idle < 0)
+				print_usage();
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (!is_server && !server_uri) {
+		fprintf(stderr, "Must select -h or -s\n");
+		print_usage();
+	}
+
+	ret = cci_init(CCI_ABI_VERSION, 0, &caps);
+	if (ret) {
+		fprintf(stderr, "cci_init() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	if (is_server)
+		do_server();
+	else
+		do_client();
+
+	ret = cci_finalize();
+	if (ret) {
+		fprintf(stderr, "cci_finalize() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+	free(server_uri);
+
+	return 0;
+}
@@ -29,6 +29,8 @@ cci_alignment_t alignment;
 int align = -1;
 int get_uri = -1;
 char *uri = NULL;
+int get_stats = -1;
+cci_stats_t stats;
 
 cci_opt_handle_t *handle;
 
@@ -44,7 +46,7 @@ static void check_return(char *func, cci_endpoint_t *endpoint, int ret)
 static void usage(void)
 {
 	printf("usage: %s [-G | -S] [-t[<usecs>]] [-r[<count>]] [-s[<count>]] "
-	       "[-k[<usecs>]] [-a]\n", proc_name);
+	       "[-k[<usecs>]] [-a] [-u] [--stats]\n", proc_name);
 	printf("where:\n");
 	printf("\t--get,-G\tGet value. If no other options set, get all options.\n");
 	printf("\t--set,-S\tSet value. Requires at least one option and its value.\n");
@@ -56,6 +58,7 @@ static void usage(void)
 	printf("\t--keepalive,-k\tKeepalive timeout in microsconds (us).\n");
 	printf("\t--align,-a\tRMA Alignment values.\n");
 	printf("\t--uri,-u\tEndpoint's URI.\n");
+	printf("\t--stats\tEndpoint's performance counters.\n");
 	printf ("Note: There are no spaces between option flags and optional values.\n");
 	exit(EXIT_FAILURE);
 }
@@ -64,7 +67,7 @@ static void test(cci_endpoint_t *endpoint, cci_opt_name_t name)
 {
 	int ret;
 	uint32_t tmpval;
-	void *oldval, *newval;
+	void *oldval = NULL, *newval = NULL;
 
 	switch (name) {
 	case CCI_OPT_ENDPT_SEND_TIMEOUT:
@@ -85,15 +88,31 @@ static void test(cci_endpoint_t *endpoint, cci_opt_name_t name)
 	case CCI_OPT_ENDPT_URI:
 		oldval = &uri; /* no newval */
 		break;
+	case CCI_OPT_ENDPT_STATS:
+		stats.version = CCI_STATS_VERSION;
+		oldval = &stats; /* no newval */
+		break;
 	default:
 		printf("unknown option\n");
-		break;
+		return;
 	}
 
 	ret = cci_get_opt(handle, name, oldval);
 	printf("\tcci_get_opt() returned %s\n", cci_strerror(endpoint, ret));
 
-	if (ret == CCI_SUCCESS) {
+	if (ret == CCI_SUCCESS && CCI_OPT_ENDPT_STATS == name) {
+		printf("\tmsgs_sent = %"PRIu64"\n", stats.msgs_sent);
+		printf("\tbytes_sent = %"PRIu64"\n", stats.bytes_sent);
+		printf("\tmsgs_recv = %"PRIu64"\n", stats.msgs_recv);
+		printf("\tbytes_recv = %"PRIu64"\n", stats.bytes_recv);
+		printf("\tresends = %"PRIu64"\n", stats.resends);
+		printf("\trnr = %"PRIu64"\n", stats.rnr);
+		printf("\tno_bufs = %"PRIu64"\n", stats.no_bufs);
+		printf("\tpartial_sends = %"PRIu64"\n", stats.partial_sends);
+		printf("\tring_full = %"PRIu64"\n", stats.ring_full);
+		printf("\tqueued = %u\n", stats.queued);
+		printf("\tpending = %u\n", stats.pending);
+	} else if (ret == CCI_SUCCESS) {
 		if (CCI_OPT_ENDPT_RMA_ALIGN != name) {
 			if (CCI_OPT_ENDPT_URI == name) {
 				printf("\t(uri = %s)\n\n", uri);
@@ -143,6 +162,7 @@ int main(int argc, char *argv[])
 		{ "keepalive",	optional_argument,	NULL,		'k' },
 		{ "align",	no_argument,		&align,		 1  },
 		{ "uri",	no_argument,		&get_uri,	 1  },
+		{ "stats",	no_argument,		&get_stats,	 1  },
 		{ NULL,		0,			NULL,		 0  }
 	};
 
@@ -202,10 +222,11 @@ int main(int argc, char *argv[])
 	    (tx_buf_cnt == (uint32_t) - 1) &&
 	    (keepalive == (uint32_t) - 1) &&
 	    (align == -1 &&
-	     get_uri == -1)) {
+	     get_uri == -1 &&
+	     get_stats == -1)) {
 		if (get) {
 			tx_timeout = rx_buf_cnt = tx_buf_cnt = keepalive = 0;
-			align = get_uri = 1;
+			align = get_uri = get_stats = 1;
 		} else {
 			printf("Set requires an option and value to set");
 			usage();
@@ -252,6 +273,15 @@ int main(int argc, char *argv[])
 		test(endpoint, CCI_OPT_ENDPT_URI);
 	}
 
+	if (get_stats != -1) {
+		if (set) {
+			printf("CCI_OPT_ENDPT_STATS is get only\n");
+			usage();
+		}
+		printf("Testing CCI_OPT_ENDPT_STATS\n");
+		test(endpoint, CCI_OPT_ENDPT_STATS);
+	}
+
 	ret = cci_destroy_endpoint(endpoint);
 	check_return("cci_destroy_endpoint", endpoint, ret);
 
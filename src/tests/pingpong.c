@@ -49,10 +49,12 @@ uint32_t rmt_comp_len = 0;
 cci_os_handle_t fd = 0;
 int ignore_os_handle = 0;
 int blocking = 0;
+cci_pollset_t *pollset = NULL;
 int nfds = 0;
 fd_set rfds;
 int attempts = 0;
 char *service = NULL;
+int ep_flags = 0;
 
 typedef struct options {
 	struct cci_rma_handle rma_handle;
@@ -70,9 +72,9 @@ options_t opts;
 static void print_usage(void)
 {
 	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-i <iters>] "
-		"[-W <warmup>] [-c <type>] [-n] [-b|-o]"
+		"[-W <warmup>] [-c <type>] [-n] [-b|-o|-P]"
 		"[[-w | -r] [-m <max_rma_size> [-C]]] "
-		"[-S <service>]\n", name);
+		"[-S <service>] [-H]\n", name);
 	fprintf(stderr, "where:\n");
 	fprintf(stderr, "\t-h\tServer's URI\n");
 	fprintf(stderr, "\t-s\tSet to run as the server\n");
@@ -88,7 +90,10 @@ static void print_usage(void)
 	fprintf(stderr, "\t-C\tSend RMA remote completion message\n");
 	fprintf(stderr, "\t-b\tBlock using the OS handle instead of polling\n");
 	fprintf(stderr, "\t-o\tGet OS handle but don't use it\n");
-	fprintf(stderr, "\t-S\tSpecify a service hint for cci_create_endpoint_at()\n\n");
+	fprintf(stderr, "\t-P\tBlock in a cci_pollset instead of polling\n");
+	fprintf(stderr, "\t-S\tSpecify a service hint for cci_create_endpoint_at()\n");
+	fprintf(stderr, "\t-H\tUse shared memory for peers on the same host "
+		"(CCI_EP_FLAG_HYBRID)\n\n");
 	fprintf(stderr, "Example:\n");
 	fprintf(stderr, "server$ %s -h ip://foo -p 2211 -s\n", name);
 	fprintf(stderr, "client$ %s -h ip://foo -p 2211\n", name);
@@ -113,6 +118,14 @@ wait_for_event(void)
 {
 	int ret = 0;
 
+	if (pollset) {
+		cci_endpoint_t *ready = NULL;
+		uint32_t n = 0;
+
+		ret = cci_pollset_wait(pollset, &ready, 1, &n, -1);
+		return ret ? -1 : 0;
+	}
+
 	FD_ZERO(&rfds);
 	FD_SET(fd, &rfds);
 
@@ -556,7 +569,7 @@ int main(int argc, char *argv[])
 
 	name = argv[0];
 
-	while ((c = getopt(argc, argv, "h:sRc:nwrm:Ci:W:boS:")) != -1) {
+	while ((c = getopt(argc, argv, "h:sRc:nwrm:Ci:W:boPS:H")) != -1) {
 		switch (c) {
 		case 'h':
 			server_uri = strdup(optarg);
@@ -609,11 +622,17 @@ int main(int argc, char *argv[])
 			ignore_os_handle = 1;
 			os_handle = &fd;
 			break;
+		case 'P':
+			blocking = 2;
+			break;
 		case 'S':
 			service = strdup(optarg);
 			if (!service)
 				fprintf(stderr, "strdup(service) failed.\n");
 			break;
+		case 'H':
+			ep_flags |= CCI_EP_FLAG_HYBRID;
+			break;
 		default:
 			print_usage();
 		}
@@ -624,6 +643,11 @@ int main(int argc, char *argv[])
 		print_usage();
 	}
 
+	if (blocking == 2 && os_handle) {
+		fprintf(stderr, "-P does not use the OS handle, drop -b or -o.\n");
+		print_usage();
+	}
+
 	if (blocking && ignore_os_handle) {
 		fprintf(stderr, "-b and -o are not compatible.\n");
 		fprintf(stderr, "-b will block using select() using the OS handle.\n");
@@ -669,9 +693,9 @@ int main(int argc, char *argv[])
 				__func__, cci_strerror(NULL, ret));
 		}
 
-		ret = cci_create_endpoint_at(devices[0], service, 0, &endpoint, os_handle);
+		ret = cci_create_endpoint_at(devices[0], service, ep_flags, &endpoint, os_handle);
 	} else {
-		ret = cci_create_endpoint(NULL, 0, &endpoint, os_handle);
+		ret = cci_create_endpoint(NULL, ep_flags, &endpoint, os_handle);
 	}
 	if (ret) {
 		fprintf(stderr, "cci_create_endpoint() failed with %s (%d)\n",
@@ -687,7 +711,16 @@ int main(int argc, char *argv[])
 	}
 	printf("Opened %s\n", uri);
 
-	if (blocking) {
+	if (blocking == 2) {
+		ret = cci_pollset_create(&pollset);
+		if (!ret)
+			ret = cci_pollset_add(pollset, endpoint);
+		if (ret) {
+			fprintf(stderr, "cci_pollset_*() failed with %s\n",
+				cci_strerror(endpoint, ret));
+			exit(EXIT_FAILURE);
+		}
+	} else if (blocking) {
 		nfds = fd + 1;
 		FD_ZERO(&rfds);
 		FD_SET(fd, &rfds);
@@ -699,6 +732,9 @@ int main(int argc, char *argv[])
 		do_client();
 
 	/* clean up */
+	if (pollset)
+		cci_pollset_destroy(pollset);
+
 	ret = cci_destroy_endpoint(endpoint);
 	if (ret) {
 		fprintf(stderr, "cci_destroy_endpoint() failed with %s\n",
@@ -32,9 +32,11 @@ static void check_return(cci_endpoint_t *endpoint, char *func, int ret)
 static void usage(char *name)
 {
 	printf
-	    ("usage: %s [-d] [-f] [-o <offset>] [-s <size>] [-t <total_allocation>]\n",
+	    ("usage: %s [-c] [-d] [-f] [-o <offset>] [-s <size>] [-t <total_allocation>]\n",
 	     name);
 	printf("where:\n");
+	printf("\t-c\tEnable the registration cache and also measure "
+	       "cache hits\n");
 	printf("\t-d\tMeasure deregister (default is register)\n");
 	printf
 	    ("\t-f\tPre-fault pages (default is unfaulted - malloc() only)\n");
@@ -49,7 +51,7 @@ static void usage(char *name)
 int main(int argc, char *argv[])
 {
 	int c, ret;
-	int dereg = 0, prefault = 0;
+	int dereg = 0, prefault = 0, cache = 0, pass;
 	uint32_t pagesize = 0, offset = 0;
 	uint64_t regsize = REGSIZE, totalsize = TOTALSIZE, count, i;
 	uint32_t caps;
@@ -59,12 +61,15 @@ int main(int argc, char *argv[])
 	uint64_t length;
 	cci_rma_handle_t **handles = NULL;
 	struct timeval start, end;
-	uint64_t usecs = 0;
+	uint64_t usecs[2] = { 0, 0 };
 
 	pagesize = sysconf(_SC_PAGESIZE);
 
-	while ((c = getopt(argc, argv, "dfo:s:t:")) != -1) {
+	while ((c = getopt(argc, argv, "cdfo:s:t:")) != -1) {
 		switch (c) {
+		case 'c':
+			cache = 1;
+			break;
 		case 'd':
 			dereg = 1;
 			break;
@@ -116,7 +121,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	ret = cci_init(CCI_ABI_VERSION, 0, &caps);
+	ret = cci_init(CCI_ABI_VERSION, cache ? CCI_INIT_FLAG_REG_CACHE : 0,
+		       &caps);
 	check_return(NULL, "cci_init", ret);
 
 	ret = cci_get_devices(&devices);
@@ -125,38 +131,49 @@ int main(int argc, char *argv[])
 	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
 	check_return(NULL, "cci_create_endpoint", ret);
 
-	/* register */
-	if (!dereg)
-		gettimeofday(&start, NULL);
+	/* the second pass finds every registration in the cache */
+	for (pass = 0; pass < 1 + cache; pass++) {
+		/* register */
+		if (!dereg)
+			gettimeofday(&start, NULL);
 
-	for (i = 0; i < count; i++) {
-		void *p = (void*)((uintptr_t)ptr + ((uintptr_t) i * (uintptr_t)length));
+		for (i = 0; i < count; i++) {
+			void *p = (void*)((uintptr_t)ptr + ((uintptr_t) i * (uintptr_t)length));
 
-		ret = cci_rma_register(endpoint, p, length, CCI_FLAG_READ|CCI_FLAG_WRITE, &handles[i]);
-		check_return(endpoint, "cci_rma_register", ret);
-	}
+			ret = cci_rma_register(endpoint, p, length, CCI_FLAG_READ|CCI_FLAG_WRITE, &handles[i]);
+			check_return(endpoint, "cci_rma_register", ret);
+		}
 
-	if (!dereg)
-		gettimeofday(&end, NULL);
+		if (!dereg)
+			gettimeofday(&end, NULL);
 
-	/* deregister */
-	if (dereg)
-		gettimeofday(&start, NULL);
+		/* deregister */
+		if (dereg)
+			gettimeofday(&start, NULL);
 
-	for (i = 0; i < count; i++) {
-		ret = cci_rma_deregister(endpoint, handles[i]);
-		check_return(endpoint, "cci_rma_register", ret);
-	}
+		for (i = 0; i < count; i++) {
+			ret = cci_rma_deregister(endpoint, handles[i]);
+			check_return(endpoint, "cci_rma_register", ret);
+		}
+
+		if (dereg)
+			gettimeofday(&end, NULL);
 
-	if (dereg)
-		gettimeofday(&end, NULL);
+		usecs[pass] = (end.tv_sec - start.tv_sec) * 1000000 +
+		    end.tv_usec - start.tv_usec;
+	}
 
-	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
-	    end.tv_usec - start.tv_usec;
 	printf("%10s%10s%10s%10s\n", "RegSize", "Count", "usecs", "us/page");
 	printf("%10" PRIu64 "%10" PRIu64 "%10" PRIu64 "%10.2f\n",
-	       regsize, count, usecs,
-	       ((double)usecs / (double) count) / ((double)regsize / (double)pagesize));
+	       regsize, count, usecs[0],
+	       ((double)usecs[0] / (double) count) / ((double)regsize / (double)pagesize));
+	if (cache)
+		printf("%10s%10" PRIu64 "%10" PRIu64 "%10.2f  (cache hits, "
+		       "%.3f us/registration vs %.3f cold)\n", "",
+		       count, usecs[1],
+		       ((double)usecs[1] / (double) count) / ((double)regsize / (double)pagesize),
+		       (double)usecs[1] / (double) count,
+		       (double)usecs[0] / (double) count);
 
 	ret = cci_destroy_endpoint(endpoint);
 	check_return(endpoint, "cci_destroy_endpoint", ret);
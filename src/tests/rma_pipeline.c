@@ -53,6 +53,7 @@ void *rmt_comp_msg = NULL;
 uint32_t rmt_comp_len = 0;
 cci_os_handle_t fd = 0;
 int blocking = 0;
+int aggregate = 0;
 int nfds = 0;
 fd_set rfds;
 struct timeval start, end;
@@ -74,7 +75,7 @@ static void print_usage(void)
 {
 	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-i <iters>] "
 		"[-W <window>] [-c <type>] [-n] "
-		"[[-w | -r] [-m <max_rma_size> [-C]]]\n", name);
+		"[[-w | -r] [-m <max_rma_size> [-C]]] [-a]\n", name);
 	fprintf(stderr, "where:\n");
 	fprintf(stderr, "\t-h\tServer's URI\n");
 	fprintf(stderr, "\t-s\tSet to run as the server\n");
@@ -88,7 +89,10 @@ static void print_usage(void)
 	fprintf(stderr, "\t-r\tUse RMA READ\n");
 	fprintf(stderr, "\t-m\tTest RMA messages up to max_rma_size\n");
 	fprintf(stderr, "\t-C\tSend RMA remote completion message\n");
-	fprintf(stderr, "\t-b\tBlock using the OS handle instead of polling\n\n");
+	fprintf(stderr, "\t-b\tBlock using the OS handle instead of polling\n");
+	fprintf(stderr, "\t-a\tStream max_rma_size RMAs for the iterations and report\n"
+			"\t\tthe aggregate bandwidth of the connection (all rails\n"
+			"\t\tor tcp streams)\n\n");
 	fprintf(stderr, "Example:\n");
 	fprintf(stderr, "server$ %s -h ip://foo -p 2211 -s\n", name);
 	fprintf(stderr, "client$ %s -h ip://foo -p 2211\n", name);
@@ -178,6 +182,51 @@ static double usecs(struct timeval start, struct timeval end)
 	    ((double)(end.tv_usec - start.tv_usec));
 }
 
+/* Keep the window full of size-byte RMAs until iters complete and
+ * report the total over the elapsed time. With a multi-rail device, or
+ * a tcp device striping RMAs over several streams, this is what all
+ * rails or sockets sustained together. */
+static void run_aggregate(uint32_t size)
+{
+	int ret;
+	double secs = 0.0, bw = 0.0;
+	cci_device_t *device = endpoint->device;
+
+	current_size = size;
+	pipeline_depth = window / size;
+	if (pipeline_depth < 1)
+		pipeline_depth = 1;
+	if (pipeline_depth > iters)
+		pipeline_depth = iters;
+
+	gettimeofday(&start, NULL);
+
+	for (count = 0; count < pipeline_depth; count++) {
+		ret = cci_rma(connection, rmt_comp_msg, rmt_comp_len,
+				local_rma_handle, 0,
+				&opts.rma_handle, 0,
+				current_size, (void *)1, opts.flags);
+		check_return(endpoint, "cci_rma", ret, 1);
+	}
+
+	while (comp < iters)
+		poll_events();
+
+	gettimeofday(&end, NULL);
+
+	secs = usecs(start, end) / 1000000.0;
+	bw = (double)size * comp / usecs(start, end);
+
+	printf("%s (%s): %d x %u bytes in %.3f s, %.2f MB/s aggregate",
+	       device->name, device->transport, comp, size, secs, bw);
+	if (device->rate)
+		printf(", link rate %.2f MB/s",
+		       (double)device->rate / 8.0 / 1000000.0);
+	printf(" (depth %d)\n", pipeline_depth);
+
+	comp = 0;
+}
+
 static void do_client(void)
 {
 	int ret;
@@ -242,6 +291,11 @@ static void do_client(void)
 		rmt_comp_len = 4;
 	}
 
+	if (aggregate) {
+		run_aggregate(max);
+		goto out;
+	}
+
 	printf("Bytes\t\t    Time\t\t  Throughput\t   Depth    Iters\n");
 
 	/* begin communication with server */
@@ -284,6 +338,7 @@ static void do_client(void)
 
 	}
 
+    out:
 	ret = cci_send(connection, "bye", 3, (void *)0xdeadbeef, opts.flags);
 	check_return(endpoint, "cci_send", ret, 0);
 
@@ -378,7 +433,7 @@ int main(int argc, char *argv[])
 
 	name = argv[0];
 
-	while ((c = getopt(argc, argv, "h:sRc:nwrm:Ci:d:W:b")) != -1) {
+	while ((c = getopt(argc, argv, "h:sRc:nwrm:Ci:d:W:ba")) != -1) {
 		switch (c) {
 		case 'h':
 			server_uri = strdup(optarg);
@@ -430,6 +485,9 @@ int main(int argc, char *argv[])
 			blocking = 1;
 			os_handle = &fd;
 			break;
+		case 'a':
+			aggregate = 1;
+			break;
 		default:
 			print_usage();
 		}
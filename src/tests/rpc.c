@@ -52,6 +52,7 @@ cci_rma_handle_t *local;
 cci_rma_handle_t *remote;
 int attempt = 1;
 int suppress = 0;
+int aggregate = 0;
 int *msg = NULL;
 
 #ifdef USE_MPI
@@ -74,7 +75,7 @@ static void print_usage(void)
 {
 	fprintf(stderr, "usage: %s [-h <server_uri> | [-s]] "
 			"[-i <iters>] [-W <warmup>] [-w | -r] "
-			"-R <request_size> -T <transfer_size> -A <ack_size>\n", name);
+			"-R <request_size> -T <transfer_size> -A <ack_size> [-a]\n", name);
 	fprintf(stderr, "where:\n");
 	fprintf(stderr, "\t-h\tServer's URI (if not using MPI)\n");
 	fprintf(stderr, "\t-s\tSet to run as the server (if not using MPI)\n");
@@ -89,6 +90,8 @@ static void print_usage(void)
 	fprintf(stderr, "\t-T\tTransfer size (RMA read or write)\n");
 	fprintf(stderr, "\t-A\tAck size (client <- server)\n");
 	fprintf(stderr, "\t-S\tSuppress output header\n");
+	fprintf(stderr, "\t-a\tAlso report the aggregate bandwidth of all RPC traffic\n"
+			"\t\t(requests, transfers and acks) on the device (all rails)\n");
 	exit(EXIT_FAILURE);
 }
 
@@ -281,6 +284,20 @@ static void do_client(void)
 	bw = (double)opts.transfer_size / lat;
 	printf("%8d\t%8.2f us\t\t%8.2f MB/s\n", opts.transfer_size, lat, bw);
 
+	if (aggregate) {
+		cci_device_t *device = endpoint->device;
+		double bytes = (double)opts.iters *
+			(opts.req_size + opts.transfer_size + opts.ack_size);
+
+		printf("%s (%s): %.2f MB/s aggregate with %d concurrent",
+		       device->name, device->transport,
+		       bytes / usecs(start, end), concurrent);
+		if (device->rate)
+			printf(", link rate %.2f MB/s",
+			       (double)device->rate / 8.0 / 1000000.0);
+		printf("\n");
+	}
+
 	ret = cci_send(connection, "bye", 3, (void *)0xdeadbeef, 0);
 	check_return(endpoint, "cci_send", ret, 1);
 
@@ -446,7 +463,7 @@ int main(int argc, char *argv[])
 	opts.transfer_size = TRANSFER_SIZE;
 	opts.ack_size = ACK_SIZE;
 
-	while ((c = getopt(argc, argv, "h:st:i:W:c:wrR:T:A:S")) != -1) {
+	while ((c = getopt(argc, argv, "h:st:i:W:c:wrR:T:A:Sa")) != -1) {
 		switch (c) {
 		case 'h':
 			strncpy(server_uri, optarg, sizeof(server_uri));
@@ -492,6 +509,9 @@ int main(int argc, char *argv[])
 		case 'S':
 			suppress = 1;
 			break;
+		case 'a':
+			aggregate = 1;
+			break;
 		default:
 			print_usage();
 		}
@@ -13,6 +13,8 @@
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <assert.h>
 #include <sys/time.h>
@@ -55,6 +57,14 @@ int ignore_os_handle = 0;
 int nfds = 0;
 fd_set rfds;
 
+/* Send completion latency (-p): a send's context is its slot + 1 */
+int percentiles = 0;
+struct timeval *slot_start = NULL;
+int *free_slots = NULL;
+int nfree = 0;
+uint32_t *lat = NULL;		/* usecs, for the current size */
+uint32_t nlat = 0, lat_size = 0;
+
 #if 1
 #define LOCK
 #define UNLOCK
@@ -65,7 +75,7 @@ fd_set rfds;
 
 static void print_usage(void)
 {
-	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-c <type>]\n", name);
+	fprintf(stderr, "usage: %s -s | -h <server_uri> [-c <type>] [-p]\n", name);
 	fprintf(stderr, "where:\n");
 	fprintf(stderr, "\t-h\tServer's URI\n");
 	fprintf(stderr, "\t-s\tSet to run as the server\n");
@@ -74,10 +84,13 @@ static void print_usage(void)
 	fprintf(stderr, "\t-t\tTimeout in seconds (default %d)\n", TIMEOUT);
 	fprintf(stderr, "\t-i\tMax number of messages in-flight (default %d)\n", MAX_PENDING);
 	fprintf(stderr, "\t-b\tBlock using the OS handle instead of polling\n");
-	fprintf(stderr, "\t-o\tGet OS handle but don't use it\n\n");
+	fprintf(stderr, "\t-o\tGet OS handle but don't use it\n");
+	fprintf(stderr, "\t-p\tReport send completion latency percentiles, "
+		"resends and RTT\n\t\t(e.g. with a sock device set to "
+		"drop=<n> to inject loss)\n\n");
 	fprintf(stderr, "Example:\n");
-	fprintf(stderr, "server$ %s -h ip://foo -p 2211 -s\n", name);
-	fprintf(stderr, "client$ %s -h ip://foo -p 2211\n", name);
+	fprintf(stderr, "server$ %s -s\n", name);
+	fprintf(stderr, "client$ %s -h sock://foo:2211 -c ro -p\n", name);
 	exit(EXIT_FAILURE);
 }
 
@@ -87,6 +100,74 @@ static double usecs(struct timeval start, struct timeval end)
 	    ((double)(end.tv_usec - start.tv_usec));
 }
 
+/* Context for the next send on the test connection */
+static void *lat_start(void)
+{
+	int slot;
+
+	if (!percentiles || !nfree)
+		return NULL;
+	slot = free_slots[--nfree];
+	gettimeofday(&slot_start[slot], NULL);
+	return (void *)(uintptr_t)(slot + 1);
+}
+
+/* A send completed (or failed to start) */
+static void lat_done(const void *context, int record)
+{
+	uintptr_t slot = (uintptr_t)context;
+	struct timeval now;
+
+	if (!percentiles || slot < 1 || slot > (uintptr_t)in_flight)
+		return;
+	slot--;
+	free_slots[nfree++] = (int)slot;
+	if (!record)
+		return;
+
+	if (nlat == lat_size) {
+		uint32_t *l;
+
+		lat_size = lat_size ? lat_size * 2 : 4096;
+		l = realloc(lat, lat_size * sizeof(*lat));
+		if (!l) {
+			fprintf(stderr, "unable to alloc latencies\n");
+			exit(EXIT_FAILURE);
+		}
+		lat = l;
+	}
+	gettimeofday(&now, NULL);
+	lat[nlat++] = (uint32_t)usecs(slot_start[slot], now);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_latency(void)
+{
+	cci_stats_t stats;
+	static uint64_t resends = 0;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.version = CCI_STATS_VERSION;
+	cci_get_opt(test_conn, CCI_OPT_CONN_STATS, &stats);
+
+	if (nlat) {
+		qsort(lat, nlat, sizeof(*lat), cmp_u32);
+		printf("      latency p50 %u p99 %u p99.9 %u max %u us, "
+		       "%" PRIu64 " resends, rtt %u us\n",
+		       lat[nlat / 2], lat[(uint64_t)nlat * 99 / 100],
+		       lat[(uint64_t)nlat * 999 / 1000], lat[nlat - 1],
+		       stats.resends - resends, stats.rtt);
+	}
+	resends = stats.resends;
+	nlat = 0;
+}
+
 static void poll_events(void)
 {
 	int ret;
@@ -117,16 +198,21 @@ again:
 	case CCI_EVENT_SEND:
 		if (!is_server) {
 			send_completed++;
+			lat_done(event->send.context,
+				 event->send.status == CCI_SUCCESS);
 			LOCK;
 			if (running) {
+				void *ctx = lat_start();
+
 				UNLOCK;
 				ret =
 				    cci_send(test_conn, buffer,
-					     current_size, NULL, 0);
+					     current_size, ctx, 0);
 				if (ret && 1) {
 					fprintf(stderr,
 						"%s: send returned %s\n",
 						__func__, cci_strerror(endpoint, ret));
+					lat_done(ctx, 0);
 				} else 
 					send++;
 
@@ -277,10 +363,14 @@ static void do_client(void)
 		gettimeofday(&start, NULL);
 
 		for (i = 0; i < in_flight; i++) {
+			void *ctx = lat_start();
+
 			ret =
-			    cci_send(test_conn, buffer, current_size, NULL, 0);
+			    cci_send(test_conn, buffer, current_size, ctx, 0);
 			if (!ret)
 				send++;
+			else
+				lat_done(ctx, 0);
 		}
 
 		LOCK;
@@ -298,6 +388,8 @@ static void do_client(void)
 		printf("sent: %7d\t%12d\t%8.2f Mb/s\t%8.2f MB/s\n",
 		       current_size, send,
 		       mbs, mbs / 8.0);
+		if (percentiles)
+			print_latency();
 
 		current_size *= 2;
 	}
@@ -326,7 +418,7 @@ int main(int argc, char *argv[])
 
 	name = argv[0];
 
-	while ((c = getopt(argc, argv, "h:p:sc:t:i:bc:o")) != -1) {
+	while ((c = getopt(argc, argv, "h:sc:t:i:bc:op")) != -1) {
 		switch (c) {
 		case 'h':
 			server_uri = strdup(optarg);
@@ -366,6 +458,9 @@ int main(int argc, char *argv[])
 			ignore_os_handle = 1;
 			os_handle = &fd;
 			break;
+		case 'p':
+			percentiles = 1;
+			break;
 		default:
 			print_usage();
 		}
@@ -376,6 +471,19 @@ int main(int argc, char *argv[])
 		print_usage();
 	}
 
+	if (percentiles && !is_server) {
+		int i;
+
+		slot_start = calloc(in_flight, sizeof(*slot_start));
+		free_slots = calloc(in_flight, sizeof(*free_slots));
+		if (!slot_start || !free_slots) {
+			fprintf(stderr, "unable to alloc latency slots\n");
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < in_flight; i++)
+			free_slots[nfree++] = i;
+	}
+
 	if (blocking && ignore_os_handle) {
 		fprintf(stderr, "-b and -o are not compatible.\n");
 		fprintf(stderr, "-b will block using select() using the OS handle.\n");
@@ -441,6 +549,9 @@ int main(int argc, char *argv[])
 	}
 	free(server_uri);
 	free(uri);
+	free(slot_start);
+	free(free_slots);
+	free(lat);
 
 #if MPI_DEBUG
 	MPI_Finalize();
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Per-thread binary trace rings (see include/cci_trace.h).
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "opa_primitives.h"
+
+typedef struct cci__trace_ring cci__trace_ring_t;
+
+struct cci__trace_ring {
+	cci__trace_ring_t *next;	/* Next ring in the global list */
+	uint64_t thread;		/* Ring index */
+	volatile uint64_t head;		/* Records written so far */
+	cci_trace_rec_t recs[CCI_TRACE_RING_SIZE];
+};
+
+volatile int cci__trace_on = 0;
+
+/* Rings are only ever pushed (lock-free) and never freed, so the
+ * signal handler may walk the list at any time. */
+static cci__trace_ring_t *volatile trace_rings = NULL;
+static volatile uint64_t trace_num_rings = 0;
+static __thread cci__trace_ring_t *trace_my_ring = NULL;
+
+static char trace_path[PATH_MAX];
+static struct sigaction trace_old_action;
+
+static cci__trace_ring_t *trace_new_ring(void)
+{
+	cci__trace_ring_t *ring = NULL, *head = NULL;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->thread = __sync_fetch_and_add(&trace_num_rings, 1);
+	do {
+		head = trace_rings;
+		ring->next = head;
+	} while (!__sync_bool_compare_and_swap(&trace_rings, head, ring));
+
+	return ring;
+}
+
+void cci__trace_record(uint32_t id, uint32_t transport,
+		       uint64_t a0, uint64_t a1, uint64_t a2)
+{
+	cci__trace_ring_t *ring = trace_my_ring;
+	cci_trace_rec_t *rec = NULL;
+	struct timespec ts;
+	uint64_t head;
+
+	if (!ring) {
+		ring = trace_my_ring = trace_new_ring();
+		if (!ring)
+			return;
+	}
+
+	/* only this thread writes to its ring */
+	head = ring->head;
+	rec = &ring->recs[head & CCI_TRACE_RING_MASK];
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec->ts = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+	rec->id = id;
+	rec->transport = transport;
+	rec->arg[0] = a0;
+	rec->arg[1] = a1;
+	rec->arg[2] = a2;
+
+	OPA_write_barrier();
+	ring->head = head + 1;
+
+	return;
+}
+
+static int trace_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t rc = write(fd, p, len);
+		if (rc < 0)
+			return -1;
+		p += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* Only uses async-signal-safe calls */
+static void trace_dump(void)
+{
+	int fd = -1;
+	uint32_t num = 0;
+	cci__trace_ring_t *ring = NULL;
+	cci_trace_file_hdr_t fhdr;
+
+	fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return;
+
+	for (ring = trace_rings; ring; ring = ring->next)
+		num++;
+
+	memset(&fhdr, 0, sizeof(fhdr));
+	memcpy(fhdr.magic, CCI_TRACE_MAGIC, sizeof(fhdr.magic));
+	fhdr.version = CCI_TRACE_VERSION;
+	fhdr.num_rings = num;
+	fhdr.pid = (uint64_t) getpid();
+	if (trace_write(fd, &fhdr, sizeof(fhdr)))
+		goto out;
+
+	for (ring = trace_rings; ring && num; ring = ring->next, num--) {
+		cci_trace_ring_hdr_t rhdr;
+		uint64_t head = ring->head, start = 0, first = 0, cnt = 0;
+
+		rhdr.thread = ring->thread;
+		rhdr.count = head < CCI_TRACE_RING_SIZE ? head : CCI_TRACE_RING_SIZE;
+		rhdr.dropped = head - rhdr.count;
+		if (trace_write(fd, &rhdr, sizeof(rhdr)))
+			goto out;
+
+		/* oldest record first, in at most two chunks */
+		start = head - rhdr.count;
+		first = start & CCI_TRACE_RING_MASK;
+		cnt = rhdr.count;
+		if (first + cnt > CCI_TRACE_RING_SIZE)
+			cnt = CCI_TRACE_RING_SIZE - first;
+		if (trace_write(fd, &ring->recs[first], cnt * sizeof(ring->recs[0])))
+			goto out;
+		if (cnt < rhdr.count &&
+		    trace_write(fd, &ring->recs[0],
+				(rhdr.count - cnt) * sizeof(ring->recs[0])))
+			goto out;
+	}
+
+    out:
+	close(fd);
+	return;
+}
+
+static void trace_signal_handler(int sig)
+{
+	(void) sig;
+
+	trace_dump();
+}
+
+void cci__trace_init(void)
+{
+	char *path = getenv("CCI_TRACE");
+	struct sigaction sa;
+
+	if (!(path && path[0] != '\0'))
+		return;
+
+	snprintf(trace_path, sizeof(trace_path), "%s.%d", path, (int) getpid());
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = trace_signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR2, &sa, &trace_old_action))
+		debug(CCI_DB_WARN, "%s: unable to catch SIGUSR2, traces will "
+			"only be written at finalize", __func__);
+
+	cci__trace_on = 1;
+
+	debug(CCI_DB_INFO, "%s: tracing to %s", __func__, trace_path);
+
+	return;
+}
+
+void cci__trace_finalize(void)
+{
+	if (!cci__trace_on)
+		return;
+
+	cci__trace_on = 0;
+	sigaction(SIGUSR2, &trace_old_action, NULL);
+
+	trace_dump();
+
+	return;
+}